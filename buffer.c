@@ -68,6 +68,16 @@
 #ifdef EVENT__HAVE_SYS_STAT_H
 #include <sys/stat.h>
 #endif
+#ifdef EVENT__HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#ifdef EVENT__HAVE_LINUX_ERRQUEUE_H
+#include <time.h>
+#include <linux/errqueue.h>
+#endif
+#ifdef EVENT__HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
 
 
 #include <errno.h>
@@ -82,6 +92,17 @@
 #endif
 #include <limits.h>
 
+#if defined(__GNUC__) && defined(__SSE2__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define EVBUFFER_USE_SSE2_
+#include <emmintrin.h>
+#if (defined(__clang__) && __clang_major__ >= 4) || \
+    (!defined(__clang__) && __GNUC__ >= 5)
+#define EVBUFFER_USE_AVX2_
+#include <immintrin.h>
+#endif
+#endif
+
 #include "event2/event.h"
 #include "event2/buffer.h"
 #include "event2/buffer_compat.h"
@@ -117,6 +138,18 @@
 #define SENDFILE_IS_SOLARIS	1
 #endif
 
+/* MSG_ZEROCOPY support */
+#if defined(EVENT__HAVE_SYS_UIO_H) && defined(EVENT__HAVE_LINUX_ERRQUEUE_H) && \
+    defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && \
+    defined(SO_EE_ORIGIN_ZEROCOPY)
+#define USE_ZEROCOPY		1
+/* Writes smaller than this are cheaper to copy than to pin. */
+#define ZEROCOPY_MIN_WRITE	32768
+/* How often to look for the reports on sends from a freed buffer, on
+ * backends that can't tell us when they arrive. */
+#define ZEROCOPY_ORPHAN_POLL_MSEC 10
+#endif
+
 /* Mask of user-selectable callback flags. */
 #define EVBUFFER_CB_USER_FLAGS	    0xffff
 /* Mask of all internal-use-only flags. */
@@ -154,11 +187,231 @@ static int evbuffer_ptr_subtract(struct evbuffer *buf, struct evbuffer_ptr *pos,
     size_t howfar);
 static int evbuffer_file_segment_materialize(struct evbuffer_file_segment *seg);
 static inline void evbuffer_chain_incref(struct evbuffer_chain *chain);
+#ifdef USE_ZEROCOPY
+static void evbuffer_zerocopy_free(struct evbuffer *buf);
+#endif
 
+/* The number of chain sizes that a chain cache keeps: MIN_BUFFER_SIZE,
+ * twice that, and so on. */
+#define CHAIN_CACHE_N_CLASSES 16
+/* The largest chain that a chain cache keeps unless told otherwise. */
+#define CHAIN_CACHE_MAX_CHAIN_SIZE 65536
+
+/* Freed chains kept for reuse by the evbuffers of an event_base. */
+struct evbuffer_chain_cache {
+	/* Protects everything below; the evbuffers that share the cache
+	 * may be used from different threads. */
+	void *lock;
+	/* The event_base holds a reference, as does each evbuffer that uses
+	 * the cache. */
+	int refcnt;
+	/* Limits set by event_base_set_evbuffer_cache().  max_chain_size is
+	 * a power of two, or 0 when the cache is off. */
+	size_t max_bytes;
+	size_t max_chain_size;
+	/* The chains of each size, linked through their next pointers. */
+	struct evbuffer_chain *free_chains[CHAIN_CACHE_N_CLASSES];
+	struct evbuffer_cache_stats stats;
+};
+
+/* Return the size class of an allocation of to_alloc bytes, or -1 if cache
+ * doesn't keep allocations of that size.  Requires lock. */
+static int
+evbuffer_chain_cache_class(struct evbuffer_chain_cache *cache, size_t to_alloc)
+{
+	size_t size = MIN_BUFFER_SIZE;
+	int i;
+
+	if (to_alloc > cache->max_chain_size)
+		return -1;
+	for (i = 0; size < to_alloc; ++i)
+		size <<= 1;
+	return size == to_alloc ? i : -1;
+}
+
+/* Take a chain of to_alloc bytes from cache, or return NULL. */
 static struct evbuffer_chain *
-evbuffer_chain_new(size_t size)
+evbuffer_chain_cache_get(struct evbuffer_chain_cache *cache, size_t to_alloc)
+{
+	struct evbuffer_chain *chain = NULL;
+	int i;
+
+	EVLOCK_LOCK(cache->lock, 0);
+	if ((i = evbuffer_chain_cache_class(cache, to_alloc)) >= 0) {
+		if ((chain = cache->free_chains[i]) != NULL) {
+			cache->free_chains[i] = chain->next;
+			--cache->stats.n_chains;
+			cache->stats.n_bytes -= to_alloc;
+			++cache->stats.hits;
+		} else {
+			++cache->stats.misses;
+		}
+	}
+	EVLOCK_UNLOCK(cache->lock, 0);
+	return chain;
+}
+
+/* Give a chain that is no longer used to cache.  Return 0 if the cache
+ * took it, or -1 if the caller should free it. */
+static int
+evbuffer_chain_cache_put(struct evbuffer_chain_cache *cache,
+    struct evbuffer_chain *chain)
+{
+	size_t to_alloc;
+	int i, r = -1;
+
+	/* Only chains that hold their own data have the size that they
+	 * were allocated with in buffer_len. */
+	if ((chain->flags & (EVBUFFER_REFERENCE|EVBUFFER_FILESEGMENT|
+		EVBUFFER_MULTICAST)) ||
+	    chain->buffer != EVBUFFER_CHAIN_EXTRA(unsigned char, chain))
+		return -1;
+	to_alloc = chain->buffer_len + EVBUFFER_CHAIN_SIZE;
+
+	EVLOCK_LOCK(cache->lock, 0);
+	if ((i = evbuffer_chain_cache_class(cache, to_alloc)) >= 0) {
+		if (cache->stats.n_bytes + to_alloc <= cache->max_bytes) {
+			chain->next = cache->free_chains[i];
+			cache->free_chains[i] = chain;
+			++cache->stats.n_chains;
+			cache->stats.n_bytes += to_alloc;
+			++cache->stats.stores;
+			r = 0;
+		} else {
+			++cache->stats.drops;
+		}
+	}
+	EVLOCK_UNLOCK(cache->lock, 0);
+	return r;
+}
+
+/* Free the chains in cache until it is within its limits.  Requires
+ * lock. */
+static void
+evbuffer_chain_cache_trim(struct evbuffer_chain_cache *cache)
 {
 	struct evbuffer_chain *chain;
+	size_t size;
+	int i;
+
+	/* Let go of the biggest chains first. */
+	for (i = CHAIN_CACHE_N_CLASSES - 1; i >= 0; --i) {
+		size = (size_t)MIN_BUFFER_SIZE << i;
+		while ((chain = cache->free_chains[i]) != NULL &&
+		    (size > cache->max_chain_size ||
+			cache->stats.n_bytes > cache->max_bytes)) {
+			cache->free_chains[i] = chain->next;
+			--cache->stats.n_chains;
+			cache->stats.n_bytes -= size;
+			mm_free(chain);
+		}
+	}
+}
+
+void
+evbuffer_chain_cache_decref_(struct evbuffer_chain_cache *cache)
+{
+	int refcnt;
+
+	EVLOCK_LOCK(cache->lock, 0);
+	refcnt = --cache->refcnt;
+	EVLOCK_UNLOCK(cache->lock, 0);
+	if (refcnt > 0)
+		return;
+
+	cache->max_bytes = cache->max_chain_size = 0;
+	evbuffer_chain_cache_trim(cache);
+	EVTHREAD_FREE_LOCK(cache->lock, 0);
+	mm_free(cache);
+}
+
+int
+event_base_set_evbuffer_cache(struct event_base *base, size_t max_bytes,
+    size_t max_chain_size)
+{
+	struct evbuffer_chain_cache *cache;
+	size_t size = MIN_BUFFER_SIZE;
+	int r = 0;
+
+	if (!max_chain_size)
+		max_chain_size = CHAIN_CACHE_MAX_CHAIN_SIZE;
+	if (max_chain_size > (size_t)MIN_BUFFER_SIZE <<
+	    (CHAIN_CACHE_N_CLASSES - 1))
+		return -1;
+	while (size < max_chain_size)
+		size <<= 1;
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if ((cache = base->evbuffer_cache) == NULL) {
+		if (!max_bytes)
+			goto done;
+		if ((cache = mm_calloc(1, sizeof(*cache))) == NULL) {
+			r = -1;
+			goto done;
+		}
+		EVTHREAD_ALLOC_LOCK(cache->lock, 0);
+		cache->refcnt = 1;
+		base->evbuffer_cache = cache;
+	}
+
+	EVLOCK_LOCK(cache->lock, 0);
+	cache->max_bytes = max_bytes;
+	cache->max_chain_size = max_bytes ? size : 0;
+	evbuffer_chain_cache_trim(cache);
+	EVLOCK_UNLOCK(cache->lock, 0);
+done:
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	return r;
+}
+
+int
+event_base_get_evbuffer_cache_stats(struct event_base *base,
+    struct evbuffer_cache_stats *stats)
+{
+	struct evbuffer_chain_cache *cache;
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	cache = base->evbuffer_cache;
+	if (cache) {
+		EVLOCK_LOCK(cache->lock, 0);
+		memcpy(stats, &cache->stats, sizeof(*stats));
+		EVLOCK_UNLOCK(cache->lock, 0);
+	}
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	return cache ? 0 : -1;
+}
+
+int
+evbuffer_set_chain_cache(struct evbuffer *buf, struct event_base *base)
+{
+	struct evbuffer_chain_cache *cache;
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	cache = base->evbuffer_cache;
+	if (cache) {
+		EVLOCK_LOCK(cache->lock, 0);
+		++cache->refcnt;
+		EVLOCK_UNLOCK(cache->lock, 0);
+	}
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	if (!cache)
+		return -1;
+
+	EVBUFFER_LOCK(buf);
+	if (buf->chain_cache)
+		evbuffer_chain_cache_decref_(buf->chain_cache);
+	buf->chain_cache = cache;
+	EVBUFFER_UNLOCK(buf);
+	return 0;
+}
+
+/* Allocate a chain with room for at least size bytes, from buf's chain
+ * cache if it has one.  buf may be NULL for chains that won't hold data
+ * of their own. */
+static struct evbuffer_chain *
+evbuffer_chain_new(struct evbuffer *buf, size_t size)
+{
+	struct evbuffer_chain *chain = NULL;
 	size_t to_alloc;
 
 	if (size > EVBUFFER_CHAIN_MAX - EVBUFFER_CHAIN_SIZE)
@@ -176,8 +429,11 @@ evbuffer_chain_new(size_t size)
 		to_alloc = size;
 	}
 
+	if (buf && buf->chain_cache)
+		chain = evbuffer_chain_cache_get(buf->chain_cache, to_alloc);
+
 	/* we get everything in one chunk */
-	if ((chain = mm_malloc(to_alloc)) == NULL)
+	if (chain == NULL && (chain = mm_malloc(to_alloc)) == NULL)
 		return (NULL);
 
 	memset(chain, 0, EVBUFFER_CHAIN_SIZE);
@@ -194,8 +450,10 @@ evbuffer_chain_new(size_t size)
 	return (chain);
 }
 
+/* Drop a reference to chain, freeing it, or giving it to the chain cache of
+ * buf if there is one, when there are no more.  buf may be NULL. */
 static inline void
-evbuffer_chain_free(struct evbuffer_chain *chain)
+evbuffer_chain_free(struct evbuffer *buf, struct evbuffer_chain *chain)
 {
 	EVUTIL_ASSERT(chain->refcnt > 0);
 	if (--chain->refcnt > 0) {
@@ -247,20 +505,23 @@ evbuffer_chain_free(struct evbuffer_chain *chain)
 		EVUTIL_ASSERT(info->source != NULL);
 		EVUTIL_ASSERT(info->parent != NULL);
 		EVBUFFER_LOCK(info->source);
-		evbuffer_chain_free(info->parent);
+		evbuffer_chain_free(info->source, info->parent);
 		evbuffer_decref_and_unlock_(info->source);
 	}
 
+	if (buf && buf->chain_cache &&
+	    evbuffer_chain_cache_put(buf->chain_cache, chain) == 0)
+		return;
 	mm_free(chain);
 }
 
 static void
-evbuffer_free_all_chains(struct evbuffer_chain *chain)
+evbuffer_free_all_chains(struct evbuffer *buf, struct evbuffer_chain *chain)
 {
 	struct evbuffer_chain *next;
 	for (; chain; chain = next) {
 		next = chain->next;
-		evbuffer_chain_free(chain);
+		evbuffer_chain_free(buf, chain);
 	}
 }
 
@@ -298,7 +559,7 @@ evbuffer_free_trailing_empty_chains(struct evbuffer *buf)
 		ch = &(*ch)->next;
 	if (*ch) {
 		EVUTIL_ASSERT(evbuffer_chains_all_empty(*ch));
-		evbuffer_free_all_chains(*ch);
+		evbuffer_free_all_chains(buf, *ch);
 		*ch = NULL;
 	}
 	return ch;
@@ -332,7 +593,7 @@ static inline struct evbuffer_chain *
 evbuffer_chain_insert_new(struct evbuffer *buf, size_t datlen)
 {
 	struct evbuffer_chain *chain;
-	if ((chain = evbuffer_chain_new(datlen)) == NULL)
+	if ((chain = evbuffer_chain_new(buf, datlen)) == NULL)
 		return NULL;
 	evbuffer_chain_insert(buf, chain);
 	return chain;
@@ -351,7 +612,7 @@ evbuffer_chain_unpin_(struct evbuffer_chain *chain, unsigned flag)
 	EVUTIL_ASSERT((chain->flags & flag) != 0);
 	chain->flags &= ~flag;
 	if (chain->flags & EVBUFFER_DANGLING)
-		evbuffer_chain_free(chain);
+		evbuffer_chain_free(NULL, chain);
 }
 
 static inline void
@@ -573,10 +834,16 @@ evbuffer_decref_and_unlock_(struct evbuffer *buffer)
 		return;
 	}
 
+#ifdef USE_ZEROCOPY
+	if (buffer->zerocopy)
+		evbuffer_zerocopy_free(buffer);
+#endif
 	for (chain = buffer->first; chain != NULL; chain = next) {
 		next = chain->next;
-		evbuffer_chain_free(chain);
+		evbuffer_chain_free(buffer, chain);
 	}
+	if (buffer->chain_cache)
+		evbuffer_chain_cache_decref_(buffer->chain_cache);
 	evbuffer_remove_all_callbacks(buffer);
 	if (buffer->deferred_cbs)
 		event_deferred_cb_cancel_(buffer->cb_queue, &buffer->deferred);
@@ -855,7 +1122,7 @@ PRESERVE_PINNED(struct evbuffer *src, struct evbuffer_chain **first,
 		struct evbuffer_chain *tmp;
 
 		EVUTIL_ASSERT(pinned == src->last_with_datap);
-		tmp = evbuffer_chain_new(chain->off);
+		tmp = evbuffer_chain_new(src, chain->off);
 		if (!tmp)
 			return -1;
 		memcpy(tmp->buffer, chain->buffer + chain->misalign,
@@ -939,7 +1206,7 @@ APPEND_CHAIN_MULTICAST(struct evbuffer *dst, struct evbuffer *src)
 			continue;
 		}
 
-		tmp = evbuffer_chain_new(sizeof(struct evbuffer_multicast_parent));
+		tmp = evbuffer_chain_new(NULL, sizeof(struct evbuffer_multicast_parent));
 		if (!tmp) {
 			event_warn("%s: out of memory", __func__);
 			return;
@@ -1008,7 +1275,7 @@ evbuffer_add_buffer(struct evbuffer *outbuf, struct evbuffer *inbuf)
 	if (out_total_len == 0) {
 		/* There might be an empty chain at the start of outbuf; free
 		 * it. */
-		evbuffer_free_all_chains(outbuf->first);
+		evbuffer_free_all_chains(outbuf, outbuf->first);
 		COPY_CHAIN(outbuf, inbuf);
 	} else {
 		APPEND_CHAIN(outbuf, inbuf);
@@ -1058,7 +1325,7 @@ evbuffer_add_buffer_reference(struct evbuffer *outbuf, struct evbuffer *inbuf)
 	if (out_total_len == 0) {
 		/* There might be an empty chain at the start of outbuf; free
 		 * it. */
-		evbuffer_free_all_chains(outbuf->first);
+		evbuffer_free_all_chains(outbuf, outbuf->first);
 	}
 	APPEND_CHAIN_MULTICAST(outbuf, inbuf);
 
@@ -1098,7 +1365,7 @@ evbuffer_prepend_buffer(struct evbuffer *outbuf, struct evbuffer *inbuf)
 	if (out_total_len == 0) {
 		/* There might be an empty chain at the start of outbuf; free
 		 * it. */
-		evbuffer_free_all_chains(outbuf->first);
+		evbuffer_free_all_chains(outbuf, outbuf->first);
 		COPY_CHAIN(outbuf, inbuf);
 	} else {
 		PREPEND_CHAIN(outbuf, inbuf);
@@ -1138,7 +1405,7 @@ evbuffer_drain(struct evbuffer *buf, size_t len)
 		len = old_len;
 		for (chain = buf->first; chain != NULL; chain = next) {
 			next = chain->next;
-			evbuffer_chain_free(chain);
+			evbuffer_chain_free(buf, chain);
 		}
 
 		ZERO_CHAIN(buf);
@@ -1166,7 +1433,7 @@ evbuffer_drain(struct evbuffer *buf, size_t len)
 				chain->off = 0;
 				break;
 			} else
-				evbuffer_chain_free(chain);
+				evbuffer_chain_free(buf, chain);
 		}
 
 		buf->first = chain;
@@ -1424,7 +1691,7 @@ evbuffer_pullup(struct evbuffer *buf, ev_ssize_t size)
 		size -= old_off;
 		chain = chain->next;
 	} else {
-		if ((tmp = evbuffer_chain_new(size)) == NULL) {
+		if ((tmp = evbuffer_chain_new(buf, size)) == NULL) {
 			event_warn("%s: out of memory", __func__);
 			goto done;
 		}
@@ -1448,7 +1715,7 @@ evbuffer_pullup(struct evbuffer *buf, ev_ssize_t size)
 		if (&chain->next == buf->last_with_datap)
 			removed_last_with_datap = 1;
 
-		evbuffer_chain_free(chain);
+		evbuffer_chain_free(buf, chain);
 	}
 
 	if (chain != NULL) {
@@ -1509,9 +1776,137 @@ evbuffer_strchr(struct evbuffer_ptr *it, const char chr)
 	return (-1);
 }
 
+/* The scanning kernels behind evbuffer_search_eol() and
+ * evbuffer_search_range().  find_eol_char() returns the first CR or LF in
+ * s[0..len).  find_pair() returns the first a in s[0..len) that is followed
+ * by b, or that is the last byte of s, since its b may be at the start of
+ * the next chain; either way the caller still has to check the rest of the
+ * pattern.  (Looking for two bytes rather than one keeps us from stopping at
+ * every space when the pattern is " \r\n", or every CR in "\r\n\r\n".)
+ *
+ * On x86 these look at 16 bytes at a time with SSE2, or 32 with AVX2 when
+ * the CPU has it; elsewhere they are built on memchr. */
+static char *
+find_pair_memchr(char *s, size_t len, char a, char b)
+{
+	char *s_end = s + len, *p;
+	while ((p = memchr(s, a, s_end - s)) != NULL) {
+		if (p + 1 == s_end || p[1] == b)
+			return p;
+		s = p + 1;
+	}
+	return NULL;
+}
+
+#ifdef EVBUFFER_USE_SSE2_
+static char *
+find_eol_char_sse2(char *s, size_t len)
+{
+	const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+	size_t i;
+	int m;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		m = _mm_movemask_epi8(_mm_or_si128(
+		    _mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+		if (m)
+			return s + i + __builtin_ctz(m);
+	}
+	for (; i < len; ++i) {
+		if (s[i] == '\r' || s[i] == '\n')
+			return s + i;
+	}
+	return NULL;
+}
+
+static char *
+find_pair_sse2(char *s, size_t len, char a, char b)
+{
+	const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+	size_t i;
+	int m;
+
+	/* Each step compares s[i..i+15] with a and s[i+1..i+16] with b. */
+	for (i = 0; i + 17 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(s + i + 1));
+		m = _mm_movemask_epi8(_mm_and_si128(
+		    _mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(y, vb)));
+		if (m)
+			return s + i + __builtin_ctz(m);
+	}
+	return find_pair_memchr(s + i, len - i, a, b);
+}
+#endif
+
+#ifdef EVBUFFER_USE_AVX2_
+__attribute__((target("avx2"))) static char *
+find_eol_char_avx2(char *s, size_t len)
+{
+	const __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+	size_t i;
+	unsigned m;
+
+	for (i = 0; i + 64 <= len; i += 64) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)(s + i + 32));
+		__m256i e0 = _mm256_or_si256(
+		    _mm256_cmpeq_epi8(v0, cr), _mm256_cmpeq_epi8(v0, lf));
+		__m256i e1 = _mm256_or_si256(
+		    _mm256_cmpeq_epi8(v1, cr), _mm256_cmpeq_epi8(v1, lf));
+		if (_mm256_testz_si256(_mm256_or_si256(e0, e1),
+			_mm256_or_si256(e0, e1)))
+			continue;
+		m = (unsigned)_mm256_movemask_epi8(e0);
+		if (m)
+			return s + i + __builtin_ctz(m);
+		m = (unsigned)_mm256_movemask_epi8(e1);
+		return s + i + 32 + __builtin_ctz(m);
+	}
+	return find_eol_char_sse2(s + i, len - i);
+}
+
+__attribute__((target("avx2"))) static char *
+find_pair_avx2(char *s, size_t len, char a, char b)
+{
+	const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+	size_t i;
+	unsigned m;
+
+	/* Each step compares s[i..i+63] with a and s[i+1..i+64] with b. */
+	for (i = 0; i + 65 <= len; i += 64) {
+		const __m256i *p = (const __m256i *)(s + i);
+		const __m256i *q = (const __m256i *)(s + i + 1);
+		__m256i e0 = _mm256_and_si256(
+		    _mm256_cmpeq_epi8(_mm256_loadu_si256(p), va),
+		    _mm256_cmpeq_epi8(_mm256_loadu_si256(q), vb));
+		__m256i e1 = _mm256_and_si256(
+		    _mm256_cmpeq_epi8(_mm256_loadu_si256(p + 1), va),
+		    _mm256_cmpeq_epi8(_mm256_loadu_si256(q + 1), vb));
+		if (_mm256_testz_si256(_mm256_or_si256(e0, e1),
+			_mm256_or_si256(e0, e1)))
+			continue;
+		m = (unsigned)_mm256_movemask_epi8(e0);
+		if (m)
+			return s + i + __builtin_ctz(m);
+		m = (unsigned)_mm256_movemask_epi8(e1);
+		return s + i + 32 + __builtin_ctz(m);
+	}
+	return find_pair_sse2(s + i, len - i, a, b);
+}
+#endif
+
 static inline char *
 find_eol_char(char *s, size_t len)
 {
+#ifdef EVBUFFER_USE_AVX2_
+	if (len >= 128 && __builtin_cpu_supports("avx2"))
+		return find_eol_char_avx2(s, len);
+#endif
+#ifdef EVBUFFER_USE_SSE2_
+	return find_eol_char_sse2(s, len);
+#else
 #define CHUNK_SZ 128
 	/* Lots of benchmarking found this approach to be faster in practice
 	 * than doing two memchrs over the whole buffer, doin a memchr on each
@@ -1534,6 +1929,21 @@ find_eol_char(char *s, size_t len)
 
 	return NULL;
 #undef CHUNK_SZ
+#endif
+}
+
+static inline char *
+find_pair(char *s, size_t len, char a, char b)
+{
+#ifdef EVBUFFER_USE_AVX2_
+	if (len >= 128 && __builtin_cpu_supports("avx2"))
+		return find_pair_avx2(s, len, a, b);
+#endif
+#ifdef EVBUFFER_USE_SSE2_
+	return find_pair_sse2(s, len, a, b);
+#else
+	return find_pair_memchr(s, len, a, b);
+#endif
 }
 
 static ev_ssize_t
@@ -1662,9 +2072,20 @@ evbuffer_search_eol(struct evbuffer *buffer,
 		/* ... optionally preceeded by a CR. */
 		if (it.pos == start_pos)
 			break; /* If the first character is \n, don't back up */
-		/* This potentially does an extra linear walk over the first
-		 * few chains.  Probably, that's not too expensive unless you
-		 * have a really pathological setup. */
+		/* Usually the CR is just before the LF in the same chain. */
+		if (it.internal_.pos_in_chain > 0) {
+			struct evbuffer_chain *chain = it.internal_.chain;
+			if (chain->buffer[chain->misalign +
+				it.internal_.pos_in_chain - 1] == '\r') {
+				--it.pos;
+				--it.internal_.pos_in_chain;
+				extra_drain = 2;
+			}
+			break;
+		}
+		/* Otherwise this potentially does an extra linear walk over
+		 * the first few chains.  Probably, that's not too expensive
+		 * unless you have a really pathological setup. */
 		memcpy(&it2, &it, sizeof(it));
 		if (evbuffer_ptr_subtract(buffer, &it2, 1)<0)
 			break;
@@ -1770,7 +2191,7 @@ evbuffer_add(struct evbuffer *buf, const void *data_in, size_t datlen)
 	/* If there are no chains allocated for this buffer, allocate one
 	 * big enough to hold all the data. */
 	if (chain == NULL) {
-		chain = evbuffer_chain_new(datlen);
+		chain = evbuffer_chain_new(buf, datlen);
 		if (!chain)
 			goto done;
 		evbuffer_chain_insert(buf, chain);
@@ -1812,7 +2233,7 @@ evbuffer_add(struct evbuffer *buf, const void *data_in, size_t datlen)
 		to_alloc <<= 1;
 	if (datlen > to_alloc)
 		to_alloc = datlen;
-	tmp = evbuffer_chain_new(to_alloc);
+	tmp = evbuffer_chain_new(buf, to_alloc);
 	if (tmp == NULL)
 		goto done;
 
@@ -1862,14 +2283,15 @@ evbuffer_prepend(struct evbuffer *buf, const void *data, size_t datlen)
 	chain = buf->first;
 
 	if (chain == NULL) {
-		chain = evbuffer_chain_new(datlen);
+		chain = evbuffer_chain_new(buf, datlen);
 		if (!chain)
 			goto done;
 		evbuffer_chain_insert(buf, chain);
 	}
 
-	/* we cannot touch immutable buffers */
-	if ((chain->flags & EVBUFFER_IMMUTABLE) == 0) {
+	/* we cannot touch immutable buffers, or the space in front of data
+	 * that may still be on its way out */
+	if ((chain->flags & (EVBUFFER_IMMUTABLE|EVBUFFER_MEM_PINNED_ANY)) == 0) {
 		/* Always true for mutable buffers */
 		EVUTIL_ASSERT(chain->misalign >= 0 &&
 		    (ev_uint64_t)chain->misalign <= EVBUFFER_CHAIN_MAX);
@@ -1902,7 +2324,7 @@ evbuffer_prepend(struct evbuffer *buf, const void *data, size_t datlen)
 	}
 
 	/* we need to add another chain */
-	if ((tmp = evbuffer_chain_new(datlen)) == NULL)
+	if ((tmp = evbuffer_chain_new(buf, datlen)) == NULL)
 		goto done;
 	buf->first = tmp;
 	if (buf->last_with_datap == &buf->first && chain->off)
@@ -2031,7 +2453,7 @@ evbuffer_expand_singlechain(struct evbuffer *buf, size_t datlen)
 		 * MAX_TO_COPY_IN_EXPAND bytes. */
 		/* figure out how much space we need */
 		size_t length = chain->off + datlen;
-		struct evbuffer_chain *tmp = evbuffer_chain_new(length);
+		struct evbuffer_chain *tmp = evbuffer_chain_new(buf, length);
 		if (tmp == NULL)
 			goto err;
 
@@ -2047,7 +2469,7 @@ evbuffer_expand_singlechain(struct evbuffer *buf, size_t datlen)
 			buf->last = tmp;
 
 		tmp->next = chain->next;
-		evbuffer_chain_free(chain);
+		evbuffer_chain_free(buf, chain);
 		goto ok;
 	}
 
@@ -2077,7 +2499,7 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 	if (chain == NULL || (chain->flags & EVBUFFER_IMMUTABLE)) {
 		/* There is no last chunk, or we can't touch the last chunk.
 		 * Just add a new chunk. */
-		chain = evbuffer_chain_new(datlen);
+		chain = evbuffer_chain_new(buf, datlen);
 		if (chain == NULL)
 			return (-1);
 
@@ -2120,7 +2542,7 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 		 * chains; we can add another. */
 		EVUTIL_ASSERT(chain == NULL);
 
-		tmp = evbuffer_chain_new(datlen - avail);
+		tmp = evbuffer_chain_new(buf, datlen - avail);
 		if (tmp == NULL)
 			return (-1);
 
@@ -2149,10 +2571,10 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 		for (; chain; chain = next) {
 			next = chain->next;
 			EVUTIL_ASSERT(chain->off == 0);
-			evbuffer_chain_free(chain);
+			evbuffer_chain_free(buf, chain);
 		}
 		EVUTIL_ASSERT(datlen >= avail);
-		tmp = evbuffer_chain_new(datlen - avail);
+		tmp = evbuffer_chain_new(buf, datlen - avail);
 		if (tmp == NULL) {
 			if (rmv_all) {
 				ZERO_CHAIN(buf);
@@ -2426,6 +2848,461 @@ done:
 	return result;
 }
 
+int
+evbuffer_read_shared_(struct evbuffer *buf, evutil_socket_t fd, int howmuch,
+    struct event_base *base, struct evbuffer_chain **chainp)
+{
+	struct evbuffer_chain *chain;
+	int n;
+
+	*chainp = NULL;
+	EVBUFFER_LOCK(buf);
+
+	if (buf->freeze_end) {
+		n = -1;
+		goto done;
+	}
+	if (howmuch < 0 || howmuch > (int)buf->max_read)
+		howmuch = (int)buf->max_read;
+
+	/* Take the shared chain from the base while we use it; if it is
+	 * already lent out, or too small, we make another. */
+	chain = base->shared_read_chain;
+	if (chain && chain->buffer_len < (size_t)howmuch) {
+		mm_free(chain);
+		chain = NULL;
+	}
+	base->shared_read_chain = NULL;
+	if (!chain && (chain = evbuffer_chain_new(NULL, howmuch)) == NULL) {
+		n = -1;
+		goto done;
+	}
+
+#ifndef _WIN32
+	n = read(fd, chain->buffer, howmuch);
+#else
+	n = recv(fd, (char *)chain->buffer, howmuch, 0);
+#endif
+	if (n <= 0) {
+		/* Nothing to lend; keep it for next time. */
+		if (base->shared_read_chain)
+			mm_free(chain);
+		else
+			base->shared_read_chain = chain;
+		goto done;
+	}
+
+	/* The base keeps a reference while the chain is lent out, so that
+	 * draining buf doesn't free it. */
+	chain->off = n;
+	evbuffer_chain_incref(chain);
+	evbuffer_chain_insert(buf, chain);
+	buf->n_add_for_cb += n;
+	*chainp = chain;
+
+	evbuffer_invoke_callbacks_(buf);
+done:
+	EVBUFFER_UNLOCK(buf);
+	return n;
+}
+
+void
+evbuffer_unshare_(struct evbuffer *buf, struct event_base *base,
+    struct evbuffer_chain *chain)
+{
+	struct evbuffer_chain **chp, *tmp;
+
+	EVBUFFER_LOCK(buf);
+
+	if (chain->refcnt > 1) {
+		for (chp = &buf->first; *chp && *chp != chain; chp = &(*chp)->next)
+			;
+		if (*chp == NULL || chain->refcnt > 2 || CHAIN_PINNED(chain)) {
+			/* The chain was moved to another buffer, or is
+			 * referenced from one: it isn't ours to reuse. */
+			evbuffer_chain_free(NULL, chain);
+			goto done;
+		}
+
+		/* Copy what was left in the chain into memory of buf's
+		 * own, and put that in its place. */
+		if ((tmp = evbuffer_chain_new(buf, chain->off)) == NULL) {
+			/* Let buf keep the chain, then. */
+			evbuffer_chain_free(NULL, chain);
+			goto done;
+		}
+		memcpy(tmp->buffer, chain->buffer + chain->misalign,
+		    chain->off);
+		tmp->off = chain->off;
+		tmp->next = chain->next;
+		*chp = tmp;
+		if (buf->last == chain)
+			buf->last = tmp;
+		if (buf->last_with_datap == &chain->next)
+			buf->last_with_datap = &tmp->next;
+		--chain->refcnt;
+	}
+
+	/* Nothing else uses the chain now; give it back to the base. */
+	EVUTIL_ASSERT(chain->refcnt == 1);
+	chain->next = NULL;
+	chain->misalign = 0;
+	chain->off = 0;
+	if (base->shared_read_chain)
+		mm_free(chain);
+	else
+		base->shared_read_chain = chain;
+done:
+	EVBUFFER_UNLOCK(buf);
+}
+
+#ifdef USE_ZEROCOPY
+/** A MSG_ZEROCOPY send that the kernel hasn't reported finished yet. */
+struct evbuffer_zerocopy_send {
+	TAILQ_ENTRY(evbuffer_zerocopy_send) next;
+	/** The kernel's sequence number for this send. */
+	ev_uint32_t id;
+	/** True once the kernel has reported this send. */
+	unsigned done : 1;
+	/** The chains that the send used.  They are pinned with
+	 * EVBUFFER_MEM_PINNED_W until the send is done.  Sends are
+	 * contiguous, so the first chain of a send may also be the last
+	 * chain of the one before; such a chain is pinned once, and
+	 * unpinned by the later send. */
+	int n_chains;
+	struct evbuffer_chain *chains[1];
+};
+
+TAILQ_HEAD(evbuffer_zerocopy_sendq, evbuffer_zerocopy_send);
+
+struct evbuffer_zerocopy {
+	/** The socket we have enabled SO_ZEROCOPY on. */
+	evutil_socket_t fd;
+	/** A duplicate of fd that we hold while sends are outstanding, so
+	 * that we can still collect their reports after fd is closed. */
+	evutil_socket_t errq_fd;
+	/** The sequence number the kernel will give our next send. */
+	ev_uint32_t next_id;
+	/** True if we shouldn't try zero-copy sends any more. */
+	unsigned disabled : 1;
+	/** Outstanding sends, oldest first. */
+	struct evbuffer_zerocopy_sendq sends;
+
+	/* Once the buffer is freed with sends outstanding, the event base
+	 * keeps them here until the kernel is done with them. */
+	/** The event base that holds us. */
+	struct event_base *base;
+	/** Our place in base->zerocopy_orphans. */
+	LIST_ENTRY(evbuffer_zerocopy) orphans;
+	/** Fires when errq_fd may have reports for us. */
+	struct event ev;
+};
+
+/* Release the chains held by the first send in zc, which must be done. */
+static void
+evbuffer_zerocopy_release(struct evbuffer_zerocopy *zc)
+{
+	struct evbuffer_zerocopy_send *send = TAILQ_FIRST(&zc->sends);
+	struct evbuffer_zerocopy_send *later = TAILQ_NEXT(send, next);
+	int i;
+
+	for (i = 0; i < send->n_chains; ++i) {
+		if (i == send->n_chains - 1 && later &&
+		    later->chains[0] == send->chains[i])
+			break;
+		evbuffer_chain_unpin_(send->chains[i], EVBUFFER_MEM_PINNED_W);
+	}
+	TAILQ_REMOVE(&zc->sends, send, next);
+	mm_free(send);
+}
+
+/* Note that the kernel is done with sends lo through hi, inclusive. */
+static void
+evbuffer_zerocopy_complete(struct evbuffer_zerocopy *zc,
+    ev_uint32_t lo, ev_uint32_t hi)
+{
+	struct evbuffer_zerocopy_send *send;
+
+	TAILQ_FOREACH(send, &zc->sends, next) {
+		/* The numbers wrap around. */
+		if ((ev_int32_t)(send->id - lo) >= 0 &&
+		    (ev_int32_t)(hi - send->id) >= 0)
+			send->done = 1;
+	}
+	/* Let go of memory in order, so that a chain shared between two
+	 * sends is unpinned by the later one. */
+	while ((send = TAILQ_FIRST(&zc->sends)) && send->done)
+		evbuffer_zerocopy_release(zc);
+}
+
+/* Collect the kernel's reports on the sends in zc, and let go of the
+ * chains of every send it is done with. */
+static void
+evbuffer_zerocopy_reap(struct evbuffer_zerocopy *zc)
+{
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *ee;
+
+	while (!TAILQ_EMPTY(&zc->sends)) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(zc->errq_fd, &msg, MSG_ERRQUEUE) < 0)
+			break;
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!(cm->cmsg_level == IPPROTO_IP &&
+				cm->cmsg_type == IP_RECVERR) &&
+			    !(cm->cmsg_level == IPPROTO_IPV6 &&
+				cm->cmsg_type == IPV6_RECVERR))
+				continue;
+			ee = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+			    ee->ee_errno != 0)
+				continue;
+			/* The kernel copied the data after all, as it
+			 * does over loopback: pinning doesn't pay off. */
+			if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				zc->disabled = 1;
+			evbuffer_zerocopy_complete(zc, ee->ee_info, ee->ee_data);
+		}
+	}
+}
+
+/* Close the duplicate socket of zc, which has no outstanding sends. */
+static void
+evbuffer_zerocopy_close_errq(struct evbuffer_zerocopy *zc)
+{
+	if (zc->errq_fd != EVUTIL_INVALID_SOCKET) {
+		evutil_closesocket(zc->errq_fd);
+		zc->errq_fd = EVUTIL_INVALID_SOCKET;
+	}
+}
+
+void
+evbuffer_zerocopy_reap_(struct evbuffer *buf)
+{
+	struct evbuffer_zerocopy *zc;
+
+	EVBUFFER_LOCK(buf);
+	zc = buf->zerocopy;
+	if (zc) {
+		evbuffer_zerocopy_reap(zc);
+		if (TAILQ_EMPTY(&zc->sends))
+			evbuffer_zerocopy_close_errq(zc);
+	}
+	EVBUFFER_UNLOCK(buf);
+}
+
+/* Return the event base that buf belongs to, if we know of one. */
+static struct event_base *
+evbuffer_get_base(struct evbuffer *buf)
+{
+	if (buf->cb_queue)
+		return buf->cb_queue;
+	if (buf->parent)
+		return buf->parent->ev_base;
+	return NULL;
+}
+
+/* Release everything that an orphaned zc holds, and free it. */
+static void
+evbuffer_zerocopy_orphan_free(struct evbuffer_zerocopy *zc)
+{
+	event_del(&zc->ev);
+	event_debug_unassign(&zc->ev);
+	while (!TAILQ_EMPTY(&zc->sends))
+		evbuffer_zerocopy_release(zc);
+	evbuffer_zerocopy_close_errq(zc);
+	mm_free(zc);
+}
+
+static void
+evbuffer_zerocopy_orphan_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct evbuffer_zerocopy *zc = arg;
+	struct event_base *base = zc->base;
+
+	evbuffer_zerocopy_reap(zc);
+	if (!TAILQ_EMPTY(&zc->sends))
+		return;
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	LIST_REMOVE(zc, orphans);
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	evbuffer_zerocopy_orphan_free(zc);
+}
+
+void
+evbuffer_zerocopy_orphans_free_(struct event_base *base)
+{
+	struct evbuffer_zerocopy *zc;
+
+	while ((zc = LIST_FIRST(&base->zerocopy_orphans)) != NULL) {
+		LIST_REMOVE(zc, orphans);
+		/* Whatever the kernel hasn't reported on by now, we can't
+		 * wait for any more. */
+		evbuffer_zerocopy_reap(zc);
+		evbuffer_zerocopy_orphan_free(zc);
+	}
+}
+
+/* Buf is being freed.  If the kernel is still sending from its chains,
+ * hand the sends to its event base, which keeps the chains pinned, and
+ * their memory alive, until the kernel reports that it is done. */
+static void
+evbuffer_zerocopy_free(struct evbuffer *buf)
+{
+	struct evbuffer_zerocopy *zc = buf->zerocopy;
+	struct event_base *base = evbuffer_get_base(buf);
+	struct timeval tv, *tvp = NULL;
+	short what = EV_PERSIST;
+
+	buf->zerocopy = NULL;
+	evbuffer_zerocopy_reap(zc);
+	if (TAILQ_EMPTY(&zc->sends) || !base) {
+		while (!TAILQ_EMPTY(&zc->sends))
+			evbuffer_zerocopy_release(zc);
+		evbuffer_zerocopy_close_errq(zc);
+		mm_free(zc);
+		return;
+	}
+
+	/* The reports arrive on the error queue, which wakes an
+	 * edge-triggered read event.  Elsewhere a read event would spin on
+	 * any data that the peer sends, so we just check now and then. */
+	if (event_base_get_features(base) & EV_FEATURE_ET) {
+		what |= EV_READ|EV_ET;
+	} else {
+		tv.tv_sec = 0;
+		tv.tv_usec = ZEROCOPY_ORPHAN_POLL_MSEC * 1000;
+		tvp = &tv;
+	}
+	zc->base = base;
+	event_assign(&zc->ev, base, zc->errq_fd, what,
+	    evbuffer_zerocopy_orphan_cb, zc);
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	LIST_INSERT_HEAD(&base->zerocopy_orphans, zc, orphans);
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	event_add(&zc->ev, tvp);
+}
+
+/* Return true iff we should try sending with MSG_ZEROCOPY on fd. */
+static int
+evbuffer_zerocopy_ok(struct evbuffer *buf, evutil_socket_t fd)
+{
+	struct evbuffer_zerocopy *zc = buf->zerocopy;
+	int one = 1;
+
+	if (!zc) {
+		/* Without an event base, nothing could finish our sends if
+		 * the buffer were freed before the kernel is done. */
+		if (!evbuffer_get_base(buf))
+			return 0;
+		if (!(zc = mm_calloc(1, sizeof(struct evbuffer_zerocopy))))
+			return 0;
+		TAILQ_INIT(&zc->sends);
+		zc->fd = EVUTIL_INVALID_SOCKET;
+		zc->errq_fd = EVUTIL_INVALID_SOCKET;
+		buf->zerocopy = zc;
+	}
+	if (zc->disabled)
+		return 0;
+	if (zc->fd != fd) {
+		/* We only follow one socket's reports. */
+		if (!TAILQ_EMPTY(&zc->sends))
+			return 0;
+		evbuffer_zerocopy_close_errq(zc);
+		if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+			sizeof(one)) < 0) {
+			zc->disabled = 1;
+			return 0;
+		}
+		zc->fd = fd;
+		zc->next_id = 0;
+	}
+	if (zc->errq_fd == EVUTIL_INVALID_SOCKET &&
+	    (zc->errq_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+		zc->errq_fd = EVUTIL_INVALID_SOCKET;
+		return 0;
+	}
+	return 1;
+}
+
+/* Send the first n_iov chains of buffer, as described by iov, with
+ * MSG_ZEROCOPY, and remember which chains the send used.  Return -2 if we
+ * didn't try, so that the caller should send them the usual way. */
+static int
+evbuffer_write_zerocopy(struct evbuffer *buffer, evutil_socket_t fd,
+    struct iovec *iov, int n_iov)
+{
+	struct evbuffer_zerocopy *zc;
+	struct evbuffer_zerocopy_send *send, *prev;
+	struct evbuffer_chain *chain;
+	struct msghdr msg;
+	size_t total = 0, remaining;
+	int i, n;
+
+	for (i = 0; i < n_iov; ++i)
+		total += iov[i].iov_len;
+	if (total < ZEROCOPY_MIN_WRITE || !evbuffer_zerocopy_ok(buffer, fd))
+		return -2;
+	zc = buffer->zerocopy;
+
+	/* The only pinned chain we can send from is one that our last
+	 * send ended in. */
+	prev = TAILQ_LAST(&zc->sends, evbuffer_zerocopy_sendq);
+	for (i = 0, chain = buffer->first; i < n_iov; ++i, chain = chain->next) {
+		if (CHAIN_PINNED(chain) && !(i == 0 && prev &&
+			prev->chains[prev->n_chains - 1] == chain))
+			return -2;
+	}
+
+	send = mm_malloc(sizeof(struct evbuffer_zerocopy_send) +
+	    (n_iov - 1) * sizeof(struct evbuffer_chain *));
+	if (!send)
+		return -2;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n_iov;
+	n = sendmsg(fd, &msg, MSG_ZEROCOPY);
+	if (n <= 0) {
+		mm_free(send);
+		/* ENOBUFS means we have too much memory pinned. */
+		if (n < 0 && errno == ENOBUFS)
+			return -2;
+		return n;
+	}
+
+	send->id = zc->next_id++;
+	send->done = 0;
+	send->n_chains = 0;
+	remaining = n;
+	for (chain = buffer->first; remaining; chain = chain->next) {
+		if (!CHAIN_PINNED(chain))
+			evbuffer_chain_pin_(chain, EVBUFFER_MEM_PINNED_W);
+		send->chains[send->n_chains++] = chain;
+		if (remaining <= chain->off)
+			break;
+		remaining -= chain->off;
+	}
+	TAILQ_INSERT_TAIL(&zc->sends, send, next);
+
+	return n;
+}
+#else
+void
+evbuffer_zerocopy_reap_(struct evbuffer *buf)
+{
+}
+
+void
+evbuffer_zerocopy_orphans_free_(struct event_base *base)
+{
+}
+#endif
+
 #ifdef USE_IOVEC_IMPL
 static inline int
 evbuffer_write_iovec(struct evbuffer *buffer, evutil_socket_t fd,
@@ -2463,6 +3340,13 @@ evbuffer_write_iovec(struct evbuffer *buffer, evutil_socket_t fd,
 	if (! i)
 		return 0;
 
+#ifdef USE_ZEROCOPY
+	if (buffer->flags & EVBUFFER_FLAG_ZEROCOPY) {
+		n = evbuffer_write_zerocopy(buffer, fd, iov, i);
+		if (n != -2)
+			return (n);
+	}
+#endif
 #ifdef _WIN32
 	{
 		DWORD bytesSent;
@@ -2543,6 +3427,11 @@ evbuffer_write_atmost(struct evbuffer *buffer, evutil_socket_t fd,
 
 	EVBUFFER_LOCK(buffer);
 
+#ifdef USE_ZEROCOPY
+	if (buffer->zerocopy)
+		evbuffer_zerocopy_reap_(buffer);
+#endif
+
 	if (buffer->freeze_start) {
 		goto done;
 	}
@@ -2737,8 +3626,8 @@ evbuffer_search_range(struct evbuffer *buffer, const char *what, size_t len, con
 {
 	struct evbuffer_ptr pos;
 	struct evbuffer_chain *chain, *last_chain = NULL;
-	const unsigned char *p;
-	char first;
+	const char *p;
+	char first, second;
 
 	EVBUFFER_LOCK(buffer);
 
@@ -2758,13 +3647,18 @@ evbuffer_search_range(struct evbuffer *buffer, const char *what, size_t len, con
 		goto done;
 
 	first = what[0];
+	second = len > 1 ? what[1] : 0;
 
 	while (chain) {
-		const unsigned char *start_at =
-		    chain->buffer + chain->misalign +
+		char *start_at = (char *)chain->buffer + chain->misalign +
 		    pos.internal_.pos_in_chain;
-		p = memchr(start_at, first,
-		    chain->off - pos.internal_.pos_in_chain);
+		size_t avail = chain->off - pos.internal_.pos_in_chain;
+		/* Find candidates by their first two bytes, then check the
+		 * rest (which may run into the next chains). */
+		if (len > 1)
+			p = find_pair(start_at, avail, first, second);
+		else
+			p = memchr(start_at, first, avail);
 		if (p) {
 			pos.pos += p - start_at;
 			pos.internal_.pos_in_chain += p - start_at;
@@ -2941,7 +3835,7 @@ evbuffer_add_reference(struct evbuffer *outbuf,
 	struct evbuffer_chain_reference *info;
 	int result = -1;
 
-	chain = evbuffer_chain_new(sizeof(struct evbuffer_chain_reference));
+	chain = evbuffer_chain_new(NULL, sizeof(struct evbuffer_chain_reference));
 	if (!chain)
 		return (-1);
 	chain->flags |= EVBUFFER_REFERENCE | EVBUFFER_IMMUTABLE;
@@ -3242,7 +4136,7 @@ evbuffer_add_file_segment(struct evbuffer *buf,
 	if (offset+length > seg->length)
 		goto err;
 
-	chain = evbuffer_chain_new(sizeof(struct evbuffer_chain_file_segment));
+	chain = evbuffer_chain_new(NULL, sizeof(struct evbuffer_chain_file_segment));
 	if (!chain)
 		goto err;
 	extra = EVBUFFER_CHAIN_EXTRA(struct evbuffer_chain_file_segment, chain);
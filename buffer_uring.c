@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+   @file buffer_uring.c
+
+   This module implements io_uring read and write functions for evbuffer
+   objects on Linux.  It is the io_uring counterpart of buffer_iocp.c: the
+   data is read straight into the evbuffer's chains, or written straight
+   out of them, by the kernel.
+*/
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef EVENT__HAVE_IO_URING
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string.h>
+
+#include "event2/buffer.h"
+#include "event2/buffer_compat.h"
+#include "event2/util.h"
+#include "event2/thread.h"
+#include "event-internal.h"
+#include "util-internal.h"
+#include "evthread-internal.h"
+#include "evbuffer-internal.h"
+#include "uring-internal.h"
+#include "mm-internal.h"
+
+/** Unpin all the chains noted as pinned in 'io'. */
+static void
+pin_release(struct evbuffer_uring_io *io, unsigned flag)
+{
+	int i;
+	struct evbuffer_chain *next, *chain = io->first_pinned;
+
+	for (i = 0; i < io->n_iov; ++i) {
+		EVUTIL_ASSERT(chain);
+		next = chain->next;
+		evbuffer_chain_unpin_(chain, flag);
+		chain = next;
+	}
+}
+
+/** Put a readv or writev for io on base's ring. */
+static int
+launch_rw(struct event_base *base, evutil_socket_t fd,
+    struct evbuffer_uring_io *io, int opcode)
+{
+	struct io_uring_sqe *sqe;
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if (!(sqe = event_uring_get_sqe_(base, &io->op))) {
+		EVBASE_RELEASE_LOCK(base, th_base_lock);
+		return -1;
+	}
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (ev_uint64_t)(ev_uintptr_t)io->iov;
+	sqe->len = io->n_iov;
+	/* Use (and ignore, for sockets and pipes) the file position. */
+	sqe->off = (ev_uint64_t)-1;
+	event_uring_commit_(base);
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	return 0;
+}
+
+void
+evbuffer_uring_commit_read_(struct evbuffer *evbuf,
+    struct evbuffer_uring_io *io, ev_ssize_t nBytes)
+{
+	struct evbuffer_chain **chainp;
+	size_t remaining, len;
+	int i;
+
+	EVBUFFER_LOCK(evbuf);
+	EVUTIL_ASSERT(io->in_progress);
+	if (nBytes < 0)
+		nBytes = 0;
+
+	evbuffer_unfreeze(evbuf, 0);
+
+	chainp = evbuf->last_with_datap;
+	if (!((*chainp)->flags & EVBUFFER_MEM_PINNED_R))
+		chainp = &(*chainp)->next;
+	remaining = nBytes;
+	for (i = 0; remaining > 0 && i < io->n_iov; ++i) {
+		EVUTIL_ASSERT(*chainp);
+		len = io->iov[i].iov_len;
+		if (remaining < len)
+			len = remaining;
+		(*chainp)->off += len;
+		evbuf->last_with_datap = chainp;
+		remaining -= len;
+		chainp = &(*chainp)->next;
+	}
+
+	pin_release(io, EVBUFFER_MEM_PINNED_R);
+
+	io->in_progress = 0;
+
+	evbuf->total_len += nBytes;
+	evbuf->n_add_for_cb += nBytes;
+
+	evbuffer_invoke_callbacks_(evbuf);
+
+	evbuffer_decref_and_unlock_(evbuf);
+}
+
+void
+evbuffer_uring_commit_write_(struct evbuffer *evbuf,
+    struct evbuffer_uring_io *io, ev_ssize_t nBytes)
+{
+	EVBUFFER_LOCK(evbuf);
+	EVUTIL_ASSERT(io->in_progress);
+	evbuffer_unfreeze(evbuf, 1);
+	if (nBytes > 0)
+		evbuffer_drain(evbuf, nBytes);
+	pin_release(io, EVBUFFER_MEM_PINNED_W);
+	io->in_progress = 0;
+	evbuffer_decref_and_unlock_(evbuf);
+}
+
+int
+evbuffer_uring_launch_write_(struct evbuffer *buf, struct event_base *base,
+    evutil_socket_t fd, ev_ssize_t at_most, struct evbuffer_uring_io *io)
+{
+	int r = -1;
+	int i;
+	struct evbuffer_chain *chain;
+
+	EVBUFFER_LOCK(buf);
+	if (buf->freeze_start || io->in_progress)
+		goto done;
+	if (!buf->total_len) {
+		/* Nothing to write */
+		r = 0;
+		goto done;
+	} else if (at_most < 0 || (size_t)at_most > buf->total_len) {
+		at_most = buf->total_len;
+	}
+	evbuffer_freeze(buf, 1);
+
+	io->first_pinned = NULL;
+	io->n_iov = 0;
+
+	chain = io->first_pinned = buf->first;
+
+	for (i = 0; i < EVBUFFER_URING_MAX_IOVECS && chain;
+	     ++i, chain = chain->next) {
+		struct iovec *v = &io->iov[i];
+		v->iov_base = chain->buffer + chain->misalign;
+		evbuffer_chain_pin_(chain, EVBUFFER_MEM_PINNED_W);
+
+		if ((size_t)at_most > chain->off) {
+			v->iov_len = chain->off;
+			at_most -= chain->off;
+		} else {
+			v->iov_len = at_most;
+			++i;
+			break;
+		}
+	}
+
+	io->n_iov = i;
+	evbuffer_incref_(buf);
+	if (launch_rw(base, fd, io, IORING_OP_WRITEV) < 0) {
+		pin_release(io, EVBUFFER_MEM_PINNED_W);
+		evbuffer_unfreeze(buf, 1);
+		evbuffer_free(buf); /* decref */
+		goto done;
+	}
+
+	io->in_progress = 1;
+	r = 0;
+done:
+	EVBUFFER_UNLOCK(buf);
+	return r;
+}
+
+int
+evbuffer_uring_launch_read_(struct evbuffer *buf, struct event_base *base,
+    evutil_socket_t fd, size_t at_most, struct evbuffer_uring_io *io)
+{
+	int r = -1, i;
+	int nvecs;
+	int npin = 0;
+	struct evbuffer_chain *chain = NULL, **chainp;
+	struct evbuffer_iovec vecs[EVBUFFER_URING_MAX_IOVECS];
+
+	EVBUFFER_LOCK(buf);
+	if (buf->freeze_end || io->in_progress)
+		goto done;
+
+	io->first_pinned = NULL;
+	io->n_iov = 0;
+
+	if (evbuffer_expand_fast_(buf, at_most, EVBUFFER_URING_MAX_IOVECS) == -1)
+		goto done;
+	evbuffer_freeze(buf, 0);
+
+	nvecs = evbuffer_read_setup_vecs_(buf, at_most,
+	    vecs, EVBUFFER_URING_MAX_IOVECS, &chainp, 1);
+	for (i = 0; i < nvecs; ++i) {
+		io->iov[i].iov_base = vecs[i].iov_base;
+		io->iov[i].iov_len = vecs[i].iov_len;
+	}
+
+	io->n_iov = nvecs;
+	io->first_pinned = chain = *chainp;
+
+	npin = 0;
+	for ( ; chain; chain = chain->next) {
+		evbuffer_chain_pin_(chain, EVBUFFER_MEM_PINNED_R);
+		++npin;
+	}
+	EVUTIL_ASSERT(npin == nvecs);
+
+	evbuffer_incref_(buf);
+	if (launch_rw(base, fd, io, IORING_OP_READV) < 0) {
+		pin_release(io, EVBUFFER_MEM_PINNED_R);
+		evbuffer_unfreeze(buf, 0);
+		evbuffer_free(buf); /* decref */
+		goto done;
+	}
+
+	io->in_progress = 1;
+	r = 0;
+done:
+	EVBUFFER_UNLOCK(buf);
+	return r;
+}
+
+#endif /* EVENT__HAVE_IO_URING */
@@ -73,6 +73,9 @@ extern "C" {
 /* On a base bufferevent, for reading: used when a filter has choked this
  * (underlying) bufferevent because it has stopped reading from it. */
 #define BEV_SUSPEND_FILT_READ 0x10
+/* On a bufferevent that a relay reads from: used when the relay is holding
+ * as much data for the other side as it may. */
+#define BEV_SUSPEND_RELAY 0x20
 
 typedef ev_uint16_t bufferevent_suspend_flags;
 
@@ -230,6 +233,10 @@ struct bufferevent_private {
 	} conn_address;
 
 	struct evdns_getaddrinfo_request *dns_request;
+
+	/** If set, this is a socket bufferevent, and this relay moves data
+	 * between its socket and another one with splice(). */
+	struct bufferevent_relay *relay;
 };
 
 /** Possible operations for a control callback. */
@@ -313,6 +320,13 @@ extern const struct bufferevent_ops bufferevent_ops_openssl;
 #define BEV_IS_OPENSSL(bevp) 0
 #endif
 
+#ifdef EVENT__HAVE_IO_URING
+extern const struct bufferevent_ops bufferevent_ops_uring;
+#define BEV_IS_URING(bevp) ((bevp)->be_ops == &bufferevent_ops_uring)
+#else
+#define BEV_IS_URING(bevp) 0
+#endif
+
 #ifdef _WIN32
 extern const struct bufferevent_ops bufferevent_ops_async;
 #define BEV_IS_ASYNC(bevp) ((bevp)->be_ops == &bufferevent_ops_async)
@@ -452,6 +466,20 @@ EVENT2_EXPORT_SYMBOL
 void
 bufferevent_socket_set_conn_address_(struct bufferevent *bev, struct sockaddr *addr, size_t addrlen);
 
+/** Internal use: splice up to howmuch bytes (or as many as we may, if
+ * howmuch is negative) from fd, the socket of bev, into its relay's pipe.
+ * Returns as read() does. */
+int bufferevent_relay_splice_in_(struct bufferevent *bev, evutil_socket_t fd,
+    ev_ssize_t howmuch);
+/** Internal use: splice up to howmuch bytes (or all of them, if howmuch is
+ * negative) that bev's relay is holding for bev to fd, the socket of bev.
+ * Returns as write() does, or 0 if there was nothing to write. */
+int bufferevent_relay_splice_out_(struct bufferevent *bev, evutil_socket_t fd,
+    ev_ssize_t howmuch);
+/** Internal use: return the number of bytes that bev's relay is holding
+ * for bev in its pipe. */
+size_t bufferevent_relay_pending_out_(struct bufferevent *bev);
+
 
 /** Internal use: We have just successfully read data into an inbuf, so
  * reset the read timeout (if any). */
@@ -371,6 +371,10 @@ bufferevent_init_common_(struct bufferevent_private *bufev_private,
 	evbuffer_set_parent_(bufev->input, bufev);
 	evbuffer_set_parent_(bufev->output, bufev);
 
+	/* Share the base's chain cache, if it has one. */
+	if (base && evbuffer_set_chain_cache(bufev->input, base) == 0)
+		evbuffer_set_chain_cache(bufev->output, base);
+
 	return 0;
 
 err:
@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos, Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+   @file bufferevent_relay.c
+
+   A relay copies everything that one bufferevent reads to another, in both
+   directions.  Between two socket bufferevents on Linux, the socket
+   callbacks in bufferevent_sock.c ask us to move the data with splice(),
+   through a pipe per direction, instead of reading it into the input
+   buffer; everything else goes through the bufferevents' buffers and the
+   ordinary callbacks.
+*/
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#endif
+#ifdef EVENT__HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef EVENT__HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <errno.h>
+
+#include "event2/util.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "event2/bufferevent_struct.h"
+#include "event2/event.h"
+#include "bufferevent-internal.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+
+#if defined(EVENT__HAVE_SPLICE) && defined(EVENT__HAVE_PIPE2)
+#define USE_SPLICE
+#endif
+
+/** How much data a relay will hold for one side, by default. */
+#define RELAY_DEFAULT_LIMIT 65536
+
+/** One direction of a relay. */
+struct bufferevent_relay_dir {
+	/** The bufferevent we read from */
+	struct bufferevent *from;
+	/** The bufferevent we write to */
+	struct bufferevent *to;
+	/** In splice mode, the pipe that holds the data between the two
+	 * sockets; otherwise -1. */
+	int pipe[2];
+	/** How many bytes are in pipe. */
+	size_t in_pipe;
+	/** True iff 'from' has reached EOF. */
+	unsigned eof : 1;
+	/** True iff we have shut down writing on 'to'. */
+	unsigned shut : 1;
+};
+
+struct bufferevent_relay {
+	/** dir[0] goes from a to b; dir[1] goes from b to a. */
+	struct bufferevent_relay_dir dir[2];
+	bufferevent_event_cb eventcb;
+	void *cbarg;
+};
+
+/** Return the direction of relay that reads from bev. */
+static inline struct bufferevent_relay_dir *
+dir_from(struct bufferevent_relay *relay, struct bufferevent *bev)
+{
+	return relay->dir[0].from == bev ? &relay->dir[0] : &relay->dir[1];
+}
+
+/** Return the direction of relay that writes to bev. */
+static inline struct bufferevent_relay_dir *
+dir_to(struct bufferevent_relay *relay, struct bufferevent *bev)
+{
+	return relay->dir[0].to == bev ? &relay->dir[0] : &relay->dir[1];
+}
+
+/** Return the most data that we will hold for d->to. */
+static size_t
+dir_limit(const struct bufferevent_relay_dir *d)
+{
+	return d->from->wm_read.high ? d->from->wm_read.high :
+	    RELAY_DEFAULT_LIMIT;
+}
+
+/** Return the amount of data that we are holding for d->to. */
+static size_t
+dir_pending(const struct bufferevent_relay_dir *d)
+{
+	return d->in_pipe + evbuffer_get_length(d->to->output);
+}
+
+/** Start reading from d->from again if we have room for more of its data. */
+static void
+dir_maybe_unsuspend(struct bufferevent_relay_dir *d)
+{
+	if (dir_pending(d) < dir_limit(d)) {
+		BEV_LOCK(d->from);
+		bufferevent_unsuspend_read_(d->from, BEV_SUSPEND_RELAY);
+		BEV_UNLOCK(d->from);
+	}
+}
+
+/** Called once everything d->from sent has been written to d->to: pass the
+ * EOF along, and tell the user if that was the last direction. */
+static void
+dir_finish(struct bufferevent_relay *relay, struct bufferevent_relay_dir *d)
+{
+	struct bufferevent_relay_dir *other =
+	    d == &relay->dir[0] ? &relay->dir[1] : &relay->dir[0];
+
+	if (d->shut)
+		return;
+	d->shut = 1;
+	bufferevent_flush(d->to, EV_WRITE, BEV_FINISHED);
+	if (BEV_IS_SOCKET(d->to)) {
+		evutil_socket_t fd = bufferevent_getfd(d->to);
+		if (fd != EVUTIL_INVALID_SOCKET)
+			shutdown(fd, EVUTIL_SHUT_WR);
+	}
+	if (other->shut && relay->eventcb)
+		relay->eventcb(d->from, BEV_EVENT_EOF, relay->cbarg);
+}
+
+static void
+relay_readcb(struct bufferevent *bev, void *arg)
+{
+	struct bufferevent_relay_dir *d = dir_from(arg, bev);
+
+	evbuffer_add_buffer(d->to->output, bev->input);
+	if (dir_pending(d) >= dir_limit(d))
+		bufferevent_suspend_read_(bev, BEV_SUSPEND_RELAY);
+}
+
+static void
+relay_writecb(struct bufferevent *bev, void *arg)
+{
+	struct bufferevent_relay *relay = arg;
+	struct bufferevent_relay_dir *d = dir_to(relay, bev);
+
+	dir_maybe_unsuspend(d);
+	if (d->eof && dir_pending(d) == 0)
+		dir_finish(relay, d);
+}
+
+static void
+relay_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct bufferevent_relay *relay = arg;
+	struct bufferevent_relay_dir *d = dir_from(relay, bev);
+
+	if ((what & (BEV_EVENT_EOF|BEV_EVENT_READING)) ==
+	    (BEV_EVENT_EOF|BEV_EVENT_READING)) {
+		d->eof = 1;
+		/* Anything that came in with the EOF still has to go. */
+		if (evbuffer_get_length(bev->input))
+			evbuffer_add_buffer(d->to->output, bev->input);
+		if (dir_pending(d) == 0)
+			dir_finish(relay, d);
+		return;
+	}
+	if (relay->eventcb)
+		relay->eventcb(bev, what, relay->cbarg);
+}
+
+struct bufferevent_relay *
+bufferevent_relay_new(struct bufferevent *a, struct bufferevent *b,
+    bufferevent_event_cb eventcb, void *cbarg)
+{
+	struct bufferevent_relay *relay;
+	int i;
+
+	if (!a || !b || a == b || a->ev_base != b->ev_base)
+		return NULL;
+	if (!(relay = mm_calloc(1, sizeof(struct bufferevent_relay))))
+		return NULL;
+
+	relay->eventcb = eventcb;
+	relay->cbarg = cbarg;
+	relay->dir[0].from = relay->dir[1].to = a;
+	relay->dir[0].to = relay->dir[1].from = b;
+	for (i = 0; i < 2; ++i)
+		relay->dir[i].pipe[0] = relay->dir[i].pipe[1] = -1;
+
+#ifdef USE_SPLICE
+	if (BEV_IS_SOCKET(a) && BEV_IS_SOCKET(b)) {
+		for (i = 0; i < 2; ++i) {
+			if (pipe2(relay->dir[i].pipe, O_NONBLOCK|O_CLOEXEC) < 0) {
+				/* Fall back to copying through the buffers. */
+				relay->dir[i].pipe[0] = relay->dir[i].pipe[1] = -1;
+				if (i == 1) {
+					close(relay->dir[0].pipe[0]);
+					close(relay->dir[0].pipe[1]);
+					relay->dir[0].pipe[0] =
+					    relay->dir[0].pipe[1] = -1;
+				}
+				break;
+			}
+		}
+	}
+#endif
+
+	bufferevent_incref(a);
+	bufferevent_incref(b);
+
+	for (i = 0; i < 2; ++i) {
+		struct bufferevent_relay_dir *d = &relay->dir[i];
+		BEV_LOCK(d->from);
+		if (d->pipe[0] != -1)
+			BEV_UPCAST(d->from)->relay = relay;
+		bufferevent_setcb(d->from, relay_readcb, relay_writecb,
+		    relay_eventcb, relay);
+		/* Pass on whatever the bufferevent read before we got it. */
+		if (evbuffer_get_length(d->from->input))
+			evbuffer_add_buffer(d->to->output, d->from->input);
+		BEV_UNLOCK(d->from);
+		bufferevent_enable(d->from, EV_READ|EV_WRITE);
+	}
+
+	return relay;
+}
+
+void
+bufferevent_relay_free(struct bufferevent_relay *relay)
+{
+	int i;
+
+	for (i = 0; i < 2; ++i) {
+		struct bufferevent_relay_dir *d = &relay->dir[i];
+		BEV_LOCK(d->from);
+		bufferevent_setcb(d->from, NULL, NULL, NULL, NULL);
+		BEV_UPCAST(d->from)->relay = NULL;
+		bufferevent_unsuspend_read_(d->from, BEV_SUSPEND_RELAY);
+		BEV_UNLOCK(d->from);
+#ifdef USE_SPLICE
+		if (d->pipe[0] != -1) {
+			close(d->pipe[0]);
+			close(d->pipe[1]);
+		}
+#endif
+	}
+	bufferevent_decref(relay->dir[0].from);
+	bufferevent_decref(relay->dir[1].from);
+	mm_free(relay);
+}
+
+int
+bufferevent_relay_splice_in_(struct bufferevent *bev, evutil_socket_t fd,
+    ev_ssize_t howmuch)
+{
+#ifdef USE_SPLICE
+	struct bufferevent_relay_dir *d = dir_from(BEV_UPCAST(bev)->relay, bev);
+	struct bufferevent *to = d->to;
+	size_t pending = dir_pending(d), limit = dir_limit(d);
+	ssize_t n;
+
+	if (pending >= limit) {
+		bufferevent_suspend_read_(bev, BEV_SUSPEND_RELAY);
+		errno = EAGAIN;
+		return -1;
+	}
+	if (howmuch < 0 || (size_t)howmuch > limit - pending)
+		howmuch = limit - pending;
+
+	n = splice(fd, NULL, d->pipe[1], NULL, howmuch,
+	    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+	if (n > 0) {
+		d->in_pipe += n;
+		BEV_LOCK(to);
+		if ((to->enabled & EV_WRITE) &&
+		    !event_pending(&to->ev_write, EV_WRITE, NULL) &&
+		    !BEV_UPCAST(to)->write_suspended)
+			bufferevent_add_event_(&to->ev_write, &to->timeout_write);
+		BEV_UNLOCK(to);
+	} else if (n < 0 && errno == EAGAIN && d->in_pipe) {
+		/* The pipe is full: wait for the other side to drain it. */
+		bufferevent_suspend_read_(bev, BEV_SUSPEND_RELAY);
+	}
+	return (int)n;
+#else
+	(void)bev; (void)fd; (void)howmuch;
+	errno = EINVAL;
+	return -1;
+#endif
+}
+
+int
+bufferevent_relay_splice_out_(struct bufferevent *bev, evutil_socket_t fd,
+    ev_ssize_t howmuch)
+{
+#ifdef USE_SPLICE
+	struct bufferevent_relay_dir *d = dir_to(BEV_UPCAST(bev)->relay, bev);
+	ssize_t n;
+
+	if (!d->in_pipe)
+		return 0;
+	if (howmuch < 0 || (size_t)howmuch > d->in_pipe)
+		howmuch = d->in_pipe;
+
+	n = splice(d->pipe[0], NULL, fd, NULL, howmuch,
+	    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+	if (n > 0) {
+		d->in_pipe -= n;
+		dir_maybe_unsuspend(d);
+	}
+	return (int)n;
+#else
+	(void)bev; (void)fd; (void)howmuch;
+	return 0;
+#endif
+}
+
+size_t
+bufferevent_relay_pending_out_(struct bufferevent *bev)
+{
+	struct bufferevent_relay *relay = BEV_UPCAST(bev)->relay;
+	return relay ? dir_to(relay, bev)->in_pipe : 0;
+}
@@ -64,13 +64,16 @@
 #include "event2/util.h"
 #include "event2/bufferevent.h"
 #include "event2/buffer.h"
+#include "event2/buffer_compat.h"
 #include "event2/bufferevent_struct.h"
 #include "event2/bufferevent_compat.h"
 #include "event2/event.h"
 #include "log-internal.h"
 #include "mm-internal.h"
 #include "bufferevent-internal.h"
+#include "evbuffer-internal.h"
 #include "util-internal.h"
+#include "uring-internal.h"
 #ifdef _WIN32
 #include "iocp-internal.h"
 #endif
@@ -125,6 +128,14 @@ bufferevent_socket_set_conn_address_(struct bufferevent *bev,
 	memcpy(&bev_p->conn_address, addr, addrlen);
 }
 
+/* Return true iff bufev has nothing left to write. */
+static int
+be_socket_output_empty(struct bufferevent *bufev)
+{
+	return evbuffer_get_length(bufev->output) == 0 &&
+	    !(BEV_UPCAST(bufev)->relay && bufferevent_relay_pending_out_(bufev));
+}
+
 static void
 bufferevent_socket_outbuf_cb(struct evbuffer *buf,
     const struct evbuffer_cb_info *cbinfo,
@@ -151,6 +162,7 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 	struct bufferevent *bufev = arg;
 	struct bufferevent_private *bufev_p = BEV_UPCAST(bufev);
 	struct evbuffer *input;
+	struct evbuffer_chain *shared = NULL;
 	int res = 0;
 	short what = BEV_EVENT_READING;
 	ev_ssize_t howmuch = -1, readmax=-1;
@@ -167,6 +179,10 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 
 	input = bufev->input;
 
+	/* The kernel's reports about zero-copy sends make the socket look
+	 * readable until we collect them. */
+	evbuffer_zerocopy_reap_(bufev->output);
+
 	/*
 	 * If we have a high watermark configured then we don't want to
 	 * read more data than would make us reach the watermark.
@@ -186,9 +202,22 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 	if (bufev_p->read_suspended)
 		goto done;
 
-	evbuffer_unfreeze(input, 0);
-	res = evbuffer_read(input, fd, (int)howmuch); /* XXXX evbuffer_read would do better to take and return ev_ssize_t */
-	evbuffer_freeze(input, 0);
+	if (bufev_p->relay) {
+		/* The data goes straight to the other end of the relay. */
+		res = bufferevent_relay_splice_in_(bufev, fd, howmuch);
+	} else if ((bufev_p->options & (BEV_OPT_SHARED_READ_BUFFER|
+		BEV_OPT_DEFER_CALLBACKS)) == BEV_OPT_SHARED_READ_BUFFER) {
+		/* The read callback runs before we return, so it can look
+		 * at the data in the base's shared chain. */
+		evbuffer_unfreeze(input, 0);
+		res = evbuffer_read_shared_(input, fd, (int)howmuch,
+		    bufev->ev_base, &shared);
+		evbuffer_freeze(input, 0);
+	} else {
+		evbuffer_unfreeze(input, 0);
+		res = evbuffer_read(input, fd, (int)howmuch); /* XXXX evbuffer_read would do better to take and return ev_ssize_t */
+		evbuffer_freeze(input, 0);
+	}
 
 	if (res == -1) {
 		int err = evutil_socket_geterror(fd);
@@ -211,7 +240,10 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 	bufferevent_decrement_read_buckets_(bufev_p, res);
 
 	/* Invoke the user callback - must always be called last */
-	bufferevent_trigger_nolock_(bufev, EV_READ, 0);
+	if (!bufev_p->relay)
+		bufferevent_trigger_nolock_(bufev, EV_READ, 0);
+	if (shared)
+		evbuffer_unshare_(input, bufev->ev_base, shared);
 
 	goto done;
 
@@ -312,7 +344,22 @@ bufferevent_writecb(evutil_socket_t fd, short event, void *arg)
 		bufferevent_decrement_write_buckets_(bufev_p, res);
 	}
 
-	if (evbuffer_get_length(bufev->output) == 0) {
+	/* Whatever a relay has for us goes after what's in the buffer. */
+	if (bufev_p->relay && evbuffer_get_length(bufev->output) == 0 &&
+	    res < atmost) {
+		int n = bufferevent_relay_splice_out_(bufev, fd, atmost - res);
+		if (n == -1) {
+			int err = evutil_socket_geterror(fd);
+			if (EVUTIL_ERR_RW_RETRIABLE(err))
+				goto reschedule;
+			what |= BEV_EVENT_ERROR;
+			goto error;
+		}
+		bufferevent_decrement_write_buckets_(bufev_p, n);
+		res += n;
+	}
+
+	if (be_socket_output_empty(bufev)) {
 		event_del(&bufev->ev_write);
 	}
 
@@ -327,7 +374,7 @@ bufferevent_writecb(evutil_socket_t fd, short event, void *arg)
 	goto done;
 
  reschedule:
-	if (evbuffer_get_length(bufev->output) == 0) {
+	if (be_socket_output_empty(bufev)) {
 		event_del(&bufev->ev_write);
 	}
 	goto done;
@@ -410,6 +457,17 @@ bufferevent_socket_connect(struct bufferevent *bev,
 			result = 0;
 			goto done;
 		} else
+#endif
+#ifdef EVENT__HAVE_IO_URING
+		if (bufferevent_uring_can_connect_(bev)) {
+			bufferevent_setfd(bev, fd);
+			r = bufferevent_uring_connect_(bev, fd, sa, socklen);
+			if (r < 0)
+				goto freesock;
+			bufev_p->connecting = 1;
+			result = 0;
+			goto done;
+		} else
 #endif
 		r = evutil_socket_connect_(&fd, sa, socklen);
 		if (r < 0)
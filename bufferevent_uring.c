@@ -0,0 +1,723 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef EVENT__HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#include <sys/queue.h>
+
+#include "event2/util.h"
+#include "event2/bufferevent.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent_struct.h"
+#include "event2/event.h"
+#include "event-internal.h"
+#include "log-internal.h"
+#include "mm-internal.h"
+#include "bufferevent-internal.h"
+#include "util-internal.h"
+#include "evthread-internal.h"
+#include "uring-internal.h"
+
+#ifdef EVENT__HAVE_IO_URING
+
+/* How much we try to read at once when there is no read-high watermark. */
+#define URING_READ_SIZE 16384
+
+/* prototypes */
+static int be_uring_enable(struct bufferevent *, short);
+static int be_uring_disable(struct bufferevent *, short);
+static void be_uring_destruct(struct bufferevent *);
+static int be_uring_flush(struct bufferevent *, short, enum bufferevent_flush_mode);
+static int be_uring_ctrl(struct bufferevent *, enum bufferevent_ctrl_op, union bufferevent_ctrl_data *);
+
+struct bufferevent_uring {
+	struct bufferevent_private bev;
+	evutil_socket_t fd;
+	/** A read straight into the input buffer's chains. */
+	struct evbuffer_uring_io read_io;
+	/** A write straight out of the output buffer's chains. */
+	struct evbuffer_uring_io write_io;
+	/** A read into a buffer that the kernel picks from the base's
+	 * provided-buffer ring. */
+	struct event_uring_op recv_op;
+	struct event_uring_op connect_op;
+	struct sockaddr_storage connect_addr;
+	size_t read_in_progress;
+	size_t write_in_progress;
+	unsigned ok : 1;
+	unsigned read_added : 1;
+	unsigned write_added : 1;
+	unsigned recv_in_progress : 1;
+	unsigned connect_in_progress : 1;
+	/** True if the last read filled all the space we gave it, so
+	 * there is probably more data waiting. */
+	unsigned last_read_full : 1;
+};
+
+const struct bufferevent_ops bufferevent_ops_uring = {
+	"socket_uring",
+	evutil_offsetof(struct bufferevent_uring, bev.bev),
+	be_uring_enable,
+	be_uring_disable,
+	NULL, /* Unlink */
+	be_uring_destruct,
+	bufferevent_generic_adj_timeouts_,
+	be_uring_flush,
+	be_uring_ctrl,
+};
+
+static inline struct bufferevent_uring *
+upcast(struct bufferevent *bev)
+{
+	struct bufferevent_uring *bev_u;
+	if (!BEV_IS_URING(bev))
+		return NULL;
+	bev_u = EVUTIL_UPCAST(bev, struct bufferevent_uring, bev.bev);
+	return bev_u;
+}
+
+static void
+bev_uring_del_write(struct bufferevent_uring *bevu)
+{
+	struct bufferevent *bev = &bevu->bev.bev;
+
+	if (bevu->write_added) {
+		bevu->write_added = 0;
+		event_base_del_virtual_(bev->ev_base);
+	}
+}
+
+static void
+bev_uring_del_read(struct bufferevent_uring *bevu)
+{
+	struct bufferevent *bev = &bevu->bev.bev;
+
+	if (bevu->read_added) {
+		bevu->read_added = 0;
+		event_base_del_virtual_(bev->ev_base);
+	}
+}
+
+static void
+bev_uring_add_write(struct bufferevent_uring *bevu)
+{
+	struct bufferevent *bev = &bevu->bev.bev;
+
+	if (!bevu->write_added) {
+		bevu->write_added = 1;
+		event_base_add_virtual_(bev->ev_base);
+	}
+}
+
+static void
+bev_uring_add_read(struct bufferevent_uring *bevu)
+{
+	struct bufferevent *bev = &bevu->bev.bev;
+
+	if (!bevu->read_added) {
+		bevu->read_added = 1;
+		event_base_add_virtual_(bev->ev_base);
+	}
+}
+
+static void
+bev_uring_consider_writing(struct bufferevent_uring *bevu)
+{
+	size_t at_most;
+	int limit;
+	struct bufferevent *bev = &bevu->bev.bev;
+
+	/* Don't write if there's a write in progress, or we do not
+	 * want to write, or when there's nothing left to write. */
+	if (bevu->write_in_progress || bevu->bev.connecting)
+		return;
+	if (!bevu->ok || !(bev->enabled&EV_WRITE) ||
+	    !evbuffer_get_length(bev->output)) {
+		bev_uring_del_write(bevu);
+		return;
+	}
+
+	at_most = evbuffer_get_length(bev->output);
+
+	/* This is safe so long as bufferevent_get_write_max never returns
+	 * more than INT_MAX.  That's true for now. XXXX */
+	limit = (int)bufferevent_get_write_max_(&bevu->bev);
+	if (at_most >= (size_t)limit && limit >= 0)
+		at_most = limit;
+
+	if (bevu->bev.write_suspended) {
+		bev_uring_del_write(bevu);
+		return;
+	}
+
+	bufferevent_incref_(bev);
+	if (evbuffer_uring_launch_write_(bev->output, bev->ev_base, bevu->fd,
+		at_most, &bevu->write_io)) {
+		bufferevent_decref_(bev);
+		bevu->ok = 0;
+		bufferevent_run_eventcb_(bev, BEV_EVENT_ERROR, 0);
+	} else {
+		bevu->write_in_progress = at_most;
+		bufferevent_decrement_write_buckets_(&bevu->bev, at_most);
+		bev_uring_add_write(bevu);
+	}
+}
+
+/* Post a read into a kernel-provided buffer.  Returns 1 on success, 0 if
+ * the base has no provided-buffer ring, and -1 on error. */
+static int
+bev_uring_launch_recv(struct bufferevent_uring *bevu)
+{
+	struct event_base *base = bevu->bev.bev.ev_base;
+	struct io_uring_sqe *sqe;
+	int bgid, r = -1;
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if ((bgid = event_uring_buffer_group_(base)) < 0) {
+		r = 0;
+		goto done;
+	}
+	if (!(sqe = event_uring_get_sqe_(base, &bevu->recv_op)))
+		goto done;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = bevu->fd;
+	sqe->len = EVENT_URING_BUFFER_SIZE;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = bgid;
+	event_uring_commit_(base);
+	r = 1;
+done:
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	return r;
+}
+
+static void
+bev_uring_consider_reading(struct bufferevent_uring *bevu)
+{
+	size_t cur_size;
+	size_t read_high;
+	size_t at_most;
+	int limit, r = 0;
+	struct bufferevent *bev = &bevu->bev.bev;
+
+	/* Don't read if there is a read in progress, or we do not
+	 * want to read. */
+	if (bevu->read_in_progress || bevu->bev.connecting)
+		return;
+	if (!bevu->ok || !(bev->enabled&EV_READ)) {
+		bev_uring_del_read(bevu);
+		return;
+	}
+
+	/* Don't read if we're full */
+	cur_size = evbuffer_get_length(bev->input);
+	read_high = bev->wm_read.high;
+	if (read_high) {
+		if (cur_size >= read_high) {
+			bev_uring_del_read(bevu);
+			return;
+		}
+		at_most = read_high - cur_size;
+	} else {
+		at_most = URING_READ_SIZE;
+	}
+
+	/* XXXX see also not above on cast on bufferevent_get_write_max_() */
+	limit = (int)bufferevent_get_read_max_(&bevu->bev);
+	if (at_most >= (size_t)limit && limit >= 0)
+		at_most = limit;
+
+	if (bevu->bev.read_suspended) {
+		bev_uring_del_read(bevu);
+		return;
+	}
+
+	bufferevent_incref_(bev);
+
+	/* If nothing is buffered and the last read came up short, the
+	 * connection is probably idle: let the kernel pick a buffer when
+	 * data finally shows up, rather than tying one up now. */
+	if (!cur_size && !bevu->last_read_full &&
+	    at_most >= EVENT_URING_BUFFER_SIZE) {
+		r = bev_uring_launch_recv(bevu);
+		if (r > 0) {
+			bevu->recv_in_progress = 1;
+			at_most = EVENT_URING_BUFFER_SIZE;
+		}
+	}
+	if (r == 0 && evbuffer_uring_launch_read_(bev->input, bev->ev_base,
+		bevu->fd, at_most, &bevu->read_io) < 0)
+		r = -1;
+
+	if (r < 0) {
+		bevu->ok = 0;
+		bufferevent_run_eventcb_(bev, BEV_EVENT_ERROR, 0);
+		bufferevent_decref_(bev);
+	} else {
+		bevu->read_in_progress = at_most;
+		bufferevent_decrement_read_buckets_(&bevu->bev, at_most);
+		bev_uring_add_read(bevu);
+	}
+}
+
+static void
+be_uring_outbuf_callback(struct evbuffer *buf,
+    const struct evbuffer_cb_info *cbinfo,
+    void *arg)
+{
+	struct bufferevent *bev = arg;
+	struct bufferevent_uring *bev_uring = upcast(bev);
+
+	/* If we added data to the outbuf and were not writing before,
+	 * we may want to write now. */
+
+	bufferevent_incref_and_lock_(bev);
+
+	if (cbinfo->n_added)
+		bev_uring_consider_writing(bev_uring);
+
+	bufferevent_decref_and_unlock_(bev);
+}
+
+static void
+be_uring_inbuf_callback(struct evbuffer *buf,
+    const struct evbuffer_cb_info *cbinfo,
+    void *arg)
+{
+	struct bufferevent *bev = arg;
+	struct bufferevent_uring *bev_uring = upcast(bev);
+
+	/* If we drained data from the inbuf and were not reading before,
+	 * we may want to read now */
+
+	bufferevent_incref_and_lock_(bev);
+
+	if (cbinfo->n_deleted)
+		bev_uring_consider_reading(bev_uring);
+
+	bufferevent_decref_and_unlock_(bev);
+}
+
+static int
+be_uring_enable(struct bufferevent *buf, short what)
+{
+	struct bufferevent_uring *bev_uring = upcast(buf);
+
+	if (!bev_uring->ok)
+		return -1;
+
+	if (bev_uring->bev.connecting) {
+		/* Don't launch anything during connection attempts. */
+		return 0;
+	}
+
+	if (what & EV_READ)
+		BEV_RESET_GENERIC_READ_TIMEOUT(buf);
+	if (what & EV_WRITE)
+		BEV_RESET_GENERIC_WRITE_TIMEOUT(buf);
+
+	/* If we newly enable reading or writing, and we aren't reading or
+	   writing already, consider launching a new read or write. */
+
+	if (what & EV_READ)
+		bev_uring_consider_reading(bev_uring);
+	if (what & EV_WRITE)
+		bev_uring_consider_writing(bev_uring);
+	return 0;
+}
+
+static int
+be_uring_disable(struct bufferevent *bev, short what)
+{
+	struct bufferevent_uring *bev_uring = upcast(bev);
+	/* As with IOCP, a read or write that is already in the ring keeps
+	 * going; we just don't launch another one. */
+
+	if (what & EV_READ) {
+		BEV_DEL_GENERIC_READ_TIMEOUT(bev);
+		bev_uring_del_read(bev_uring);
+	}
+	if (what & EV_WRITE) {
+		BEV_DEL_GENERIC_WRITE_TIMEOUT(bev);
+		bev_uring_del_write(bev_uring);
+	}
+
+	return 0;
+}
+
+static void
+be_uring_destruct(struct bufferevent *bev)
+{
+	struct bufferevent_uring *bev_uring = upcast(bev);
+	struct bufferevent_private *bev_p = BEV_UPCAST(bev);
+
+	EVUTIL_ASSERT(!bev_uring->write_in_progress &&
+	    !bev_uring->read_in_progress &&
+	    !bev_uring->connect_in_progress);
+
+	bev_uring_del_read(bev_uring);
+	bev_uring_del_write(bev_uring);
+
+	if (bev_uring->fd != EVUTIL_INVALID_SOCKET &&
+	    (bev_p->options & BEV_OPT_CLOSE_ON_FREE)) {
+		evutil_closesocket(bev_uring->fd);
+		bev_uring->fd = EVUTIL_INVALID_SOCKET;
+	}
+
+	evutil_getaddrinfo_cancel_async_(bev_p->dns_request);
+}
+
+static int
+be_uring_flush(struct bufferevent *bev, short what,
+    enum bufferevent_flush_mode mode)
+{
+	return 0;
+}
+
+static void
+read_done(struct bufferevent_uring *bev_u, int res)
+{
+	struct bufferevent *bev = &bev_u->bev.bev;
+	short what = BEV_EVENT_READING;
+	size_t nbytes = res > 0 ? (size_t)res : 0;
+	ev_ssize_t amount_unread;
+
+	amount_unread = bev_u->read_in_progress - nbytes;
+	bev_u->last_read_full = nbytes == bev_u->read_in_progress;
+	bev_u->read_in_progress = 0;
+	if (amount_unread)
+		bufferevent_decrement_read_buckets_(&bev_u->bev, -amount_unread);
+
+	if (bev_u->ok) {
+		if (res > 0) {
+			BEV_RESET_GENERIC_READ_TIMEOUT(bev);
+			bufferevent_trigger_nolock_(bev, EV_READ, 0);
+			bev_uring_consider_reading(bev_u);
+		} else if (res < 0) {
+			what |= BEV_EVENT_ERROR;
+			bev_u->ok = 0;
+			errno = -res;
+			bufferevent_run_eventcb_(bev, what, 0);
+		} else {
+			what |= BEV_EVENT_EOF;
+			bev_u->ok = 0;
+			bufferevent_run_eventcb_(bev, what, 0);
+		}
+	}
+
+	bufferevent_decref_and_unlock_(bev);
+}
+
+static void
+read_complete(struct event_callback *cb, void *arg)
+{
+	struct bufferevent_uring *bev_u = arg;
+	struct bufferevent *bev = &bev_u->bev.bev;
+	int res;
+
+	BEV_LOCK(bev);
+	EVUTIL_ASSERT(bev_u->read_in_progress && !bev_u->recv_in_progress);
+
+	res = bev_u->read_io.op.res;
+	evbuffer_uring_commit_read_(bev->input, &bev_u->read_io, res);
+	read_done(bev_u, res);
+}
+
+static void
+recv_complete(struct event_callback *cb, void *arg)
+{
+	struct bufferevent_uring *bev_u = arg;
+	struct bufferevent *bev = &bev_u->bev.bev;
+	struct event_base *base = bev->ev_base;
+	int res = bev_u->recv_op.res;
+	unsigned flags = bev_u->recv_op.cqe_flags;
+
+	BEV_LOCK(bev);
+	EVUTIL_ASSERT(bev_u->read_in_progress && bev_u->recv_in_progress);
+	bev_u->recv_in_progress = 0;
+
+	if (flags & IORING_CQE_F_BUFFER) {
+		unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+		if (res > 0 &&
+		    evbuffer_add(bev->input, event_uring_buffer_(base, bid),
+			res) < 0)
+			res = -ENOMEM;
+		event_uring_buffer_release_(base, bid);
+		EVBASE_RELEASE_LOCK(base, th_base_lock);
+	}
+
+	if (res == -ENOBUFS) {
+		/* Every provided buffer was in use.  Try again with a read
+		 * into our own buffer. */
+		bufferevent_decrement_read_buckets_(&bev_u->bev,
+		    -(ev_ssize_t)bev_u->read_in_progress);
+		bev_u->read_in_progress = 0;
+		bev_u->last_read_full = 1;
+		bev_uring_consider_reading(bev_u);
+		bufferevent_decref_and_unlock_(bev);
+		return;
+	}
+
+	read_done(bev_u, res);
+}
+
+static void
+write_complete(struct event_callback *cb, void *arg)
+{
+	struct bufferevent_uring *bev_u = arg;
+	struct bufferevent *bev = &bev_u->bev.bev;
+	short what = BEV_EVENT_WRITING;
+	int res;
+	size_t nbytes;
+	ev_ssize_t amount_unwritten;
+
+	BEV_LOCK(bev);
+	EVUTIL_ASSERT(bev_u->write_in_progress);
+
+	res = bev_u->write_io.op.res;
+	nbytes = res > 0 ? (size_t)res : 0;
+	amount_unwritten = bev_u->write_in_progress - nbytes;
+	evbuffer_uring_commit_write_(bev->output, &bev_u->write_io, res);
+	bev_u->write_in_progress = 0;
+
+	if (amount_unwritten)
+		bufferevent_decrement_write_buckets_(&bev_u->bev,
+		                                     -amount_unwritten);
+
+	if (bev_u->ok) {
+		if (res > 0) {
+			BEV_RESET_GENERIC_WRITE_TIMEOUT(bev);
+			bufferevent_trigger_nolock_(bev, EV_WRITE, 0);
+			bev_uring_consider_writing(bev_u);
+		} else if (res < 0) {
+			what |= BEV_EVENT_ERROR;
+			bev_u->ok = 0;
+			errno = -res;
+			bufferevent_run_eventcb_(bev, what, 0);
+		} else {
+			what |= BEV_EVENT_EOF;
+			bev_u->ok = 0;
+			bufferevent_run_eventcb_(bev, what, 0);
+		}
+	}
+
+	bufferevent_decref_and_unlock_(bev);
+}
+
+static void
+connect_complete(struct event_callback *cb, void *arg)
+{
+	struct bufferevent_uring *bev_u = arg;
+	struct bufferevent *bev = &bev_u->bev.bev;
+	int res = bev_u->connect_op.res;
+
+	BEV_LOCK(bev);
+
+	EVUTIL_ASSERT(bev_u->connect_in_progress);
+	bev_u->connect_in_progress = 0;
+	bev_u->bev.connecting = 0;
+
+	if (res == 0 && bev_u->ok) {
+		bufferevent_socket_set_conn_address_fd_(bev, bev_u->fd);
+		bufferevent_run_eventcb_(bev, BEV_EVENT_CONNECTED, 0);
+		/* Now's a good time to consider reading/writing */
+		be_uring_enable(bev, bev->enabled);
+	} else if (bev_u->ok) {
+		bev_u->ok = 0;
+		if (res < 0)
+			errno = -res;
+		bufferevent_run_eventcb_(bev, BEV_EVENT_ERROR, 0);
+	}
+
+	event_base_del_virtual_(bev->ev_base);
+
+	bufferevent_decref_and_unlock_(bev);
+}
+
+struct bufferevent *
+bufferevent_uring_new(struct event_base *base,
+    evutil_socket_t fd, int options)
+{
+	struct bufferevent_uring *bev_u;
+	struct bufferevent *bev;
+
+	if (!event_base_is_uring_(base))
+		return NULL;
+
+	if (!(bev_u = mm_calloc(1, sizeof(struct bufferevent_uring))))
+		return NULL;
+
+	bev = &bev_u->bev.bev;
+	if (bufferevent_init_common_(&bev_u->bev, base, &bufferevent_ops_uring,
+		options) < 0) {
+		mm_free(bev_u);
+		return NULL;
+	}
+
+	evbuffer_add_cb(bev->input, be_uring_inbuf_callback, bev);
+	evbuffer_add_cb(bev->output, be_uring_outbuf_callback, bev);
+
+	event_uring_op_init_(&bev_u->read_io.op, base, read_complete, bev_u);
+	event_uring_op_init_(&bev_u->write_io.op, base, write_complete, bev_u);
+	event_uring_op_init_(&bev_u->recv_op, base, recv_complete, bev_u);
+	event_uring_op_init_(&bev_u->connect_op, base, connect_complete, bev_u);
+
+	bufferevent_init_generic_timeout_cbs_(bev);
+
+	bev_u->fd = fd;
+	bev_u->ok = fd >= 0;
+
+	return bev;
+}
+
+int
+bufferevent_uring_can_connect_(struct bufferevent *bev)
+{
+	return BEV_IS_URING(bev) && event_base_is_uring_(bev->ev_base);
+}
+
+int
+bufferevent_uring_connect_(struct bufferevent *bev, evutil_socket_t fd,
+    const struct sockaddr *sa, int socklen)
+{
+	struct bufferevent_uring *bev_u = upcast(bev);
+	struct event_base *base = bev->ev_base;
+	struct io_uring_sqe *sqe;
+
+	EVUTIL_ASSERT(fd >= 0 && sa != NULL && fd == bev_u->fd);
+
+	if (bev_u->connect_in_progress ||
+	    socklen > (int)sizeof(bev_u->connect_addr))
+		return -1;
+	/* The kernel reads the address when the request is submitted,
+	 * which is later than now. */
+	memcpy(&bev_u->connect_addr, sa, socklen);
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if (!(sqe = event_uring_get_sqe_(base, &bev_u->connect_op))) {
+		EVBASE_RELEASE_LOCK(base, th_base_lock);
+		return -1;
+	}
+	sqe->opcode = IORING_OP_CONNECT;
+	sqe->fd = fd;
+	sqe->addr = (ev_uint64_t)(ev_uintptr_t)&bev_u->connect_addr;
+	sqe->off = socklen;
+	event_uring_commit_(base);
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	bev_u->connect_in_progress = 1;
+	event_base_add_virtual_(base);
+	bufferevent_incref_(bev);
+
+	return 0;
+}
+
+/* Ask the kernel to cancel whatever request is running on op. */
+static void
+bev_uring_cancel(struct event_base *base, struct event_uring_op *op)
+{
+	struct io_uring_sqe *sqe;
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if ((sqe = event_uring_get_sqe_(base, NULL))) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (ev_uint64_t)(ev_uintptr_t)op;
+		event_uring_commit_(base);
+	}
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+}
+
+static int
+be_uring_ctrl(struct bufferevent *bev, enum bufferevent_ctrl_op op,
+    union bufferevent_ctrl_data *data)
+{
+	struct bufferevent_uring *bev_u = upcast(bev);
+
+	switch (op) {
+	case BEV_CTRL_GET_FD:
+		data->fd = bev_u->fd;
+		return 0;
+	case BEV_CTRL_SET_FD:
+		if (data->fd == bev_u->fd)
+			return 0;
+		bev_u->fd = data->fd;
+		bev_u->ok = data->fd >= 0;
+		bev_u->last_read_full = 0;
+		return 0;
+	case BEV_CTRL_CANCEL_ALL: {
+		/* A pending request holds a reference to the file, so closing
+		 * the fd isn't enough to stop it, as it is with IOCP. */
+		if (bev_u->read_in_progress)
+			bev_uring_cancel(bev->ev_base, bev_u->recv_in_progress ?
+			    &bev_u->recv_op : &bev_u->read_io.op);
+		if (bev_u->write_in_progress)
+			bev_uring_cancel(bev->ev_base, &bev_u->write_io.op);
+		if (bev_u->connect_in_progress)
+			bev_uring_cancel(bev->ev_base, &bev_u->connect_op);
+		if (bev_u->fd != EVUTIL_INVALID_SOCKET &&
+		    (bev_u->bev.options & BEV_OPT_CLOSE_ON_FREE)) {
+			evutil_closesocket(bev_u->fd);
+			bev_u->fd = EVUTIL_INVALID_SOCKET;
+		}
+		bev_u->ok = 0;
+		return 0;
+	}
+	case BEV_CTRL_GET_UNDERLYING:
+	default:
+		return -1;
+	}
+}
+
+#else /* !EVENT__HAVE_IO_URING */
+
+struct bufferevent *
+bufferevent_uring_new(struct event_base *base,
+    evutil_socket_t fd, int options)
+{
+	return NULL;
+}
+
+#endif /* EVENT__HAVE_IO_URING */
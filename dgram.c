@@ -0,0 +1,787 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <sys/types.h>
+
+#ifdef _WIN32
+#ifndef _WIN32_WINNT
+/* Minimum required for InitializeCriticalSectionAndSpinCount */
+#define _WIN32_WINNT 0x0403
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+#include <errno.h>
+#include <string.h>
+#ifdef EVENT__HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef EVENT__HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+#ifdef EVENT__HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#ifdef __linux__
+#include <netinet/udp.h>
+#endif
+
+#include "event2/dgram.h"
+#include "event2/util.h"
+#include "event2/event.h"
+#include "event2/event_struct.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+#include "log-internal.h"
+#include "evthread-internal.h"
+
+/* Older C libraries don't know these yet, but the kernel may. */
+#if defined(__linux__) && defined(SOL_UDP)
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+#if defined(EVENT__HAVE_RECVMMSG) && defined(UDP_GRO)
+#define USE_GRO
+#endif
+#if defined(EVENT__HAVE_SENDMMSG) && defined(UDP_SEGMENT)
+#define USE_GSO
+#endif
+
+/** Default number of datagrams to read at once, and their longest length */
+#define DGRAM_DEFAULT_BATCH 32
+#define DGRAM_DEFAULT_MSG_SIZE 2048
+/** Defaults with EVDGRAM_OPT_GRO, where every buffer must take 64k */
+#define DGRAM_GRO_BATCH 8
+#define DGRAM_GRO_MSG_SIZE 65535
+/** Largest number of datagrams we read at once */
+#define DGRAM_MAX_BATCH 1024
+/** Default limit on the bytes of datagrams queued for sending */
+#define DGRAM_DEFAULT_MAX_PENDING (1024*1024)
+/** Most batches we read before letting other events run */
+#define DGRAM_MAX_READ_ROUNDS 16
+/** Most datagrams the kernel coalesces into one with GRO, or takes as one
+ * with GSO, and the most bytes that a GSO send can hold */
+#define DGRAM_MAX_SEGS 64
+#define DGRAM_GSO_MAX_BYTES 65000
+/** Most messages, and buffers, that we give sendmmsg() at once */
+#define DGRAM_SEND_BATCH 64
+#define DGRAM_SEND_IOV 256
+
+/** A datagram queued for sending, followed by its contents. */
+struct evdgram_out {
+	struct evdgram_out *next;
+	size_t len;
+	ev_socklen_t addrlen;
+	struct sockaddr_storage addr;
+};
+
+#define DGRAM_OUT_DATA(o) ((unsigned char *)((o) + 1))
+
+struct evdgram {
+	struct event_base *base;
+	evutil_socket_t fd;
+	struct event read_ev;
+	struct event write_ev;
+	void *lock;
+	evdgram_read_cb readcb;
+	evdgram_error_cb errorcb;
+	void *user_data;
+	unsigned flags;
+	int refcnt;
+	/** Nonzero while the read callback runs: sends are queued. */
+	int reading;
+	unsigned enabled : 1;
+	/** True if the kernel gives us coalesced datagrams. */
+	unsigned gro : 1;
+	/** False once the kernel has refused a GSO send. */
+	unsigned gso_ok : 1;
+
+	/* How many datagrams we read at once, and the longest. */
+	int max_msgs;
+	size_t max_msg_size;
+	/* Buffers for reading, allocated on the first read: max_msgs buffers
+	 * of max_msg_size bytes, their addresses, and the datagrams that we
+	 * hand to the read callback, of which there are more with GRO. */
+	unsigned char *bufs;
+	struct sockaddr_storage *addrs;
+	struct evdgram_msg *msgs;
+#ifdef EVENT__HAVE_RECVMMSG
+	struct mmsghdr *mmsgs;
+	struct iovec *iovs;
+	unsigned char *controls;
+#endif
+
+	/* Datagrams waiting to be sent, and their total length. */
+	struct evdgram_out *out_head;
+	struct evdgram_out **out_tailp;
+	size_t n_pending;
+	size_t max_pending;
+};
+
+#define LOCK(dg) EVLOCK_LOCK((dg)->lock, 0)
+#define UNLOCK(dg) EVLOCK_UNLOCK((dg)->lock, 0)
+
+#ifdef USE_GRO
+#define DGRAM_CONTROL_LEN CMSG_SPACE(sizeof(int))
+#endif
+
+static void dgram_read_cb(evutil_socket_t, short, void *);
+static void dgram_write_cb(evutil_socket_t, short, void *);
+
+static void
+dgram_free_bufs(struct evdgram *dg)
+{
+	if (dg->bufs)
+		mm_free(dg->bufs);
+	if (dg->addrs)
+		mm_free(dg->addrs);
+	if (dg->msgs)
+		mm_free(dg->msgs);
+	dg->bufs = NULL;
+	dg->addrs = NULL;
+	dg->msgs = NULL;
+#ifdef EVENT__HAVE_RECVMMSG
+	if (dg->mmsgs)
+		mm_free(dg->mmsgs);
+	if (dg->iovs)
+		mm_free(dg->iovs);
+	if (dg->controls)
+		mm_free(dg->controls);
+	dg->mmsgs = NULL;
+	dg->iovs = NULL;
+	dg->controls = NULL;
+#endif
+}
+
+static int
+dgram_alloc_bufs(struct evdgram *dg)
+{
+	size_t n = dg->max_msgs;
+
+	if (dg->bufs)
+		return 0;
+	dg->bufs = mm_malloc(n * dg->max_msg_size);
+	dg->addrs = mm_calloc(n, sizeof(struct sockaddr_storage));
+	dg->msgs = mm_calloc(dg->gro ? n * DGRAM_MAX_SEGS : n,
+	    sizeof(struct evdgram_msg));
+	if (!dg->bufs || !dg->addrs || !dg->msgs)
+		goto err;
+#ifdef EVENT__HAVE_RECVMMSG
+	dg->mmsgs = mm_calloc(n, sizeof(struct mmsghdr));
+	dg->iovs = mm_calloc(n, sizeof(struct iovec));
+	if (!dg->mmsgs || !dg->iovs)
+		goto err;
+#ifdef USE_GRO
+	if (dg->gro && !(dg->controls = mm_calloc(n, DGRAM_CONTROL_LEN)))
+		goto err;
+#endif
+#endif
+	return 0;
+err:
+	dgram_free_bufs(dg);
+	return -1;
+}
+
+static void
+dgram_free_queue(struct evdgram *dg)
+{
+	struct evdgram_out *o, *next;
+
+	for (o = dg->out_head; o; o = next) {
+		next = o->next;
+		mm_free(o);
+	}
+	dg->out_head = NULL;
+	dg->out_tailp = &dg->out_head;
+	dg->n_pending = 0;
+}
+
+/* Remove the first datagram from the send queue. */
+static void
+dgram_pop(struct evdgram *dg)
+{
+	struct evdgram_out *o = dg->out_head;
+
+	dg->out_head = o->next;
+	if (!dg->out_head)
+		dg->out_tailp = &dg->out_head;
+	dg->n_pending -= o->len;
+	mm_free(o);
+}
+
+#ifdef EVENT__HAVE_SENDMMSG
+/** Room for the UDP_SEGMENT option of one message. */
+union dgram_control {
+	unsigned char buf[CMSG_SPACE(sizeof(ev_uint16_t))];
+	struct cmsghdr align;
+};
+
+/* Put as many queued datagrams as fit into msgs for one sendmmsg().  With
+ * GSO, each run of datagrams of one size to one address, of which only the
+ * last may be shorter, goes into one message.  Sets n_segs[i] to the
+ * number of datagrams in message i, and returns the number of messages. */
+static int
+dgram_fill_mmsgs(struct evdgram *dg, struct mmsghdr *msgs,
+    struct iovec *iov, union dgram_control *control, int *n_segs)
+{
+	struct evdgram_out *o = dg->out_head, *first, *prev;
+	int n_msgs = 0, n_iov = 0, max_segs;
+	size_t total;
+
+	max_segs = 1;
+#ifdef USE_GSO
+	if ((dg->flags & EVDGRAM_OPT_GSO) && dg->gso_ok)
+		max_segs = DGRAM_MAX_SEGS;
+#endif
+
+	while (o && n_msgs < DGRAM_SEND_BATCH && n_iov < DGRAM_SEND_IOV) {
+		struct msghdr *mh = &msgs[n_msgs].msg_hdr;
+		int n = 0;
+
+		first = o;
+		total = 0;
+		do {
+			iov[n_iov + n].iov_base = DGRAM_OUT_DATA(o);
+			iov[n_iov + n].iov_len = o->len;
+			total += o->len;
+			++n;
+			prev = o;
+			o = o->next;
+		} while (o && n < max_segs && n_iov + n < DGRAM_SEND_IOV &&
+		    first->len > 0 && prev->len == first->len &&
+		    o->len > 0 && o->len <= first->len &&
+		    total + o->len <= DGRAM_GSO_MAX_BYTES &&
+		    o->addrlen == first->addrlen &&
+		    !memcmp(&o->addr, &first->addr, o->addrlen));
+
+		memset(mh, 0, sizeof(*mh));
+		if (first->addrlen) {
+			mh->msg_name = &first->addr;
+			mh->msg_namelen = first->addrlen;
+		}
+		mh->msg_iov = &iov[n_iov];
+		mh->msg_iovlen = n;
+#ifdef USE_GSO
+		if (n > 1) {
+			struct cmsghdr *cm;
+			ev_uint16_t segsize = (ev_uint16_t)first->len;
+
+			mh->msg_control = control[n_msgs].buf;
+			mh->msg_controllen = sizeof(control[n_msgs].buf);
+			cm = CMSG_FIRSTHDR(mh);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(segsize));
+			memcpy(CMSG_DATA(cm), &segsize, sizeof(segsize));
+		}
+#else
+		(void)control;
+#endif
+		n_segs[n_msgs++] = n;
+		n_iov += n;
+	}
+	return n_msgs;
+}
+#endif
+
+/* Send queued datagrams until the queue is empty or the socket would
+ * block, and wait for the socket to be writable if it did.  A datagram that
+ * fails with any other error is dropped.  Returns the error of the first
+ * dropped datagram, or 0. */
+static int
+dgram_send_queue(struct evdgram *dg)
+{
+	int first_err = 0, err;
+#ifdef EVENT__HAVE_SENDMMSG
+	struct mmsghdr msgs[DGRAM_SEND_BATCH];
+	struct iovec iov[DGRAM_SEND_IOV];
+	union dgram_control control[DGRAM_SEND_BATCH];
+	int n_segs[DGRAM_SEND_BATCH];
+	int n_msgs, r, i, j;
+
+	while (dg->out_head) {
+		n_msgs = dgram_fill_mmsgs(dg, msgs, iov, control, n_segs);
+		r = sendmmsg(dg->fd, msgs, n_msgs, 0);
+		if (r > 0) {
+			for (i = 0; i < r; ++i)
+				for (j = 0; j < n_segs[i]; ++j)
+					dgram_pop(dg);
+			continue;
+		}
+		if (r == 0)
+			break;
+		err = evutil_socket_geterror(dg->fd);
+		if (EVUTIL_ERR_RW_RETRIABLE(err))
+			break;
+		if (n_segs[0] > 1) {
+			/* The kernel or the device can't do GSO here; send
+			 * them one at a time from now on. */
+			dg->gso_ok = 0;
+			continue;
+		}
+		if (!first_err)
+			first_err = err;
+		dgram_pop(dg);
+	}
+#else
+	struct evdgram_out *o;
+	ev_ssize_t r;
+
+	while ((o = dg->out_head)) {
+		r = sendto(dg->fd, (const void *)DGRAM_OUT_DATA(o), (int)o->len, 0,
+		    o->addrlen ? (struct sockaddr *)&o->addr : NULL,
+		    o->addrlen);
+		if (r < 0) {
+			err = evutil_socket_geterror(dg->fd);
+			if (EVUTIL_ERR_RW_RETRIABLE(err))
+				break;
+			if (!first_err)
+				first_err = err;
+		}
+		dgram_pop(dg);
+	}
+#endif
+
+	if (dg->out_head)
+		event_add(&dg->write_ev, NULL);
+	else
+		event_del(&dg->write_ev);
+	return first_err;
+}
+
+static int
+dgram_decref_and_unlock(struct evdgram *dg)
+{
+	if (--dg->refcnt > 0) {
+		UNLOCK(dg);
+		return 0;
+	}
+
+	/* Send what we can without waiting. */
+	if (dg->out_head)
+		dgram_send_queue(dg);
+	event_del(&dg->read_ev);
+	event_del(&dg->write_ev);
+	event_debug_unassign(&dg->read_ev);
+	event_debug_unassign(&dg->write_ev);
+	if (dg->flags & EVDGRAM_OPT_CLOSE_ON_FREE)
+		evutil_closesocket(dg->fd);
+	dgram_free_queue(dg);
+	dgram_free_bufs(dg);
+	UNLOCK(dg);
+	EVTHREAD_FREE_LOCK(dg->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	mm_free(dg);
+	return 1;
+}
+
+/* Tell the user about a non-retriable error.  Returns 1 if the callback
+ * freed dg, which is then unlocked; otherwise dg is still locked. */
+static int
+dgram_report_error(struct evdgram *dg, short what, int err)
+{
+	evdgram_error_cb errorcb = dg->errorcb;
+	void *user_data = dg->user_data;
+
+	if (!errorcb) {
+		event_warnx("Error while %s a datagram: %s",
+		    what == EV_READ ? "reading" : "sending",
+		    evutil_socket_error_to_string(err));
+		return 0;
+	}
+	++dg->refcnt;
+	UNLOCK(dg);
+	errorcb(dg, what, err, user_data);
+	LOCK(dg);
+	if (dg->refcnt == 1)
+		return dgram_decref_and_unlock(dg);
+	--dg->refcnt;
+	return 0;
+}
+
+/* Read one batch of datagrams into dg->msgs.  Returns the number of
+ * datagrams the kernel gave us, or -1 on error, and sets *n_msgs to the
+ * number of datagrams for the read callback. */
+static int
+dgram_recv_batch(struct evdgram *dg, int *n_msgs)
+{
+	int i, n = 0, max_n = dg->gro ? dg->max_msgs * DGRAM_MAX_SEGS :
+	    dg->max_msgs;
+#ifdef EVENT__HAVE_RECVMMSG
+	int r;
+
+	for (i = 0; i < dg->max_msgs; ++i) {
+		struct msghdr *mh = &dg->mmsgs[i].msg_hdr;
+		dg->iovs[i].iov_base = dg->bufs + i * dg->max_msg_size;
+		dg->iovs[i].iov_len = dg->max_msg_size;
+		memset(mh, 0, sizeof(*mh));
+		mh->msg_name = &dg->addrs[i];
+		mh->msg_namelen = sizeof(struct sockaddr_storage);
+		mh->msg_iov = &dg->iovs[i];
+		mh->msg_iovlen = 1;
+#ifdef USE_GRO
+		if (dg->gro) {
+			mh->msg_control = dg->controls + i * DGRAM_CONTROL_LEN;
+			mh->msg_controllen = DGRAM_CONTROL_LEN;
+		}
+#endif
+	}
+	r = recvmmsg(dg->fd, dg->mmsgs, dg->max_msgs, 0, NULL);
+	if (r < 0)
+		return -1;
+
+	for (i = 0; i < r; ++i) {
+		struct msghdr *mh = &dg->mmsgs[i].msg_hdr;
+		unsigned char *data = dg->iovs[i].iov_base;
+		size_t len = dg->mmsgs[i].msg_len, seg = len, off = 0;
+		int flags = (mh->msg_flags & MSG_TRUNC) ?
+		    EVDGRAM_MSG_TRUNCATED : 0;
+#ifdef USE_GRO
+		struct cmsghdr *cm;
+		for (cm = dg->gro ? CMSG_FIRSTHDR(mh) : NULL; cm;
+		     cm = CMSG_NXTHDR(mh, cm)) {
+			int gso_size;
+			if (cm->cmsg_level != SOL_UDP ||
+			    cm->cmsg_type != UDP_GRO)
+				continue;
+			memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+			if (gso_size > 0)
+				seg = gso_size;
+		}
+#endif
+		/* Split what GRO coalesced back into datagrams. */
+		do {
+			struct evdgram_msg *m = &dg->msgs[n++];
+			m->data = data + off;
+			m->len = len - off < seg ? len - off : seg;
+			m->addr = (struct sockaddr *)&dg->addrs[i];
+			m->addrlen = mh->msg_namelen;
+			m->flags = flags;
+			off += m->len;
+		} while (off < len && n < max_n);
+	}
+	*n_msgs = n;
+	return r;
+#else
+	(void)max_n;
+	for (i = 0; i < dg->max_msgs; ++i) {
+		ev_socklen_t addrlen = sizeof(struct sockaddr_storage);
+		int flags = 0;
+		ev_ssize_t r = recvfrom(dg->fd,
+		    (void *)(dg->bufs + i * dg->max_msg_size),
+		    (int)dg->max_msg_size, 0, (struct sockaddr *)&dg->addrs[i],
+		    &addrlen);
+		if (r < 0) {
+#ifdef _WIN32
+			if (WSAGetLastError() == WSAEMSGSIZE) {
+				r = (ev_ssize_t)dg->max_msg_size;
+				flags = EVDGRAM_MSG_TRUNCATED;
+			} else
+#endif
+			if (i == 0)
+				return -1;
+			else
+				break;
+		}
+		dg->msgs[n].data = dg->bufs + i * dg->max_msg_size;
+		dg->msgs[n].len = r;
+		dg->msgs[n].addr = (struct sockaddr *)&dg->addrs[i];
+		dg->msgs[n].addrlen = addrlen;
+		dg->msgs[n].flags = flags;
+		++n;
+	}
+	*n_msgs = n;
+	return i;
+#endif
+}
+
+static void
+dgram_read_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct evdgram *dg = arg;
+	evdgram_read_cb readcb;
+	void *user_data;
+	int rounds, n_read, n_msgs = 0, err;
+
+	LOCK(dg);
+	for (rounds = 0; rounds < DGRAM_MAX_READ_ROUNDS; ++rounds) {
+		if (!dg->readcb || !dg->enabled)
+			break;
+		if (dgram_alloc_bufs(dg) < 0) {
+			event_warnx("%s: out of memory", __func__);
+			break;
+		}
+		n_read = dgram_recv_batch(dg, &n_msgs);
+		if (n_read < 0) {
+			err = evutil_socket_geterror(fd);
+			if (EVUTIL_ERR_RW_RETRIABLE(err))
+				break;
+			if (dgram_report_error(dg, EV_READ, err))
+				return;
+			break;
+		}
+
+		/* Whatever the callback sends goes out in one batch once
+		 * it returns. */
+		++dg->refcnt;
+		++dg->reading;
+		readcb = dg->readcb;
+		user_data = dg->user_data;
+		UNLOCK(dg);
+		readcb(dg, dg->msgs, n_msgs, user_data);
+		LOCK(dg);
+		--dg->reading;
+		if (dg->refcnt == 1) {
+			int freed = dgram_decref_and_unlock(dg);
+			EVUTIL_ASSERT(freed);
+			return;
+		}
+		--dg->refcnt;
+
+		if (dg->out_head && !dg->reading) {
+			err = dgram_send_queue(dg);
+			if (err && dgram_report_error(dg, EV_WRITE, err))
+				return;
+		}
+		if (n_read < dg->max_msgs)
+			break;
+	}
+	UNLOCK(dg);
+}
+
+static void
+dgram_write_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct evdgram *dg = arg;
+	int err;
+
+	LOCK(dg);
+	if (!dg->reading) {
+		err = dgram_send_queue(dg);
+		if (err && dgram_report_error(dg, EV_WRITE, err))
+			return;
+	}
+	UNLOCK(dg);
+}
+
+struct evdgram *
+evdgram_new(struct event_base *base, evutil_socket_t fd, unsigned flags,
+    evdgram_read_cb readcb, evdgram_error_cb errorcb, void *user_arg)
+{
+	struct evdgram *dg;
+
+	if (evutil_make_socket_nonblocking(fd) < 0)
+		return NULL;
+	if (!(dg = mm_calloc(1, sizeof(struct evdgram))))
+		return NULL;
+
+	dg->base = base;
+	dg->fd = fd;
+	dg->readcb = readcb;
+	dg->errorcb = errorcb;
+	dg->user_data = user_arg;
+	dg->flags = flags;
+	dg->refcnt = 1;
+	dg->gso_ok = 1;
+	dg->max_msgs = DGRAM_DEFAULT_BATCH;
+	dg->max_msg_size = DGRAM_DEFAULT_MSG_SIZE;
+	dg->out_tailp = &dg->out_head;
+	dg->max_pending = DGRAM_DEFAULT_MAX_PENDING;
+
+#ifdef USE_GRO
+	if (flags & EVDGRAM_OPT_GRO) {
+		int on = 1;
+		if (setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0) {
+			dg->gro = 1;
+			dg->max_msgs = DGRAM_GRO_BATCH;
+			dg->max_msg_size = DGRAM_GRO_MSG_SIZE;
+		}
+	}
+#endif
+
+	if (flags & EVDGRAM_OPT_THREADSAFE) {
+		EVTHREAD_ALLOC_LOCK(dg->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	}
+
+	event_assign(&dg->read_ev, base, fd, EV_READ|EV_PERSIST,
+	    dgram_read_cb, dg);
+	event_assign(&dg->write_ev, base, fd, EV_WRITE|EV_PERSIST,
+	    dgram_write_cb, dg);
+
+	if (!(flags & EVDGRAM_OPT_DISABLED))
+		evdgram_enable(dg);
+
+	return dg;
+}
+
+void
+evdgram_free(struct evdgram *dg)
+{
+	LOCK(dg);
+	dg->readcb = NULL;
+	dg->errorcb = NULL;
+	dg->enabled = 0;
+	event_del(&dg->read_ev);
+	dgram_decref_and_unlock(dg);
+}
+
+int
+evdgram_set_batch(struct evdgram *dg, int max_msgs, size_t max_msg_size)
+{
+	int r = -1;
+
+	if (max_msgs < 1 || max_msgs > DGRAM_MAX_BATCH ||
+	    max_msg_size < 1 || max_msg_size > 65535)
+		return -1;
+	LOCK(dg);
+	if (!dg->reading) {
+		dgram_free_bufs(dg);
+		dg->max_msgs = max_msgs;
+		dg->max_msg_size = max_msg_size;
+		r = 0;
+	}
+	UNLOCK(dg);
+	return r;
+}
+
+void
+evdgram_set_max_pending(struct evdgram *dg, size_t max_bytes)
+{
+	LOCK(dg);
+	dg->max_pending = max_bytes;
+	UNLOCK(dg);
+}
+
+int
+evdgram_enable(struct evdgram *dg)
+{
+	int r = 0;
+
+	LOCK(dg);
+	dg->enabled = 1;
+	if (dg->readcb)
+		r = event_add(&dg->read_ev, NULL);
+	UNLOCK(dg);
+	return r;
+}
+
+int
+evdgram_disable(struct evdgram *dg)
+{
+	int r;
+
+	LOCK(dg);
+	dg->enabled = 0;
+	r = event_del(&dg->read_ev);
+	UNLOCK(dg);
+	return r;
+}
+
+int
+evdgram_send(struct evdgram *dg, const void *data, size_t len,
+    const struct sockaddr *to, ev_socklen_t tolen)
+{
+	struct evdgram_out *o;
+	int r = -1;
+
+	if (!to)
+		tolen = 0;
+	if (tolen > (ev_socklen_t)sizeof(struct sockaddr_storage))
+		return -1;
+
+	LOCK(dg);
+	if (!dg->reading && !dg->out_head) {
+		/* Nothing to wait for: try to send it now. */
+		if (sendto(dg->fd, data, (int)len, 0, to, tolen) >= 0) {
+			r = 0;
+			goto done;
+		}
+		if (!EVUTIL_ERR_RW_RETRIABLE(evutil_socket_geterror(dg->fd)))
+			goto done;
+	}
+
+	if (len > dg->max_pending - dg->n_pending)
+		goto done;
+	if (!(o = mm_malloc(sizeof(struct evdgram_out) + len)))
+		goto done;
+	o->next = NULL;
+	o->len = len;
+	o->addrlen = tolen;
+	if (tolen)
+		memcpy(&o->addr, to, tolen);
+	memcpy(DGRAM_OUT_DATA(o), data, len);
+	*dg->out_tailp = o;
+	dg->out_tailp = &o->next;
+	dg->n_pending += len;
+	/* The read callback sends the queue when it is done. */
+	if (!dg->reading)
+		event_add(&dg->write_ev, NULL);
+	r = 0;
+done:
+	UNLOCK(dg);
+	return r;
+}
+
+int
+evdgram_flush(struct evdgram *dg)
+{
+	int err;
+
+	LOCK(dg);
+	err = dgram_send_queue(dg);
+	UNLOCK(dg);
+	return err ? -1 : 0;
+}
+
+size_t
+evdgram_get_pending(struct evdgram *dg)
+{
+	size_t n;
+
+	LOCK(dg);
+	n = dg->n_pending;
+	UNLOCK(dg);
+	return n;
+}
+
+evutil_socket_t
+evdgram_get_fd(struct evdgram *dg)
+{
+	return dg->fd;
+}
+
+struct event_base *
+evdgram_get_base(struct evdgram *dg)
+{
+	return dg->base;
+}
@@ -155,6 +155,14 @@ struct evbuffer {
 	/** The parent bufferevent object this evbuffer belongs to.
 	 * NULL if the evbuffer stands alone. */
 	struct bufferevent *parent;
+
+	/** State for MSG_ZEROCOPY sends, or NULL if we haven't made any.
+	 * See EVBUFFER_FLAG_ZEROCOPY. */
+	struct evbuffer_zerocopy *zerocopy;
+
+	/** The chain cache that this buffer gets its chains from and gives
+	 * them back to, or NULL.  See evbuffer_set_chain_cache(). */
+	struct evbuffer_chain_cache *chain_cache;
 };
 
 #if EVENT__SIZEOF_OFF_T < EVENT__SIZEOF_SIZE_T
@@ -336,11 +344,27 @@ int evbuffer_read_setup_vecs_(struct evbuffer *buf, ev_ssize_t howmuch,
 /* XXXX the cast above is safe for now, but not if we allow mmaps on win64.
  * See note in buffer_iocp's launch_write function */
 
+/** Read up to howmuch bytes from fd into the shared read chain of base,
+ * and add that chain to the end of buf.  If any data was read, set chainp
+ * to the chain, which must be given back with evbuffer_unshare_() before
+ * returning to the event loop.  Returns as evbuffer_read(). */
+int evbuffer_read_shared_(struct evbuffer *buf, evutil_socket_t fd,
+    int howmuch, struct event_base *base, struct evbuffer_chain **chainp);
+/** Give back a chain that evbuffer_read_shared_() added to buf, copying any
+ * data still in it to a chain of buf's own. */
+void evbuffer_unshare_(struct evbuffer *buf, struct event_base *base,
+    struct evbuffer_chain *chain);
+
 /** Set the parent bufferevent object for buf to bev */
 void evbuffer_set_parent_(struct evbuffer *buf, struct bufferevent *bev);
 
 void evbuffer_invoke_callbacks_(struct evbuffer *buf);
 
+/** Collect the kernel's reports of finished MSG_ZEROCOPY sends from buf,
+ * and release the chains that they were holding.  Does nothing if buf has
+ * no zero-copy sends outstanding. */
+void evbuffer_zerocopy_reap_(struct evbuffer *buf);
+
 
 int evbuffer_get_callbacks_(struct evbuffer *buffer,
     struct event_callback **cbs,
@@ -87,6 +87,7 @@
 #include "event2/dns.h"
 #include "event2/dns_struct.h"
 #include "event2/dns_compat.h"
+#include "event2/dgram.h"
 #include "event2/util.h"
 #include "event2/event.h"
 #include "event2/event_struct.h"
@@ -99,6 +100,8 @@
 #include "ipv6-internal.h"
 #include "util-internal.h"
 #include "evthread-internal.h"
+#include "ht-internal.h"
+#include "time-internal.h"
 #ifdef _WIN32
 #include <ctype.h>
 #include <winsock2.h>
@@ -187,6 +190,17 @@ struct request {
 	u16 trans_id;  /* the transaction id */
 	unsigned request_appended :1;	/* true if the request pointer is data which follows this struct */
 	unsigned transmit_me :1;  /* needs to be transmitted */
+	unsigned from_cache :1;  /* will be answered from the cache; on req_cached_head */
+	unsigned coalesced :1;  /* in base->inflight_questions */
+
+	/* Requests for the same question that we'll answer when this one is
+	 * answered, in a circular list.  They go out on the network only if
+	 * this request is cancelled first. */
+	struct request *followers;
+	/* If we're one of another request's followers, that request. */
+	struct request *leader;
+	HT_ENTRY(request) question_node;
+	unsigned question_hash;
 
 	/* XXXX This is a horrible hack. */
 	char **put_cname_in_ptr; /* store the cname here if we get one. */
@@ -214,6 +228,23 @@ struct reply {
 	} data;
 };
 
+/* An answer we got from a nameserver, kept so that we can give it again
+ * without asking.  Keyed on the question type and the name as it appears
+ * in the question packet, with case folded. */
+struct evdns_cache_entry {
+	HT_ENTRY(evdns_cache_entry) node;
+	TAILQ_ENTRY(evdns_cache_entry) lru;
+	unsigned hash;
+	u8 type;
+	u16 qname_len;
+	u8 qname[256];
+	/* When the answer stops being good, by the base's monotonic timer. */
+	struct timeval expires;
+	/* 0 if 'reply' holds the answer; otherwise the error to report. */
+	u32 err;
+	struct reply reply;
+};
+
 struct nameserver {
 	evutil_socket_t socket;	 /* a connected UDP socket */
 	struct sockaddr_storage address;
@@ -242,15 +273,11 @@ struct nameserver {
 /* Represents a local port where we're listening for DNS requests. Right now, */
 /* only UDP is supported. */
 struct evdns_server_port {
-	evutil_socket_t socket; /* socket we use to read queries and write replies. */
+	struct evdgram *dgram; /* reads queries and queues replies in batches. */
 	int refcnt; /* reference count. */
-	char choked; /* Are we currently blocked from writing? */
-	char closing; /* Are we trying to close this port, pending writes? */
+	char closing; /* Are we trying to close this port, pending requests? */
 	evdns_request_callback_fn_type user_callback; /* Fn to handle requests */
 	void *user_data; /* Opaque pointer passed to user_callback */
-	struct event event; /* Read/write event */
-	/* circular list of replies that we want to write. */
-	struct server_request *pending_replies;
 	struct event_base *event_base;
 
 #ifndef EVENT__DISABLE_THREAD_SUPPORT
@@ -273,12 +300,6 @@ struct server_reply_item {
 /* Represents a request that we've received as a DNS server, and holds */
 /* the components of the reply as we're constructing it. */
 struct server_request {
-	/* Pointers to the next and previous entries on the list of replies */
-	/* that we're waiting to write.	 Only set if we have tried to respond */
-	/* and gotten EAGAIN. */
-	struct server_request *next_pending;
-	struct server_request *prev_pending;
-
 	u16 trans_id; /* Transaction id. */
 	struct evdns_server_port *port; /* Which port received this request on? */
 	struct sockaddr_storage addr; /* Where to send the response */
@@ -309,6 +330,9 @@ struct evdns_base {
 	/* A circular list of requests that we're waiting to send, but haven't
 	 * sent yet because there are too many requests inflight */
 	struct request *req_waiting_head;
+	/* A circular list of requests that we're about to answer from the
+	 * cache. */
+	struct request *req_cached_head;
 	/* A circular list of nameservers. */
 	struct nameserver *server_head;
 	int n_req_heads;
@@ -355,6 +379,19 @@ struct evdns_base {
 
 	TAILQ_HEAD(hosts_list, hosts_entry) hostsdb;
 
+	/* Answers (and, per RFC 2308, NXDOMAIN and NODATA replies) that are
+	 * still within their TTL.  Most recently used first on cache_lru. */
+	HT_HEAD(evdns_cache_map, evdns_cache_entry) cache;
+	TAILQ_HEAD(evdns_cache_lru, evdns_cache_entry) cache_lru;
+	int cache_n;
+	/* Most entries to keep; 0 disables the cache. */
+	int cache_max;
+	struct evutil_monotonic_timer cache_timer;
+
+	/* Requests that are inflight or waiting, and that other requests for
+	 * the same question can wait on, by question. */
+	HT_HEAD(evdns_question_map, request) inflight_questions;
+
 #ifndef EVENT__DISABLE_THREAD_SUPPORT
 	void *lock;
 #endif
@@ -407,12 +444,15 @@ static void request_submit(struct request *const req);
 static int server_request_free(struct server_request *req);
 static void server_request_free_answers(struct server_request *req);
 static void server_port_free(struct evdns_server_port *port);
-static void server_port_ready_callback(evutil_socket_t fd, short events, void *arg);
 static int evdns_base_resolv_conf_parse_impl(struct evdns_base *base, int flags, const char *const filename);
 static int evdns_base_set_option_impl(struct evdns_base *base,
     const char *option, const char *val, int flags);
 static void evdns_base_free_and_unlock(struct evdns_base *base, int fail_requests);
 static void evdns_request_timeout_callback(evutil_socket_t fd, short events, void *arg);
+static void evdns_request_cached_callback(evutil_socket_t fd, short events, void *arg);
+static void evdns_cache_store(struct request *req, u32 ttl, u32 err, const struct reply *reply);
+static struct evdns_cache_entry *evdns_cache_lookup(struct evdns_base *base, const struct request *req, u32 *ttl_out);
+static void evdns_cache_shrink(struct evdns_base *base, int max);
 
 static int strtoint(const char *const str);
 
@@ -641,6 +681,102 @@ request_trans_id_set(struct request *const req, const u16 trans_id) {
 	*((u16 *) req->request) = htons(trans_id);
 }
 
+/* Find the question name in the packet that we built for req.  Return its
+ * length, counting the final empty label, or -1 if it is malformed. */
+static int
+request_question_name(const struct request *req, const u8 **name_out)
+{
+	/* The question name follows the 12-byte header. */
+	const u8 *qname = req->request + 12;
+	size_t max, len = 0;
+
+	if (req->request_len <= 12)
+		return -1;
+	max = req->request_len - 12;
+	while (len < max && qname[len])
+		len += qname[len] + 1;
+	if (len >= max)
+		return -1;
+	*name_out = qname;
+	return (int)len + 1;
+}
+
+static inline unsigned
+request_question_hash(const struct request *req)
+{
+	return req->question_hash;
+}
+
+/* Return true iff a and b ask the same question.  Case doesn't count, so
+ * that the 0x20 hack doesn't make every question different. */
+static inline int
+request_question_eq(const struct request *a, const struct request *b)
+{
+	const u8 *name_a, *name_b;
+	int len, i;
+
+	if (a->request_type != b->request_type)
+		return 0;
+	len = request_question_name(a, &name_a);
+	if (len < 0 || len != request_question_name(b, &name_b))
+		return 0;
+	for (i = 0; i < len; ++i) {
+		if (EVUTIL_TOLOWER_((char)name_a[i]) !=
+		    EVUTIL_TOLOWER_((char)name_b[i]))
+			return 0;
+	}
+	return 1;
+}
+
+HT_PROTOTYPE(evdns_question_map, request, question_node,
+    request_question_hash, request_question_eq)
+HT_GENERATE(evdns_question_map, request, question_node,
+    request_question_hash, request_question_eq, 0.5,
+    mm_malloc, mm_realloc, mm_free)
+
+/* Set req->question_hash.  Return -1 if req has no usable question. */
+static int
+request_question_key(struct request *req)
+{
+	const u8 *qname;
+	unsigned h = req->request_type;
+	int len, i;
+
+	if ((len = request_question_name(req, &qname)) < 0)
+		return -1;
+	for (i = 0; i < len; ++i)
+		h = (h * 33) ^ (u8)EVUTIL_TOLOWER_((char)qname[i]);
+	req->question_hash = h;
+	return 0;
+}
+
+/* Return the list that req is on. */
+static struct request **
+request_list(struct request *req)
+{
+	struct evdns_base *base = req->base;
+	if (req->from_cache)
+		return &base->req_cached_head;
+	if (req->leader)
+		return &req->leader->followers;
+	if (req->ns)
+		return &REQ_HEAD(base, req->trans_id);
+	return &base->req_waiting_head;
+}
+
+/* Ask req's question ourselves after all, rather than waiting for the
+ * cache or for another request.  req must not be on any list. */
+static void
+request_requeue(struct request *req)
+{
+	req->from_cache = 0;
+	req->leader = NULL;
+	req->ns = NULL;
+	evtimer_assign(&req->timeout_event, req->base->event_base,
+	    evdns_request_timeout_callback, req);
+	request_submit(req);
+}
+
 /* Called to remove a request from a list and dealloc it. */
 /* head is a pointer to the head of the list it should be */
 /* removed from or NULL if the request isn't in a list. */
@@ -648,19 +784,34 @@ request_trans_id_set(struct request *const req, const u16 trans_id) {
 static void
 request_finished(struct request *const req, struct request **head, int free_handle) {
 	struct evdns_base *base = req->base;
-	int was_inflight = (head != &base->req_waiting_head);
+	int was_inflight = (head != &base->req_waiting_head &&
+	    head != &base->req_cached_head && !req->leader);
 	EVDNS_LOCK(base);
 	ASSERT_VALID_REQUEST(req);
 
 	if (head)
 		evdns_request_remove(req, head);
 
+	if (req->coalesced) {
+		HT_REMOVE(evdns_question_map, &base->inflight_questions, req);
+		req->coalesced = 0;
+	}
+	/* If nobody answered our followers (say, we were cancelled), one of
+	 * them will have to ask for itself. */
+	while (req->followers) {
+		struct request *follower = req->followers;
+		evdns_request_remove(follower, &req->followers);
+		request_requeue(follower);
+	}
+
 	log(EVDNS_LOG_DEBUG, "Removing timeout for request %p", req);
 	if (was_inflight) {
 		evtimer_del(&req->timeout_event);
 		base->global_requests_inflight--;
 		req->ns->requests_inflight--;
-	} else {
+	} else if (head == &base->req_cached_head) {
+		event_del(&req->timeout_event);
+	} else if (!req->leader) {
 		base->global_requests_waiting--;
 	}
 	/* it was initialized during request_new / evtimer_assign */
@@ -864,6 +1015,146 @@ reply_schedule_callback(struct request *const req, u32 ttl, u32 err, struct repl
 }
 
 
+static inline unsigned
+evdns_cache_entry_hash(const struct evdns_cache_entry *e)
+{
+	return e->hash;
+}
+
+static inline int
+evdns_cache_entry_eq(const struct evdns_cache_entry *a,
+    const struct evdns_cache_entry *b)
+{
+	return a->type == b->type && a->qname_len == b->qname_len &&
+	    !memcmp(a->qname, b->qname, a->qname_len);
+}
+
+HT_PROTOTYPE(evdns_cache_map, evdns_cache_entry, node,
+    evdns_cache_entry_hash, evdns_cache_entry_eq)
+HT_GENERATE(evdns_cache_map, evdns_cache_entry, node,
+    evdns_cache_entry_hash, evdns_cache_entry_eq, 0.5,
+    mm_malloc, mm_realloc, mm_free)
+
+/* Set the key of 'e' from the question in the packet that we built for
+ * req.  Return -1 if there is no sensible key. */
+static int
+evdns_cache_key(struct evdns_cache_entry *e, const struct request *req)
+{
+	const u8 *qname;
+	unsigned h = req->request_type;
+	int len, i;
+
+	len = request_question_name(req, &qname);
+	if (len < 0 || len > (int)sizeof(e->qname))
+		return -1;
+
+	/* Fold case, so that the 0x20 hack doesn't make every query
+	 * different.  Label lengths are below 64, so they stay as they
+	 * are. */
+	for (i = 0; i < len; ++i) {
+		e->qname[i] = (u8)EVUTIL_TOLOWER_((char)qname[i]);
+		h = (h * 33) ^ e->qname[i];
+	}
+	e->qname_len = (u16)len;
+	e->type = req->request_type;
+	e->hash = h;
+	return 0;
+}
+
+static void
+evdns_cache_entry_free(struct evdns_base *base, struct evdns_cache_entry *e)
+{
+	HT_REMOVE(evdns_cache_map, &base->cache, e);
+	TAILQ_REMOVE(&base->cache_lru, e, lru);
+	--base->cache_n;
+	mm_free(e);
+}
+
+/* Throw away least recently used entries until there are no more than
+ * max. */
+static void
+evdns_cache_shrink(struct evdns_base *base, int max)
+{
+	ASSERT_LOCKED(base);
+	while (base->cache_n > max)
+		evdns_cache_entry_free(base,
+		    TAILQ_LAST(&base->cache_lru, evdns_cache_lru));
+}
+
+/* Remember the outcome of req for ttl seconds: either 'reply', or (if it is
+ * NULL) the error 'err'. */
+static void
+evdns_cache_store(struct request *req, u32 ttl, u32 err,
+    const struct reply *reply)
+{
+	struct evdns_base *base = req->base;
+	struct evdns_cache_entry find, *e;
+	struct timeval now;
+
+	ASSERT_LOCKED(base);
+	if (!base->cache_max || !ttl)
+		return;
+	if (evdns_cache_key(&find, req) < 0)
+		return;
+	if (evutil_gettime_monotonic_(&base->cache_timer, &now) < 0)
+		return;
+
+	e = HT_FIND(evdns_cache_map, &base->cache, &find);
+	if (e) {
+		TAILQ_REMOVE(&base->cache_lru, e, lru);
+	} else {
+		evdns_cache_shrink(base, base->cache_max - 1);
+		if (!(e = mm_malloc(sizeof(*e))))
+			return;
+		e->hash = find.hash;
+		e->type = find.type;
+		e->qname_len = find.qname_len;
+		memcpy(e->qname, find.qname, find.qname_len);
+		HT_INSERT(evdns_cache_map, &base->cache, e);
+		++base->cache_n;
+	}
+	TAILQ_INSERT_HEAD(&base->cache_lru, e, lru);
+
+	e->expires = now;
+	e->expires.tv_sec += ttl;
+	if (reply) {
+		e->err = 0;
+		memcpy(&e->reply, reply, sizeof(*reply));
+	} else {
+		e->err = err;
+	}
+}
+
+/* Return a cache entry that can answer req, and set *ttl_out to the time
+ * it has left; or return NULL if there is none. */
+static struct evdns_cache_entry *
+evdns_cache_lookup(struct evdns_base *base, const struct request *req,
+    u32 *ttl_out)
+{
+	struct evdns_cache_entry find, *e;
+	struct timeval now;
+
+	ASSERT_LOCKED(base);
+	if (!base->cache_n)
+		return NULL;
+	if (evdns_cache_key(&find, req) < 0)
+		return NULL;
+	if (!(e = HT_FIND(evdns_cache_map, &base->cache, &find)))
+		return NULL;
+	if (evutil_gettime_monotonic_(&base->cache_timer, &now) < 0 ||
+	    !evutil_timercmp(&now, &e->expires, <)) {
+		evdns_cache_entry_free(base, e);
+		return NULL;
+	}
+	TAILQ_REMOVE(&base->cache_lru, e, lru);
+	TAILQ_INSERT_HEAD(&base->cache_lru, e, lru);
+	/* Round up, so that we never say 0 for a good answer. */
+	*ttl_out = (u32)(e->expires.tv_sec - now.tv_sec);
+	if (e->expires.tv_usec > now.tv_usec)
+		++*ttl_out;
+	return e;
+}
+
 #define _QR_MASK    0x8000U
 #define _OP_MASK    0x7800U
 #define _AA_MASK    0x0400U
@@ -876,6 +1167,26 @@ reply_schedule_callback(struct request *const req, u32 ttl, u32 err, struct repl
 #define _RCODE_MASK 0x000fU
 #define _Z_MASK_DEPRECATED 0x0070U
 
+/* Give the outcome of req to every request that was waiting for it: either
+ * 'reply', or (if it is NULL) the error 'err'.  If try_next is set,
+ * followers that are searching go on to their next name, as req does. */
+static void
+request_answer_followers(struct request *req, u32 ttl, u32 err,
+    struct reply *reply, int try_next)
+{
+	struct request *follower;
+
+	ASSERT_LOCKED(req->base);
+	while ((follower = req->followers)) {
+		if (!reply && try_next && follower->handle->search_state &&
+		    follower->request_type != TYPE_PTR &&
+		    !search_try_next(follower->handle))
+			continue;
+		reply_schedule_callback(follower, ttl, err, reply);
+		request_finished(follower, &req->followers, 1);
+	}
+}
+
 /* this processes a parsed reply packet */
 static void
 reply_handle(struct request *const req, u16 flags, u32 ttl, struct reply *reply) {
@@ -942,6 +1253,13 @@ reply_handle(struct request *const req, u16 flags, u32 ttl, struct reply *reply)
 			nameserver_up(req->ns);
 		}
 
+		/* The name doesn't exist, or has no records of this type:
+		 * remember that for as long as the SOA record said to. */
+		if (error == DNS_ERR_NOTEXIST || error == DNS_ERR_NODATA)
+			evdns_cache_store(req, ttl, error, NULL);
+
+		request_answer_followers(req, ttl, error, NULL, 1);
+
 		if (req->handle->search_state &&
 		    req->request_type != TYPE_PTR) {
 			/* if we have a list of domains to search in,
@@ -961,6 +1279,8 @@ reply_handle(struct request *const req, u16 flags, u32 ttl, struct reply *reply)
 		request_finished(req, &REQ_HEAD(req->base, req->trans_id), 1);
 	} else {
 		/* all ok, tell the user */
+		evdns_cache_store(req, ttl, 0, reply);
+		request_answer_followers(req, ttl, 0, reply, 0);
 		reply_schedule_callback(req, ttl, 0, reply);
 		if (req->handle == req->ns->probe_request)
 			req->ns->probe_request = NULL; /* Avoid double-free */
@@ -1413,67 +1733,41 @@ nameserver_read(struct nameserver *ns) {
 	}
 }
 
-/* Read a packet from a DNS client on a server port s, parse it, and */
+/* Parse a batch of packets that DNS clients sent to a server port, and */
 /* act accordingly. */
 static void
-server_port_read(struct evdns_server_port *s) {
-	u8 packet[1500];
-	struct sockaddr_storage addr;
-	ev_socklen_t addrlen;
-	int r;
-	ASSERT_LOCKED(s);
+server_port_read_cb(struct evdgram *dgram, struct evdgram_msg *msgs,
+    int n_msgs, void *arg)
+{
+	struct evdns_server_port *port = arg;
+	int i;
+	(void)dgram;
 
-	for (;;) {
-		addrlen = sizeof(struct sockaddr_storage);
-		r = recvfrom(s->socket, (void*)packet, sizeof(packet), 0,
-					 (struct sockaddr*) &addr, &addrlen);
-		if (r < 0) {
-			int err = evutil_socket_geterror(s->socket);
-			if (EVUTIL_ERR_RW_RETRIABLE(err))
-				return;
-			log(EVDNS_LOG_WARN,
-			    "Error %s (%d) while reading request.",
-			    evutil_socket_error_to_string(err), err);
-			return;
-		}
-		request_parse(packet, r, s, (struct sockaddr*) &addr, addrlen);
+	EVDNS_LOCK(port);
+	/* Hold the port, in case a callback closes it. */
+	++port->refcnt;
+	for (i = 0; i < n_msgs && !port->closing; ++i) {
+		if (msgs[i].flags & EVDGRAM_MSG_TRUNCATED)
+			continue;
+		request_parse(msgs[i].data, (int)msgs[i].len, port,
+		    msgs[i].addr, msgs[i].addrlen);
+	}
+	if (--port->refcnt == 0) {
+		EVDNS_UNLOCK(port);
+		server_port_free(port);
+		return;
 	}
+	EVDNS_UNLOCK(port);
 }
 
-/* Try to write all pending replies on a given DNS server port. */
 static void
-server_port_flush(struct evdns_server_port *port)
+server_port_error_cb(struct evdgram *dgram, short what, int err, void *arg)
 {
-	struct server_request *req = port->pending_replies;
-	ASSERT_LOCKED(port);
-	while (req) {
-		int r = sendto(port->socket, req->response, (int)req->response_len, 0,
-			   (struct sockaddr*) &req->addr, (ev_socklen_t)req->addrlen);
-		if (r < 0) {
-			int err = evutil_socket_geterror(port->socket);
-			if (EVUTIL_ERR_RW_RETRIABLE(err))
-				return;
-			log(EVDNS_LOG_WARN, "Error %s (%d) while writing response to port; dropping", evutil_socket_error_to_string(err), err);
-		}
-		if (server_request_free(req)) {
-			/* we released the last reference to req->port. */
-			return;
-		} else {
-			EVUTIL_ASSERT(req != port->pending_replies);
-			req = port->pending_replies;
-		}
-	}
-
-	/* We have no more pending requests; stop listening for 'writeable' events. */
-	(void) event_del(&port->event);
-	event_assign(&port->event, port->event_base,
-				 port->socket, EV_READ | EV_PERSIST,
-				 server_port_ready_callback, port);
-
-	if (event_add(&port->event, NULL) < 0) {
-		log(EVDNS_LOG_WARN, "Error from libevent when adding event for DNS server.");
-		/* ???? Do more? */
-	}
+	(void)dgram;
+	(void)arg;
+	log(EVDNS_LOG_WARN, "Error %s (%d) while %s.",
+	    evutil_socket_error_to_string(err), err,
+	    what == EV_READ ? "reading request" : "writing response; dropping");
 }
 
 /* set if we are waiting for the ability to write to this server. */
@@ -1519,24 +1813,6 @@ nameserver_ready_callback(evutil_socket_t fd, short events, void *arg) {
 	EVDNS_UNLOCK(ns->base);
 }
 
-/* a callback function. Called by libevent when the kernel says that */
-/* a server socket is ready for writing or reading. */
-static void
-server_port_ready_callback(evutil_socket_t fd, short events, void *arg) {
-	struct evdns_server_port *port = (struct evdns_server_port *) arg;
-	(void) fd;
-
-	EVDNS_LOCK(port);
-	if (events & EV_WRITE) {
-		port->choked = 0;
-		server_port_flush(port);
-	}
-	if (events & EV_READ) {
-		server_port_read(port);
-	}
-	EVDNS_UNLOCK(port);
-}
-
 /* This is an inefficient representation; only use it via the dnslabel_table_*
  * functions, so that is can be safely replaced with something smarter later. */
 #define MAX_LABELS 128
@@ -1726,23 +2002,29 @@ evdns_add_server_port_with_base(struct event_base *base, evutil_socket_t socket,
 	memset(port, 0, sizeof(struct evdns_server_port));
 
 
-	port->socket = socket;
 	port->refcnt = 1;
-	port->choked = 0;
 	port->closing = 0;
 	port->user_callback = cb;
 	port->user_data = user_data;
-	port->pending_replies = NULL;
 	port->event_base = base;
 
-	event_assign(&port->event, port->event_base,
-				 port->socket, EV_READ | EV_PERSIST,
-				 server_port_ready_callback, port);
-	if (event_add(&port->event, NULL) < 0) {
+	/* Don't start reading until the lock is there for the read callback
+	 * to take.  The socket is closed in server_port_free() and not by the
+	 * evdgram, so that it stays open if we fail here. */
+	port->dgram = evdgram_new(base, socket,
+	    EVDGRAM_OPT_THREADSAFE|EVDGRAM_OPT_DISABLED,
+	    server_port_read_cb, server_port_error_cb, port);
+	if (!port->dgram) {
 		mm_free(port);
 		return NULL;
 	}
 	EVTHREAD_ALLOC_LOCK(port->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	if (evdgram_enable(port->dgram) < 0) {
+		evdgram_free(port->dgram);
+		EVTHREAD_FREE_LOCK(port->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+		mm_free(port);
+		return NULL;
+	}
 	return port;
 }
 
@@ -1752,6 +2034,49 @@ evdns_add_server_port(evutil_socket_t socket, int flags, evdns_request_callback_
 	return evdns_add_server_port_with_base(NULL, socket, flags, cb, user_data);
 }
 
+/* exported function */
+struct evdns_server_port *
+evdns_add_server_port_bind(struct event_base *base, const struct sockaddr *sa, int socklen, int flags, evdns_request_callback_fn_type cb, void *user_data)
+{
+	struct evdns_server_port *port;
+	evutil_socket_t fd;
+
+	if (flags & ~EVDNS_SERVER_PORT_REUSEPORT)
+		return NULL;
+#if !defined(__linux__) || !defined(SO_REUSEPORT)
+	/* evutil_make_listen_socket_reuseable_port() is a no-op here, and a
+	 * second port on the address would fail to bind. */
+	if (flags & EVDNS_SERVER_PORT_REUSEPORT)
+		return NULL;
+#endif
+
+	fd = socket(sa->sa_family, SOCK_DGRAM, 0);
+	if (fd == EVUTIL_INVALID_SOCKET)
+		return NULL;
+	if (evutil_make_socket_closeonexec(fd) < 0)
+		goto err;
+	if ((flags & EVDNS_SERVER_PORT_REUSEPORT) &&
+	    evutil_make_listen_socket_reuseable_port(fd) < 0)
+		goto err;
+	if (bind(fd, sa, socklen) < 0)
+		goto err;
+
+	port = evdns_add_server_port_with_base(base, fd, 0, cb, user_data);
+	if (!port)
+		goto err;
+	return port;
+err:
+	evutil_closesocket(fd);
+	return NULL;
+}
+
+/* exported function */
+evutil_socket_t
+evdns_server_port_get_fd(struct evdns_server_port *port)
+{
+	return evdgram_get_fd(port->dgram);
+}
+
 /* exported function */
 void
 evdns_close_server_port(struct evdns_server_port *port)
@@ -1761,7 +2086,9 @@ evdns_close_server_port(struct evdns_server_port *port)
 		EVDNS_UNLOCK(port);
 		server_port_free(port);
 	} else {
+		/* Stop taking requests, but answer those we have. */
 		port->closing = 1;
+		evdgram_disable(port->dgram);
 		EVDNS_UNLOCK(port);
 	}
 }
@@ -2010,44 +2337,15 @@ evdns_server_request_respond(struct evdns_server_request *req_, int err)
 			goto done;
 	}
 
-	r = sendto(port->socket, req->response, (int)req->response_len, 0,
-			   (struct sockaddr*) &req->addr, (ev_socklen_t)req->addrlen);
-	if (r<0) {
-		int sock_err = evutil_socket_geterror(port->socket);
-		if (EVUTIL_ERR_RW_RETRIABLE(sock_err))
-			goto done;
-
-		if (port->pending_replies) {
-			req->prev_pending = port->pending_replies->prev_pending;
-			req->next_pending = port->pending_replies;
-			req->prev_pending->next_pending =
-				req->next_pending->prev_pending = req;
-		} else {
-			req->prev_pending = req->next_pending = req;
-			port->pending_replies = req;
-			port->choked = 1;
-
-			(void) event_del(&port->event);
-			event_assign(&port->event, port->event_base, port->socket, (port->closing?0:EV_READ) | EV_WRITE | EV_PERSIST, server_port_ready_callback, port);
-
-			if (event_add(&port->event, NULL) < 0) {
-				log(EVDNS_LOG_WARN, "Error from libevent when adding event for DNS server");
-			}
-
-		}
-
-		r = 1;
-		goto done;
-	}
-	if (server_request_free(req)) {
-		r = 0;
-		goto done;
-	}
-
-	if (port->pending_replies)
-		server_port_flush(port);
-
-	r = 0;
+	/* Replies to requests from one batch are queued, and sent together
+	 * once the whole batch has been handled. */
+	r = evdgram_send(port->dgram, req->response, req->response_len,
+	    (struct sockaddr*) &req->addr, (ev_socklen_t)req->addrlen);
+	if (r < 0)
+		log(EVDNS_LOG_WARN, "Error while writing response to port; dropping");
+	EVDNS_UNLOCK(port);
+	server_request_free(req);
+	return r;
 done:
 	EVDNS_UNLOCK(port);
 	return r;
@@ -2095,12 +2393,6 @@ server_request_free(struct server_request *req)
 	if (req->port) {
 		EVDNS_LOCK(req->port);
 		lock=1;
-		if (req->port->pending_replies == req) {
-			if (req->next_pending && req->next_pending != req)
-				req->port->pending_replies = req->next_pending;
-			else
-				req->port->pending_replies = NULL;
-		}
 		rc = --req->port->refcnt;
 	}
 
@@ -2110,11 +2402,6 @@ server_request_free(struct server_request *req)
 
 	server_request_free_answers(req);
 
-	if (req->next_pending && req->next_pending != req) {
-		req->next_pending->prev_pending = req->prev_pending;
-		req->prev_pending->next_pending = req->next_pending;
-	}
-
 	if (rc == 0) {
 		EVDNS_UNLOCK(req->port); /* ????? nickm */
 		server_port_free(req->port);
@@ -2131,15 +2418,13 @@ server_request_free(struct server_request *req)
 static void
 server_port_free(struct evdns_server_port *port)
 {
+	evutil_socket_t fd;
+
 	EVUTIL_ASSERT(port);
 	EVUTIL_ASSERT(!port->refcnt);
-	EVUTIL_ASSERT(!port->pending_replies);
-	if (port->socket > 0) {
-		evutil_closesocket(port->socket);
-		port->socket = -1;
-	}
-	(void) event_del(&port->event);
-	event_debug_unassign(&port->event);
+	fd = evdgram_get_fd(port->dgram);
+	evdgram_free(port->dgram);
+	evutil_closesocket(fd);
 	EVTHREAD_FREE_LOCK(port->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
 	mm_free(port);
 }
@@ -2185,6 +2470,7 @@ evdns_request_timeout_callback(evutil_socket_t fd, short events, void *arg) {
 		/* this request has failed */
 		log(EVDNS_LOG_DEBUG, "Giving up on request %p; tx_count==%d",
 		    arg, req->tx_count);
+		request_answer_followers(req, 0, DNS_ERR_TIMEOUT, NULL, 0);
 		reply_schedule_callback(req, 0, DNS_ERR_TIMEOUT, NULL);
 
 		request_finished(req, &REQ_HEAD(req->base, req->trans_id), 1);
@@ -2207,6 +2493,45 @@ evdns_request_timeout_callback(evutil_socket_t fd, short events, void *arg) {
 	EVDNS_UNLOCK(base);
 }
 
+/* this is a libevent callback function which is called when we can answer
+ * a request from the cache. */
+static void
+evdns_request_cached_callback(evutil_socket_t fd, short events, void *arg) {
+	struct request *const req = (struct request *) arg;
+	struct evdns_base *base = req->base;
+	struct evdns_cache_entry *e;
+	u32 ttl, err;
+
+	(void) fd;
+	(void) events;
+
+	EVDNS_LOCK(base);
+
+	e = evdns_cache_lookup(base, req, &ttl);
+	if (!e) {
+		/* The answer expired or was evicted after we found it.  Put
+		 * the request in line to be sent after all. */
+		evdns_request_remove(req, &base->req_cached_head);
+		request_requeue(req);
+		evdns_requests_pump_waiting_queue(base);
+	} else if (!e->err) {
+		reply_schedule_callback(req, ttl, 0, &e->reply);
+		request_finished(req, &base->req_cached_head, 1);
+	} else {
+		err = e->err;
+		if (req->handle && req->handle->search_state &&
+		    req->request_type != TYPE_PTR &&
+		    !search_try_next(req->handle)) {
+			/* a new request was issued for the next name */
+		} else {
+			reply_schedule_callback(req, ttl, err, NULL);
+			request_finished(req, &base->req_cached_head, 1);
+		}
+	}
+
+	EVDNS_UNLOCK(base);
+}
+
 /* try to send a request to a given server. */
 /* */
 /* return: */
@@ -2836,8 +3161,38 @@ err1:
 static void
 request_submit(struct request *const req) {
 	struct evdns_base *base = req->base;
+	int probe = req->ns && req->ns->probe_request == req->handle;
+	int have_key = !probe && request_question_key(req) == 0;
+	struct request *leader = NULL;
+	u32 ttl;
 	ASSERT_LOCKED(base);
 	ASSERT_VALID_REQUEST(req);
+	if (have_key)
+		leader = HT_FIND(evdns_question_map,
+		    &base->inflight_questions, req);
+
+	if (!probe && evdns_cache_lookup(base, req, &ttl)) {
+		/* We can answer this from the cache.  Do so from the event
+		 * loop, once our caller is done setting the request up. */
+		req->from_cache = 1;
+		evdns_request_insert(req, &base->req_cached_head);
+		evtimer_assign(&req->timeout_event, base->event_base,
+		    evdns_request_cached_callback, req);
+		event_active(&req->timeout_event, EV_TIMEOUT, 1);
+		return;
+	}
+	if (leader) {
+		/* Somebody is already asking this question: wait for their
+		 * answer rather than asking again. */
+		req->leader = leader;
+		evdns_request_insert(req, &leader->followers);
+		return;
+	}
+
+	if (have_key) {
+		HT_INSERT(evdns_question_map, &base->inflight_questions, req);
+		req->coalesced = 1;
+	}
 	if (req->ns) {
 		/* if it has a nameserver assigned then this is going */
 		/* straight into the inflight queue */
@@ -2879,13 +3234,7 @@ evdns_cancel_request(struct evdns_base *base, struct evdns_request *handle)
 	ASSERT_VALID_REQUEST(req);
 
 	reply_schedule_callback(req, 0, DNS_ERR_CANCEL, NULL);
-	if (req->ns) {
-		/* remove from inflight queue */
-		request_finished(req, &REQ_HEAD(base, req->trans_id), 1);
-	} else {
-		/* remove from global_waiting head */
-		request_finished(req, &base->req_waiting_head, 1);
-	}
+	request_finished(req, request_list(req), 1);
 	EVDNS_UNLOCK(base);
 }
 
@@ -3301,7 +3650,7 @@ search_try_next(struct evdns_request *const handle) {
 	return 1;
 
 submit_next:
-	request_finished(req, &REQ_HEAD(req->base, req->trans_id), 0);
+	request_finished(req, request_list(req), 0);
 	handle->current_req = newreq;
 	newreq->handle = handle;
 	request_submit(newreq);
@@ -3521,6 +3870,13 @@ evdns_base_set_option_impl(struct evdns_base *base,
 			(struct sockaddr*)&base->global_outgoing_address, &len))
 			return -1;
 		base->global_outgoing_addrlen = len;
+	} else if (str_matches_option(option, "cache-size:")) {
+		const int cache_size = strtoint(val);
+		if (cache_size == -1) return -1;
+		if (!(flags & DNS_OPTION_MISC)) return 0;
+		log(EVDNS_LOG_DEBUG, "Setting cache size to %d", cache_size);
+		base->cache_max = cache_size;
+		evdns_cache_shrink(base, cache_size);
 	} else if (str_matches_option(option, "initial-probe-timeout:")) {
 		struct timeval tv;
 		if (evdns_strtotimeval(val, &tv) == -1) return -1;
@@ -3975,6 +4331,11 @@ evdns_base_new(struct event_base *event_base, int flags)
 
 	TAILQ_INIT(&base->hostsdb);
 
+	HT_INIT(evdns_cache_map, &base->cache);
+	HT_INIT(evdns_question_map, &base->inflight_questions);
+	TAILQ_INIT(&base->cache_lru);
+	evutil_configure_monotonic_time_(&base->cache_timer, 0);
+
 #define EVDNS_BASE_ALL_FLAGS ( \
 	EVDNS_BASE_INITIALIZE_NAMESERVERS | \
 	EVDNS_BASE_DISABLE_WHEN_INACTIVE  | \
@@ -4075,6 +4436,21 @@ evdns_base_free_and_unlock(struct evdns_base *base, int fail_requests)
 
 	/* TODO(nickm) we might need to refcount here. */
 
+	/* Finish the followers first, so that finishing their leaders
+	 * doesn't send them. */
+	{
+		struct request **leaderp, *leader;
+		HT_FOREACH(leaderp, evdns_question_map,
+		    &base->inflight_questions) {
+			leader = *leaderp;
+			while (leader->followers) {
+				if (fail_requests)
+					reply_schedule_callback(leader->followers, 0, DNS_ERR_SHUTDOWN, NULL);
+				request_finished(leader->followers, &leader->followers, 1);
+			}
+		}
+	}
+
 	for (i = 0; i < base->n_req_heads; ++i) {
 		while (base->req_heads[i]) {
 			if (fail_requests)
@@ -4087,8 +4463,17 @@ evdns_base_free_and_unlock(struct evdns_base *base, int fail_requests)
 			reply_schedule_callback(base->req_waiting_head, 0, DNS_ERR_SHUTDOWN, NULL);
 		request_finished(base->req_waiting_head, &base->req_waiting_head, 1);
 	}
+	while (base->req_cached_head) {
+		if (fail_requests)
+			reply_schedule_callback(base->req_cached_head, 0, DNS_ERR_SHUTDOWN, NULL);
+		request_finished(base->req_cached_head, &base->req_cached_head, 1);
+	}
 	base->global_requests_inflight = base->global_requests_waiting = 0;
 
+	evdns_cache_shrink(base, 0);
+	HT_CLEAR(evdns_cache_map, &base->cache);
+	HT_CLEAR(evdns_question_map, &base->inflight_questions);
+
 	for (server = base->server_head; server; server = server_next) {
 		server_next = server->next;
 		/** already done something before */
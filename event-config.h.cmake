@@ -166,6 +166,10 @@
 /* Define to 1 if you have the <inttypes.h> header file. */
 #cmakedefine EVENT__HAVE_INTTYPES_H 1
 
+/* Define if your system supports io_uring and the kernel headers are
+   recent enough for us to use it */
+#cmakedefine EVENT__HAVE_IO_URING 1
+
 /* Define to 1 if you have the `issetugid' function. */
 #cmakedefine EVENT__HAVE_ISSETUGID 1
 
@@ -175,6 +179,12 @@
 /* Define if the system has zlib */
 #cmakedefine EVENT__HAVE_LIBZ 1
 
+/* Define to 1 if you have the <linux/errqueue.h> header file. */
+#cmakedefine EVENT__HAVE_LINUX_ERRQUEUE_H 1
+
+/* Define to 1 if you have the <linux/io_uring.h> header file. */
+#cmakedefine EVENT__HAVE_LINUX_IO_URING_H 1
+
 /* Define to 1 if you have the `mach_absolute_time' function. */
 #cmakedefine EVENT__HAVE_MACH_ABSOLUTE_TIME 1
 
@@ -235,6 +245,9 @@
 /* Define to 1 if you have the `putenv' function. */
 #cmakedefine EVENT__HAVE_PUTENV 1
 
+/* Define to 1 if you have the `recvmmsg' function. */
+#cmakedefine EVENT__HAVE_RECVMMSG 1
+
 /* Define to 1 if the system has the type `sa_family_t'. */
 #cmakedefine EVENT__HAVE_SA_FAMILY_T 1
 
@@ -253,6 +266,9 @@
 /* Define to 1 if you have the `sendfile' function. */
 #cmakedefine EVENT__HAVE_SENDFILE 1
 
+/* Define to 1 if you have the `sendmmsg' function. */
+#cmakedefine EVENT__HAVE_SENDMMSG 1
+
 /* Define to 1 if you have the `sigaction' function. */
 #cmakedefine EVENT__HAVE_SIGACTION 1
 
@@ -298,6 +314,9 @@
 /* Define to 1 if the system has the type `struct addrinfo'. */
 #cmakedefine EVENT__HAVE_STRUCT_ADDRINFO 1
 
+/* Define to 1 if the system has the type `struct io_uring_buf_reg'. */
+#cmakedefine EVENT__HAVE_STRUCT_IO_URING_BUF_REG 1
+
 /* Define to 1 if the system has the type `struct in6_addr'. */
 #cmakedefine EVENT__HAVE_STRUCT_IN6_ADDR 1
 
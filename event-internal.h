@@ -39,6 +39,7 @@ extern "C" {
 #include <sys/queue.h>
 #include "event2/event_struct.h"
 #include "minheap-internal.h"
+#include "timerwheel-internal.h"
 #include "evsignal-internal.h"
 #include "mm-internal.h"
 #include "defer-internal.h"
@@ -333,6 +334,9 @@ struct event_base {
 
 	/** Priority queue of events with timeouts. */
 	struct min_heap timeheap;
+	/** If set, events with (non-common) timeouts go in this timing wheel
+	 * instead of timeheap. */
+	struct timer_wheel *timerwheel;
 
 	/** Stored timeval: used to avoid calling gettimeofday/clock_gettime
 	 * too often. */
@@ -385,6 +389,10 @@ struct event_base {
 	struct event th_notify;
 	/** A function used to wake up the main thread from another thread. */
 	int (*th_notify_fn)(struct event_base *base);
+	/** Activations that other threads have made without taking
+	 * th_base_lock, or NULL if the base has no inbox.  Filled with atomic
+	 * operations; only drained with th_base_lock held. */
+	struct event_inbox *inbox;
 
 	/** Saved seed for weak random number generator. Some backends use
 	 * this to produce fairness among sockets. Protected by th_base_lock. */
@@ -395,6 +403,18 @@ struct event_base {
 
 	/** "Prepare" and "check" watchers. */
 	struct evwatch_list watchers[EVWATCH_MAX];
+
+	/** Freed evbuffer chains kept for reuse, or NULL if
+	 * event_base_set_evbuffer_cache() was never called. */
+	struct evbuffer_chain_cache *evbuffer_cache;
+
+	/** The chain that socket bufferevents with BEV_OPT_SHARED_READ_BUFFER
+	 * read into, when it isn't lent to one of them, or NULL. */
+	struct evbuffer_chain *shared_read_chain;
+
+	/** MSG_ZEROCOPY sends from freed evbuffers that the kernel hasn't
+	 * reported finished yet.  Protected by th_base_lock. */
+	LIST_HEAD(evbuffer_zerocopy_list, evbuffer_zerocopy) zerocopy_orphans;
 };
 
 struct event_config_entry {
@@ -523,6 +543,14 @@ void event_base_assert_ok_nolock_(struct event_base *base);
 int event_base_foreach_event_nolock_(struct event_base *base,
     event_base_foreach_event_cb cb, void *arg);
 
+/* Drop a reference to an evbuffer chain cache, freeing it and the chains in
+ * it if that was the last one.  Defined in buffer.c. */
+void evbuffer_chain_cache_decref_(struct evbuffer_chain_cache *cache);
+
+/* Let go of the MSG_ZEROCOPY sends that base holds for freed evbuffers,
+ * whether the kernel is done with them or not.  Defined in buffer.c. */
+void evbuffer_zerocopy_orphans_free_(struct event_base *base);
+
 /* Cleanup function to reset debug mode during shutdown.
  *
  * Calling this function doesn't mean it'll be possible to re-enable
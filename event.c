@@ -90,6 +90,9 @@ extern const struct eventop pollops;
 #ifdef EVENT__HAVE_EPOLL
 extern const struct eventop epollops;
 #endif
+#ifdef EVENT__HAVE_IO_URING
+extern const struct eventop uringops;
+#endif
 #ifdef EVENT__HAVE_WORKING_KQUEUE
 extern const struct eventop kqops;
 #endif
@@ -111,6 +114,9 @@ static const struct eventop *eventops[] = {
 #ifdef EVENT__HAVE_EPOLL
 	&epollops,
 #endif
+#ifdef EVENT__HAVE_IO_URING
+	&uringops,
+#endif
 #ifdef EVENT__HAVE_DEVPOLL
 	&devpollops,
 #endif
@@ -166,6 +172,47 @@ static inline void	event_persist_closure(struct event_base *, struct event *ev);
 
 static int	evthread_notify_base(struct event_base *base);
 
+/* Activations from threads other than the one running the loop go through
+ * a lock-free inbox when we have atomic operations to build it with. */
+#if !defined(EVENT__DISABLE_THREAD_SUPPORT) && defined(__GNUC__)
+#define USE_INBOX
+/* The inbox is a bounded queue; when it is full, activations fall back to
+ * taking the lock.  This must be a power of two. */
+#define EVENT_INBOX_SIZE 256
+struct event_inbox_cell {
+	/* The position this cell is next written at, plus one once it has
+	 * been written there. */
+	size_t seq;
+	struct event *ev;
+	int res;
+};
+struct event_inbox {
+	/* The next position that a producer will claim. */
+	size_t tail;
+	/* The next position that the loop will drain.  Protected by
+	 * th_base_lock. */
+	size_t head;
+	/* Set once the loop has been woken to drain the inbox. */
+	int notified;
+	struct event_inbox_cell cells[EVENT_INBOX_SIZE];
+};
+static int	event_active_via_inbox_(struct event *ev, int res);
+static void	event_base_drain_inbox_(struct event_base *base);
+/* True if some thread has claimed a place in base's inbox that the loop
+ * hasn't drained yet.  Requires th_base_lock. */
+#define EVENT_BASE_INBOX_PENDING(base)					\
+	((base)->inbox &&						\
+	    __atomic_load_n(&(base)->inbox->tail, __ATOMIC_RELAXED) !=	\
+	    (base)->inbox->head)
+#define EVENT_BASE_DRAIN_INBOX(base) do {				\
+		if (EVENT_BASE_INBOX_PENDING(base))			\
+			event_base_drain_inbox_(base);			\
+	} while (0)
+#else
+#define EVENT_BASE_INBOX_PENDING(base) 0
+#define EVENT_BASE_DRAIN_INBOX(base) ((void)0)
+#endif
+
 static void insert_common_timeout_inorder(struct common_timeout_list *ctl,
     struct event *ev);
 
@@ -643,6 +690,23 @@ event_base_new_with_config(const struct event_config *cfg)
 
 	min_heap_ctor_(&base->timeheap);
 
+	if (should_check_environment &&
+	    evutil_getenv_("EVENT_TIMER_WHEEL") != NULL)
+		base->flags |= EVENT_BASE_FLAG_TIMER_WHEEL;
+	if (base->flags & EVENT_BASE_FLAG_TIMER_WHEEL) {
+		struct timeval now;
+		ev_uint32_t tick_usec =
+		    (base->flags & EVENT_BASE_FLAG_PRECISE_TIMER) ? 1 : 1000;
+		base->timerwheel = mm_malloc(sizeof(struct timer_wheel));
+		if (base->timerwheel == NULL) {
+			event_warn("%s: malloc", __func__);
+			event_base_free(base);
+			return NULL;
+		}
+		gettime(base, &now);
+		timer_wheel_ctor_(base->timerwheel, tick_usec, &now);
+	}
+
 	base->sig.ev_signal_pair[0] = -1;
 	base->sig.ev_signal_pair[1] = -1;
 	base->th_notify_fd[0] = -1;
@@ -864,6 +928,12 @@ event_base_free_(struct event_base *base, int run_finalizers)
 	event_base_stop_iocp_(base);
 #endif
 
+	/* Anything activated from another thread gets freed like any other
+	 * active event. */
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	EVENT_BASE_DRAIN_INBOX(base);
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
 	/* threading fds if we have them */
 	if (base->th_notify_fd[0] != -1) {
 		event_del(&base->th_notify);
@@ -882,6 +952,12 @@ event_base_free_(struct event_base *base, int run_finalizers)
 		event_del(ev);
 		++n_deleted;
 	}
+	if (base->timerwheel) {
+		while ((ev = timer_wheel_any_(base->timerwheel)) != NULL) {
+			event_del(ev);
+			++n_deleted;
+		}
+	}
 	for (i = 0; i < base->n_common_timeouts; ++i) {
 		struct common_timeout_list *ctl =
 		    base->common_timeout_queues[i];
@@ -927,6 +1003,7 @@ event_base_free_(struct event_base *base, int run_finalizers)
 		LIST_REMOVE(eonce, next_once);
 		mm_free(eonce);
 	}
+	evbuffer_zerocopy_orphans_free_(base);
 
 	if (base->evsel != NULL && base->evsel->dealloc != NULL)
 		base->evsel->dealloc(base);
@@ -936,6 +1013,10 @@ event_base_free_(struct event_base *base, int run_finalizers)
 
 	EVUTIL_ASSERT(min_heap_empty_(&base->timeheap));
 	min_heap_dtor_(&base->timeheap);
+	if (base->timerwheel) {
+		EVUTIL_ASSERT(timer_wheel_empty_(base->timerwheel));
+		mm_free(base->timerwheel);
+	}
 
 	mm_free(base->activequeues);
 
@@ -955,6 +1036,16 @@ event_base_free_(struct event_base *base, int run_finalizers)
 		}
 	}
 
+	if (base->evbuffer_cache)
+		evbuffer_chain_cache_decref_(base->evbuffer_cache);
+	if (base->shared_read_chain)
+		mm_free(base->shared_read_chain);
+
+#ifdef USE_INBOX
+	if (base->inbox)
+		mm_free(base->inbox);
+#endif
+
 	/* If we're freeing current_base, there won't be a current_base. */
 	if (base == current_base)
 		current_base = NULL;
@@ -1312,6 +1403,7 @@ event_base_get_num_events(struct event_base *base, unsigned int type)
 	int r = 0;
 
 	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	EVENT_BASE_DRAIN_INBOX(base);
 
 	if (type & EVENT_BASE_COUNT_ACTIVE)
 		r += base->event_count_active;
@@ -1333,6 +1425,7 @@ event_base_get_max_events(struct event_base *base, unsigned int type, int clear)
 	int r = 0;
 
 	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	EVENT_BASE_DRAIN_INBOX(base);
 
 	if (type & EVENT_BASE_COUNT_ACTIVE) {
 		r += base->event_count_active_max;
@@ -1419,6 +1512,21 @@ event_signal_closure(struct event_base *base, struct event *ev)
 #define COMMON_TIMEOUT_IDX(tv) \
 	(((tv)->tv_usec & COMMON_TIMEOUT_IDX_MASK)>>COMMON_TIMEOUT_IDX_SHIFT)
 
+/** Carry tv's microseconds into its seconds, so that 0 <= tv_usec <
+ * 1000000. */
+static inline void
+timeval_normalize(struct timeval *tv)
+{
+	if (tv->tv_usec >= 0 && tv->tv_usec < 1000000)
+		return;
+	tv->tv_sec += tv->tv_usec / 1000000;
+	tv->tv_usec %= 1000000;
+	if (tv->tv_usec < 0) {
+		tv->tv_usec += 1000000;
+		--tv->tv_sec;
+	}
+}
+
 /** Return true iff if 'tv' is a common timeout in 'base' */
 static inline int
 is_common_timeout(const struct timeval *tv,
@@ -1985,6 +2093,8 @@ event_base_loop(struct event_base *base, int flags)
 			break;
 		}
 
+		EVENT_BASE_DRAIN_INBOX(base);
+
 		tv_p = &tv;
 		if (!N_ACTIVE_CALLBACKS(base) && !(flags & EVLOOP_NONBLOCK)) {
 			timeout_next(base, &tv_p);
@@ -1996,9 +2106,12 @@ event_base_loop(struct event_base *base, int flags)
 			evutil_timerclear(&tv);
 		}
 
-		/* If we have no events, we just exit */
+		/* If we have no events, we just exit.  An activation that
+		 * another thread queued since we drained the inbox counts:
+		 * its producer will wake us up to drain it. */
 		if (0==(flags&EVLOOP_NO_EXIT_ON_EMPTY) &&
-		    !event_haveevents(base) && !N_ACTIVE_CALLBACKS(base)) {
+		    !event_haveevents(base) && !N_ACTIVE_CALLBACKS(base) &&
+		    !EVENT_BASE_INBOX_PENDING(base)) {
 			event_debug(("%s: no events registered.", __func__));
 			retval = 1;
 			goto done;
@@ -2027,6 +2140,8 @@ event_base_loop(struct event_base *base, int flags)
 
 		update_time_cache(base);
 
+		EVENT_BASE_DRAIN_INBOX(base);
+
 		/* Invoke check watchers after polling for events, and before
 		 * processing them */
 		TAILQ_FOREACH(watcher, &base->watchers[EVWATCH_CHECK], next) {
@@ -2051,6 +2166,7 @@ event_base_loop(struct event_base *base, int flags)
 done:
 	clear_time_cache(base);
 	base->running_loop = 0;
+	EVENT_BASE_DRAIN_INBOX(base);
 
 	EVBASE_RELEASE_LOCK(base, th_base_lock);
 
@@ -2415,6 +2531,7 @@ event_pending(const struct event *ev, short event, struct timeval *tv)
 
 	EVBASE_ACQUIRE_LOCK(ev->ev_base, th_base_lock);
 	event_debug_assert_is_setup_(ev);
+	EVENT_BASE_DRAIN_INBOX(ev->ev_base);
 
 	if (ev->ev_flags & EVLIST_INSERTED)
 		flags |= (ev->ev_events & (EV_READ|EV_WRITE|EV_CLOSED|EV_SIGNAL));
@@ -2657,7 +2774,8 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 	 * prepare for timeout insertion further below, if we get a
 	 * failure on any step, we should not change any state.
 	 */
-	if (tv != NULL && !(ev->ev_flags & EVLIST_TIMEOUT)) {
+	if (tv != NULL && !(ev->ev_flags & EVLIST_TIMEOUT) &&
+	    !base->timerwheel) {
 		if (min_heap_reserve_(&base->timeheap,
 			1 + min_heap_size_(&base->timeheap)) == -1)
 			return (-1);  /* ENOMEM == errno */
@@ -2755,6 +2873,10 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 		} else {
 			evutil_timeradd(&now, tv, &ev->ev_timeout);
 		}
+		/* The timeout queues need tv_usec within [0, 1000000), and
+		 * the caller's timeval might not have had it. */
+		if (!common_timeout)
+			timeval_normalize(&ev->ev_timeout);
 
 		event_debug((
 			 "event_add: event %p, timeout in %d seconds %d useconds, call %p",
@@ -2772,6 +2894,10 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 			if (ev == TAILQ_FIRST(&ctl->events)) {
 				common_timeout_schedule(ctl, &now, ev);
 			}
+		} else if (base->timerwheel) {
+			/* The main thread might be waiting for a later tick. */
+			if (timer_wheel_wakes_late_(base->timerwheel, ev))
+				notify = 1;
 		} else {
 			struct event* top = NULL;
 			/* See if the earliest timeout is now earlier than it
@@ -2853,6 +2979,10 @@ event_del_nolock_(struct event *ev, int blocking)
 
 	EVENT_BASE_ASSERT_LOCKED(ev->ev_base);
 
+	/* Make sure no activation from another thread is still on its way
+	 * to the base. */
+	EVENT_BASE_DRAIN_INBOX(ev->ev_base);
+
 	if (blocking != EVENT_DEL_EVEN_IF_FINALIZING) {
 		if (ev->ev_flags & EVLIST_FINALIZING) {
 			/* XXXX Debug */
@@ -2937,6 +3067,11 @@ event_active(struct event *ev, int res, short ncalls)
 		return;
 	}
 
+#ifdef USE_INBOX
+	if (event_active_via_inbox_(ev, res))
+		return;
+#endif
+
 	EVBASE_ACQUIRE_LOCK(ev->ev_base, th_base_lock);
 
 	event_debug_assert_is_setup_(ev);
@@ -2946,6 +3081,86 @@ event_active(struct event *ev, int res, short ncalls)
 	EVBASE_RELEASE_LOCK(ev->ev_base, th_base_lock);
 }
 
+#ifdef USE_INBOX
+/* Try to activate ev from a thread other than the one running its base's
+ * loop without taking th_base_lock, by queueing the activation in the
+ * base's inbox.  Only the thread that finds the loop not yet woken wakes
+ * it.  Return 1 if we did so, or 0 if the caller needs to take the lock. */
+static int
+event_active_via_inbox_(struct event *ev, int res)
+{
+	struct event_base *base = ev->ev_base;
+	struct event_inbox *inbox;
+	struct event_inbox_cell *cell;
+	size_t pos, seq;
+
+	/* Signal events need ev_ncalls and may need to wait for their
+	 * callback to finish; leave those to the locked path, along with
+	 * bases that aren't running a loop in some other thread. */
+	inbox = __atomic_load_n(&base->inbox, __ATOMIC_ACQUIRE);
+	if (!inbox || !base->th_notify_fn || !res ||
+	    (ev->ev_events & EV_SIGNAL) ||
+	    !__atomic_load_n(&base->running_loop, __ATOMIC_RELAXED) ||
+	    __atomic_load_n(&base->th_owner_id, __ATOMIC_RELAXED) ==
+	    EVTHREAD_GET_ID())
+		return 0;
+
+	event_debug_assert_is_setup_(ev);
+
+	pos = __atomic_load_n(&inbox->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		cell = &inbox->cells[pos & (EVENT_INBOX_SIZE - 1)];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&inbox->tail, &pos,
+				pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((ev_ssize_t)(seq - pos) < 0) {
+			/* The loop hasn't drained this cell since the last
+			 * time around: the inbox is full. */
+			return 0;
+		} else {
+			pos = __atomic_load_n(&inbox->tail, __ATOMIC_RELAXED);
+		}
+	}
+	cell->ev = ev;
+	cell->res = res;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	if (!__atomic_exchange_n(&inbox->notified, 1, __ATOMIC_ACQ_REL))
+		base->th_notify_fn(base);
+	return 1;
+}
+
+/* Activate everything in the inbox, in the order it was queued. */
+static void
+event_base_drain_inbox_(struct event_base *base)
+{
+	struct event_inbox *inbox = base->inbox;
+	struct event_inbox_cell *cell;
+	struct event *ev;
+	int res;
+
+	EVENT_BASE_ASSERT_LOCKED(base);
+
+	/* A producer that fills a cell after we stop looking will find this
+	 * cleared, and wake us again. */
+	__atomic_exchange_n(&inbox->notified, 0, __ATOMIC_ACQ_REL);
+	for (;;) {
+		cell = &inbox->cells[inbox->head & (EVENT_INBOX_SIZE - 1)];
+		if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) !=
+		    inbox->head + 1)
+			break;
+		ev = cell->ev;
+		res = cell->res;
+		__atomic_store_n(&cell->seq, inbox->head + EVENT_INBOX_SIZE,
+		    __ATOMIC_RELEASE);
+		++inbox->head;
+		event_active_nolock_(ev, res, 1);
+	}
+}
+#endif
+
 
 void
 event_active_nolock_(struct event *ev, int res, short ncalls)
@@ -3171,6 +3386,34 @@ event_deferred_cb_schedule_(struct event_base *base, struct event_callback *cb)
 	return r;
 }
 
+/* Like timeout_next, for a base that uses a timing wheel. */
+static int
+timeout_next_wheel(struct event_base *base, struct timeval **tv_p)
+{
+	/* Caller must hold th_base_lock */
+	struct timeval now, when;
+	struct timeval *tv = *tv_p;
+
+	if (timer_wheel_next_(base->timerwheel, &when) < 0) {
+		/* if no time-based events are active wait for I/O */
+		*tv_p = NULL;
+		return 0;
+	}
+
+	if (gettime(base, &now) == -1)
+		return -1;
+
+	if (evutil_timercmp(&when, &now, <=)) {
+		evutil_timerclear(tv);
+		return 0;
+	}
+
+	evutil_timersub(&when, &now, tv);
+	event_debug(("timeout_next: timing wheel, in %d seconds, %d useconds",
+		(int)tv->tv_sec, (int)tv->tv_usec));
+	return 0;
+}
+
 static int
 timeout_next(struct event_base *base, struct timeval **tv_p)
 {
@@ -3180,6 +3423,9 @@ timeout_next(struct event_base *base, struct timeval **tv_p)
 	struct timeval *tv = *tv_p;
 	int res = 0;
 
+	if (base->timerwheel)
+		return timeout_next_wheel(base, tv_p);
+
 	ev = min_heap_top_(&base->timeheap);
 
 	if (ev == NULL) {
@@ -3216,6 +3462,20 @@ timeout_process(struct event_base *base)
 	struct timeval now;
 	struct event *ev;
 
+	if (base->timerwheel) {
+		if (timer_wheel_empty_(base->timerwheel))
+			return;
+		gettime(base, &now);
+		timer_wheel_expire_(base->timerwheel, &now);
+		while ((ev = timer_wheel_first_expired_(base->timerwheel))) {
+			event_del_nolock_(ev, EVENT_DEL_NOBLOCK);
+			event_debug(("timeout_process: event: %p, call %p",
+				 ev, ev->ev_callback));
+			event_active_nolock_(ev, EV_TIMEOUT, 1);
+		}
+		return;
+	}
+
 	if (min_heap_empty_(&base->timeheap)) {
 		return;
 	}
@@ -3312,6 +3572,8 @@ event_queue_remove_timeout(struct event_base *base, struct event *ev)
 		    get_common_timeout_list(base, &ev->ev_timeout);
 		TAILQ_REMOVE(&ctl->events, ev,
 		    ev_timeout_pos.ev_next_with_common_timeout);
+	} else if (base->timerwheel) {
+		timer_wheel_erase_(base->timerwheel, ev);
 	} else {
 		min_heap_erase_(&base->timeheap, ev);
 	}
@@ -3341,15 +3603,26 @@ event_queue_reinsert_timeout(struct event_base *base, struct event *ev,
 		ctl = base->common_timeout_queues[old_timeout_idx];
 		TAILQ_REMOVE(&ctl->events, ev,
 		    ev_timeout_pos.ev_next_with_common_timeout);
-		min_heap_push_(&base->timeheap, ev);
+		if (base->timerwheel)
+			timer_wheel_push_(base->timerwheel, ev);
+		else
+			min_heap_push_(&base->timeheap, ev);
 		break;
 	case 1: /* Wasn't common; has become common. */
-		min_heap_erase_(&base->timeheap, ev);
+		if (base->timerwheel)
+			timer_wheel_erase_(base->timerwheel, ev);
+		else
+			min_heap_erase_(&base->timeheap, ev);
 		ctl = get_common_timeout_list(base, &ev->ev_timeout);
 		insert_common_timeout_inorder(ctl, ev);
 		break;
 	case 0: /* was in heap; is still on heap. */
-		min_heap_adjust_(&base->timeheap, ev);
+		if (base->timerwheel) {
+			timer_wheel_erase_(base->timerwheel, ev);
+			timer_wheel_push_(base->timerwheel, ev);
+		} else {
+			min_heap_adjust_(&base->timeheap, ev);
+		}
 		break;
 	default:
 		EVUTIL_ASSERT(0); /* unreachable */
@@ -3462,6 +3735,8 @@ event_queue_insert_timeout(struct event_base *base, struct event *ev)
 		struct common_timeout_list *ctl =
 		    get_common_timeout_list(base, &ev->ev_timeout);
 		insert_common_timeout_inorder(ctl, ev);
+	} else if (base->timerwheel) {
+		timer_wheel_push_(base->timerwheel, ev);
 	} else {
 		min_heap_push_(&base->timeheap, ev);
 	}
@@ -3670,6 +3945,20 @@ evthread_make_base_notifiable_nolock_(struct event_base *base)
 		return 0;
 	}
 
+#ifdef USE_INBOX
+	if (!base->inbox && base->th_base_lock) {
+		/* Without an inbox, other threads just take the lock. */
+		struct event_inbox *inbox = mm_calloc(1, sizeof(*inbox));
+		if (inbox) {
+			size_t i;
+			for (i = 0; i < EVENT_INBOX_SIZE; ++i)
+				inbox->cells[i].seq = i;
+			__atomic_store_n(&base->inbox, inbox,
+			    __ATOMIC_RELEASE);
+		}
+	}
+#endif
+
 #if defined(EVENT__HAVE_WORKING_KQUEUE)
 	if (base->evsel == &kqops && event_kq_add_notify_event_(base) == 0) {
 		base->th_notify_fn = event_kq_notify_base_;
@@ -3716,6 +4005,8 @@ event_base_foreach_event_nolock_(struct event_base *base,
 	size_t u;
 	struct event *ev;
 
+	EVENT_BASE_DRAIN_INBOX(base);
+
 	/* Start out with all the EVLIST_INSERTED events. */
 	if ((r = evmap_foreach_event_(base, fn, arg)))
 		return r;
@@ -3723,7 +4014,7 @@ event_base_foreach_event_nolock_(struct event_base *base,
 	/* Okay, now we deal with those events that have timeouts and are in
 	 * the min-heap. */
 	for (u = 0; u < base->timeheap.n; ++u) {
-		ev = base->timeheap.p[u];
+		ev = min_heap_get_(&base->timeheap, u);
 		if (ev->ev_flags & EVLIST_INSERTED) {
 			/* we already processed this one */
 			continue;
@@ -3732,6 +4023,20 @@ event_base_foreach_event_nolock_(struct event_base *base,
 			return r;
 	}
 
+	/* ... or in the timing wheel. */
+	if (base->timerwheel) {
+		for (i = 0; i < TIMER_WHEEL_N_LISTS; ++i) {
+			struct timer_wheel_list *l =
+			    timer_wheel_list_(base->timerwheel, i);
+			LIST_FOREACH(ev, l, ev_timeout_pos.ev_next_in_timer_wheel) {
+				if (ev->ev_flags & EVLIST_INSERTED)
+					continue;
+				if ((r = fn(base, ev, arg)))
+					return r;
+			}
+		}
+	}
+
 	/* Now for the events in one of the timeout queues.
 	 * the min-heap. */
 	for (i = 0; i < base->n_common_timeouts; ++i) {
@@ -3870,12 +4175,24 @@ event_base_active_by_fd(struct event_base *base, evutil_socket_t fd, short event
 		struct event *ev;
 
 		for (u = 0; u < base->timeheap.n; ++u) {
-			ev = base->timeheap.p[u];
+			ev = min_heap_get_(&base->timeheap, u);
 			if (ev->ev_fd == fd) {
 				event_active_nolock_(ev, EV_TIMEOUT, 1);
 			}
 		}
 
+		if (base->timerwheel) {
+			for (i = 0; i < TIMER_WHEEL_N_LISTS; ++i) {
+				LIST_FOREACH(ev,
+				    timer_wheel_list_(base->timerwheel, i),
+				    ev_timeout_pos.ev_next_in_timer_wheel) {
+					if (ev->ev_fd == fd) {
+						event_active_nolock_(ev, EV_TIMEOUT, 1);
+					}
+				}
+			}
+		}
+
 		for (i = 0; i < base->n_common_timeouts; ++i) {
 			struct common_timeout_list *ctl = base->common_timeout_queues[i];
 			TAILQ_FOREACH(ev, &ctl->events,
@@ -4004,13 +4321,29 @@ event_base_assert_ok_nolock_(struct event_base *base)
 
 	/* Check the heap property */
 	for (u = 1; u < base->timeheap.n; ++u) {
-		size_t parent = (u - 1) / 2;
+		size_t parent = (u - 1) / MIN_HEAP_ARITY;
 		struct event *ev, *p_ev;
-		ev = base->timeheap.p[u];
-		p_ev = base->timeheap.p[parent];
+		ev = min_heap_get_(&base->timeheap, u);
+		p_ev = min_heap_get_(&base->timeheap, parent);
 		EVUTIL_ASSERT(ev->ev_flags & EVLIST_TIMEOUT);
 		EVUTIL_ASSERT(evutil_timercmp(&p_ev->ev_timeout, &ev->ev_timeout, <=));
 		EVUTIL_ASSERT(ev->ev_timeout_pos.min_heap_idx == u);
+		EVUTIL_ASSERT(base->timeheap.p[u].key == min_heap_key_(ev));
+	}
+
+	/* Check that everything in the timing wheel belongs there */
+	if (base->timerwheel) {
+		size_t n = 0;
+		for (i = 0; i < TIMER_WHEEL_N_LISTS; ++i) {
+			struct event *ev;
+			LIST_FOREACH(ev, timer_wheel_list_(base->timerwheel, i),
+			    ev_timeout_pos.ev_next_in_timer_wheel) {
+				EVUTIL_ASSERT(ev->ev_flags & EVLIST_TIMEOUT);
+				EVUTIL_ASSERT(!is_common_timeout(&ev->ev_timeout, base));
+				++n;
+			}
+		}
+		EVUTIL_ASSERT(n == timer_wheel_size_(base->timerwheel));
 	}
 
 	/* Check that the common timeouts are fine */
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+/* With glibc we need to define _GNU_SOURCE to get pthread_setaffinity_np.
+ * This comes from evconfig-private.h
+ */
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <linux/filter.h>
+#endif
+#include <string.h>
+
+#include "event2/event.h"
+#include "event2/listener.h"
+#include "event2/thread.h"
+#include "event2/util.h"
+#include "event2/pool.h"
+#include "mm-internal.h"
+#include "log-internal.h"
+
+#if defined(__linux__) && defined(CPU_SET)
+#define USE_AFFINITY
+#endif
+
+struct event_base_pool_worker {
+	struct event_base *base;
+	/* Made active to get the loop to stop. */
+	struct event *stop_ev;
+	pthread_t thread;
+	/* The CPU to pin the thread to, or -1. */
+	int cpu;
+	unsigned started : 1;
+};
+
+struct event_base_pool {
+	int n_bases;
+	unsigned flags;
+	struct event_base_pool_worker *workers;
+	/* Every listener we made, n_bases at a time. */
+	struct evconnlistener **listeners;
+	int n_listeners;
+};
+
+static void *
+pool_thread(void *arg)
+{
+	struct event_base_pool_worker *w = arg;
+
+#ifdef USE_AFFINITY
+	if (w->cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(w->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+			event_debug(("%s: could not pin thread to CPU %d",
+				__func__, w->cpu));
+	}
+#endif
+
+	event_base_loop(w->base, EVLOOP_NO_EXIT_ON_EMPTY);
+	return NULL;
+}
+
+static void
+pool_stop_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct event_base *base = arg;
+	event_base_loopbreak(base);
+}
+
+static int
+pool_n_cpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > 0)
+		return (int)n;
+#endif
+	return 1;
+}
+
+struct event_base_pool *
+event_base_pool_new(int n_bases, const struct event_config *cfg,
+    unsigned flags)
+{
+	struct event_base_pool *pool;
+	int i, n_cpus = pool_n_cpus();
+
+	if (evthread_use_pthreads() < 0)
+		return NULL;
+
+	if (n_bases <= 0)
+		n_bases = n_cpus;
+
+	if (!(pool = mm_calloc(1, sizeof(*pool))))
+		return NULL;
+	pool->flags = flags;
+	pool->workers = mm_calloc(n_bases, sizeof(*pool->workers));
+	if (!pool->workers)
+		goto err;
+
+	for (i = 0; i < n_bases; ++i) {
+		struct event_base_pool_worker *w = &pool->workers[i];
+		++pool->n_bases;
+		w->cpu = (flags & EVENT_BASE_POOL_CPU_AFFINITY) ? i % n_cpus : -1;
+		if (cfg)
+			w->base = event_base_new_with_config(cfg);
+		else
+			w->base = event_base_new();
+		if (!w->base)
+			goto err;
+		w->stop_ev = event_new(w->base, -1, 0, pool_stop_cb, w->base);
+		if (!w->stop_ev)
+			goto err;
+		if (pthread_create(&w->thread, NULL, pool_thread, w)) {
+			event_warn("%s: pthread_create", __func__);
+			goto err;
+		}
+		w->started = 1;
+	}
+
+	return pool;
+err:
+	event_base_pool_free(pool);
+	return NULL;
+}
+
+void
+event_base_pool_free(struct event_base_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < pool->n_bases; ++i) {
+		struct event_base_pool_worker *w = &pool->workers[i];
+		/* An active event stays active until the loop runs it, so
+		 * this works even if the thread has not started looping
+		 * yet. */
+		if (w->started)
+			event_active(w->stop_ev, EV_READ, 0);
+	}
+	for (i = 0; i < pool->n_bases; ++i) {
+		struct event_base_pool_worker *w = &pool->workers[i];
+		if (w->started)
+			pthread_join(w->thread, NULL);
+	}
+
+	for (i = 0; i < pool->n_listeners; ++i)
+		evconnlistener_free(pool->listeners[i]);
+	mm_free(pool->listeners);
+
+	for (i = 0; i < pool->n_bases; ++i) {
+		struct event_base_pool_worker *w = &pool->workers[i];
+		if (w->stop_ev)
+			event_free(w->stop_ev);
+		if (w->base)
+			event_base_free(w->base);
+	}
+	mm_free(pool->workers);
+	mm_free(pool);
+}
+
+int
+event_base_pool_get_n_bases(const struct event_base_pool *pool)
+{
+	return pool->n_bases;
+}
+
+struct event_base *
+event_base_pool_get_base(struct event_base_pool *pool, int i)
+{
+	if (i < 0 || i >= pool->n_bases)
+		return NULL;
+	return pool->workers[i].base;
+}
+
+/* Have the kernel give each connection to the listener at index
+ * (CPU % n_bases) in the SO_REUSEPORT group of fd; that is the listener
+ * running on the same CPU. */
+static void
+pool_steer_by_cpu(struct event_base_pool *pool, evutil_socket_t fd)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	struct sock_filter code[] = {
+		/* A = the current CPU */
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+		/* A = A % n_bases */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, (ev_uint32_t)pool->n_bases },
+		/* return A */
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog;
+
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+		&prog, sizeof(prog)) < 0)
+		event_debug(("%s: could not attach reuseport program: %s",
+			__func__, evutil_socket_error_to_string(
+			    EVUTIL_SOCKET_ERROR())));
+#endif
+}
+
+struct evconnlistener *
+event_base_pool_listen(struct event_base_pool *pool,
+    evconnlistener_cb cb, void *ptr, unsigned flags, int backlog,
+    const struct sockaddr *sa, int socklen)
+{
+	struct sockaddr_storage ss;
+	struct evconnlistener **lev;
+	int i;
+
+	if (socklen <= 0 || (size_t)socklen > sizeof(ss))
+		return NULL;
+	memcpy(&ss, sa, socklen);
+	flags |= LEV_OPT_REUSEABLE_PORT | LEV_OPT_THREADSAFE;
+
+	lev = mm_realloc(pool->listeners,
+	    (pool->n_listeners + pool->n_bases) * sizeof(*lev));
+	if (!lev)
+		return NULL;
+	pool->listeners = lev;
+	lev += pool->n_listeners;
+
+	for (i = 0; i < pool->n_bases; ++i) {
+		lev[i] = evconnlistener_new_bind(pool->workers[i].base,
+		    cb, ptr, flags, backlog, (struct sockaddr *)&ss, socklen);
+		if (!lev[i])
+			goto err;
+		if (i == 0) {
+			/* Bind the rest to the same port, even if we were
+			 * asked for port 0. */
+			ev_socklen_t len = sizeof(ss);
+			if (getsockname(evconnlistener_get_fd(lev[0]),
+				(struct sockaddr *)&ss, &len) < 0) {
+				++i;
+				goto err;
+			}
+		}
+	}
+
+	if (pool->flags & EVENT_BASE_POOL_CPU_AFFINITY)
+		pool_steer_by_cpu(pool, evconnlistener_get_fd(lev[0]));
+
+	pool->n_listeners += pool->n_bases;
+	return lev[0];
+err:
+	while (i--)
+		evconnlistener_free(lev[i]);
+	return NULL;
+}
@@ -189,6 +189,9 @@ evrpc_process_hooks(struct evrpc_hook_list *head, void *ctx,
     struct evhttp_request *req, struct evbuffer *evbuf)
 {
 	struct evrpc_hook *hook;
+
+	/* The hooks may change the request's headers */
+	evhttp_request_hand_out_headers_(req);
 	TAILQ_FOREACH(hook, head, next) {
 		int res = hook->process(ctx, req, evbuf, hook->process_arg);
 		if (res != EVRPC_CONTINUE)
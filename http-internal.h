@@ -13,11 +13,23 @@
 #include "event2/event_struct.h"
 #include "util-internal.h"
 #include "defer-internal.h"
+#include "ht-internal.h"
 
 #define HTTP_CONNECT_TIMEOUT	45
 #define HTTP_WRITE_TIMEOUT	50
 #define HTTP_READ_TIMEOUT	50
 #define HTTP_INITIAL_RETRY_TIMEOUT	2
+/* Stop reading a streamed request body while this much of it waits for
+ * the handler */
+#define HTTP_STREAM_BODY_BUFFER	(64*1024)
+/* Responses shorter than this are not compressed, by default */
+#define HTTP_COMPRESS_MIN_SIZE	256
+/* How much space to reserve at a time for compressed output */
+#define HTTP_COMPRESS_RESERVE	4096
+/* How many files to keep open for evhttp_set_static_root(), and how many
+ * seconds to trust them for, by default */
+#define HTTP_STATIC_MAX_FILES	256
+#define HTTP_STATIC_REVALIDATE	5
 
 enum message_read_status {
 	ALL_DATA_READ = 1,
@@ -30,6 +42,8 @@ enum message_read_status {
 struct evbuffer;
 struct addrinfo;
 struct evhttp_request;
+struct evhttp2_session;
+struct evkeyvalq;
 
 enum evhttp_connection_state {
 	EVCON_DISCONNECTED,	/**< not currently connected not trying either*/
@@ -45,10 +59,21 @@ enum evhttp_connection_state {
 
 struct event_base;
 
+/* A piece of a request's arena (see evhttp_request_alloc_()).  Memory is
+ * handed out from the front of the space that follows this struct. */
+struct evhttp_arena_chunk {
+	struct evhttp_arena_chunk *next;
+	size_t size;	/* how much space follows the struct */
+	size_t used;	/* how much of it has been handed out */
+};
+
+/* The usual size of a chunk; bigger allocations get a chunk of their own */
+#define EVHTTP_ARENA_CHUNK_SIZE 4096
+
 /* A client or server connection. */
 struct evhttp_connection {
 	/* we use this tailq only if this connection was created for an http
-	 * server */
+	 * server, or by a connection pool */
 	TAILQ_ENTRY(evhttp_connection) next;
 
 	evutil_socket_t fd;
@@ -65,6 +90,10 @@ struct evhttp_connection {
 	size_t max_headers_size;
 	ev_uint64_t max_body_size;
 
+	/* For server connections with pipelining, how many requests we may
+	 * have read and not yet answered; otherwise 0. */
+	int pipeline_depth;
+
 	int flags;
 #define EVHTTP_CON_INCOMING	0x0001       /* only one request on it ever */
 #define EVHTTP_CON_OUTGOING	0x0002       /* multiple requests possible */
@@ -76,6 +105,16 @@ struct evhttp_connection {
 #define EVHTTP_CON_READING_ERROR	(EVHTTP_CON_AUTOFREE << 1)
 /* Timeout is not default */
 #define EVHTTP_CON_TIMEOUT_ADJUSTED	(EVHTTP_CON_READING_ERROR << 1)
+/* Pipelining: read no more requests; close once the ones read are done */
+#define EVHTTP_CON_PIPELINE_STOP	(EVHTTP_CON_TIMEOUT_ADJUSTED << 1)
+/* Pipelining: reading timed out while earlier requests were still being
+ * answered; read again once they are */
+#define EVHTTP_CON_READ_PAUSED	(EVHTTP_CON_PIPELINE_STOP << 1)
+/* The connection has been kept alive after a response, so the server may
+ * have closed it by the time we send the next request */
+#define EVHTTP_CON_REUSED	(EVHTTP_CON_READ_PAUSED << 1)
+/* Reading a streamed request body until its handler takes what it has */
+#define EVHTTP_CON_BODY_PAUSED	(EVHTTP_CON_REUSED << 1)
 
 	struct timeval timeout_connect;		/* timeout for connect phase */
 	struct timeval timeout_read;		/* timeout for read */
@@ -107,21 +146,155 @@ struct evhttp_connection {
 	int ai_family;
 
 	evhttp_ext_method_cb ext_method_cmp;
+
+	/* An emptied arena chunk left by the last request, for the next */
+	struct evhttp_arena_chunk *spare_arena;
+
+	/* Set while the connection speaks HTTP/2 */
+	struct evhttp2_session *h2;
+
+	/* For connections of a pool, the host they are to, and when they
+	 * last ran out of requests */
+	struct evhttp_pool_host *pool_host;
+	struct timeval pool_idle_since;
+};
+
+/* The headers that evhttp looks up itself. */
+enum evhttp_known_header {
+	EVHTTP_HDR_OTHER_,
+	EVHTTP_HDR_ACCEPT_ENCODING,
+	EVHTTP_HDR_CONNECTION,
+	EVHTTP_HDR_CONTENT_ENCODING,
+	EVHTTP_HDR_CONTENT_LENGTH,
+	EVHTTP_HDR_CONTENT_TYPE,
+	EVHTTP_HDR_DATE,
+	EVHTTP_HDR_EXPECT,
+	EVHTTP_HDR_HOST,
+	EVHTTP_HDR_PROXY_CONNECTION,
+	EVHTTP_HDR_TRANSFER_ENCODING,
+	EVHTTP_HDR_MAX_
+};
+
+/* Where the known headers are in one of a request's header lists.  Built
+ * the first time evhttp looks one up, and then kept up to date as headers
+ * are added at the end of the list.  Removing any indexed header throws
+ * it away, to be built again when next needed. */
+struct evhttp_header_index {
+	/* The first header with each known name, or NULL. */
+	struct evkeyval *first[EVHTTP_HDR_MAX_];
+	/* The list's first element and tqh_last when we last caught up. */
+	struct evkeyval *list_first;
+	struct evkeyval **list_last;
+	unsigned valid : 1;
 };
 
 /* A callback for an http server */
 struct evhttp_cb {
 	TAILQ_ENTRY(evhttp_cb) next;
+	/* In the evhttp's exact-match table, unless this is a prefix
+	 * callback. */
+	HT_ENTRY(evhttp_cb) node;
+	unsigned hash;
 
 	char *what;
+	/* Set if this is a prefix callback, in the evhttp's route trie. */
+	unsigned prefix : 1;
+	/* Set only on lookup keys: what is a URI path still to be
+	 * %-decoded. */
+	unsigned encoded : 1;
+	/* EVHTTP_CB_* flags */
+	int flags;
 
 	void (*cb)(struct evhttp_request *req, void *);
 	void *cbarg;
 };
 
+/* A directory served with evhttp_set_static_root() */
+struct evhttp_static_root {
+	TAILQ_ENTRY(evhttp_static_root) next;
+	struct evhttp *http;
+
+	char *prefix;
+	char *root;
+};
+
+/* A file of a static root, kept open in its evhttp's cache */
+struct evhttp_static_file {
+	HT_ENTRY(evhttp_static_file) node;
+	/* Most recently used first */
+	TAILQ_ENTRY(evhttp_static_file) next;
+
+	char *path;
+	/* Holds the open file, which it closes once it is no longer cached
+	 * and no longer being sent */
+	struct evbuffer_file_segment *seg;
+
+	/* To tell whether the file has changed */
+	ev_uint64_t dev;
+	ev_uint64_t ino;
+	ev_int64_t size;
+	ev_int64_t mtime;
+
+	const char *content_type;
+	char etag[48];
+	char last_modified[32];
+};
+
+/* A content coding added with evhttp_add_content_encoder() */
+struct evhttp_content_encoder {
+	TAILQ_ENTRY(evhttp_content_encoder) next;
+	char *name;
+
+	evhttp_encoder_init_cb init_cb;
+	evhttp_encoder_cb encode_cb;
+	evhttp_encoder_free_cb free_cb;
+	void *arg;
+};
+
+/* A node in the radix trie of prefix callbacks.  The prefix a node stands
+ * for is the labels on the way down to it, joined. */
+struct evhttp_route_node {
+	char *label;
+	size_t label_len;
+	/* The callback for exactly this prefix, or NULL. */
+	struct evhttp_cb *cb;
+	/* Sorted by the first byte of their labels, which all differ. */
+	struct evhttp_route_node **children;
+	int n_children;
+};
+
 /* both the http server as well as the rpc system need to queue connections */
 TAILQ_HEAD(evconq, evhttp_connection);
 
+/* The connections that a pool has to one address and port */
+struct evhttp_pool_host {
+	HT_ENTRY(evhttp_pool_host) node;
+	struct evhttp_connection_pool *pool;
+
+	char *address;
+	ev_uint16_t port;
+
+	/* Those that became idle most recently come first */
+	struct evconq connections;
+	int n_connections;
+
+	/* Frees the connections that have been idle too long */
+	struct event idle_ev;
+};
+
+struct evhttp_connection_pool {
+	HT_HEAD(evhttp_pool_host_map, evhttp_pool_host) hosts;
+
+	struct event_base *base;
+	struct evdns_base *dns_base;
+
+	int max_connections;		/* to each host */
+	struct timeval idle_timeout;
+
+	void (*connection_cb)(struct evhttp_connection *, void *);
+	void *connection_cb_arg;
+};
+
 /* each bound socket is stored in one of these */
 struct evhttp_bound_socket {
 	TAILQ_ENTRY(evhttp_bound_socket) next;
@@ -143,7 +316,11 @@ struct evhttp {
 	/* All listeners for this host */
 	TAILQ_HEAD(boundq, evhttp_bound_socket) sockets;
 
+	/* Every callback set with evhttp_set_cb() or evhttp_set_prefix_cb(),
+	 * indexed below by path and by prefix. */
 	TAILQ_HEAD(httpcbq, evhttp_cb) callbacks;
+	HT_HEAD(evhttp_cb_map, evhttp_cb) exact_callbacks;
+	struct evhttp_route_node *prefix_callbacks;
 
 	/* All live connections on this host. */
 	struct evconq connections;
@@ -160,9 +337,26 @@ struct evhttp {
 
 	size_t default_max_headers_size;
 	ev_uint64_t default_max_body_size;
+	int pipeline_depth;
 	int flags;
 	const char *default_content_type;
 
+	/* Content codings to compress responses with, in order of
+	 * preference, and the settings for them. */
+	TAILQ_HEAD(encoderq, evhttp_content_encoder) encoders;
+	int compress_level;
+	size_t compress_min_size;
+
+	/* Directories served with evhttp_set_static_root(), and the cache of
+	 * their files that are open, which a timer checks for changes. */
+	TAILQ_HEAD(static_rootq, evhttp_static_root) static_roots;
+	HT_HEAD(evhttp_static_file_map, evhttp_static_file) static_files;
+	TAILQ_HEAD(static_fileq, evhttp_static_file) static_lru;
+	int n_static_files;
+	int max_static_files;
+	struct timeval static_revalidate;
+	struct event static_ev;
+
 	/* Bitmask of all HTTP methods that we accept and pass to user
 	 * callbacks. */
 	ev_uint32_t allowed_methods;
@@ -171,6 +365,7 @@ struct evhttp {
 	   don't match. */
 	void (*gencb)(struct evhttp_request *req, void *);
 	void *gencbarg;
+	int gencb_flags;
 	struct bufferevent* (*bevcb)(struct event_base *, void *);
 	void *bevcbarg;
 	int (*newreqcb)(struct evhttp_request *req, void *);
@@ -205,6 +400,25 @@ enum message_read_status evhttp_parse_headers_(struct evhttp_request *, struct e
 void evhttp_start_read_(struct evhttp_connection *);
 void evhttp_start_write_(struct evhttp_connection *);
 
+/* Memory from req's arena, which lasts as long as req */
+void *evhttp_request_alloc_(struct evhttp_request *req, size_t size);
+char *evhttp_request_strndup_(struct evhttp_request *req,
+    const char *s, size_t len);
+int evhttp_request_add_header_(struct evhttp_request *req,
+    struct evkeyvalq *headers, const char *key, const char *value);
+/* Make req's headers safe for the public functions that change header
+ * lists, as evhttp_request_get_input_headers() and _output_headers() do */
+void evhttp_request_hand_out_headers_(struct evhttp_request *req);
+
+/* A new request for the user of evcon's server to answer */
+struct evhttp_request *evhttp_server_request_new_(
+    struct evhttp_connection *evcon);
+/* Set up req as if its request line had been "method target HTTP/2.0" */
+int evhttp_request_set_target_(struct evhttp_request *req,
+    const char *method, const char *target);
+/* The method of req, a client request, as it is sent */
+const char *evhttp_request_method_(struct evhttp_request *req);
+
 /* response sending HTML the data in the buffer */
 void evhttp_response_code_(struct evhttp_request *, int, const char *);
 void evhttp_send_page_(struct evhttp_request *, struct evbuffer *);
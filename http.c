@@ -111,6 +111,7 @@
 #include "http-internal.h"
 #include "mm-internal.h"
 #include "bufferevent-internal.h"
+#include "http2-internal.h"
 
 #ifndef EVENT__HAVE_GETNAMEINFO
 #define NI_MAXSERV 32
@@ -180,7 +181,10 @@ extern int debug;
 static evutil_socket_t bind_socket_ai(struct evutil_addrinfo *, int reuse);
 static evutil_socket_t bind_socket(const char *, ev_uint16_t, int reuse);
 static void name_from_addr(struct sockaddr *, ev_socklen_t, char **, char **);
-static struct evhttp_uri *evhttp_uri_parse_authority(char *source_uri);
+static struct evhttp_uri *evhttp_uri_parse_authority(char *source_uri,
+    struct evhttp_request *req);
+static struct evhttp_uri *evhttp_uri_parse_with_flags_(const char *source_uri,
+    unsigned flags, struct evhttp_request *req);
 static int evhttp_associate_new_request_with_connection(
 	struct evhttp_connection *evcon);
 static void evhttp_connection_start_detectclose(
@@ -188,17 +192,39 @@ static void evhttp_connection_start_detectclose(
 static void evhttp_connection_stop_detectclose(
 	struct evhttp_connection *evcon);
 static void evhttp_request_dispatch(struct evhttp_connection* evcon);
+static void evhttp_connection_read_next_(struct evhttp_connection *evcon);
+static void evhttp_send_done(struct evhttp_connection *evcon, void *arg);
+static int evhttp_connection_pipeline_read_error_(
+	struct evhttp_connection *evcon, short what);
+static int evhttp_connection_enqueue_(struct evhttp_connection *evcon,
+    struct evhttp_request *req);
+static void evhttp_pool_connection_idle_(struct evhttp_connection *evcon);
+static int evhttp_request_streams_body_(struct evhttp *http,
+    struct evhttp_request *req);
+static int evhttp_pool_retry_(struct evhttp_connection *evcon,
+    struct evhttp_request *req, enum evhttp_request_error error);
 static void evhttp_read_firstline(struct evhttp_connection *evcon,
 				  struct evhttp_request *req);
 static void evhttp_read_header(struct evhttp_connection *evcon,
     struct evhttp_request *req);
+static void evhttp_clear_headers_(struct evhttp_request *req,
+    struct evkeyvalq *headers);
 static int evhttp_add_header_internal(struct evkeyvalq *headers,
     const char *key, const char *value);
+static struct evkeyval *evhttp_header_new_(const char *key,
+    const char *value);
+static int evhttp_remove_header_(struct evhttp_request *req,
+    struct evkeyvalq *headers, const char *key);
+static const char *evhttp_find_known_header_(struct evhttp_request *req,
+    struct evkeyvalq *headers, enum evhttp_known_header which);
+static int evhttp_remove_known_header_(struct evhttp_request *req,
+    struct evkeyvalq *headers, enum evhttp_known_header which);
 static const char *evhttp_response_phrase_internal(int code);
 static void evhttp_get_request(struct evhttp *, evutil_socket_t, struct sockaddr *, ev_socklen_t);
 static void evhttp_write_buffer(struct evhttp_connection *,
     void (*)(struct evhttp_connection *, void *), void *);
-static void evhttp_make_header(struct evhttp_connection *, struct evhttp_request *);
+static void evhttp_make_header(struct evhttp_connection *,
+    struct evhttp_request *, struct evbuffer *);
 static int evhttp_method_may_have_body_(struct evhttp_connection *, enum evhttp_cmd_type);
 
 /* callbacks for bufferevent */
@@ -405,6 +431,12 @@ evhttp_method_(struct evhttp_connection *evcon,
 	return (method);
 }
 
+const char *
+evhttp_request_method_(struct evhttp_request *req)
+{
+	return evhttp_method_(req->evcon, req->type, NULL);
+}
+
 /**
  * Determines if a response should have a body.
  * Follows the rules in RFC 2616 section 4.3.
@@ -420,6 +452,33 @@ evhttp_response_needs_body(struct evhttp_request *req)
 		req->type != EVHTTP_REQ_HEAD);
 }
 
+/** Helper: returns true iff evcon is in the middle of reading a request
+ * or a response. */
+static int
+evhttp_connection_is_reading_(struct evhttp_connection *evcon)
+{
+	switch (evcon->state) {
+	case EVCON_READING_FIRSTLINE:
+	case EVCON_READING_HEADERS:
+	case EVCON_READING_BODY:
+	case EVCON_READING_TRAILER:
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+/** Helper: returns the request that evcon is reading, or would read next.
+ * A server connection that pipelines appends each request it reads to the
+ * end of its queue, while the one at the front is being answered. */
+static struct evhttp_request *
+evhttp_connection_reading_request_(struct evhttp_connection *evcon)
+{
+	if (evcon->flags & EVHTTP_CON_INCOMING)
+		return TAILQ_LAST(&evcon->requests, evcon_requestq);
+	return TAILQ_FIRST(&evcon->requests);
+}
+
 /** Helper: called after we've added some data to an evcon's bufferevent's
  * output buffer.  Sets the evconn's writing-is-done callback, and puts
  * the bufferevent into writing mode.
@@ -428,6 +487,9 @@ static void
 evhttp_write_buffer(struct evhttp_connection *evcon,
     void (*cb)(struct evhttp_connection *, void *), void *arg)
 {
+	int pipelined_read = evcon->pipeline_depth &&
+	    evhttp_connection_is_reading_(evcon);
+
 	event_debug(("%s: preparing to write buffer\n", __func__));
 
 	/* Set call back */
@@ -436,14 +498,20 @@ evhttp_write_buffer(struct evhttp_connection *evcon,
 
 	/* Disable the read callback: we don't actually care about data;
 	 * we only care about close detection. (We don't disable reading --
-	 * EV_READ, since we *do* want to learn about any close events.) */
+	 * EV_READ, since we *do* want to learn about any close events.)
+	 * A pipelining connection may be reading the next request while
+	 * it answers this one, though, so leave it reading then; and once
+	 * it has stopped reading for good, leave EV_READ alone too. */
 	bufferevent_setcb(evcon->bufev,
-	    NULL, /*read*/
+	    pipelined_read ? evhttp_read_cb : NULL,
 	    evhttp_write_cb,
 	    evhttp_error_cb,
 	    evcon);
 
-	bufferevent_enable(evcon->bufev, EV_READ|EV_WRITE);
+	if (evcon->flags & EVHTTP_CON_PIPELINE_STOP)
+		bufferevent_enable(evcon->bufev, EV_WRITE);
+	else
+		bufferevent_enable(evcon->bufev, EV_READ|EV_WRITE);
 }
 
 static void
@@ -499,7 +567,8 @@ evhttp_make_header_request(struct evhttp_connection *evcon,
 	const char *method;
 	ev_uint16_t flags;
 
-	evhttp_remove_header(req->output_headers, "Proxy-Connection");
+	evhttp_remove_known_header_(req, req->output_headers,
+	    EVHTTP_HDR_PROXY_CONNECTION);
 
 	/* Generate request line */
 	if (!(method = evhttp_method_(evcon, req->type, &flags))) {
@@ -515,26 +584,30 @@ evhttp_make_header_request(struct evhttp_connection *evcon,
 	if ((flags & EVHTTP_METHOD_HAS_BODY) &&
 	    (evbuffer_get_length(req->output_buffer) > 0 ||
 	     req->type == EVHTTP_REQ_POST || req->type == EVHTTP_REQ_PUT) &&
-	    evhttp_find_header(req->output_headers, "Content-Length") == NULL) {
+	    evhttp_find_known_header_(req, req->output_headers,
+		EVHTTP_HDR_CONTENT_LENGTH) == NULL) {
 		char size[22];
 		evutil_snprintf(size, sizeof(size), EV_SIZE_FMT,
 		    EV_SIZE_ARG(evbuffer_get_length(req->output_buffer)));
-		evhttp_add_header(req->output_headers, "Content-Length", size);
+		evhttp_request_add_header_(req, req->output_headers,
+		    "Content-Length", size);
 	}
 }
 
-/** Return true if the list of headers in 'headers', intepreted with respect
- * to flags, means that we should send a "connection: close" when the request
- * is done. */
+/** Return true if the list of headers in 'headers', one of req's, means that
+ * we should send a "connection: close" when the request is done. */
 static int
-evhttp_is_connection_close(int flags, struct evkeyvalq* headers)
+evhttp_is_connection_close(struct evhttp_request *req,
+    struct evkeyvalq* headers)
 {
-	if (flags & EVHTTP_PROXY_REQUEST) {
+	if (req->flags & EVHTTP_PROXY_REQUEST) {
 		/* proxy connection */
-		const char *connection = evhttp_find_header(headers, "Proxy-Connection");
+		const char *connection = evhttp_find_known_header_(req,
+		    headers, EVHTTP_HDR_PROXY_CONNECTION);
 		return (connection == NULL || evutil_ascii_strcasecmp(connection, "keep-alive") != 0);
 	} else {
-		const char *connection = evhttp_find_header(headers, "Connection");
+		const char *connection = evhttp_find_known_header_(req,
+		    headers, EVHTTP_HDR_CONNECTION);
 		return (connection != NULL && evutil_ascii_strcasecmp(connection, "close") == 0);
 	}
 }
@@ -542,27 +615,31 @@ static int
 evhttp_is_request_connection_close(struct evhttp_request *req)
 {
 	return
-		evhttp_is_connection_close(req->flags, req->input_headers) ||
-		evhttp_is_connection_close(req->flags, req->output_headers);
+		evhttp_is_connection_close(req, req->input_headers) ||
+		evhttp_is_connection_close(req, req->output_headers);
 }
 
-/* Return true iff 'headers' contains 'Connection: keep-alive' */
+/* Return true iff 'headers', one of req's, contains
+ * 'Connection: keep-alive' */
 static int
-evhttp_is_connection_keepalive(struct evkeyvalq* headers)
+evhttp_is_connection_keepalive(struct evhttp_request *req,
+    struct evkeyvalq* headers)
 {
-	const char *connection = evhttp_find_header(headers, "Connection");
+	const char *connection = evhttp_find_known_header_(req, headers,
+	    EVHTTP_HDR_CONNECTION);
 	return (connection != NULL
 	    && evutil_ascii_strncasecmp(connection, "keep-alive", 10) == 0);
 }
 
 /* Add a correct "Date" header to headers, unless it already has one. */
 static void
-evhttp_maybe_add_date_header(struct evkeyvalq *headers)
+evhttp_maybe_add_date_header(struct evhttp_request *req,
+    struct evkeyvalq *headers)
 {
-	if (evhttp_find_header(headers, "Date") == NULL) {
+	if (evhttp_find_known_header_(req, headers, EVHTTP_HDR_DATE) == NULL) {
 		char date[50];
 		if (sizeof(date) - evutil_date_rfc1123(date, sizeof(date), NULL) > 0) {
-			evhttp_add_header(headers, "Date", date);
+			evhttp_request_add_header_(req, headers, "Date", date);
 		}
 	}
 }
@@ -570,15 +647,17 @@ evhttp_maybe_add_date_header(struct evkeyvalq *headers)
 /* Add a "Content-Length" header with value 'content_length' to headers,
  * unless it already has a content-length or transfer-encoding header. */
 static void
-evhttp_maybe_add_content_length_header(struct evkeyvalq *headers,
-    size_t content_length)
+evhttp_maybe_add_content_length_header(struct evhttp_request *req,
+    struct evkeyvalq *headers, size_t content_length)
 {
-	if (evhttp_find_header(headers, "Transfer-Encoding") == NULL &&
-	    evhttp_find_header(headers,	"Content-Length") == NULL) {
+	if (evhttp_find_known_header_(req, headers,
+		EVHTTP_HDR_TRANSFER_ENCODING) == NULL &&
+	    evhttp_find_known_header_(req, headers,
+		EVHTTP_HDR_CONTENT_LENGTH) == NULL) {
 		char len[22];
 		evutil_snprintf(len, sizeof(len), EV_SIZE_FMT,
 		    EV_SIZE_ARG(content_length));
-		evhttp_add_header(headers, "Content-Length", len);
+		evhttp_request_add_header_(req, headers, "Content-Length", len);
 	}
 }
 
@@ -588,24 +667,25 @@ evhttp_maybe_add_content_length_header(struct evkeyvalq *headers,
  */
 static void
 evhttp_make_header_response(struct evhttp_connection *evcon,
-    struct evhttp_request *req)
+    struct evhttp_request *req, struct evbuffer *output)
 {
-	int is_keepalive = evhttp_is_connection_keepalive(req->input_headers);
-	evbuffer_add_printf(bufferevent_get_output(evcon->bufev),
+	int is_keepalive = evhttp_is_connection_keepalive(req,
+	    req->input_headers);
+	evbuffer_add_printf(output,
 	    "HTTP/%d.%d %d %s\r\n",
 	    req->major, req->minor, req->response_code,
 	    req->response_code_line);
 
 	if (req->major == 1) {
 		if (req->minor >= 1)
-			evhttp_maybe_add_date_header(req->output_headers);
+			evhttp_maybe_add_date_header(req, req->output_headers);
 
 		/*
 		 * if the protocol is 1.0; and the connection was keep-alive
 		 * we need to add a keep-alive header, too.
 		 */
 		if (req->minor == 0 && is_keepalive)
-			evhttp_add_header(req->output_headers,
+			evhttp_request_add_header_(req, req->output_headers,
 			    "Connection", "keep-alive");
 
 		if ((req->minor >= 1 || is_keepalive) &&
@@ -615,7 +695,7 @@ evhttp_make_header_response(struct evhttp_connection *evcon,
 			 * user did not give it, this is required for
 			 * persistent connections to work.
 			 */
-			evhttp_maybe_add_content_length_header(
+			evhttp_maybe_add_content_length_header(req,
 				req->output_headers,
 				evbuffer_get_length(req->output_buffer));
 		}
@@ -623,21 +703,50 @@ evhttp_make_header_response(struct evhttp_connection *evcon,
 
 	/* Potentially add headers for unidentified content. */
 	if (evhttp_response_needs_body(req)) {
-		if (evhttp_find_header(req->output_headers,
-			"Content-Type") == NULL
+		if (evhttp_find_known_header_(req, req->output_headers,
+			EVHTTP_HDR_CONTENT_TYPE) == NULL
 		    && evcon->http_server->default_content_type) {
-			evhttp_add_header(req->output_headers,
+			evhttp_request_add_header_(req, req->output_headers,
 			    "Content-Type",
 			    evcon->http_server->default_content_type);
 		}
 	}
 
 	/* if the request asked for a close, we send a close, too */
-	if (evhttp_is_connection_close(req->flags, req->input_headers)) {
-		evhttp_remove_header(req->output_headers, "Connection");
+	if (evhttp_is_connection_close(req, req->input_headers)) {
+		evhttp_remove_known_header_(req, req->output_headers,
+		    EVHTTP_HDR_CONNECTION);
 		if (!(req->flags & EVHTTP_PROXY_REQUEST))
-		    evhttp_add_header(req->output_headers, "Connection", "close");
-		evhttp_remove_header(req->output_headers, "Proxy-Connection");
+		    evhttp_request_add_header_(req, req->output_headers,
+			"Connection", "close");
+		evhttp_remove_known_header_(req, req->output_headers,
+		    EVHTTP_HDR_PROXY_CONNECTION);
+	}
+}
+
+/*
+ * Add to req->output_headers what evhttp_make_header_response() would, for
+ * a response on an HTTP/2 connection: that has no use for the headers
+ * about connections, and sends bodies in frames rather than chunks.
+ * 'complete' is set if the whole body is in req->output_buffer.
+ */
+static void
+evhttp_make_header_h2_(struct evhttp_request *req, int complete)
+{
+	struct evhttp *http = req->evcon->http_server;
+
+	evhttp_maybe_add_date_header(req, req->output_headers);
+	if (!evhttp_response_needs_body(req))
+		return;
+	if (complete)
+		evhttp_maybe_add_content_length_header(req,
+		    req->output_headers,
+		    evbuffer_get_length(req->output_buffer));
+	if (evhttp_find_known_header_(req, req->output_headers,
+		EVHTTP_HDR_CONTENT_TYPE) == NULL &&
+	    http->default_content_type) {
+		evhttp_request_add_header_(req, req->output_headers,
+		    "Content-Type", http->default_content_type);
 	}
 }
 
@@ -650,7 +759,7 @@ static enum expect evhttp_have_expect(struct evhttp_request *req, int input)
 	if (!(req->kind == EVHTTP_REQUEST) || !REQ_VERSION_ATLEAST(req, 1, 1))
 		return NO;
 
-	expect = evhttp_find_header(h, "Expect");
+	expect = evhttp_find_known_header_(req, h, EVHTTP_HDR_EXPECT);
 	if (!expect)
 		return NO;
 
@@ -659,13 +768,14 @@ static enum expect evhttp_have_expect(struct evhttp_request *req, int input)
 
 
 /** Generate all headers appropriate for sending the http request in req (or
- * the response, if we're sending a response), and write them to evcon's
- * bufferevent. Also writes all data from req->output_buffer */
+ * the response, if we're sending a response), and write them to output:
+ * evcon's bufferevent, or where a pipelined response waits its turn. Also
+ * writes all data from req->output_buffer */
 static void
-evhttp_make_header(struct evhttp_connection *evcon, struct evhttp_request *req)
+evhttp_make_header(struct evhttp_connection *evcon, struct evhttp_request *req,
+    struct evbuffer *output)
 {
 	struct evkeyval *header;
-	struct evbuffer *output = bufferevent_get_output(evcon->bufev);
 
 	/*
 	 * Depending if this is a HTTP request or response, we might need to
@@ -674,7 +784,7 @@ evhttp_make_header(struct evhttp_connection *evcon, struct evhttp_request *req)
 	if (req->kind == EVHTTP_REQUEST) {
 		evhttp_make_header_request(evcon, req);
 	} else {
-		evhttp_make_header_response(evcon, req);
+		evhttp_make_header_response(evcon, req, output);
 	}
 
 	TAILQ_FOREACH(header, req->output_headers, next) {
@@ -712,10 +822,46 @@ evhttp_connection_set_max_body_size(struct evhttp_connection* evcon,
 		evcon->max_body_size = new_max_body_size;
 }
 
+/* Before freeing a server connection, take every request on it that the
+ * user has not answered yet off it, so that answering it later just frees
+ * it. */
+static void
+evhttp_connection_release_user_requests_(struct evhttp_connection *evcon)
+{
+	struct evhttp_request *req, *next;
+
+	for (req = TAILQ_FIRST(&evcon->requests); req != NULL; req = next) {
+		next = TAILQ_NEXT(req, next);
+		if (!req->userdone) {
+			TAILQ_REMOVE(&evcon->requests, req, next);
+			req->evcon = NULL;
+		}
+	}
+}
+
+/* Take req, whose body was being streamed to its handler, off its
+ * connection, and tell the handler that the rest of the body will not
+ * come. */
+static void
+evhttp_request_body_failed_(struct evhttp_request *req,
+    enum evhttp_request_error error)
+{
+	TAILQ_REMOVE(&req->evcon->requests, req, next);
+	req->evcon = NULL;
+	if (req->body_error_cb != NULL)
+		(*req->body_error_cb)(error, req->body_cb_arg);
+}
+
 static int
 evhttp_connection_incoming_fail(struct evhttp_request *req,
     enum evhttp_request_error error)
 {
+	/* The handler has the request, and is waiting for its body */
+	if ((req->flags & EVHTTP_REQ_STREAM_BODY) && !req->userdone) {
+		evhttp_request_body_failed_(req, error);
+		return (-1);
+	}
+
 	switch (error) {
 		case EVREQ_HTTP_DATA_TOO_LONG:
 			req->response_code = HTTP_ENTITYTOOLARGE;
@@ -750,10 +896,7 @@ evhttp_connection_incoming_fail(struct evhttp_request *req,
 	case EVREQ_HTTP_DATA_TOO_LONG:
 	default:	/* xxx: probably should just error on default */
 		/* the callback looks at the uri to determine errors */
-		if (req->uri) {
-			mm_free(req->uri);
-			req->uri = NULL;
-		}
+		req->uri = NULL;
 		if (req->uri_elems) {
 			evhttp_uri_free(req->uri_elems);
 			req->uri_elems = NULL;
@@ -769,6 +912,113 @@ evhttp_connection_incoming_fail(struct evhttp_request *req,
 	return (0);
 }
 
+/*
+ * Request arenas.  Things that live exactly as long as a request are
+ * allocated from its arena, a list of chunks that we hand out memory from
+ * in order, and are never freed one at a time.  When a connection is done
+ * with a request, it keeps one emptied chunk for the next request.
+ */
+
+#define EVHTTP_ARENA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+#define EVHTTP_ARENA_HEADER_SIZE \
+	EVHTTP_ARENA_ALIGN(sizeof(struct evhttp_arena_chunk))
+#define EVHTTP_ARENA_DATA(chunk) ((char *)(chunk) + EVHTTP_ARENA_HEADER_SIZE)
+
+/* Return size bytes from req's arena, or NULL on error. */
+void *
+evhttp_request_alloc_(struct evhttp_request *req, size_t size)
+{
+	struct evhttp_arena_chunk *chunk = req->arena;
+	size_t chunk_size = EVHTTP_ARENA_CHUNK_SIZE;
+	char *p;
+
+	if (size > EV_SIZE_MAX / 2) {
+		event_warn("%s: too big", __func__);
+		return (NULL);
+	}
+	size = EVHTTP_ARENA_ALIGN(size);
+	if (chunk != NULL && chunk->size - chunk->used >= size) {
+		p = EVHTTP_ARENA_DATA(chunk) + chunk->used;
+		chunk->used += size;
+		return (p);
+	}
+
+	if (size > chunk_size)
+		chunk_size = size;
+	chunk = mm_malloc(EVHTTP_ARENA_HEADER_SIZE + chunk_size);
+	if (chunk == NULL) {
+		event_warn("%s: malloc", __func__);
+		return (NULL);
+	}
+	chunk->size = chunk_size;
+	chunk->used = size;
+	if (req->arena != NULL && size > EVHTTP_ARENA_CHUNK_SIZE / 4) {
+		/* Keep using the space left in the current chunk. */
+		chunk->next = req->arena->next;
+		req->arena->next = chunk;
+	} else {
+		chunk->next = req->arena;
+		req->arena = chunk;
+	}
+	return (EVHTTP_ARENA_DATA(chunk));
+}
+
+/* Copy the len bytes at s, and a NUL, into req's arena; or onto the heap
+ * if req is NULL. */
+char *
+evhttp_request_strndup_(struct evhttp_request *req, const char *s, size_t len)
+{
+	char *p;
+
+	if (req != NULL)
+		p = evhttp_request_alloc_(req, len + 1);
+	else if ((p = mm_malloc(len + 1)) == NULL)
+		event_warn("%s: malloc", __func__);
+	if (p != NULL) {
+		memcpy(p, s, len);
+		p[len] = '\0';
+	}
+	return (p);
+}
+
+static char *
+evhttp_request_strdup_(struct evhttp_request *req, const char *s)
+{
+	return evhttp_request_strndup_(req, s, strlen(s));
+}
+
+static void
+evhttp_arena_free_(struct evhttp_arena_chunk *chunk)
+{
+	while (chunk != NULL) {
+		struct evhttp_arena_chunk *next = chunk->next;
+		mm_free(chunk);
+		chunk = next;
+	}
+}
+
+/* Free every chunk in an arena but one of the usual size, which we empty
+ * and return. */
+static struct evhttp_arena_chunk *
+evhttp_arena_reset_(struct evhttp_arena_chunk *chunk)
+{
+	struct evhttp_arena_chunk *keep = NULL;
+
+	while (chunk != NULL) {
+		struct evhttp_arena_chunk *next = chunk->next;
+		if (keep == NULL && chunk->size == EVHTTP_ARENA_CHUNK_SIZE)
+			keep = chunk;
+		else
+			mm_free(chunk);
+		chunk = next;
+	}
+	if (keep != NULL) {
+		keep->next = NULL;
+		keep->used = 0;
+	}
+	return (keep);
+}
+
 /* Free connection ownership of which can be acquired by user using
  * evhttp_request_own(). */
 static inline void
@@ -778,11 +1028,58 @@ evhttp_request_free_auto(struct evhttp_request *req)
 		evhttp_request_free(req);
 }
 
+/* Take the arena of req, which is about to be freed, so that evcon can
+ * keep it for its next request.  Returns NULL if evcon has one already, or
+ * if req is not really going away yet.  Since what req points to may be in
+ * the arena, call evhttp_connection_keep_arena_() only after freeing req. */
+static struct evhttp_arena_chunk *
+evhttp_request_detach_arena_(struct evhttp_connection *evcon,
+    struct evhttp_request *req)
+{
+	struct evhttp_arena_chunk *arena = NULL;
+
+	if (!(req->flags & EVHTTP_REQ_DEFER_FREE) &&
+	    evcon->spare_arena == NULL) {
+		/* Only while req has its arena can we tell which of its
+		 * headers are in it. */
+		evhttp_clear_headers_(req, req->input_headers);
+		evhttp_clear_headers_(req, req->output_headers);
+		arena = req->arena;
+		req->arena = NULL;
+	}
+	return arena;
+}
+
+static void
+evhttp_connection_keep_arena_(struct evhttp_connection *evcon,
+    struct evhttp_arena_chunk *arena)
+{
+	if (arena != NULL)
+		evcon->spare_arena = evhttp_arena_reset_(arena);
+}
+
 static void
 evhttp_request_free_(struct evhttp_connection *evcon, struct evhttp_request *req)
 {
+	struct evhttp_arena_chunk *arena = NULL;
+
 	TAILQ_REMOVE(&evcon->requests, req, next);
+	if (!(req->flags & EVHTTP_USER_OWNED))
+		arena = evhttp_request_detach_arena_(evcon, req);
 	evhttp_request_free_auto(req);
+	evhttp_connection_keep_arena_(evcon, arena);
+}
+
+/* Give req the arena chunk that evcon kept from its last request, if it
+ * has none of its own yet. */
+static void
+evhttp_request_take_spare_arena(struct evhttp_connection *evcon,
+    struct evhttp_request *req)
+{
+	if (req->arena == NULL) {
+		req->arena = evcon->spare_arena;
+		evcon->spare_arena = NULL;
+	}
 }
 
 static void
@@ -826,14 +1123,19 @@ evhttp_connection_fail_(struct evhttp_connection *evcon,
     enum evhttp_request_error error)
 {
 	const int errsave = EVUTIL_SOCKET_ERROR();
-	struct evhttp_request* req = TAILQ_FIRST(&evcon->requests);
+	struct evhttp_request* req = evhttp_connection_reading_request_(evcon);
 	void (*cb)(struct evhttp_request *, void *);
 	void *cb_arg;
 	void (*error_cb)(enum evhttp_request_error, void *);
 	void *error_cb_arg;
 	EVUTIL_ASSERT(req != NULL);
 
-	bufferevent_disable(evcon->bufev, EV_READ|EV_WRITE);
+	/* With pipelining, the responses to requests before this one may
+	 * still be going out. */
+	if (TAILQ_FIRST(&evcon->requests) != req)
+		bufferevent_disable(evcon->bufev, EV_READ);
+	else
+		bufferevent_disable(evcon->bufev, EV_READ|EV_WRITE);
 
 	if (evcon->flags & EVHTTP_CON_INCOMING) {
 		/*
@@ -844,11 +1146,18 @@ evhttp_connection_fail_(struct evhttp_connection *evcon,
 		 * For HTTP problems, we might have to send back a
 		 * reply before the connection can be freed.
 		 */
-		if (evhttp_connection_incoming_fail(req, error) == -1)
+		if (evhttp_connection_incoming_fail(req, error) == -1) {
+			evhttp_connection_release_user_requests_(evcon);
 			evhttp_connection_free(evcon);
+		}
 		return;
 	}
 
+	/* A pool sends it again if the server just closed a kept-alive
+	 * connection under it */
+	if (evcon->pool_host != NULL && evhttp_pool_retry_(evcon, req, error))
+		return;
+
 	error_cb = req->error_cb;
 	error_cb_arg = req->cb_arg;
 	/* when the request was canceled, the callback is not executed */
@@ -873,6 +1182,8 @@ evhttp_connection_fail_(struct evhttp_connection *evcon,
 	/* We are trying the next request that was queued on us */
 	if (TAILQ_FIRST(&evcon->requests) != NULL)
 		evhttp_connection_connect_(evcon);
+	else if (evcon->pool_host != NULL)
+		evhttp_pool_connection_idle_(evcon);
 
 	/* The call to evhttp_connection_reset_ overwrote errno.
 	 * Let's restore the original errno, so that the user's
@@ -909,7 +1220,7 @@ evhttp_write_cb(struct bufferevent *bufev, void *arg)
 static void
 evhttp_connection_done(struct evhttp_connection *evcon)
 {
-	struct evhttp_request *req = TAILQ_FIRST(&evcon->requests);
+	struct evhttp_request *req = evhttp_connection_reading_request_(evcon);
 	int con_outgoing = evcon->flags & EVHTTP_CON_OUTGOING;
 	int free_evcon = 0;
 
@@ -947,16 +1258,34 @@ evhttp_connection_done(struct evhttp_connection *evcon)
 			 */
 			 free_evcon = 1;
 		}
+		if (!need_close)
+			evcon->flags |= EVHTTP_CON_REUSED;
+
+		/* A pool may have a request waiting for it */
+		if (evcon->pool_host != NULL &&
+		    TAILQ_FIRST(&evcon->requests) == NULL)
+			evhttp_pool_connection_idle_(evcon);
 	} else {
 		/*
 		 * incoming connection - we need to leave the request on the
 		 * connection so that we can reply to it.
 		 */
 		evcon->state = EVCON_WRITING;
+		evcon->flags &= ~EVHTTP_CON_BODY_PAUSED;
+
+		/* With pipelining, read the next request while the user
+		 * works on this one. */
+		if (evcon->pipeline_depth)
+			evhttp_connection_read_next_(evcon);
 	}
 
-	/* notify the user of the request */
-	(*req->cb)(req, req->cb_arg);
+	/* notify the user of the request, or that its body has all come */
+	if (req->flags & EVHTTP_REQ_STREAM_BODY) {
+		if (req->body_done_cb != NULL)
+			(*req->body_done_cb)(req, req->body_cb_arg);
+	} else {
+		(*req->cb)(req, req->cb_arg);
+	}
 
 	/* if this was an outgoing request, we own and it's done. so free it. */
 	if (con_outgoing) {
@@ -988,6 +1317,60 @@ evhttp_connection_done(struct evhttp_connection *evcon)
  *     ran over the maximum limit
  */
 
+/* How much more of a streamed body may go into req's input buffer */
+static size_t
+evhttp_stream_body_room_(struct evhttp_request *req)
+{
+	size_t len = evbuffer_get_length(req->input_buffer);
+
+	return len < HTTP_STREAM_BODY_BUFFER ? HTTP_STREAM_BODY_BUFFER - len : 0;
+}
+
+/* Give the handler of req, a request whose body is streamed, what has been
+ * read of the body, and stop reading while it has too much.  Returns -1 if
+ * the handler answered req, so that the body is no longer read. */
+static int
+evhttp_stream_body_(struct evhttp_connection *evcon,
+    struct evhttp_request *req, size_t before)
+{
+	if (evbuffer_get_length(req->input_buffer) > before) {
+		if (req->body_chunk_cb != NULL)
+			(*req->body_chunk_cb)(req, req->body_cb_arg);
+		else
+			evbuffer_drain(req->input_buffer, -1);
+		if (evcon->state != EVCON_READING_BODY &&
+		    evcon->state != EVCON_READING_TRAILER)
+			return (-1);
+	}
+
+	if (evhttp_stream_body_room_(req) == 0) {
+		evcon->flags |= EVHTTP_CON_BODY_PAUSED;
+		bufferevent_disable(evcon->bufev, EV_READ);
+	}
+	return (0);
+}
+
+/* Called when the handler of a streamed body drains some of it: read more
+ * if we had stopped. */
+static void
+evhttp_stream_body_drained_cb(struct evbuffer *buf,
+    const struct evbuffer_cb_info *info, void *arg)
+{
+	struct evhttp_request *req = arg;
+	struct evhttp_connection *evcon = req->evcon;
+
+	if (info->n_deleted == 0 || evcon == NULL ||
+	    !(evcon->flags & EVHTTP_CON_BODY_PAUSED) ||
+	    evhttp_connection_reading_request_(evcon) != req ||
+	    evhttp_stream_body_room_(req) == 0)
+		return;
+
+	evcon->flags &= ~EVHTTP_CON_BODY_PAUSED;
+	bufferevent_enable(evcon->bufev, EV_READ);
+	/* what we have read already will not make the socket readable */
+	event_deferred_cb_schedule_(evcon->base, &evcon->read_more_deferred_cb);
+}
+
 static enum message_read_status
 evhttp_handle_chunked_read(struct evhttp_request *req, struct evbuffer *buf)
 {
@@ -1057,6 +1440,23 @@ evhttp_handle_chunked_read(struct evhttp_request *req, struct evbuffer *buf)
 			return DATA_CORRUPTED;
 		}
 
+		/* A streamed body is passed on as it comes, not a chunk at a
+		 * time, and only as far as there is room for it */
+		if (req->flags & EVHTTP_REQ_STREAM_BODY) {
+			size_t n = evhttp_stream_body_room_(req);
+			if (n > buflen)
+				n = buflen;
+			if (n > (size_t)req->ntoread)
+				n = (size_t)req->ntoread;
+			if (n == 0)
+				return (MORE_DATA_EXPECTED);
+			evbuffer_remove_buffer(buf, req->input_buffer, n);
+			req->ntoread -= n;
+			if (req->ntoread == 0)
+				req->ntoread = -1;
+			continue;
+		}
+
 		/* don't have enough to complete a chunk; wait for more */
 		if (req->ntoread > 0 && buflen < (ev_uint64_t)req->ntoread)
 			return (MORE_DATA_EXPECTED);
@@ -1133,12 +1533,16 @@ static void
 evhttp_read_body(struct evhttp_connection *evcon, struct evhttp_request *req)
 {
 	struct evbuffer *buf = bufferevent_get_input(evcon->bufev);
+	size_t before = evbuffer_get_length(req->input_buffer);
 
 	if (req->chunked) {
 		switch (evhttp_handle_chunked_read(req, buf)) {
 		case ALL_DATA_READ:
 			/* finished last chunk */
 			evcon->state = EVCON_READING_TRAILER;
+			if ((req->flags & EVHTTP_REQ_STREAM_BODY) &&
+			    evhttp_stream_body_(evcon, req, before) == -1)
+				return;
 			evhttp_read_trailer(evcon, req);
 			return;
 		case DATA_CORRUPTED:
@@ -1164,7 +1568,9 @@ evhttp_read_body(struct evhttp_connection *evcon, struct evhttp_request *req)
 
 		req->body_size += evbuffer_get_length(buf);
 		evbuffer_add_buffer(req->input_buffer, buf);
-	} else if (req->chunk_cb != NULL || evbuffer_get_length(buf) >= (size_t)req->ntoread) {
+	} else if (req->chunk_cb != NULL ||
+	    (req->flags & EVHTTP_REQ_STREAM_BODY) ||
+	    evbuffer_get_length(buf) >= (size_t)req->ntoread) {
 		/* XXX: the above get_length comparison has to be fixed for overflow conditions! */
 		/* We've postponed moving the data until now, but we're
 		 * about to use it. */
@@ -1172,6 +1578,9 @@ evhttp_read_body(struct evhttp_connection *evcon, struct evhttp_request *req)
 
 		if (n > (size_t) req->ntoread)
 			n = (size_t) req->ntoread;
+		if ((req->flags & EVHTTP_REQ_STREAM_BODY) &&
+		    n > evhttp_stream_body_room_(req))
+			n = evhttp_stream_body_room_(req);
 		req->ntoread -= n;
 		req->body_size += n;
 		evbuffer_remove_buffer(buf, req->input_buffer, n);
@@ -1187,7 +1596,10 @@ evhttp_read_body(struct evhttp_connection *evcon, struct evhttp_request *req)
 		return;
 	}
 
-	if (evbuffer_get_length(req->input_buffer) > 0 && req->chunk_cb != NULL) {
+	if (req->flags & EVHTTP_REQ_STREAM_BODY) {
+		if (evhttp_stream_body_(evcon, req, before) == -1)
+			return;
+	} else if (evbuffer_get_length(req->input_buffer) > 0 && req->chunk_cb != NULL) {
 		req->flags |= EVHTTP_REQ_DEFER_FREE;
 		(*req->chunk_cb)(req, req->cb_arg);
 		req->flags &= ~EVHTTP_REQ_DEFER_FREE;
@@ -1210,6 +1622,41 @@ evhttp_read_body(struct evhttp_connection *evcon, struct evhttp_request *req)
 #define get_deferred_queue(evcon)		\
 	((evcon)->base)
 
+/*
+ * On a server that takes HTTP/2, see whether the client has sent the
+ * HTTP/2 preface where we expect its first request, and if so, speak
+ * HTTP/2 from now on.  Returns 1 if evhttp_read_cb() has nothing more to
+ * do: because the connection now speaks HTTP/2, or because all that we
+ * have read so far could be the start of the preface.
+ */
+static int
+evhttp_connection_maybe_http2_(struct evhttp_connection *evcon,
+    struct evhttp_request *req)
+{
+	struct evbuffer *input = bufferevent_get_input(evcon->bufev);
+	size_t len = evbuffer_get_length(input);
+
+	if (!(evcon->flags & EVHTTP_CON_INCOMING) ||
+	    !(evcon->http_server->flags & EVHTTP_SERVER_HTTP2) ||
+	    TAILQ_FIRST(&evcon->requests) != req ||
+	    TAILQ_NEXT(req, next) != NULL)
+		return (0);
+
+	if (len > EVHTTP2_PREFACE_LEN)
+		len = EVHTTP2_PREFACE_LEN;
+	if (len == 0 ||
+	    memcmp(evbuffer_pullup(input, len), EVHTTP2_PREFACE, len))
+		return (0);
+	if (len < EVHTTP2_PREFACE_LEN)
+		return (1);
+
+	evbuffer_drain(input, EVHTTP2_PREFACE_LEN);
+	evhttp_request_free_(evcon, req);
+	if (evhttp2_session_start_(evcon) == -1)
+		evhttp_connection_free(evcon);
+	return (1);
+}
+
 /*
  * Gets called when more data becomes available
  */
@@ -1218,7 +1665,7 @@ static void
 evhttp_read_cb(struct bufferevent *bufev, void *arg)
 {
 	struct evhttp_connection *evcon = arg;
-	struct evhttp_request *req = TAILQ_FIRST(&evcon->requests);
+	struct evhttp_request *req = evhttp_connection_reading_request_(evcon);
 
 	/* Cancel if it's pending. */
 	event_deferred_cb_cancel_(get_deferred_queue(evcon),
@@ -1226,6 +1673,8 @@ evhttp_read_cb(struct bufferevent *bufev, void *arg)
 
 	switch (evcon->state) {
 	case EVCON_READING_FIRSTLINE:
+		if (evhttp_connection_maybe_http2_(evcon, req))
+			break;
 		evhttp_read_firstline(evcon, req);
 		/* note the request may have been freed in
 		 * evhttp_read_body */
@@ -1315,6 +1764,9 @@ evhttp_connection_free(struct evhttp_connection *evcon)
 			(*evcon->closecb)(evcon, evcon->closecb_arg);
 	}
 
+	if (evcon->h2 != NULL)
+		evhttp2_session_free_(evcon->h2);
+
 	/* remove all requests that might be queued on this
 	 * connection.  for server connections, this should be empty.
 	 * because it gets dequeued either in evhttp_connection_done or
@@ -1329,6 +1781,12 @@ evhttp_connection_free(struct evhttp_connection *evcon)
 		TAILQ_REMOVE(&http->connections, evcon, next);
 	}
 
+	if (evcon->pool_host != NULL) {
+		struct evhttp_pool_host *host = evcon->pool_host;
+		TAILQ_REMOVE(&host->connections, evcon, next);
+		--host->n_connections;
+	}
+
 	if (event_initialized(&evcon->retry_ev)) {
 		event_del(&evcon->retry_ev);
 		event_debug_unassign(&evcon->retry_ev);
@@ -1358,6 +1816,8 @@ evhttp_connection_free(struct evhttp_connection *evcon)
 	if (evcon->address != NULL)
 		mm_free(evcon->address);
 
+	evhttp_arena_free_(evcon->spare_arena);
+
 	mm_free(evcon);
 }
 
@@ -1405,7 +1865,7 @@ evhttp_request_dispatch(struct evhttp_connection* evcon)
 	evcon->state = EVCON_WRITING;
 
 	/* Create the header from the store arguments */
-	evhttp_make_header(evcon, req);
+	evhttp_make_header(evcon, req, bufferevent_get_output(evcon->bufev));
 
 	evhttp_write_buffer(evcon, evhttp_write_connectioncb, NULL);
 }
@@ -1418,6 +1878,9 @@ evhttp_connection_reset_(struct evhttp_connection *evcon)
 	struct evbuffer *tmp;
 	int err;
 
+	if (evcon->h2 != NULL)
+		evhttp2_session_free_(evcon->h2);
+
 	bufferevent_setcb(evcon->bufev, NULL, NULL, NULL, NULL);
 
 	/* XXXX This is not actually an optimal fix.  Instead we ought to have
@@ -1456,7 +1919,7 @@ evhttp_connection_reset_(struct evhttp_connection *evcon)
 	err = evbuffer_drain(tmp, -1);
 	EVUTIL_ASSERT(!err && "drain input");
 
-	evcon->flags &= ~EVHTTP_CON_READING_ERROR;
+	evcon->flags &= ~(EVHTTP_CON_READING_ERROR|EVHTTP_CON_REUSED);
 
 	evcon->state = EVCON_DISCONNECTED;
 }
@@ -1535,6 +1998,9 @@ evhttp_connection_cb_cleanup(struct evhttp_connection *evcon)
 		request->cb(request, request->cb_arg);
 		evhttp_request_free_auto(request);
 	}
+
+	if (evcon->pool_host != NULL && TAILQ_FIRST(&evcon->requests) == NULL)
+		evhttp_pool_connection_idle_(evcon);
 }
 
 static void
@@ -1565,11 +2031,18 @@ static void
 evhttp_error_cb(struct bufferevent *bufev, short what, void *arg)
 {
 	struct evhttp_connection *evcon = arg;
-	struct evhttp_request *req = TAILQ_FIRST(&evcon->requests);
+	struct evhttp_request *req = evhttp_connection_reading_request_(evcon);
 
 	if (evcon->fd == -1)
 		evcon->fd = bufferevent_getfd(bufev);
 
+	/* A pipelining connection that has requests to answer before the
+	 * one it is reading should not lose them to trouble reading the
+	 * next: the client may just be waiting for its responses. */
+	if (evcon->pipeline_depth && (what & BEV_EVENT_READING) &&
+	    req != NULL && evhttp_connection_pipeline_read_error_(evcon, what))
+		return;
+
 	switch (evcon->state) {
 	case EVCON_CONNECTING:
 		if (what & BEV_EVENT_TIMEOUT) {
@@ -1614,6 +2087,12 @@ evhttp_error_cb(struct bufferevent *bufev, short what, void *arg)
 		EVUTIL_ASSERT(evcon->state == EVCON_IDLE);
 		evhttp_connection_reset_(evcon);
 
+		/* A pool has no use for it any more */
+		if (evcon->pool_host != NULL) {
+			evhttp_connection_free(evcon);
+			return;
+		}
+
 		/*
 		 * If we have no more requests that need completion
 		 * and we want to auto-free the connection when all
@@ -1720,6 +2199,13 @@ evhttp_connection_cb(struct bufferevent *bufev, short what, void *arg)
 	bufferevent_set_timeouts(evcon->bufev,
 	    &evcon->timeout_read, &evcon->timeout_write);
 
+	if (evcon->flags & EVHTTP_CON_HTTP2) {
+		if (evhttp2_session_start_(evcon) == -1)
+			goto cleanup;
+		evhttp2_submit_requests_(evcon);
+		return;
+	}
+
 	/* try to start requests that have queued up on this connection */
 	evhttp_request_dispatch(evcon);
 	return;
@@ -1783,12 +2269,9 @@ evhttp_parse_response_line(struct evhttp_request *req, char *line)
 		return (-1);
 	}
 
-	if (req->response_code_line != NULL)
-		mm_free(req->response_code_line);
-	if ((req->response_code_line = mm_strdup(readable)) == NULL) {
-		event_warn("%s: strdup", __func__);
+	if ((req->response_code_line =
+		evhttp_request_strdup_(req, readable)) == NULL)
 		return (-1);
-	}
 
 	return (0);
 }
@@ -2020,18 +2503,17 @@ evhttp_parse_request_line(struct evhttp_request *req, char *line, size_t len)
 	if (evhttp_parse_http_version(version, req) < 0)
 		return -1;
 
-	if ((req->uri = mm_strdup(uri)) == NULL) {
-		event_debug(("%s: mm_strdup", __func__));
-		return -1;
-	}
+	/* The line is in the request's arena already. */
+	req->uri = uri;
 
 	if (type == EVHTTP_REQ_CONNECT) {
-		if ((req->uri_elems = evhttp_uri_parse_authority(req->uri)) == NULL) {
+		if ((req->uri_elems = evhttp_uri_parse_authority(req->uri,
+			    req)) == NULL) {
 			return -1;
 		}
 	} else {
-		if ((req->uri_elems = evhttp_uri_parse_with_flags(req->uri,
-			    EVHTTP_URI_NONCONFORMANT)) == NULL) {
+		if ((req->uri_elems = evhttp_uri_parse_with_flags_(req->uri,
+			    EVHTTP_URI_NONCONFORMANT, req)) == NULL) {
 			return -1;
 		}
 	}
@@ -2050,71 +2532,355 @@ evhttp_parse_request_line(struct evhttp_request *req, char *line, size_t len)
 	return 0;
 }
 
-const char *
-evhttp_find_header(const struct evkeyvalq *headers, const char *key)
+int
+evhttp_request_set_target_(struct evhttp_request *req, const char *method,
+    const char *target)
 {
-	struct evkeyval *header;
-
-	TAILQ_FOREACH(header, headers, next) {
-		if (evutil_ascii_strcasecmp(header->key, key) == 0)
-			return (header->value);
-	}
+	size_t len = strlen(method) + strlen(target) + strlen("  HTTP/1.1");
+	char *line;
 
-	return (NULL);
+	/* Nothing in them may change how the line splits up */
+	if (strpbrk(method, " \r\n") != NULL ||
+	    strpbrk(target, " \r\n") != NULL)
+		return (-1);
+	if ((line = evhttp_request_alloc_(req, len + 1)) == NULL)
+		return (-1);
+	evutil_snprintf(line, len + 1, "%s %s HTTP/1.1", method, target);
+	if (evhttp_parse_request_line(req, line, len) == -1)
+		return (-1);
+	req->major = 2;
+	req->minor = 0;
+	return (0);
 }
 
-void
-evhttp_clear_headers(struct evkeyvalq *headers)
+/* Return true if p is in req's arena. */
+static int
+evhttp_request_owns_(const struct evhttp_request *req, const void *p)
 {
-	struct evkeyval *header;
+	const struct evhttp_arena_chunk *chunk;
+	ev_uintptr_t addr = (ev_uintptr_t)p;
 
-	for (header = TAILQ_FIRST(headers);
-	    header != NULL;
-	    header = TAILQ_FIRST(headers)) {
-		TAILQ_REMOVE(headers, header, next);
-		mm_free(header->key);
-		mm_free(header->value);
-		mm_free(header);
+	for (chunk = req->arena; chunk != NULL; chunk = chunk->next) {
+		ev_uintptr_t data = (ev_uintptr_t)chunk + EVHTTP_ARENA_HEADER_SIZE;
+		if (addr >= data && addr < data + chunk->used)
+			return 1;
 	}
+	return 0;
 }
 
-/*
- * Returns 0,  if the header was successfully removed.
- * Returns -1, if the header could not be found.
- */
-
-int
-evhttp_remove_header(struct evkeyvalq *headers, const char *key)
+/* Free a header that has been taken out of one of req's lists, or out of
+ * some other list if req is NULL.  Headers in req's arena go away with
+ * it rather than on their own. */
+static void
+evhttp_header_free_(struct evhttp_request *req, struct evkeyval *header)
 {
-	struct evkeyval *header;
-
-	TAILQ_FOREACH(header, headers, next) {
-		if (evutil_ascii_strcasecmp(header->key, key) == 0)
-			break;
-	}
-
-	if (header == NULL)
-		return (-1);
-
-	/* Free and remove the header that we found */
-	TAILQ_REMOVE(headers, header, next);
+	if (req != NULL && evhttp_request_owns_(req, header))
+		return;
 	mm_free(header->key);
 	mm_free(header->value);
 	mm_free(header);
-
-	return (0);
 }
 
+/* Return the flag that says headers, one of req's lists, has been handed
+ * out with evhttp_request_get_input_headers() or _output_headers(). */
 static int
-evhttp_header_is_valid_value(const char *value)
+evhttp_headers_handed_out_flag_(struct evhttp_request *req,
+    struct evkeyvalq *headers)
 {
-	const char *p = value;
+	if (headers == req->input_headers)
+		return EVHTTP_REQ_INPUT_HEADERS_OUT;
+	if (headers == req->output_headers)
+		return EVHTTP_REQ_OUTPUT_HEADERS_OUT;
+	return 0;
+}
 
-	while ((p = strpbrk(p, "\r\n")) != NULL) {
-		/* we really expect only one new line */
-		p += strspn(p, "\r\n");
-		/* we expect a space or tab for continuation */
-		if (*p != ' ' && *p != '\t')
+/* Move the headers in headers, one of req's lists, that are in req's
+ * arena to the heap. */
+static void
+evhttp_request_headers_to_heap_(struct evhttp_request *req,
+    struct evkeyvalq *headers)
+{
+	struct evkeyval *header, *next, *copy;
+
+	for (header = TAILQ_FIRST(headers); header != NULL; header = next) {
+		next = TAILQ_NEXT(header, next);
+		if (!evhttp_request_owns_(req, header))
+			continue;
+		/* One that we can't copy is lost */
+		copy = evhttp_header_new_(header->key, header->value);
+		if (copy != NULL)
+			TAILQ_INSERT_BEFORE(header, copy, next);
+		TAILQ_REMOVE(headers, header, next);
+	}
+}
+
+/* Before headers, one of req's lists, goes where evhttp_remove_header()
+ * and evhttp_clear_headers() may be used on it, move it to the heap; those
+ * functions free what they take out.  It stays there from then on. */
+static void
+evhttp_request_hand_out_list_(struct evhttp_request *req,
+    struct evkeyvalq *headers)
+{
+	int flag = evhttp_headers_handed_out_flag_(req, headers);
+
+	if (req->flags & flag)
+		return;
+	req->flags |= flag;
+	evhttp_request_headers_to_heap_(req, headers);
+}
+
+void
+evhttp_request_hand_out_headers_(struct evhttp_request *req)
+{
+	evhttp_request_hand_out_list_(req, req->input_headers);
+	evhttp_request_hand_out_list_(req, req->output_headers);
+}
+
+/*
+ * The known headers, with the hashes of their lowercased names.  Each
+ * hash lands on its own slot of evhttp_known_header_slots, so telling
+ * whether a name is a known one takes a single probe.
+ */
+static const struct {
+	ev_uint32_t hash;
+	const char *name;
+} evhttp_known_headers[EVHTTP_HDR_MAX_] = {
+	{ 0, NULL },
+	{ 0xc9715a99, "Accept-Encoding" },
+	{ 0x38b99ed9, "Connection" },
+	{ 0x03e2ed88, "Content-Encoding" },
+	{ 0x4df9451d, "Content-Length" },
+	{ 0xfcf70995, "Content-Type" },
+	{ 0xd472dc59, "Date" },
+	{ 0x96da6b58, "Expect" },
+	{ 0xaffea56f, "Host" },
+	{ 0x32c09da6, "Proxy-Connection" },
+	{ 0xddb4744c, "Transfer-Encoding" },
+};
+
+#define EVHTTP_KNOWN_HEADER_SLOT(h)	(((h) ^ ((h) >> 14)) & 15)
+static const unsigned char evhttp_known_header_slots[16] = {
+	0, EVHTTP_HDR_EXPECT, EVHTTP_HDR_DATE, EVHTTP_HDR_CONTENT_ENCODING,
+	EVHTTP_HDR_PROXY_CONNECTION, EVHTTP_HDR_HOST, 0, 0,
+	EVHTTP_HDR_CONTENT_LENGTH, EVHTTP_HDR_CONTENT_TYPE, 0, 0,
+	EVHTTP_HDR_ACCEPT_ENCODING, EVHTTP_HDR_TRANSFER_ENCODING, 0,
+	EVHTTP_HDR_CONNECTION,
+};
+
+/* Return which known header key names, or EVHTTP_HDR_OTHER_. */
+static enum evhttp_known_header
+evhttp_known_header_(const char *key)
+{
+	/* 32-bit FNV-1a of the lowercased name */
+	ev_uint32_t h = 2166136261U;
+	const char *p;
+	int id;
+
+	for (p = key; *p; ++p) {
+		h ^= (unsigned char)EVUTIL_TOLOWER_(*p);
+		h *= 16777619U;
+	}
+	id = evhttp_known_header_slots[EVHTTP_KNOWN_HEADER_SLOT(h)];
+	if (id && evhttp_known_headers[id].hash == h &&
+	    !evutil_ascii_strcasecmp(key, evhttp_known_headers[id].name))
+		return id;
+	return EVHTTP_HDR_OTHER_;
+}
+
+static void
+evhttp_header_index_add_(struct evhttp_header_index *idx,
+    struct evkeyval *header)
+{
+	enum evhttp_known_header known = evhttp_known_header_(header->key);
+
+	if (known != EVHTTP_HDR_OTHER_ && idx->first[known] == NULL)
+		idx->first[known] = header;
+}
+
+/* Throw away the index of headers, one of req's lists, after a header was
+ * taken out of it other than through the index. */
+static void
+evhttp_header_index_reset_(struct evhttp_request *req,
+    struct evkeyvalq *headers)
+{
+	if (req->header_index == NULL)
+		return;
+	if (headers == req->input_headers)
+		req->header_index[0].valid = 0;
+	else if (headers == req->output_headers)
+		req->header_index[1].valid = 0;
+}
+
+/* Return an up to date index of headers, which must be one of req's header
+ * lists, or NULL if we can't have one. */
+static struct evhttp_header_index *
+evhttp_header_index_(struct evhttp_request *req, struct evkeyvalq *headers)
+{
+	struct evhttp_header_index *idx;
+	struct evkeyval *header;
+
+	if (req->header_index == NULL) {
+		idx = evhttp_request_alloc_(req, 2 * sizeof(*idx));
+		if (idx == NULL)
+			return NULL;
+		memset(idx, 0, 2 * sizeof(*idx));
+		req->header_index = idx;
+	}
+	/* Once the user has a list, it may change behind our back */
+	if (headers == req->input_headers)
+		idx = &req->header_index[0];
+	else if (headers == req->output_headers)
+		idx = &req->header_index[1];
+	else
+		return NULL;
+	if (req->flags & evhttp_headers_handed_out_flag_(req, headers))
+		return NULL;
+
+	if (!idx->valid || TAILQ_FIRST(headers) != idx->list_first) {
+		memset(idx->first, 0, sizeof(idx->first));
+		header = TAILQ_FIRST(headers);
+		idx->valid = 1;
+	} else if (headers->tqh_last != idx->list_last) {
+		/* There are new headers after the one that was last. */
+		header = TAILQ_NEXT(EVUTIL_UPCAST(idx->list_last,
+			struct evkeyval, next.tqe_next), next);
+	} else {
+		return idx;
+	}
+
+	for (; header != NULL; header = TAILQ_NEXT(header, next))
+		evhttp_header_index_add_(idx, header);
+	idx->list_first = TAILQ_FIRST(headers);
+	idx->list_last = headers->tqh_last;
+	return idx;
+}
+
+/* Like evhttp_find_header(), for one of the known headers in one of req's
+ * header lists. */
+static const char *
+evhttp_find_known_header_(struct evhttp_request *req,
+    struct evkeyvalq *headers, enum evhttp_known_header which)
+{
+	struct evhttp_header_index *idx = evhttp_header_index_(req, headers);
+
+	if (idx == NULL)
+		return evhttp_find_header(headers,
+		    evhttp_known_headers[which].name);
+	return idx->first[which] ? idx->first[which]->value : NULL;
+}
+
+/* Like evhttp_remove_header(), for one of the known headers in one of req's
+ * header lists. */
+static int
+evhttp_remove_known_header_(struct evhttp_request *req,
+    struct evkeyvalq *headers, enum evhttp_known_header which)
+{
+	struct evhttp_header_index *idx = evhttp_header_index_(req, headers);
+	struct evkeyval *header, *next;
+
+	if (idx == NULL)
+		return evhttp_remove_header_(req, headers,
+		    evhttp_known_headers[which].name);
+	if ((header = idx->first[which]) == NULL)
+		return (-1);
+
+	for (next = TAILQ_NEXT(header, next); next != NULL;
+	     next = TAILQ_NEXT(next, next)) {
+		if (evhttp_known_header_(next->key) == which)
+			break;
+	}
+	idx->first[which] = next;
+
+	TAILQ_REMOVE(headers, header, next);
+	evhttp_header_free_(req, header);
+	idx->list_first = TAILQ_FIRST(headers);
+	idx->list_last = headers->tqh_last;
+
+	return (0);
+}
+
+const char *
+evhttp_find_header(const struct evkeyvalq *headers, const char *key)
+{
+	struct evkeyval *header;
+
+	TAILQ_FOREACH(header, headers, next) {
+		if (evutil_ascii_strcasecmp(header->key, key) == 0)
+			return (header->value);
+	}
+
+	return (NULL);
+}
+
+/* Like evhttp_clear_headers(), for headers that are one of req's lists,
+ * or no request's if req is NULL. */
+static void
+evhttp_clear_headers_(struct evhttp_request *req, struct evkeyvalq *headers)
+{
+	struct evkeyval *header;
+
+	for (header = TAILQ_FIRST(headers);
+	    header != NULL;
+	    header = TAILQ_FIRST(headers)) {
+		TAILQ_REMOVE(headers, header, next);
+		evhttp_header_free_(req, header);
+	}
+	if (req != NULL)
+		evhttp_header_index_reset_(req, headers);
+}
+
+void
+evhttp_clear_headers(struct evkeyvalq *headers)
+{
+	evhttp_clear_headers_(NULL, headers);
+}
+
+/* Like evhttp_remove_header(), for headers that are one of req's lists,
+ * or no request's if req is NULL. */
+static int
+evhttp_remove_header_(struct evhttp_request *req, struct evkeyvalq *headers,
+    const char *key)
+{
+	struct evkeyval *header;
+
+	TAILQ_FOREACH(header, headers, next) {
+		if (evutil_ascii_strcasecmp(header->key, key) == 0)
+			break;
+	}
+
+	if (header == NULL)
+		return (-1);
+
+	/* Free and remove the header that we found */
+	TAILQ_REMOVE(headers, header, next);
+	evhttp_header_free_(req, header);
+	if (req != NULL)
+		evhttp_header_index_reset_(req, headers);
+
+	return (0);
+}
+
+/*
+ * Returns 0,  if the header was successfully removed.
+ * Returns -1, if the header could not be found.
+ */
+
+int
+evhttp_remove_header(struct evkeyvalq *headers, const char *key)
+{
+	return evhttp_remove_header_(NULL, headers, key);
+}
+
+static int
+evhttp_header_is_valid_value(const char *value)
+{
+	const char *p = value;
+
+	while ((p = strpbrk(p, "\r\n")) != NULL) {
+		/* we really expect only one new line */
+		p += strspn(p, "\r\n");
+		/* we expect a space or tab for continuation */
+		if (*p != ' ' && *p != '\t')
 			return (0);
 	}
 	return (1);
@@ -2140,27 +2906,67 @@ evhttp_add_header(struct evkeyvalq *headers,
 	return (evhttp_add_header_internal(headers, key, value));
 }
 
-static int
-evhttp_add_header_internal(struct evkeyvalq *headers,
-    const char *key, const char *value)
+/* Allocate a header, with copies of key and value, on the heap. */
+static struct evkeyval *
+evhttp_header_new_(const char *key, const char *value)
 {
 	struct evkeyval *header = mm_calloc(1, sizeof(struct evkeyval));
 	if (header == NULL) {
 		event_warn("%s: calloc", __func__);
-		return (-1);
+		return (NULL);
 	}
 	if ((header->key = mm_strdup(key)) == NULL) {
 		mm_free(header);
 		event_warn("%s: strdup", __func__);
-		return (-1);
+		return (NULL);
 	}
 	if ((header->value = mm_strdup(value)) == NULL) {
 		mm_free(header->key);
 		mm_free(header);
 		event_warn("%s: strdup", __func__);
+		return (NULL);
+	}
+	return (header);
+}
+
+static int
+evhttp_add_header_internal(struct evkeyvalq *headers,
+    const char *key, const char *value)
+{
+	struct evkeyval *header = evhttp_header_new_(key, value);
+	if (header == NULL)
+		return (-1);
+
+	TAILQ_INSERT_TAIL(headers, header, next);
+
+	return (0);
+}
+
+/* Like evhttp_add_header(), for headers that go away with req: the header
+ * and its strings are in req's arena, unless the user has the list. */
+int
+evhttp_request_add_header_(struct evhttp_request *req,
+    struct evkeyvalq *headers, const char *key, const char *value)
+{
+	size_t key_len = strlen(key), value_len = strlen(value);
+	struct evkeyval *header;
+
+	if (strpbrk(key, "\r\n") != NULL ||
+	    !evhttp_header_is_valid_value(value)) {
+		event_debug(("%s: dropping illegal header\n", __func__));
 		return (-1);
 	}
+	if (req->flags & evhttp_headers_handed_out_flag_(req, headers))
+		return (evhttp_add_header_internal(headers, key, value));
 
+	header = evhttp_request_alloc_(req,
+	    sizeof(*header) + key_len + value_len + 2);
+	if (header == NULL)
+		return (-1);
+	header->key = (char *)(header + 1);
+	memcpy(header->key, key, key_len + 1);
+	header->value = header->key + key_len + 1;
+	memcpy(header->value, value, value_len + 1);
 	TAILQ_INSERT_TAIL(headers, header, next);
 
 	return (0);
@@ -2181,11 +2987,11 @@ evhttp_parse_firstline_(struct evhttp_request *req, struct evbuffer *buffer)
 {
 	char *line;
 	enum message_read_status status = ALL_DATA_READ;
+	struct evbuffer_ptr eol;
+	size_t len, eol_len;
 
-	size_t len;
-	/* XXX try */
-	line = evbuffer_readln(buffer, &len, EVBUFFER_EOL_CRLF);
-	if (line == NULL) {
+	eol = evbuffer_search_eol(buffer, NULL, &eol_len, EVBUFFER_EOL_CRLF);
+	if (eol.pos < 0) {
 		if (req->evcon != NULL &&
 		    evbuffer_get_length(buffer) > req->evcon->max_headers_size)
 			return (DATA_TOO_LONG);
@@ -2193,10 +2999,17 @@ evhttp_parse_firstline_(struct evhttp_request *req, struct evbuffer *buffer)
 			return (MORE_DATA_EXPECTED);
 	}
 
-	if (req->evcon != NULL && len > req->evcon->max_headers_size) {
-		mm_free(line);
+	len = eol.pos;
+	if (req->evcon != NULL && len > req->evcon->max_headers_size)
 		return (DATA_TOO_LONG);
-	}
+
+	/* The line stays in the request's arena, so that what we parse out
+	 * of it can point into it. */
+	if ((line = evhttp_request_alloc_(req, len + 1)) == NULL)
+		return (DATA_CORRUPTED);
+	evbuffer_remove(buffer, line, len);
+	line[len] = '\0';
+	evbuffer_drain(buffer, eol_len);
 
 	req->headers_size = len;
 
@@ -2213,101 +3026,148 @@ evhttp_parse_firstline_(struct evhttp_request *req, struct evbuffer *buffer)
 		status = DATA_CORRUPTED;
 	}
 
-	mm_free(line);
 	return (status);
 }
 
+/* Parse the header lines in the NUL-terminated block of text 'text' into
+ * the 'hdrs' array, and add them to 'headers'.  The headers point into
+ * the text, which we cut up in place. */
 static int
-evhttp_append_to_last_header(struct evkeyvalq *headers, char *line)
+evhttp_parse_header_block(struct evkeyvalq *headers,
+    struct evkeyval *hdrs, char *text, size_t len)
 {
-	struct evkeyval *header = TAILQ_LAST(headers, evkeyvalq);
-	char *newval;
-	size_t old_len, line_len;
+	char *p = text, *end = text + len;
+	struct evkeyval *last = NULL;
 
-	if (header == NULL)
-		return (-1);
+	while (p < end) {
+		char *eol = memchr(p, '\n', end - p);
+		char *line_end = eol;
+
+		EVUTIL_ASSERT(eol != NULL);
+		if (line_end > p && line_end[-1] == '\r')
+			--line_end;
+		*line_end = '\0';
+		if (line_end == p) /* Last header - Done */
+			break;
 
-	old_len = strlen(header->value);
+		if (*p == ' ' || *p == '\t') {
+			/* A continuation line: append it to the last value,
+			 * which ends before this line starts, so it fits. */
+			size_t old_len, line_len;
 
-	/* Strip space from start and end of line. */
-	while (*line == ' ' || *line == '\t')
-		++line;
-	evutil_rtrim_lws_(line);
+			if (last == NULL)
+				return (-1);
+			while (*p == ' ' || *p == '\t')
+				++p;
+			evutil_rtrim_lws_(p);
+			old_len = strlen(last->value);
+			line_len = strlen(p);
+			last->value[old_len] = ' ';
+			memmove(last->value + old_len + 1, p, line_len + 1);
+		} else {
+			char *value = memchr(p, ':', line_end - p);
 
-	line_len = strlen(line);
+			if (value == NULL)
+				return (-1);
+			*value++ = '\0';
+			value += strspn(value, " ");
+			evutil_rtrim_lws_(value);
+
+			if (strchr(p, '\r') != NULL ||
+			    !evhttp_header_is_valid_value(value)) {
+				event_debug(("%s: dropping illegal header\n",
+					__func__));
+				return (-1);
+			}
 
-	newval = mm_realloc(header->value, old_len + line_len + 2);
-	if (newval == NULL)
-		return (-1);
+			last = hdrs;
+			last->key = p;
+			last->value = value;
+			TAILQ_INSERT_TAIL(headers, last, next);
+			++hdrs;
+		}
 
-	newval[old_len] = ' ';
-	memcpy(newval + old_len + 1, line, line_len + 1);
-	header->value = newval;
+		p = eol + 1;
+	}
 
 	return (0);
 }
 
+/*
+ * Header lines are left in the buffer until the empty line that ends them
+ * has arrived.  Then they are copied out in one go into the request's
+ * arena along with room for a struct evkeyval per line, and parsed in
+ * place, so that no header needs an allocation of its own.
+ * req->headers_scanned and req->header_lines remember how much of the
+ * buffer we've looked at between calls.
+ */
 enum message_read_status
 evhttp_parse_headers_(struct evhttp_request *req, struct evbuffer* buffer)
 {
-	enum message_read_status errcode = DATA_CORRUPTED;
-	char *line;
 	enum message_read_status status = MORE_DATA_EXPECTED;
+	size_t max_size = req->evcon != NULL ?
+	    req->evcon->max_headers_size : EV_SIZE_MAX;
+	struct evkeyval *hdrs;
+	struct evbuffer_ptr pos;
+	size_t eol_len, block_len;
+	char *text;
+
+	if (evbuffer_ptr_set(buffer, &pos, req->headers_scanned,
+		EVBUFFER_PTR_SET) < 0) {
+		status = DATA_CORRUPTED;
+		goto done;
+	}
+	for (;;) {
+		size_t line_start = pos.pos;
 
-	struct evkeyvalq* headers = req->input_headers;
-	size_t len;
-	while ((line = evbuffer_readln(buffer, &len, EVBUFFER_EOL_CRLF))
-	       != NULL) {
-		char *skey, *svalue;
-
-		req->headers_size += len;
+		pos = evbuffer_search_eol(buffer, &pos, &eol_len,
+		    EVBUFFER_EOL_CRLF);
+		if (pos.pos < 0)
+			break;
 
-		if (req->evcon != NULL &&
-		    req->headers_size > req->evcon->max_headers_size) {
-			errcode = DATA_TOO_LONG;
-			goto error;
+		req->headers_size += pos.pos - line_start;
+		if (req->headers_size > max_size) {
+			status = DATA_TOO_LONG;
+			goto done;
 		}
 
-		if (*line == '\0') { /* Last header - Done */
+		req->headers_scanned = pos.pos + eol_len;
+		if ((size_t)pos.pos == line_start) {
 			status = ALL_DATA_READ;
-			mm_free(line);
 			break;
 		}
-
-		/* Check if this is a continuation line */
-		if (*line == ' ' || *line == '\t') {
-			if (evhttp_append_to_last_header(headers, line) == -1)
-				goto error;
-			mm_free(line);
-			continue;
-		}
-
-		/* Processing of header lines */
-		svalue = line;
-		skey = strsep(&svalue, ":");
-		if (svalue == NULL)
-			goto error;
-
-		svalue += strspn(svalue, " ");
-		evutil_rtrim_lws_(svalue);
-
-		if (evhttp_add_header(headers, skey, svalue) == -1)
-			goto error;
-
-		mm_free(line);
+		++req->header_lines;
+		evbuffer_ptr_set(buffer, &pos, eol_len, EVBUFFER_PTR_ADD);
 	}
 
 	if (status == MORE_DATA_EXPECTED) {
-		if (req->evcon != NULL &&
-		req->headers_size + evbuffer_get_length(buffer) > req->evcon->max_headers_size)
-			return (DATA_TOO_LONG);
+		if (req->headers_size + evbuffer_get_length(buffer) -
+		    req->headers_scanned > max_size)
+			status = DATA_TOO_LONG;
+		return (status);
 	}
 
-	return (status);
+	block_len = req->headers_scanned;
+	hdrs = evhttp_request_alloc_(req,
+	    req->header_lines * sizeof(struct evkeyval) + block_len + 1);
+	if (hdrs == NULL) {
+		status = DATA_CORRUPTED;
+		goto done;
+	}
+	text = (char *)(hdrs + req->header_lines);
+	evbuffer_remove(buffer, text, block_len);
+	text[block_len] = '\0';
 
- error:
-	mm_free(line);
-	return (errcode);
+	if (evhttp_parse_header_block(req->input_headers, hdrs,
+		text, block_len) < 0)
+		status = DATA_CORRUPTED;
+	if (req->flags & EVHTTP_REQ_INPUT_HEADERS_OUT)
+		evhttp_request_headers_to_heap_(req, req->input_headers);
+
+ done:
+	req->headers_scanned = 0;
+	req->header_lines = 0;
+	return (status);
 }
 
 static int
@@ -2317,8 +3177,10 @@ evhttp_get_body_length(struct evhttp_request *req)
 	const char *content_length;
 	const char *connection;
 
-	content_length = evhttp_find_header(headers, "Content-Length");
-	connection = evhttp_find_header(headers, "Connection");
+	content_length = evhttp_find_known_header_(req, headers,
+	    EVHTTP_HDR_CONTENT_LENGTH);
+	connection = evhttp_find_known_header_(req, headers,
+	    EVHTTP_HDR_CONNECTION);
 
 	if (content_length == NULL && connection == NULL)
 		req->ntoread = -1;
@@ -2365,7 +3227,8 @@ evhttp_get_body(struct evhttp_connection *evcon, struct evhttp_request *req)
 		return;
 	}
 	evcon->state = EVCON_READING_BODY;
-	xfer_enc = evhttp_find_header(req->input_headers, "Transfer-Encoding");
+	xfer_enc = evhttp_find_known_header_(req, req->input_headers,
+	    EVHTTP_HDR_TRANSFER_ENCODING);
 	if (xfer_enc != NULL && evutil_ascii_strcasecmp(xfer_enc, "chunked") == 0) {
 		req->chunked = 1;
 		req->ntoread = -1;
@@ -2382,6 +3245,18 @@ evhttp_get_body(struct evhttp_connection *evcon, struct evhttp_request *req)
 		}
 	}
 
+	/* The handler may want the body as it comes; then it gets the
+	 * request now, and may answer before we ask for the body. */
+	if ((evcon->flags & EVHTTP_CON_INCOMING) &&
+	    evhttp_request_streams_body_(evcon->http_server, req)) {
+		req->flags |= EVHTTP_REQ_STREAM_BODY;
+		evbuffer_add_cb(req->input_buffer,
+		    evhttp_stream_body_drained_cb, req);
+		(*req->cb)(req, req->cb_arg);
+		if (evcon->state != EVCON_READING_BODY)
+			return;
+	}
+
 	/* Should we send a 100 Continue status line? */
 	switch (evhttp_have_expect(req, 1)) {
 		case CONTINUE:
@@ -2399,7 +3274,11 @@ evhttp_get_body(struct evhttp_connection *evcon, struct evhttp_request *req)
 						return;
 					}
 				}
-				if (!evbuffer_get_length(bufferevent_get_input(evcon->bufev)))
+				/* With pipelining, a 100 may only go out
+				 * once the responses before it have. */
+				if (TAILQ_FIRST(&evcon->requests) != req)
+					req->flags |= EVHTTP_REQ_NEEDS_CONTINUE;
+				else if (!evbuffer_get_length(bufferevent_get_input(evcon->bufev)))
 					evhttp_send_continue(evcon, req);
 			break;
 		case OTHER:
@@ -2613,6 +3492,7 @@ int evhttp_connection_set_flags(struct evhttp_connection *evcon,
 	int avail_flags = 0;
 	avail_flags |= EVHTTP_CON_REUSE_CONNECTED_ADDR;
 	avail_flags |= EVHTTP_CON_READ_ON_WRITE_ERROR;
+	avail_flags |= EVHTTP_CON_HTTP2;
 
 	if (flags & ~avail_flags || flags > EVHTTP_CON_PUBLIC_FLAGS_END)
 		return 1;
@@ -2825,10 +3705,8 @@ evhttp_make_request(struct evhttp_connection *evcon,
 	/* We are making a request */
 	req->kind = EVHTTP_REQUEST;
 	req->type = type;
-	if (req->uri != NULL)
-		mm_free(req->uri);
-	if ((req->uri = mm_strdup(uri)) == NULL) {
-		event_warn("%s: strdup", __func__);
+	evhttp_request_take_spare_arena(evcon, req);
+	if ((req->uri = evhttp_request_strdup_(req, uri)) == NULL) {
 		evhttp_request_free_auto(req);
 		return (-1);
 	}
@@ -2839,12 +3717,27 @@ evhttp_make_request(struct evhttp_connection *evcon,
 		req->minor = 1;
 	}
 
+	return evhttp_connection_enqueue_(evcon, req);
+}
+
+/* Queue req, which is ready to be sent, on evcon, and start sending it if
+ * nothing is ahead of it. */
+static int
+evhttp_connection_enqueue_(struct evhttp_connection *evcon,
+    struct evhttp_request *req)
+{
 	EVUTIL_ASSERT(req->evcon == NULL);
 	req->evcon = evcon;
 	EVUTIL_ASSERT(!(req->flags & EVHTTP_REQ_OWN_CONNECTION));
 
 	TAILQ_INSERT_TAIL(&evcon->requests, req, next);
 
+	/* Over HTTP/2, it gets a stream as soon as there can be another */
+	if (evcon->h2 != NULL) {
+		evhttp2_submit_requests_(evcon);
+		return (0);
+	}
+
 	/* We do not want to conflict with retry_ev */
 	if (evcon->retry_cnt)
 		return (0);
@@ -2877,6 +3770,11 @@ void
 evhttp_cancel_request(struct evhttp_request *req)
 {
 	struct evhttp_connection *evcon = req->evcon;
+	if (req->h2_stream != NULL) {
+		/* only its stream needs to go */
+		evhttp2_cancel_request_(req);
+		return;
+	}
 	if (evcon != NULL) {
 		/* We need to remove it from the connection */
 		if (TAILQ_FIRST(&evcon->requests) == req) {
@@ -2900,46 +3798,537 @@ evhttp_cancel_request(struct evhttp_request *req)
 }
 
 /*
- * Reads data from file descriptor into request structure
- * Request structure needs to be set up correctly.
+ * Connection pools
  */
 
-void
-evhttp_start_read_(struct evhttp_connection *evcon)
+static inline unsigned
+evhttp_pool_host_hash(const struct evhttp_pool_host *host)
 {
-	bufferevent_disable(evcon->bufev, EV_WRITE);
-	bufferevent_enable(evcon->bufev, EV_READ);
-
-	evcon->state = EVCON_READING_FIRSTLINE;
-	/* Reset the bufferevent callbacks */
-	bufferevent_setcb(evcon->bufev,
-	    evhttp_read_cb,
-	    evhttp_write_cb,
-	    evhttp_error_cb,
-	    evcon);
-
-	/* If there's still data pending, process it next time through the
-	 * loop.  Don't do it now; that could get recusive. */
-	if (evbuffer_get_length(bufferevent_get_input(evcon->bufev))) {
-		event_deferred_cb_schedule_(get_deferred_queue(evcon),
-		    &evcon->read_more_deferred_cb);
-	}
+	return ht_improve_hash_(ht_string_hash_(host->address) ^ host->port);
 }
 
-void
-evhttp_start_write_(struct evhttp_connection *evcon)
+static inline int
+evhttp_pool_host_eq(const struct evhttp_pool_host *a,
+    const struct evhttp_pool_host *b)
 {
-	bufferevent_disable(evcon->bufev, EV_WRITE);
+	return a->port == b->port && !strcmp(a->address, b->address);
+}
+
+HT_PROTOTYPE(evhttp_pool_host_map, evhttp_pool_host, node,
+    evhttp_pool_host_hash, evhttp_pool_host_eq)
+HT_GENERATE(evhttp_pool_host_map, evhttp_pool_host, node,
+    evhttp_pool_host_hash, evhttp_pool_host_eq,
+    0.5, mm_malloc, mm_realloc, mm_free)
+
+struct evhttp_connection_pool *
+evhttp_connection_pool_new(struct event_base *base,
+    struct evdns_base *dnsbase)
+{
+	struct evhttp_connection_pool *pool;
+
+	if ((pool = mm_calloc(1, sizeof(*pool))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return (NULL);
+	}
+	HT_INIT(evhttp_pool_host_map, &pool->hosts);
+	pool->base = base;
+	pool->dns_base = dnsbase;
+	pool->max_connections = 8;
+	pool->idle_timeout.tv_sec = 60;
+	return (pool);
+}
+
+void
+evhttp_connection_pool_free(struct evhttp_connection_pool *pool)
+{
+	struct evhttp_pool_host **hostp, *host;
+
+	for (hostp = HT_START(evhttp_pool_host_map, &pool->hosts);
+	     hostp != NULL;) {
+		struct evhttp_connection *evcon;
+
+		host = *hostp;
+		hostp = HT_NEXT_RMV(evhttp_pool_host_map, &pool->hosts, hostp);
+		while ((evcon = TAILQ_FIRST(&host->connections)) != NULL)
+			evhttp_connection_free(evcon);
+		event_del(&host->idle_ev);
+		mm_free(host->address);
+		mm_free(host);
+	}
+	HT_CLEAR(evhttp_pool_host_map, &pool->hosts);
+	mm_free(pool);
+}
+
+void
+evhttp_connection_pool_set_max_connections(
+    struct evhttp_connection_pool *pool, int max_connections)
+{
+	if (max_connections < 1)
+		max_connections = 1;
+	pool->max_connections = max_connections;
+}
+
+void
+evhttp_connection_pool_set_idle_timeout_tv(
+    struct evhttp_connection_pool *pool, const struct timeval *tv)
+{
+	if (tv != NULL)
+		pool->idle_timeout = *tv;
+	else
+		evutil_timerclear(&pool->idle_timeout);
+}
+
+void
+evhttp_connection_pool_set_connection_cb(
+    struct evhttp_connection_pool *pool,
+    void (*cb)(struct evhttp_connection *, void *), void *cbarg)
+{
+	pool->connection_cb = cb;
+	pool->connection_cb_arg = cbarg;
+}
+
+/* Close the connections of host that have been idle for as long as its
+ * pool allows, or that are idle beyond its limit, and wait for the next
+ * to be. */
+static void
+evhttp_pool_idle_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct evhttp_pool_host *host = arg;
+	struct evhttp_connection_pool *pool = host->pool;
+	struct evhttp_connection *evcon, *next;
+	struct timeval now, expire, first;
+	int pending = 0;
+
+	evutil_timerclear(&first);
+	event_base_gettimeofday_cached(pool->base, &now);
+	for (evcon = TAILQ_FIRST(&host->connections); evcon; evcon = next) {
+		next = TAILQ_NEXT(evcon, next);
+		if (TAILQ_FIRST(&evcon->requests) != NULL)
+			continue;
+		if (host->n_connections > pool->max_connections) {
+			evhttp_connection_free(evcon);
+			continue;
+		}
+		if (!evutil_timerisset(&pool->idle_timeout))
+			continue;
+		evutil_timeradd(&evcon->pool_idle_since, &pool->idle_timeout,
+		    &expire);
+		if (evutil_timercmp(&expire, &now, <=)) {
+			evhttp_connection_free(evcon);
+		} else if (!pending || evutil_timercmp(&expire, &first, <)) {
+			first = expire;
+			pending = 1;
+		}
+	}
+	if (pending) {
+		evutil_timersub(&first, &now, &expire);
+		event_add(&host->idle_ev, &expire);
+	}
+}
+
+/* evcon, a connection of a pool, has no more requests.  Give it one that
+ * waits on another connection, or let it be idle. */
+static void
+evhttp_pool_connection_idle_(struct evhttp_connection *evcon)
+{
+	struct evhttp_pool_host *host = evcon->pool_host;
+	struct evhttp_connection_pool *pool = host->pool;
+	struct evhttp_connection *other;
+
+	TAILQ_FOREACH(other, &host->connections, next) {
+		struct evhttp_request *req = TAILQ_FIRST(&other->requests);
+		if (req == NULL || (req = TAILQ_NEXT(req, next)) == NULL)
+			continue;
+		/* the first is being worked on, but this one only waits */
+		TAILQ_REMOVE(&other->requests, req, next);
+		req->evcon = NULL;
+		evhttp_connection_enqueue_(evcon, req);
+		return;
+	}
+
+	TAILQ_REMOVE(&host->connections, evcon, next);
+	TAILQ_INSERT_HEAD(&host->connections, evcon, next);
+	event_base_gettimeofday_cached(pool->base, &evcon->pool_idle_since);
+
+	/* evcon may still be in use up the stack, so even one beyond the
+	 * limit is closed from the timer */
+	if (host->n_connections > pool->max_connections) {
+		struct timeval now = { 0, 0 };
+		evtimer_add(&host->idle_ev, &now);
+	} else if (evutil_timerisset(&pool->idle_timeout) &&
+	    !evtimer_pending(&host->idle_ev, NULL)) {
+		evtimer_add(&host->idle_ev, &pool->idle_timeout);
+	}
+}
+
+/* The connection of host to send a new request on */
+static struct evhttp_connection *
+evhttp_pool_get_connection_(struct evhttp_pool_host *host)
+{
+	struct evhttp_connection_pool *pool = host->pool;
+	struct evhttp_connection *evcon, *idle = NULL, *best = NULL;
+	int best_queued = 0;
+
+	/* one that is idle, and connected if we can */
+	TAILQ_FOREACH(evcon, &host->connections, next) {
+		if (TAILQ_FIRST(&evcon->requests) != NULL)
+			continue;
+		if (evhttp_connected(evcon))
+			return (evcon);
+		if (idle == NULL)
+			idle = evcon;
+	}
+	if (idle != NULL)
+		return (idle);
+
+	if (host->n_connections < pool->max_connections) {
+		evcon = evhttp_connection_base_new(pool->base, pool->dns_base,
+		    host->address, host->port);
+		if (evcon == NULL)
+			return (NULL);
+		evcon->pool_host = host;
+		TAILQ_INSERT_TAIL(&host->connections, evcon, next);
+		++host->n_connections;
+		if (pool->connection_cb != NULL)
+			(*pool->connection_cb)(evcon, pool->connection_cb_arg);
+		return (evcon);
+	}
+
+	/* all are busy: the one with the fewest requests to get through */
+	TAILQ_FOREACH(evcon, &host->connections, next) {
+		struct evhttp_request *req;
+		int queued = 0;
+		TAILQ_FOREACH(req, &evcon->requests, next)
+			++queued;
+		if (best == NULL || queued < best_queued) {
+			best = evcon;
+			best_queued = queued;
+		}
+	}
+	return (best);
+}
+
+/* If req failed because evcon, a connection of a pool, was kept alive and
+ * the server has closed it, send it again on another connection.  Only a
+ * request that has had no answer and would do no harm if sent twice is
+ * sent again; its body is gone by now, so it must not have one. */
+static int
+evhttp_pool_retry_(struct evhttp_connection *evcon,
+    struct evhttp_request *req, enum evhttp_request_error error)
+{
+	const char *length;
+	struct evhttp_connection *other;
+
+	if (error != EVREQ_HTTP_EOF && error != EVREQ_HTTP_BUFFER_ERROR)
+		return (0);
+	if (!(evcon->flags & EVHTTP_CON_REUSED) ||
+	    TAILQ_FIRST(&evcon->requests) != req)
+		return (0);
+	if (evcon->state != EVCON_WRITING &&
+	    (evcon->state != EVCON_READING_FIRSTLINE ||
+	     evbuffer_get_length(bufferevent_get_input(evcon->bufev)) > 0))
+		return (0);
+	switch (req->type) {
+	case EVHTTP_REQ_GET:
+	case EVHTTP_REQ_HEAD:
+	case EVHTTP_REQ_PUT:
+	case EVHTTP_REQ_DELETE:
+	case EVHTTP_REQ_OPTIONS:
+	case EVHTTP_REQ_TRACE:
+		break;
+	default:
+		return (0);
+	}
+	length = evhttp_find_known_header_(req, req->output_headers,
+	    EVHTTP_HDR_CONTENT_LENGTH);
+	if ((length != NULL && strcmp(length, "0")) ||
+	    evhttp_find_known_header_(req, req->output_headers,
+		EVHTTP_HDR_TRANSFER_ENCODING) != NULL)
+		return (0);
+
+	event_debug(("%s: sending \"%s\" to \"%s:%d\" again", __func__,
+		req->uri, evcon->address, evcon->port));
+
+	TAILQ_REMOVE(&evcon->requests, req, next);
+	req->evcon = NULL;
+	req->kind = EVHTTP_REQUEST;
+	evhttp_connection_reset_(evcon);
+	if (TAILQ_FIRST(&evcon->requests) != NULL)
+		evhttp_connection_connect_(evcon);
+	else
+		evhttp_pool_connection_idle_(evcon);
+
+	/* a fresh connection is not reused, so it is sent again only once
+	 * unless another kept-alive connection is also stale */
+	if ((other = evhttp_pool_get_connection_(evcon->pool_host)) == NULL ||
+	    evhttp_connection_enqueue_(other, req) == -1) {
+		/* as if it had failed on a connection of its own */
+		if (req->error_cb != NULL)
+			req->error_cb(error, req->cb_arg);
+		if (req->cb != NULL)
+			req->cb(NULL, req->cb_arg);
+		evhttp_request_free_auto(req);
+	}
+	return (1);
+}
+
+int
+evhttp_connection_pool_make_request(struct evhttp_connection_pool *pool,
+    const char *address, ev_uint16_t port, struct evhttp_request *req,
+    enum evhttp_cmd_type type, const char *uri)
+{
+	struct evhttp_pool_host key, *host;
+	struct evhttp_connection *evcon;
+
+	key.address = (char *)address;
+	key.port = port;
+	if ((host = HT_FIND(evhttp_pool_host_map, &pool->hosts, &key)) == NULL) {
+		if ((host = mm_calloc(1, sizeof(*host))) == NULL) {
+			event_warn("%s: calloc", __func__);
+			goto error;
+		}
+		if ((host->address = mm_strdup(address)) == NULL) {
+			event_warn("%s: strdup", __func__);
+			mm_free(host);
+			goto error;
+		}
+		host->pool = pool;
+		host->port = port;
+		TAILQ_INIT(&host->connections);
+		evtimer_assign(&host->idle_ev, pool->base,
+		    evhttp_pool_idle_cb, host);
+		HT_INSERT(evhttp_pool_host_map, &pool->hosts, host);
+	}
+
+	if ((evcon = evhttp_pool_get_connection_(host)) == NULL)
+		goto error;
+	return evhttp_make_request(evcon, req, type, uri);
+
+ error:
+	evhttp_request_free_auto(req);
+	return (-1);
+}
+
+/*
+ * Reads data from file descriptor into request structure
+ * Request structure needs to be set up correctly.
+ */
+
+void
+evhttp_start_read_(struct evhttp_connection *evcon)
+{
+	/* With pipelining, earlier responses may still be going out. */
+	if (!evcon->pipeline_depth)
+		bufferevent_disable(evcon->bufev, EV_WRITE);
+	bufferevent_enable(evcon->bufev, EV_READ);
+
+	evcon->state = EVCON_READING_FIRSTLINE;
+	/* Reset the bufferevent callbacks */
+	bufferevent_setcb(evcon->bufev,
+	    evhttp_read_cb,
+	    evhttp_write_cb,
+	    evhttp_error_cb,
+	    evcon);
+
+	/* If there's still data pending, process it next time through the
+	 * loop.  Don't do it now; that could get recusive. */
+	if (evbuffer_get_length(bufferevent_get_input(evcon->bufev))) {
+		event_deferred_cb_schedule_(get_deferred_queue(evcon),
+		    &evcon->read_more_deferred_cb);
+	}
+}
+
+void
+evhttp_start_write_(struct evhttp_connection *evcon)
+{
+	bufferevent_disable(evcon->bufev, EV_WRITE);
 	bufferevent_enable(evcon->bufev, EV_READ);
 
 	evcon->state = EVCON_WRITING;
 	evhttp_write_buffer(evcon, evhttp_write_connectioncb, NULL);
 }
 
+/* Returns true iff the connection must be closed once req, a request
+ * that we received, has been answered. */
+static int
+evhttp_request_needs_close_(struct evhttp_request *req)
+{
+	return (REQ_VERSION_BEFORE(req, 1, 1) &&
+	    !evhttp_is_connection_keepalive(req, req->input_headers)) ||
+	    evhttp_is_request_connection_close(req);
+}
+
+/*
+ * Server pipelining.  A connection with EVHTTP_SERVER_PIPELINING keeps
+ * reading requests while the user answers the ones it has read; they all
+ * stay queued on the connection in the order they came in.  The response
+ * to the request at the front goes straight to the bufferevent; any other
+ * response is kept in req->pending_output until the ones before it have
+ * been sent.
+ */
+
+/* Return the buffer that the response to req should be written to, or
+ * NULL if we could not allocate one; then the connection is gone. */
+static struct evbuffer *
+evhttp_request_output_(struct evhttp_connection *evcon,
+    struct evhttp_request *req)
+{
+	if (TAILQ_FIRST(&evcon->requests) == req)
+		return bufferevent_get_output(evcon->bufev);
+
+	if (req->pending_output == NULL &&
+	    (req->pending_output = evbuffer_new()) == NULL) {
+		event_warn("%s: evbuffer_new", __func__);
+		evhttp_connection_release_user_requests_(evcon);
+		evhttp_connection_free(evcon);
+	}
+	return req->pending_output;
+}
+
+/* Called when the user starts answering req.  If req is still being read,
+ * it is answered from what has been read so far, and nothing after it will
+ * be. */
+static void
+evhttp_request_stop_reading_(struct evhttp_connection *evcon,
+    struct evhttp_request *req)
+{
+	/* A handler that answers before it has the whole body gets no more
+	 * of it, and we cannot find the next request after it */
+	if ((req->flags & EVHTTP_REQ_STREAM_BODY) &&
+	    evhttp_connection_is_reading_(evcon) &&
+	    evhttp_connection_reading_request_(evcon) == req) {
+		evcon->state = EVCON_WRITING;
+		evcon->flags &= ~EVHTTP_CON_BODY_PAUSED;
+		if (evcon->pipeline_depth)
+			evcon->flags |= EVHTTP_CON_PIPELINE_STOP;
+		bufferevent_disable(evcon->bufev, EV_READ);
+		evhttp_remove_known_header_(req, req->output_headers,
+		    EVHTTP_HDR_CONNECTION);
+		evhttp_request_add_header_(req, req->output_headers,
+		    "Connection", "close");
+		return;
+	}
+
+	if (evcon->pipeline_depth && evhttp_connection_is_reading_(evcon) &&
+	    TAILQ_LAST(&evcon->requests, evcon_requestq) == req) {
+		evcon->state = EVCON_WRITING;
+		evcon->flags |= EVHTTP_CON_PIPELINE_STOP;
+		bufferevent_disable(evcon->bufev, EV_READ);
+	}
+}
+
+/* Start reading another request on evcon, unless it is reading one
+ * already, has as many as it may, or must not read any more. */
+static void
+evhttp_connection_read_next_(struct evhttp_connection *evcon)
+{
+	struct evhttp_request *req;
+	int n = 0;
+
+	if ((evcon->flags & EVHTTP_CON_PIPELINE_STOP) ||
+	    evhttp_connection_is_reading_(evcon))
+		return;
+
+	TAILQ_FOREACH(req, &evcon->requests, next) {
+		if (++n >= evcon->pipeline_depth)
+			return;
+	}
+
+	req = TAILQ_LAST(&evcon->requests, evcon_requestq);
+	if ((req != NULL && evhttp_request_needs_close_(req)) ||
+	    evhttp_associate_new_request_with_connection(evcon) == -1)
+		evcon->flags |= EVHTTP_CON_PIPELINE_STOP;
+}
+
+/* Called when reading on evcon fails with requests still to be answered
+ * before the one being read.  Returns 1 if we dealt with it, and 0 if it
+ * should fail the connection as usual. */
+static int
+evhttp_connection_pipeline_read_error_(struct evhttp_connection *evcon,
+    short what)
+{
+	struct evhttp_request *req = TAILQ_LAST(&evcon->requests, evcon_requestq);
+	int reading = evhttp_connection_is_reading_(evcon);
+
+	if (TAILQ_FIRST(&evcon->requests) == req && reading)
+		return (0);
+
+	if (what & BEV_EVENT_TIMEOUT) {
+		/* The client is probably waiting for its responses; try
+		 * again once the next one has been sent. */
+		evcon->flags |= EVHTTP_CON_READ_PAUSED;
+		return (1);
+	}
+
+	if (what & BEV_EVENT_EOF) {
+		/* The client has sent all it will: drop any request that it
+		 * did not finish, and close once we answer the rest. */
+		if (reading) {
+			if ((req->flags & EVHTTP_REQ_STREAM_BODY) &&
+			    !req->userdone)
+				evhttp_request_body_failed_(req,
+				    EVREQ_HTTP_EOF);
+			else
+				evhttp_request_free_(evcon, req);
+			evcon->state = EVCON_WRITING;
+		}
+		evcon->flags |= EVHTTP_CON_PIPELINE_STOP;
+		bufferevent_disable(evcon->bufev, EV_READ);
+		return (1);
+	}
+
+	return (0);
+}
+
+/* Called once the response at the front of evcon's queue has been sent
+ * and taken off it: send whatever is ready of the next one, and read more
+ * if we can. */
+static void
+evhttp_connection_pipeline_next_(struct evhttp_connection *evcon)
+{
+	struct evhttp_request *req = TAILQ_FIRST(&evcon->requests);
+
+	evcon->cb = NULL;
+	evcon->cb_arg = NULL;
+
+	if (evcon->flags & EVHTTP_CON_READ_PAUSED) {
+		evcon->flags &= ~EVHTTP_CON_READ_PAUSED;
+		bufferevent_enable(evcon->bufev, EV_READ);
+	}
+
+	if (req != NULL && req->pending_output != NULL) {
+		evbuffer_add_buffer(bufferevent_get_output(evcon->bufev),
+		    req->pending_output);
+		evbuffer_free(req->pending_output);
+		req->pending_output = NULL;
+		if (req->userdone)
+			evhttp_write_buffer(evcon, evhttp_send_done, NULL);
+		else
+			evhttp_write_buffer(evcon,
+			    req->pending_cb, req->pending_cb_arg);
+	} else if (req != NULL && (req->flags & EVHTTP_REQ_NEEDS_CONTINUE)) {
+		/* Its 100 Continue was held back for the responses before
+		 * it; send it now, unless the client went ahead anyway. */
+		req->flags &= ~EVHTTP_REQ_NEEDS_CONTINUE;
+		if (evcon->state == EVCON_READING_BODY &&
+		    evhttp_connection_reading_request_(evcon) == req &&
+		    !req->body_size &&
+		    !evbuffer_get_length(bufferevent_get_input(evcon->bufev)))
+			evhttp_send_continue(evcon, req);
+	}
+
+	evhttp_connection_read_next_(evcon);
+
+	/* Nothing left to answer, and nothing more to read */
+	if (TAILQ_FIRST(&evcon->requests) == NULL)
+		evhttp_connection_free(evcon);
+}
+
 static void
 evhttp_send_done(struct evhttp_connection *evcon, void *arg)
 {
 	int need_close;
+	struct evhttp_arena_chunk *arena;
 	struct evhttp_request *req = TAILQ_FIRST(&evcon->requests);
 	TAILQ_REMOVE(&evcon->requests, req, next);
 
@@ -2947,19 +4336,24 @@ evhttp_send_done(struct evhttp_connection *evcon, void *arg)
 		req->on_complete_cb(req, req->on_complete_cb_arg);
 	}
 
-	need_close =
-	    (REQ_VERSION_BEFORE(req, 1, 1) &&
-	    !evhttp_is_connection_keepalive(req->input_headers)) ||
-	    evhttp_is_request_connection_close(req);
+	need_close = evhttp_request_needs_close_(req);
 
 	EVUTIL_ASSERT(req->flags & EVHTTP_REQ_OWN_CONNECTION);
+	arena = need_close ? NULL : evhttp_request_detach_arena_(evcon, req);
 	evhttp_request_free(req);
+	evhttp_connection_keep_arena_(evcon, arena);
 
 	if (need_close) {
+		evhttp_connection_release_user_requests_(evcon);
 		evhttp_connection_free(evcon);
 		return;
 	}
 
+	if (evcon->pipeline_depth) {
+		evhttp_connection_pipeline_next_(evcon);
+		return;
+	}
+
 	/* we have a persistent connection; try to accept another request. */
 	if (evhttp_associate_new_request_with_connection(evcon) == -1) {
 		evhttp_connection_free(evcon);
@@ -3000,19 +4394,306 @@ evhttp_send_error(struct evhttp_request *req, int error, const char *reason)
 #undef ERR_FORMAT
 }
 
+/* Return the weight, from 0 to 1000, of a qvalue (RFC 7231 section
+ * 5.3.1). */
+static int
+evhttp_parse_qvalue_(const char *p)
+{
+	int q = 0, scale = 1000;
+
+	if (*p == '1')
+		return (1000);
+	if (*p != '0')
+		return (0);
+	if (*++p == '.') {
+		while (scale > 1 && *++p >= '0' && *p <= '9') {
+			scale /= 10;
+			q += (*p - '0') * scale;
+		}
+	}
+	return (q);
+}
+
+/* Return the weight, from 0 to 1000, that the Accept-Encoding header value
+ * accept gives to the content coding name. */
+static int
+evhttp_accept_encoding_q_(const char *accept, const char *name)
+{
+	size_t name_len = strlen(name), len;
+	const char *p = accept, *token;
+	int q, wildcard = 0;
+
+	while (*p) {
+		p += strspn(p, " \t,");
+		token = p;
+		p += strcspn(p, " \t,;");
+		len = p - token;
+		q = 1000;
+		/* the parameters, of which only q means anything */
+		while (*p && *p != ',') {
+			p += strspn(p, " \t;");
+			if ((*p == 'q' || *p == 'Q') && p[1] == '=')
+				q = evhttp_parse_qvalue_(p + 2);
+			p += strcspn(p, ";,");
+		}
+		if (len == name_len &&
+		    !evutil_ascii_strncasecmp(token, name, len))
+			return (q);
+		if (len == 1 && *token == '*')
+			wildcard = q;
+	}
+	return (wildcard);
+}
+
+/* Choose, for a request to http, the first of http's content codings that
+ * the request accepts. */
+static void
+evhttp_choose_encoder_(struct evhttp *http, struct evhttp_request *req)
+{
+	struct evhttp_content_encoder *encoder;
+	const char *accept;
+
+	if (TAILQ_EMPTY(&http->encoders))
+		return;
+	accept = evhttp_find_known_header_(req, req->input_headers,
+	    EVHTTP_HDR_ACCEPT_ENCODING);
+	if (accept == NULL)
+		return;
+
+	TAILQ_FOREACH(encoder, &http->encoders, next) {
+		if (evhttp_accept_encoding_q_(accept, encoder->name) > 0) {
+			req->encoder = encoder;
+			req->compress_level = http->compress_level;
+			req->compress_min_size = http->compress_min_size;
+			return;
+		}
+	}
+}
+
+/* Whether content_type is of data that is compressed already. */
+static int
+evhttp_is_compressed_type_(const char *content_type)
+{
+	static const char *const types[] = {
+		"image/", "audio/", "video/", "font/woff",
+		"application/zip", "application/gzip", "application/x-gzip",
+		"application/x-bzip2", "application/x-xz", "application/zstd",
+		"application/x-7z-compressed", "application/x-rar-compressed",
+		NULL
+	};
+	int i;
+
+	if (!evutil_ascii_strncasecmp(content_type, "image/svg+xml", 13))
+		return (0);
+	for (i = 0; types[i] != NULL; ++i) {
+		if (!evutil_ascii_strncasecmp(content_type, types[i],
+			strlen(types[i])))
+			return (1);
+	}
+	return (0);
+}
+
+/* Done compressing the response to req, whether or not it all was. */
+static void
+evhttp_compress_end_(struct evhttp_request *req)
+{
+	if (req->encoder_ctx != NULL) {
+		if (req->encoder->free_cb != NULL)
+			(*req->encoder->free_cb)(req->encoder_ctx,
+			    req->encoder->arg);
+		req->encoder_ctx = NULL;
+	}
+	if (req->encoder_buf != NULL) {
+		evbuffer_free(req->encoder_buf);
+		req->encoder_buf = NULL;
+	}
+	req->encoder = NULL;
+}
+
+/* Start compressing the response to req, if it should be, and set its
+ * headers to say so.  length is how long the body is, or -1 if that is not
+ * known yet. */
+static void
+evhttp_compress_start_(struct evhttp_request *req, ev_int64_t length)
+{
+	struct evhttp_content_encoder *encoder = req->encoder;
+	const char *value;
+
+	if (encoder == NULL || req->encoder_ctx != NULL)
+		return;
+
+	/* 206 Partial Content: a range of the uncompressed body */
+	if (!evhttp_response_needs_body(req) || req->response_code == 206)
+		goto skip;
+	if (evhttp_find_known_header_(req, req->output_headers,
+		EVHTTP_HDR_CONTENT_ENCODING) != NULL)
+		goto skip;
+	value = evhttp_find_known_header_(req, req->output_headers,
+	    EVHTTP_HDR_CONTENT_TYPE);
+	if (value != NULL && evhttp_is_compressed_type_(value))
+		goto skip;
+	if (length < 0) {
+		value = evhttp_find_known_header_(req, req->output_headers,
+		    EVHTTP_HDR_CONTENT_LENGTH);
+		if (value != NULL)
+			length = evutil_strtoll(value, NULL, 10);
+	}
+	if (length >= 0 && (ev_uint64_t)length < req->compress_min_size)
+		goto skip;
+
+	if ((req->encoder_buf = evbuffer_new()) == NULL)
+		goto skip;
+	req->encoder_ctx = (*encoder->init_cb)(req->compress_level,
+	    encoder->arg);
+	if (req->encoder_ctx == NULL)
+		goto skip;
+
+	evhttp_remove_known_header_(req, req->output_headers,
+	    EVHTTP_HDR_CONTENT_LENGTH);
+	evhttp_request_add_header_(req, req->output_headers,
+	    "Content-Encoding", encoder->name);
+	evhttp_request_add_header_(req, req->output_headers,
+	    "Vary", "Accept-Encoding");
+	return;
+
+skip:
+	evhttp_compress_end_(req);
+}
+
+/*
+ * Compress all of src, or nothing if src is NULL, onto the end of dst.
+ * The encoder writes straight into space reserved in dst's chains, and
+ * reads straight out of src's.  Returns -1 if the encoder failed.
+ */
+static int
+evhttp_compress_(struct evhttp_request *req, struct evbuffer *src,
+    struct evbuffer *dst, int flags)
+{
+	struct evhttp_content_encoder *encoder = req->encoder;
+	struct evbuffer_iovec in, out;
+	size_t in_len, out_len;
+	int n, res;
+
+	for (;;) {
+		/* how many chains src has, and the first of them */
+		n = src != NULL ? evbuffer_peek(src,
+		    evbuffer_get_length(src), NULL, &in, 1) : 0;
+		if (n == 0) {
+			if (!flags)
+				return (0);
+			in.iov_base = NULL;
+			in.iov_len = 0;
+		}
+		if (evbuffer_reserve_space(dst, HTTP_COMPRESS_RESERVE,
+			&out, 1) < 1)
+			return (-1);
+
+		in_len = in.iov_len;
+		out_len = out.iov_len;
+		res = (*encoder->encode_cb)(req->encoder_ctx,
+		    in.iov_base, &in_len, out.iov_base, &out_len,
+		    n <= 1 ? flags : 0);
+		if (res < 0 || in_len > in.iov_len || out_len > out.iov_len)
+			return (-1);
+
+		out.iov_len = out_len;
+		if (evbuffer_commit_space(dst, &out, 1) < 0)
+			return (-1);
+		if (in_len && evbuffer_drain(src, in_len) < 0)
+			return (-1);
+
+		if (res == 0 && n <= 1 && in_len == in.iov_len)
+			return (0);
+		/* an encoder that is stuck would have us loop forever */
+		if (!in_len && !out_len)
+			return (-1);
+	}
+}
+
+/* The encoder failed on the response to req: the rest of it is thrown
+ * away, and the response is cut short once the user is done with it. */
+static void
+evhttp_compress_failed_(struct evhttp_request *req)
+{
+	event_warnx("%s: could not compress the response with \"%s\"",
+	    __func__, req->encoder->name);
+	evhttp_compress_end_(req);
+	req->flags |= EVHTTP_REQ_COMPRESS_FAILED;
+}
+
+/* Compress the whole body of the response to req, in its output buffer, if
+ * it should be.  Returns -1 if the encoder failed. */
+static int
+evhttp_compress_body_(struct evhttp_request *req)
+{
+	evhttp_compress_start_(req, evbuffer_get_length(req->output_buffer));
+	if (req->encoder_ctx == NULL)
+		return (0);
+
+	if (evhttp_compress_(req, req->output_buffer, req->encoder_buf,
+		EVHTTP_ENCODE_FINISH) < 0) {
+		evhttp_compress_failed_(req);
+		return (-1);
+	}
+	evbuffer_add_buffer(req->output_buffer, req->encoder_buf);
+	evhttp_compress_end_(req);
+	return (0);
+}
+
+/* Give up on the response to req, which the user is done with, because it
+ * could not be compressed: reset its stream, or close its connection
+ * without the end of the body, so that the client knows it is cut short. */
+static void
+evhttp_send_aborted_(struct evhttp_request *req)
+{
+	struct evhttp_connection *evcon = req->evcon;
+
+	if (req->h2_stream != NULL) {
+		evhttp2_cancel_request_(req);
+		return;
+	}
+	req->userdone = 1;
+	evhttp_connection_release_user_requests_(evcon);
+	evhttp_connection_free(evcon);
+}
+
 /* Requires that headers and response code are already set up */
 
 static inline void
 evhttp_send(struct evhttp_request *req, struct evbuffer *databuf)
 {
 	struct evhttp_connection *evcon = req->evcon;
+	struct evbuffer *output;
 
 	if (evcon == NULL) {
 		evhttp_request_free(req);
 		return;
 	}
 
-	EVUTIL_ASSERT(TAILQ_FIRST(&evcon->requests) == req);
+	if (req->h2_stream != NULL) {
+		req->userdone = 1;
+		if (databuf != NULL)
+			evbuffer_add_buffer(req->output_buffer, databuf);
+		if (evhttp_compress_body_(req) < 0) {
+			evhttp_send_aborted_(req);
+			return;
+		}
+		evhttp_make_header_h2_(req, 1);
+		if (!evhttp_response_needs_body(req) ||
+		    evbuffer_get_length(req->output_buffer) == 0) {
+			evhttp2_send_headers_(req, 1);
+			return;
+		}
+		evhttp2_send_headers_(req, 0);
+		evhttp2_send_data_(req, req->output_buffer, 1, NULL, NULL);
+		return;
+	}
+
+	evhttp_request_stop_reading_(evcon, req);
+	if ((output = evhttp_request_output_(evcon, req)) == NULL) {
+		evhttp_request_free(req);
+		return;
+	}
 
 	/* we expect no more calls form the user on this request */
 	req->userdone = 1;
@@ -3021,8 +4702,17 @@ evhttp_send(struct evhttp_request *req, struct evbuffer *databuf)
 	if (databuf != NULL)
 		evbuffer_add_buffer(req->output_buffer, databuf);
 
+	if (evhttp_compress_body_(req) < 0) {
+		evhttp_send_aborted_(req);
+		return;
+	}
+
 	/* Adds headers to the response */
-	evhttp_make_header(evcon, req);
+	evhttp_make_header(evcon, req, output);
+
+	/* held until the responses before it have been sent */
+	if (output == req->pending_output)
+		return;
 
 	evhttp_write_buffer(evcon, evhttp_send_done, NULL);
 }
@@ -3040,12 +4730,27 @@ void
 evhttp_send_reply_start(struct evhttp_request *req, int code,
     const char *reason)
 {
+	struct evbuffer *output;
+
 	evhttp_response_code_(req, code, reason);
 
 	if (req->evcon == NULL)
 		return;
 
-	if (evhttp_find_header(req->output_headers, "Content-Length") == NULL &&
+	evhttp_compress_start_(req, -1);
+
+	if (req->h2_stream != NULL) {
+		/* the body goes in DATA frames, not chunks */
+		req->chunked = 0;
+		evhttp_make_header_h2_(req, 0);
+		evhttp2_send_headers_(req, 0);
+		return;
+	}
+
+	evhttp_request_stop_reading_(req->evcon, req);
+
+	if (evhttp_find_known_header_(req, req->output_headers,
+		EVHTTP_HDR_CONTENT_LENGTH) == NULL &&
 	    REQ_VERSION_ATLEAST(req, 1, 1) &&
 	    evhttp_response_needs_body(req)) {
 		/*
@@ -3053,32 +4758,40 @@ evhttp_send_reply_start(struct evhttp_request *req, int code,
 		 * note RFC 2616 section 4.4 forbids it with Content-Length:
 		 * and it's not necessary then anyway.
 		 */
-		evhttp_add_header(req->output_headers, "Transfer-Encoding",
-		    "chunked");
+		evhttp_request_add_header_(req, req->output_headers,
+		    "Transfer-Encoding", "chunked");
 		req->chunked = 1;
 	} else {
 		req->chunked = 0;
 	}
-	evhttp_make_header(req->evcon, req);
+	if ((output = evhttp_request_output_(req->evcon, req)) == NULL)
+		return;
+	evhttp_make_header(req->evcon, req, output);
+	if (output == req->pending_output) {
+		req->pending_cb = NULL;
+		req->pending_cb_arg = NULL;
+		return;
+	}
 	evhttp_write_buffer(req->evcon, NULL, NULL);
 }
 
-void
-evhttp_send_reply_chunk_with_cb(struct evhttp_request *req, struct evbuffer *databuf,
+static void
+evhttp_send_reply_chunk_(struct evhttp_request *req, struct evbuffer *databuf,
     void (*cb)(struct evhttp_connection *, void *), void *arg)
 {
 	struct evhttp_connection *evcon = req->evcon;
 	struct evbuffer *output;
 
-	if (evcon == NULL)
-		return;
-
-	output = bufferevent_get_output(evcon->bufev);
-
 	if (evbuffer_get_length(databuf) == 0)
 		return;
 	if (!evhttp_response_needs_body(req))
 		return;
+	if (req->h2_stream != NULL) {
+		evhttp2_send_data_(req, databuf, 0, cb, arg);
+		return;
+	}
+	if ((output = evhttp_request_output_(evcon, req)) == NULL)
+		return;
 	if (req->chunked) {
 		evbuffer_add_printf(output, "%x\r\n",
 				    (unsigned)evbuffer_get_length(databuf));
@@ -3087,7 +4800,34 @@ evhttp_send_reply_chunk_with_cb(struct evhttp_request *req, struct evbuffer *dat
 	if (req->chunked) {
 		evbuffer_add(output, "\r\n", 2);
 	}
-	evhttp_write_buffer(evcon, cb, arg);
+	if (output == req->pending_output) {
+		req->pending_cb = cb;
+		req->pending_cb_arg = arg;
+		return;
+	}
+	evhttp_write_buffer(evcon, cb, arg);
+}
+
+void
+evhttp_send_reply_chunk_with_cb(struct evhttp_request *req, struct evbuffer *databuf,
+    void (*cb)(struct evhttp_connection *, void *), void *arg)
+{
+	if (req->evcon == NULL)
+		return;
+
+	if (req->flags & EVHTTP_REQ_COMPRESS_FAILED) {
+		evbuffer_drain(databuf, evbuffer_get_length(databuf));
+		return;
+	}
+	if (req->encoder_ctx != NULL && evbuffer_get_length(databuf)) {
+		if (evhttp_compress_(req, databuf, req->encoder_buf,
+			EVHTTP_ENCODE_FLUSH) < 0) {
+			evhttp_compress_failed_(req);
+			return;
+		}
+		databuf = req->encoder_buf;
+	}
+	evhttp_send_reply_chunk_(req, databuf, cb, arg);
 }
 
 void
@@ -3106,11 +4846,50 @@ evhttp_send_reply_end(struct evhttp_request *req)
 		return;
 	}
 
-	output = bufferevent_get_output(evcon->bufev);
+	if (req->flags & EVHTTP_REQ_COMPRESS_FAILED) {
+		evhttp_send_aborted_(req);
+		return;
+	}
+	if (req->encoder_ctx != NULL) {
+		/* the end of the compressed data */
+		if (evhttp_compress_(req, NULL, req->encoder_buf,
+			EVHTTP_ENCODE_FINISH) < 0) {
+			evhttp_compress_failed_(req);
+			evhttp_send_aborted_(req);
+			return;
+		}
+		evhttp_send_reply_chunk_(req, req->encoder_buf, NULL, NULL);
+		evhttp_compress_end_(req);
+		/* that may have found the connection gone */
+		if ((evcon = req->evcon) == NULL) {
+			evhttp_request_free(req);
+			return;
+		}
+	}
+
+	if (req->h2_stream != NULL) {
+		req->userdone = 1;
+		evhttp2_send_data_(req, NULL, 1, NULL, NULL);
+		return;
+	}
+
+	if ((output = evhttp_request_output_(evcon, req)) == NULL) {
+		evhttp_request_free(req);
+		return;
+	}
 
 	/* we expect no more calls form the user on this request */
 	req->userdone = 1;
 
+	if (output == req->pending_output) {
+		/* sent, with evhttp_send_done(), once it is this one's turn */
+		if (req->chunked) {
+			evbuffer_add(output, "0\r\n\r\n", 5);
+			req->chunked = 0;
+		}
+		return;
+	}
+
 	if (req->chunked) {
 		evbuffer_add(output, "0\r\n\r\n", 5);
 		evhttp_write_buffer(req->evcon, evhttp_send_done, NULL);
@@ -3220,15 +4999,11 @@ evhttp_response_code_(struct evhttp_request *req, int code, const char *reason)
 {
 	req->kind = EVHTTP_RESPONSE;
 	req->response_code = code;
-	if (req->response_code_line != NULL)
-		mm_free(req->response_code_line);
 	if (reason == NULL)
 		reason = evhttp_response_phrase_internal(code);
-	req->response_code_line = mm_strdup(reason);
-	if (req->response_code_line == NULL) {
+	req->response_code_line = evhttp_request_strdup_(req, reason);
+	if (req->response_code_line == NULL)
 		event_warn("%s: strdup", __func__);
-		/* XXX what else can we do? */
-	}
 }
 
 void
@@ -3242,13 +5017,466 @@ evhttp_send_page_(struct evhttp_request *req, struct evbuffer *databuf)
 	if (req->kind != EVHTTP_RESPONSE)
 		evhttp_response_code_(req, 200, "OK");
 
-	evhttp_clear_headers(req->output_headers);
-	evhttp_add_header(req->output_headers, "Content-Type", "text/html");
-	evhttp_add_header(req->output_headers, "Connection", "close");
+	evhttp_clear_headers_(req, req->output_headers);
+	evhttp_request_add_header_(req, req->output_headers,
+	    "Content-Type", "text/html");
+	evhttp_request_add_header_(req, req->output_headers,
+	    "Connection", "close");
 
 	evhttp_send(req, databuf);
 }
 
+#ifndef _WIN32
+/*
+ * Static files
+ */
+
+static const struct {
+	const char *extension;
+	const char *content_type;
+} evhttp_static_types[] = {
+	{ "html", "text/html; charset=utf-8" },
+	{ "htm", "text/html; charset=utf-8" },
+	{ "css", "text/css" },
+	{ "js", "text/javascript" },
+	{ "mjs", "text/javascript" },
+	{ "json", "application/json" },
+	{ "txt", "text/plain; charset=utf-8" },
+	{ "xml", "application/xml" },
+	{ "svg", "image/svg+xml" },
+	{ "png", "image/png" },
+	{ "jpg", "image/jpeg" },
+	{ "jpeg", "image/jpeg" },
+	{ "gif", "image/gif" },
+	{ "webp", "image/webp" },
+	{ "ico", "image/x-icon" },
+	{ "pdf", "application/pdf" },
+	{ "wasm", "application/wasm" },
+	{ "woff", "font/woff" },
+	{ "woff2", "font/woff2" },
+	{ "mp4", "video/mp4" },
+	{ "zip", "application/zip" },
+	{ "gz", "application/gzip" },
+	{ NULL, NULL },
+};
+
+static const char *
+evhttp_static_content_type_(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	const char *dot = strrchr(path, '.');
+	int i;
+
+	if (dot != NULL && (slash == NULL || dot > slash)) {
+		for (i = 0; evhttp_static_types[i].extension != NULL; ++i) {
+			if (!evutil_ascii_strcasecmp(dot + 1,
+				evhttp_static_types[i].extension))
+				return evhttp_static_types[i].content_type;
+		}
+	}
+	return "application/octet-stream";
+}
+
+static inline unsigned
+evhttp_static_file_hash(const struct evhttp_static_file *file)
+{
+	return ht_improve_hash_(ht_string_hash_(file->path));
+}
+
+static inline int
+evhttp_static_file_eq(const struct evhttp_static_file *a,
+    const struct evhttp_static_file *b)
+{
+	return !strcmp(a->path, b->path);
+}
+
+HT_PROTOTYPE(evhttp_static_file_map, evhttp_static_file, node,
+    evhttp_static_file_hash, evhttp_static_file_eq)
+HT_GENERATE(evhttp_static_file_map, evhttp_static_file, node,
+    evhttp_static_file_hash, evhttp_static_file_eq,
+    0.5, mm_malloc, mm_realloc, mm_free)
+
+/* Take file out of http's cache.  It is closed once it is no longer being
+ * sent. */
+static void
+evhttp_static_file_free_(struct evhttp *http, struct evhttp_static_file *file)
+{
+	HT_REMOVE(evhttp_static_file_map, &http->static_files, file);
+	TAILQ_REMOVE(&http->static_lru, file, next);
+	evbuffer_file_segment_free(file->seg);
+	mm_free(file->path);
+	mm_free(file);
+
+	if (--http->n_static_files == 0 && event_initialized(&http->static_ev))
+		event_del(&http->static_ev);
+}
+
+/* Parse an HTTP date in the format of RFC 7231 section 7.1.1.1, such as
+ * "Sun, 06 Nov 1994 08:49:37 GMT".  Returns -1 if it is not one. */
+static ev_int64_t
+evhttp_parse_date_(const char *date)
+{
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	const char *p;
+	char month[4];
+	int day, year, hour, min, sec, m, y, era, yoe, doy;
+
+	if (sscanf(date, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT",
+		&day, month, &year, &hour, &min, &sec) != 6)
+		return (-1);
+	if (strlen(month) != 3 || (p = strstr(months, month)) == NULL ||
+	    (p - months) % 3 != 0 || year < 1970)
+		return (-1);
+	m = (int)(p - months) / 3 + 1;
+
+	/* the days since 1970-01-01 of the proleptic Gregorian calendar */
+	y = year - (m <= 2);
+	era = y / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + day - 1;
+	return ((ev_int64_t)era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 +
+	    doy - 719468) * 86400 + hour * 3600 + min * 60 + sec;
+}
+
+/* Parse the Range header value for a file of size bytes.  Returns 1 and
+ * sets start and length for a single satisfiable byte range, -1 for an
+ * unsatisfiable one, and 0 if the header should be ignored. */
+static int
+evhttp_parse_range_(const char *value, ev_int64_t size,
+    ev_int64_t *start, ev_int64_t *length)
+{
+	ev_int64_t first, last;
+	char *end;
+
+	if (evutil_ascii_strncasecmp(value, "bytes=", 6))
+		return (0);
+	value += 6;
+	/* several ranges: send the whole file instead */
+	if (strchr(value, ',') != NULL)
+		return (0);
+
+	if (*value == '-') {
+		/* the last so many bytes */
+		last = evutil_strtoll(value + 1, &end, 10);
+		if (end == value + 1 || *end != '\0' || last < 0)
+			return (0);
+		if (last == 0 || size == 0)
+			return (-1);
+		*length = last < size ? last : size;
+		*start = size - *length;
+		return (1);
+	}
+
+	if (*value < '0' || *value > '9')
+		return (0);
+	first = evutil_strtoll(value, &end, 10);
+	if (*end++ != '-')
+		return (0);
+	if (*end == '\0') {
+		last = size - 1;
+	} else {
+		value = end;
+		last = evutil_strtoll(value, &end, 10);
+		if (*value < '0' || *value > '9' || *end != '\0' ||
+		    last < first)
+			return (0);
+		if (last >= size)
+			last = size - 1;
+	}
+	if (first >= size)
+		return (-1);
+	*start = first;
+	*length = last - first + 1;
+	return (1);
+}
+
+/* Whether the If-None-Match or If-Modified-Since header of req says that
+ * the client has file as it is. */
+static int
+evhttp_static_not_modified_(struct evhttp_request *req,
+    const struct evhttp_static_file *file)
+{
+	const char *value;
+	ev_int64_t since;
+
+	value = evhttp_find_header(req->input_headers, "If-None-Match");
+	if (value != NULL)
+		return !strcmp(value, "*") || strstr(value, file->etag) != NULL;
+	value = evhttp_find_header(req->input_headers, "If-Modified-Since");
+	if (value != NULL && (since = evhttp_parse_date_(value)) >= 0)
+		return file->mtime <= since;
+	return (0);
+}
+
+/* Whether a Range header of req applies: it has no If-Range header, or one
+ * that names file as it is. */
+static int
+evhttp_static_if_range_(struct evhttp_request *req,
+    const struct evhttp_static_file *file)
+{
+	const char *value = evhttp_find_header(req->input_headers, "If-Range");
+
+	return value == NULL || !strcmp(value, file->etag) ||
+	    !strcmp(value, file->last_modified);
+}
+
+/* Whether path, from a request, stays in the directory that it is looked
+ * up in. */
+static int
+evhttp_static_path_ok_(const char *path)
+{
+	size_t n;
+
+	while (*path) {
+		path += strspn(path, "/");
+		n = strcspn(path, "/");
+		if (n == 2 && path[0] == '.' && path[1] == '.')
+			return (0);
+		path += n;
+	}
+	return (1);
+}
+
+/*
+ * Send length bytes of file, from start, as the response to req.  On a
+ * connection of its own, the file goes straight into the connection's
+ * output buffer, so that a socket can send it with sendfile(); a response
+ * that is compressed, or goes in HTTP/2 frames, is read from a memory map.
+ */
+static void
+evhttp_static_send_(struct evhttp_request *req, int code,
+    struct evhttp_static_file *file, ev_int64_t start, ev_int64_t length)
+{
+	struct evhttp_connection *evcon = req->evcon;
+	struct evbuffer *output;
+	char len[22];
+
+	evhttp_response_code_(req, code, NULL);
+	evutil_snprintf(len, sizeof(len), EV_I64_FMT, EV_I64_ARG(length));
+
+	evhttp_compress_start_(req, length);
+	if (!evhttp_response_needs_body(req)) {
+		/* HEAD */
+		evhttp_request_add_header_(req, req->output_headers,
+		    "Content-Length", len);
+		evhttp_send(req, NULL);
+		return;
+	}
+	if (req->h2_stream != NULL || req->encoder_ctx != NULL) {
+		if (length > 0 && evbuffer_add_file_segment(req->output_buffer,
+			file->seg, start, length) < 0) {
+			evhttp_compress_end_(req);
+			evhttp_send_error(req, HTTP_INTERNAL, NULL);
+			return;
+		}
+		evhttp_send(req, NULL);
+		return;
+	}
+
+	evhttp_request_stop_reading_(evcon, req);
+	if ((output = evhttp_request_output_(evcon, req)) == NULL) {
+		evhttp_request_free(req);
+		return;
+	}
+
+	/* we expect no more calls form the user on this request */
+	req->userdone = 1;
+
+	evhttp_request_add_header_(req, req->output_headers,
+	    "Content-Length", len);
+	evhttp_make_header(evcon, req, output);
+	if (length > 0 &&
+	    evbuffer_add_file_segment(output, file->seg, start, length) < 0) {
+		evhttp_send_aborted_(req);
+		return;
+	}
+
+	/* held until the responses before it have been sent */
+	if (output == req->pending_output)
+		return;
+
+	evhttp_write_buffer(evcon, evhttp_send_done, NULL);
+}
+
+/* Check that the files in http's cache have not changed, and forget those
+ * that have. */
+static void
+evhttp_static_revalidate_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct evhttp *http = arg;
+	struct evhttp_static_file *file, *next;
+	struct stat st;
+
+	for (file = TAILQ_FIRST(&http->static_lru); file != NULL; file = next) {
+		next = TAILQ_NEXT(file, next);
+		if (stat(file->path, &st) < 0 ||
+		    file->dev != (ev_uint64_t)st.st_dev ||
+		    file->ino != (ev_uint64_t)st.st_ino ||
+		    file->size != (ev_int64_t)st.st_size ||
+		    file->mtime != (ev_int64_t)st.st_mtime)
+			evhttp_static_file_free_(http, file);
+	}
+}
+
+/* Return the file at path from http's cache, opening it if it is not there
+ * yet; or NULL if it is not a regular file that we can open. */
+static struct evhttp_static_file *
+evhttp_static_file_get_(struct evhttp *http, const char *path)
+{
+	struct evhttp_static_file find, *file;
+	struct stat st;
+	struct tm tm;
+	time_t mtime;
+	int fd, flags = O_RDONLY;
+
+	find.path = (char *)path;
+	file = HT_FIND(evhttp_static_file_map, &http->static_files, &find);
+	if (file != NULL) {
+		TAILQ_REMOVE(&http->static_lru, file, next);
+		TAILQ_INSERT_HEAD(&http->static_lru, file, next);
+		return (file);
+	}
+
+#ifdef O_CLOEXEC
+	flags |= O_CLOEXEC;
+#endif
+	if ((fd = open(path, flags)) < 0)
+		return (NULL);
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    (file = mm_calloc(1, sizeof(*file))) == NULL) {
+		close(fd);
+		return (NULL);
+	}
+	if ((file->path = mm_strdup(path)) == NULL ||
+	    (file->seg = evbuffer_file_segment_new(fd, 0, st.st_size,
+		EVBUF_FS_CLOSE_ON_FREE)) == NULL) {
+		event_warn("%s: cannot cache %s", __func__, path);
+		if (file->path != NULL)
+			mm_free(file->path);
+		mm_free(file);
+		close(fd);
+		return (NULL);
+	}
+
+	file->dev = st.st_dev;
+	file->ino = st.st_ino;
+	file->size = st.st_size;
+	file->mtime = st.st_mtime;
+	file->content_type = evhttp_static_content_type_(path);
+	evutil_snprintf(file->etag, sizeof(file->etag), "\"" EV_I64_FMT "-"
+	    EV_I64_FMT "\"", EV_I64_ARG(file->mtime), EV_I64_ARG(file->size));
+	mtime = st.st_mtime;
+	gmtime_r(&mtime, &tm);
+	evutil_date_rfc1123(file->last_modified, sizeof(file->last_modified),
+	    &tm);
+
+	HT_INSERT(evhttp_static_file_map, &http->static_files, file);
+	TAILQ_INSERT_HEAD(&http->static_lru, file, next);
+	if (++http->n_static_files > http->max_static_files)
+		evhttp_static_file_free_(http,
+		    TAILQ_LAST(&http->static_lru, static_fileq));
+
+	if (event_initialized(&http->static_ev) &&
+	    evutil_timerisset(&http->static_revalidate) &&
+	    !event_pending(&http->static_ev, EV_TIMEOUT, NULL))
+		event_add(&http->static_ev, &http->static_revalidate);
+
+	return (file);
+}
+
+static void
+evhttp_static_cb(struct evhttp_request *req, void *arg)
+{
+	struct evhttp_static_root *root = arg;
+	struct evhttp_static_file *file;
+	size_t len, prefix_len = strlen(root->prefix);
+	const char *path, *rest, *value;
+	char *decoded = NULL, *full = NULL;
+	ev_int64_t start = 0, length;
+	int code = HTTP_OK, range;
+	char buf[64];
+
+	if (req->type != EVHTTP_REQ_GET && req->type != EVHTTP_REQ_HEAD) {
+		evhttp_send_error(req, HTTP_BADMETHOD, NULL);
+		return;
+	}
+
+	/* what is after the prefix, which must end at a '/' */
+	path = evhttp_uri_get_path(req->uri_elems);
+	if (path == NULL || (decoded = evhttp_uridecode(path, 0, &len)) == NULL)
+		goto notfound;
+	if (strlen(decoded) != len ||
+	    strncmp(decoded, root->prefix, prefix_len))
+		goto notfound;
+	rest = decoded + prefix_len;
+	if (*rest && *rest != '/' && prefix_len &&
+	    root->prefix[prefix_len - 1] != '/')
+		goto notfound;
+	if (!evhttp_static_path_ok_(rest))
+		goto notfound;
+
+	rest += strspn(rest, "/");
+	len = strlen(root->root) + strlen(rest) + sizeof("/index.html");
+	if ((full = mm_malloc(len)) == NULL) {
+		event_warn("%s: malloc", __func__);
+		evhttp_send_error(req, HTTP_INTERNAL, NULL);
+		goto done;
+	}
+	evutil_snprintf(full, len, "%s/%s%s", root->root, rest,
+	    !*rest || rest[strlen(rest) - 1] == '/' ? "index.html" : "");
+	if ((file = evhttp_static_file_get_(root->http, full)) == NULL)
+		goto notfound;
+
+	evhttp_request_add_header_(req, req->output_headers,
+	    "Content-Type", file->content_type);
+	evhttp_request_add_header_(req, req->output_headers,
+	    "Last-Modified", file->last_modified);
+	evhttp_request_add_header_(req, req->output_headers,
+	    "ETag", file->etag);
+	evhttp_request_add_header_(req, req->output_headers,
+	    "Accept-Ranges", "bytes");
+
+	if (evhttp_static_not_modified_(req, file)) {
+		evhttp_send_reply(req, HTTP_NOTMODIFIED, NULL, NULL);
+		goto done;
+	}
+
+	length = file->size;
+	value = evhttp_find_header(req->input_headers, "Range");
+	if (value != NULL && evhttp_static_if_range_(req, file)) {
+		range = evhttp_parse_range_(value, file->size, &start, &length);
+		if (range < 0) {
+			evutil_snprintf(buf, sizeof(buf), "bytes */" EV_I64_FMT,
+			    EV_I64_ARG(file->size));
+			evhttp_request_add_header_(req, req->output_headers,
+			    "Content-Range", buf);
+			evhttp_send_reply(req, 416, NULL, NULL);
+			goto done;
+		}
+		if (range > 0) {
+			code = 206;
+			evutil_snprintf(buf, sizeof(buf), "bytes " EV_I64_FMT
+			    "-" EV_I64_FMT "/" EV_I64_FMT, EV_I64_ARG(start),
+			    EV_I64_ARG(start + length - 1),
+			    EV_I64_ARG(file->size));
+			evhttp_request_add_header_(req, req->output_headers,
+			    "Content-Range", buf);
+		}
+	}
+
+	evhttp_static_send_(req, code, file, start, length);
+	goto done;
+
+notfound:
+	evhttp_send_error(req, HTTP_NOTFOUND, NULL);
+done:
+	if (decoded != NULL)
+		mm_free(decoded);
+	if (full != NULL)
+		mm_free(full);
+}
+#endif /* !_WIN32 */
+
 static const char uri_chars[256] = {
 	/* 0 */
 	0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0,
@@ -3514,33 +5742,334 @@ evhttp_parse_query_str_flags(const char *uri, struct evkeyvalq *headers, unsigne
 	return evhttp_parse_query_impl(uri, headers, 0, flags);
 }
 
+/*
+ * Request routing.  Callbacks for exact paths are in a hash table, and
+ * callbacks for prefixes in a radix trie, so that finding the callback for
+ * a request takes time in the length of its path rather than in the number
+ * of callbacks.  Both are keyed on the %-decoded path, which we decode a
+ * character at a time as we go instead of into a copy.
+ */
+
+static int
+evhttp_hex_value_(char c)
+{
+	if (EVUTIL_ISDIGIT_(c))
+		return c - '0';
+	return EVUTIL_TOLOWER_(c) - 'a' + 10;
+}
+
+/* Return the next character of the path at *p, %-decoded the way
+ * evhttp_decode_uri_internal() does it for paths, and move *p past it.
+ * Returns '\0' at the end of the path; a "%00" ends it too, as it always
+ * did for dispatch. */
+static char
+evhttp_path_next_(const char **p, int encoded)
+{
+	const char *s = *p;
+	char c = *s;
+
+	if (c == '\0')
+		return c;
+	if (encoded && c == '%' &&
+	    EVUTIL_ISXDIGIT_(s[1]) && EVUTIL_ISXDIGIT_(s[2])) {
+		c = (char)(evhttp_hex_value_(s[1]) << 4 |
+		    evhttp_hex_value_(s[2]));
+		*p = s + 3;
+		return c;
+	}
+	*p = s + 1;
+	return c;
+}
+
+static unsigned
+evhttp_path_hash_(const char *path, int encoded)
+{
+	unsigned h = 5381;
+	char c;
+
+	while ((c = evhttp_path_next_(&path, encoded)) != '\0')
+		h = (h * 33) ^ (unsigned char)c;
+	return h;
+}
+
+static inline unsigned
+evhttp_cb_hash(const struct evhttp_cb *cb)
+{
+	return cb->hash;
+}
+
+static inline int
+evhttp_cb_eq(const struct evhttp_cb *a, const struct evhttp_cb *b)
+{
+	const char *pa = a->what, *pb = b->what;
+	char c1, c2;
+
+	do {
+		c1 = evhttp_path_next_(&pa, a->encoded);
+		c2 = evhttp_path_next_(&pb, b->encoded);
+		if (c1 != c2)
+			return 0;
+	} while (c1 != '\0');
+	return 1;
+}
+
+HT_PROTOTYPE(evhttp_cb_map, evhttp_cb, node, evhttp_cb_hash, evhttp_cb_eq)
+HT_GENERATE(evhttp_cb_map, evhttp_cb, node, evhttp_cb_hash, evhttp_cb_eq,
+    0.5, mm_malloc, mm_realloc, mm_free)
+
+/* Allocate a callback for what into *out.  Returns 0 on success, -2 if we
+ * could not allocate it, or -3 if we could not copy what. */
+static int
+evhttp_cb_new_(const char *what,
+    void (*cb)(struct evhttp_request *, void *), void *cbarg,
+    struct evhttp_cb **out)
+{
+	struct evhttp_cb *http_cb;
+
+	if ((http_cb = mm_calloc(1, sizeof(struct evhttp_cb))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return (-2);
+	}
+
+	http_cb->what = mm_strdup(what);
+	if (http_cb->what == NULL) {
+		event_warn("%s: strdup", __func__);
+		mm_free(http_cb);
+		return (-3);
+	}
+	http_cb->cb = cb;
+	http_cb->cbarg = cbarg;
+
+	*out = http_cb;
+	return (0);
+}
+
+static void
+evhttp_cb_free_(struct evhttp_cb *http_cb)
+{
+	mm_free(http_cb->what);
+	mm_free(http_cb);
+}
+
+/* Return the index of the child of node whose label starts with c, or if
+ * there is none, minus one minus the index to insert it at. */
+static int
+evhttp_route_child_(const struct evhttp_route_node *node, char c)
+{
+	int lo = 0, hi = node->n_children;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		unsigned char m = (unsigned char)node->children[mid]->label[0];
+		if (m == (unsigned char)c)
+			return mid;
+		if (m < (unsigned char)c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return -1 - lo;
+}
+
+static struct evhttp_route_node *
+evhttp_route_node_new_(const char *label, size_t len)
+{
+	struct evhttp_route_node *node;
+
+	if ((node = mm_calloc(1, sizeof(*node))) == NULL)
+		return NULL;
+	if ((node->label = mm_malloc(len + 1)) == NULL) {
+		mm_free(node);
+		return NULL;
+	}
+	memcpy(node->label, label, len);
+	node->label[len] = '\0';
+	node->label_len = len;
+	return node;
+}
+
+static void
+evhttp_route_node_free_(struct evhttp_route_node *node)
+{
+	int i;
+
+	for (i = 0; i < node->n_children; ++i)
+		evhttp_route_node_free_(node->children[i]);
+	mm_free(node->children);
+	mm_free(node->label);
+	mm_free(node);
+}
+
+static int
+evhttp_route_add_child_(struct evhttp_route_node *node, int where,
+    struct evhttp_route_node *child)
+{
+	struct evhttp_route_node **children;
+
+	children = mm_realloc(node->children,
+	    (node->n_children + 1) * sizeof(*children));
+	if (children == NULL)
+		return -1;
+	memmove(children + where + 1, children + where,
+	    (node->n_children - where) * sizeof(*children));
+	children[where] = child;
+	node->children = children;
+	++node->n_children;
+	return 0;
+}
+
+/* Put cb in the trie under cb->what.  Returns -1 if there is a callback for
+ * that prefix already, -2 on error. */
+static int
+evhttp_route_insert_(struct evhttp_route_node **rootp, struct evhttp_cb *cb)
+{
+	struct evhttp_route_node *node = *rootp;
+	const char *s = cb->what;
+
+	if (node == NULL) {
+		if ((node = evhttp_route_node_new_("", 0)) == NULL)
+			return -2;
+		*rootp = node;
+	}
+
+	while (*s) {
+		struct evhttp_route_node *child;
+		size_t common = 0;
+		int i = evhttp_route_child_(node, *s);
+
+		if (i < 0) {
+			child = evhttp_route_node_new_(s, strlen(s));
+			if (child == NULL)
+				return -2;
+			if (evhttp_route_add_child_(node, -1 - i, child) < 0) {
+				evhttp_route_node_free_(child);
+				return -2;
+			}
+			node = child;
+			break;
+		}
+
+		child = node->children[i];
+		while (common < child->label_len &&
+		    child->label[common] == s[common])
+			++common;
+		if (common < child->label_len) {
+			/* Only part of the label matches: split the child
+			 * there. */
+			struct evhttp_route_node *mid =
+			    evhttp_route_node_new_(s, common);
+			if (mid == NULL ||
+			    evhttp_route_add_child_(mid, 0, child) < 0) {
+				if (mid)
+					evhttp_route_node_free_(mid);
+				return -2;
+			}
+			child->label_len -= common;
+			memmove(child->label, child->label + common,
+			    child->label_len + 1);
+			node->children[i] = mid;
+			child = mid;
+		}
+		s += common;
+		node = child;
+	}
+
+	if (node->cb != NULL)
+		return -1;
+	node->cb = cb;
+	return 0;
+}
+
+/* Take the callback for exactly the prefix s out of the trie under node,
+ * and tidy up the nodes that leaves with no reason to be there.  Returns
+ * NULL if there is no callback for s. */
 static struct evhttp_cb *
-evhttp_dispatch_callback(struct httpcbq *callbacks, struct evhttp_request *req)
+evhttp_route_remove_(struct evhttp_route_node *node, const char *s)
 {
+	struct evhttp_route_node *child;
 	struct evhttp_cb *cb;
-	size_t offset = 0;
-	char *translated;
-	const char *path;
+	int i;
 
-	/* Test for different URLs */
-	path = evhttp_uri_get_path(req->uri_elems);
-	offset = strlen(path);
-	if ((translated = mm_malloc(offset + 1)) == NULL)
-		return (NULL);
-	evhttp_decode_uri_internal(path, offset, translated,
-	    0 /* decode_plus */);
+	if (*s == '\0') {
+		cb = node->cb;
+		node->cb = NULL;
+		return cb;
+	}
+
+	i = evhttp_route_child_(node, *s);
+	if (i < 0)
+		return NULL;
+	child = node->children[i];
+	if (strncmp(child->label, s, child->label_len))
+		return NULL;
+	if ((cb = evhttp_route_remove_(child, s + child->label_len)) == NULL)
+		return NULL;
 
-	TAILQ_FOREACH(cb, callbacks, next) {
-		if (!strcmp(cb->what, translated)) {
-			mm_free(translated);
-			return (cb);
+	if (child->cb == NULL && child->n_children == 0) {
+		--node->n_children;
+		memmove(node->children + i, node->children + i + 1,
+		    (node->n_children - i) * sizeof(*node->children));
+		evhttp_route_node_free_(child);
+	} else if (child->cb == NULL && child->n_children == 1) {
+		/* Fold the child into its only child. */
+		struct evhttp_route_node *only = child->children[0];
+		size_t len = child->label_len + only->label_len;
+		char *label = mm_malloc(len + 1);
+		if (label != NULL) {
+			memcpy(label, child->label, child->label_len);
+			memcpy(label + child->label_len, only->label,
+			    only->label_len + 1);
+			mm_free(only->label);
+			only->label = label;
+			only->label_len = len;
+			node->children[i] = only;
+			child->n_children = 0;
+			evhttp_route_node_free_(child);
 		}
 	}
+	return cb;
+}
 
-	mm_free(translated);
-	return (NULL);
+/* Return the callback for the longest prefix of path in the trie. */
+static struct evhttp_cb *
+evhttp_route_lookup_(const struct evhttp_route_node *node, const char *path)
+{
+	struct evhttp_cb *best = NULL;
+	char c;
+
+	while (node != NULL) {
+		size_t j;
+		int i;
+
+		if (node->cb != NULL)
+			best = node->cb;
+		if ((c = evhttp_path_next_(&path, 1)) == '\0')
+			break;
+		if ((i = evhttp_route_child_(node, c)) < 0)
+			break;
+		node = node->children[i];
+		for (j = 1; j < node->label_len; ++j) {
+			if (evhttp_path_next_(&path, 1) != node->label[j])
+				return best;
+		}
+	}
+	return best;
 }
 
+static struct evhttp_cb *
+evhttp_dispatch_callback(struct evhttp *http, struct evhttp_request *req)
+{
+	struct evhttp_cb find, *cb;
+	const char *path = evhttp_uri_get_path(req->uri_elems);
+
+	find.what = (char *)path;
+	find.encoded = 1;
+	find.hash = evhttp_path_hash_(path, 1);
+	if ((cb = HT_FIND(evhttp_cb_map, &http->exact_callbacks, &find)))
+		return cb;
+
+	return evhttp_route_lookup_(http->prefix_callbacks, path);
+}
 
 static int
 prefix_suffix_match(const char *pattern, const char *name, int ignorecase)
@@ -3644,6 +6173,27 @@ evhttp_find_vhost(struct evhttp *http, struct evhttp **outhttp,
 	return match_found;
 }
 
+/* Whether the callback that will be given req, a request on http that
+ * has a body, wants the body as it is read. */
+static int
+evhttp_request_streams_body_(struct evhttp *http, struct evhttp_request *req)
+{
+	struct evhttp_cb *cb;
+	const char *hostname;
+
+	if (req->uri == NULL || (http->allowed_methods & req->type) == 0)
+		return (0);
+
+	hostname = evhttp_request_get_host(req);
+	if (hostname != NULL)
+		evhttp_find_vhost(http, &http, hostname);
+
+	if ((cb = evhttp_dispatch_callback(http, req)) != NULL)
+		return (cb->flags & EVHTTP_CB_STREAM_BODY) != 0;
+	return http->gencb != NULL &&
+	    (http->gencb_flags & EVHTTP_CB_STREAM_BODY) != 0;
+}
+
 static void
 evhttp_handle_request(struct evhttp_request *req, void *arg)
 {
@@ -3654,7 +6204,11 @@ evhttp_handle_request(struct evhttp_request *req, void *arg)
 	/* we have a new request on which the user needs to take action */
 	req->userdone = 0;
 
-	bufferevent_disable(req->evcon->bufev, EV_READ);
+	/* unless we are pipelining, and reading the next one already, or
+	 * the request is one of many streams on an HTTP/2 connection */
+	if (req->h2_stream == NULL &&
+	    !evhttp_connection_is_reading_(req->evcon))
+		bufferevent_disable(req->evcon->bufev, EV_READ);
 
 	if (req->uri == NULL) {
 		evhttp_send_error(req, req->response_code, NULL);
@@ -3674,7 +6228,9 @@ evhttp_handle_request(struct evhttp_request *req, void *arg)
 		evhttp_find_vhost(http, &http, hostname);
 	}
 
-	if ((cb = evhttp_dispatch_callback(&http->callbacks, req)) != NULL) {
+	evhttp_choose_encoder_(http, req);
+
+	if ((cb = evhttp_dispatch_callback(http, req)) != NULL) {
 		(*cb->cb)(req, cb->cbarg);
 		return;
 	}
@@ -3851,6 +6407,7 @@ static struct evhttp*
 evhttp_new_object(void)
 {
 	struct evhttp *http = NULL;
+	struct timeval revalidate = { HTTP_STATIC_REVALIDATE, 0 };
 
 	if ((http = mm_calloc(1, sizeof(struct evhttp))) == NULL) {
 		event_warn("%s: calloc", __func__);
@@ -3862,6 +6419,9 @@ evhttp_new_object(void)
 
 	evhttp_set_max_headers_size(http, EV_SIZE_MAX);
 	evhttp_set_max_body_size(http, EV_SIZE_MAX);
+	evhttp_set_pipeline_depth(http, 8);
+	evhttp_set_compression(http, -1, HTTP_COMPRESS_MIN_SIZE);
+	evhttp_set_static_cache(http, HTTP_STATIC_MAX_FILES, &revalidate);
 	evhttp_set_default_content_type(http, "text/html; charset=ISO-8859-1");
 	evhttp_set_allowed_methods(http,
 	    EVHTTP_REQ_GET |
@@ -3872,9 +6432,14 @@ evhttp_new_object(void)
 
 	TAILQ_INIT(&http->sockets);
 	TAILQ_INIT(&http->callbacks);
+	HT_INIT(evhttp_cb_map, &http->exact_callbacks);
 	TAILQ_INIT(&http->connections);
 	TAILQ_INIT(&http->virtualhosts);
 	TAILQ_INIT(&http->aliases);
+	TAILQ_INIT(&http->encoders);
+	TAILQ_INIT(&http->static_roots);
+	HT_INIT(evhttp_static_file_map, &http->static_files);
+	TAILQ_INIT(&http->static_lru);
 
 	return (http);
 }
@@ -3920,6 +6485,8 @@ evhttp_free(struct evhttp* http)
 	struct evhttp_bound_socket *bound;
 	struct evhttp* vhost;
 	struct evhttp_server_alias *alias;
+	struct evhttp_content_encoder *encoder;
+	struct evhttp_static_root *root;
 
 	/* Remove the accepting part */
 	while ((bound = TAILQ_FIRST(&http->sockets)) != NULL) {
@@ -3937,9 +6504,11 @@ evhttp_free(struct evhttp* http)
 
 	while ((http_cb = TAILQ_FIRST(&http->callbacks)) != NULL) {
 		TAILQ_REMOVE(&http->callbacks, http_cb, next);
-		mm_free(http_cb->what);
-		mm_free(http_cb);
+		evhttp_cb_free_(http_cb);
 	}
+	HT_CLEAR(evhttp_cb_map, &http->exact_callbacks);
+	if (http->prefix_callbacks != NULL)
+		evhttp_route_node_free_(http->prefix_callbacks);
 
 	while ((vhost = TAILQ_FIRST(&http->virtualhosts)) != NULL) {
 		TAILQ_REMOVE(&http->virtualhosts, vhost, next_vhost);
@@ -3956,6 +6525,24 @@ evhttp_free(struct evhttp* http)
 		mm_free(alias);
 	}
 
+	while ((encoder = TAILQ_FIRST(&http->encoders)) != NULL) {
+		TAILQ_REMOVE(&http->encoders, encoder, next);
+		mm_free(encoder->name);
+		mm_free(encoder);
+	}
+
+#ifndef _WIN32
+	while (TAILQ_FIRST(&http->static_lru) != NULL)
+		evhttp_static_file_free_(http, TAILQ_FIRST(&http->static_lru));
+	HT_CLEAR(evhttp_static_file_map, &http->static_files);
+#endif
+	while ((root = TAILQ_FIRST(&http->static_roots)) != NULL) {
+		TAILQ_REMOVE(&http->static_roots, root, next);
+		mm_free(root->prefix);
+		mm_free(root->root);
+		mm_free(root);
+	}
+
 	mm_free(http);
 }
 
@@ -4055,6 +6642,8 @@ int evhttp_set_flags(struct evhttp *http, int flags)
 {
 	int avail_flags = 0;
 	avail_flags |= EVHTTP_SERVER_LINGERING_CLOSE;
+	avail_flags |= EVHTTP_SERVER_PIPELINING;
+	avail_flags |= EVHTTP_SERVER_HTTP2;
 
 	if (flags & ~avail_flags)
 		return 1;
@@ -4065,6 +6654,116 @@ int evhttp_set_flags(struct evhttp *http, int flags)
 	return 0;
 }
 
+void
+evhttp_set_pipeline_depth(struct evhttp *http, int depth)
+{
+	http->pipeline_depth = depth < 1 ? 1 : depth;
+}
+
+int
+evhttp_add_content_encoder(struct evhttp *http, const char *name,
+    evhttp_encoder_init_cb init_cb, evhttp_encoder_cb encode_cb,
+    evhttp_encoder_free_cb free_cb, void *arg)
+{
+	struct evhttp_content_encoder *encoder;
+
+	if (name == NULL || !*name || init_cb == NULL || encode_cb == NULL)
+		return (-1);
+
+	if ((encoder = mm_calloc(1, sizeof(*encoder))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return (-1);
+	}
+	if ((encoder->name = mm_strdup(name)) == NULL) {
+		event_warn("%s: strdup", __func__);
+		mm_free(encoder);
+		return (-1);
+	}
+	encoder->init_cb = init_cb;
+	encoder->encode_cb = encode_cb;
+	encoder->free_cb = free_cb;
+	encoder->arg = arg;
+
+	TAILQ_INSERT_TAIL(&http->encoders, encoder, next);
+
+	return (0);
+}
+
+void
+evhttp_set_compression(struct evhttp *http, int level, size_t min_size)
+{
+	http->compress_level = level;
+	http->compress_min_size = min_size;
+}
+
+int
+evhttp_set_static_root(struct evhttp *http, const char *prefix,
+    const char *root)
+{
+#ifdef _WIN32
+	return (-2);
+#else
+	struct evhttp_static_root *sr;
+	size_t len;
+	int res;
+
+	if ((sr = mm_calloc(1, sizeof(*sr))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return (-2);
+	}
+	sr->http = http;
+	if ((sr->prefix = mm_strdup(prefix)) == NULL ||
+	    (sr->root = mm_strdup(root)) == NULL) {
+		event_warn("%s: strdup", __func__);
+		res = -2;
+		goto err;
+	}
+	/* the paths looked up under it start with a '/' */
+	len = strlen(sr->root);
+	while (len > 0 && sr->root[len - 1] == '/')
+		sr->root[--len] = '\0';
+
+	if ((res = evhttp_set_prefix_cb(http, prefix, evhttp_static_cb, sr)))
+		goto err;
+	if (http->base != NULL && !event_initialized(&http->static_ev))
+		event_assign(&http->static_ev, http->base, -1, EV_PERSIST,
+		    evhttp_static_revalidate_cb, http);
+	TAILQ_INSERT_TAIL(&http->static_roots, sr, next);
+	return (0);
+
+err:
+	if (sr->prefix != NULL)
+		mm_free(sr->prefix);
+	if (sr->root != NULL)
+		mm_free(sr->root);
+	mm_free(sr);
+	return (res);
+#endif
+}
+
+void
+evhttp_set_static_cache(struct evhttp *http, int max_files,
+    const struct timeval *revalidate)
+{
+	http->max_static_files = max_files < 1 ? 1 : max_files;
+	if (revalidate != NULL)
+		http->static_revalidate = *revalidate;
+	else
+		evutil_timerclear(&http->static_revalidate);
+
+#ifndef _WIN32
+	while (http->n_static_files > http->max_static_files)
+		evhttp_static_file_free_(http,
+		    TAILQ_LAST(&http->static_lru, static_fileq));
+	if (event_initialized(&http->static_ev)) {
+		event_del(&http->static_ev);
+		if (http->n_static_files > 0 &&
+		    evutil_timerisset(&http->static_revalidate))
+			event_add(&http->static_ev, &http->static_revalidate);
+	}
+#endif
+}
+
 void
 evhttp_set_max_headers_size(struct evhttp* http, ev_ssize_t max_headers_size)
 {
@@ -4105,27 +6804,20 @@ int
 evhttp_set_cb(struct evhttp *http, const char *uri,
     void (*cb)(struct evhttp_request *, void *), void *cbarg)
 {
-	struct evhttp_cb *http_cb;
-
-	TAILQ_FOREACH(http_cb, &http->callbacks, next) {
-		if (strcmp(http_cb->what, uri) == 0)
-			return (-1);
-	}
+	struct evhttp_cb find, *http_cb;
+	int res;
 
-	if ((http_cb = mm_calloc(1, sizeof(struct evhttp_cb))) == NULL) {
-		event_warn("%s: calloc", __func__);
-		return (-2);
-	}
+	find.what = (char *)uri;
+	find.encoded = 0;
+	find.hash = evhttp_path_hash_(uri, 0);
+	if (HT_FIND(evhttp_cb_map, &http->exact_callbacks, &find))
+		return (-1);
 
-	http_cb->what = mm_strdup(uri);
-	if (http_cb->what == NULL) {
-		event_warn("%s: strdup", __func__);
-		mm_free(http_cb);
-		return (-3);
-	}
-	http_cb->cb = cb;
-	http_cb->cbarg = cbarg;
+	if ((res = evhttp_cb_new_(uri, cb, cbarg, &http_cb)) < 0)
+		return (res);
+	http_cb->hash = find.hash;
 
+	HT_INSERT(evhttp_cb_map, &http->exact_callbacks, http_cb);
 	TAILQ_INSERT_TAIL(&http->callbacks, http_cb, next);
 
 	return (0);
@@ -4133,19 +6825,54 @@ evhttp_set_cb(struct evhttp *http, const char *uri,
 
 int
 evhttp_del_cb(struct evhttp *http, const char *uri)
+{
+	struct evhttp_cb find, *http_cb;
+
+	find.what = (char *)uri;
+	find.encoded = 0;
+	find.hash = evhttp_path_hash_(uri, 0);
+	http_cb = HT_REMOVE(evhttp_cb_map, &http->exact_callbacks, &find);
+	if (http_cb == NULL)
+		return (-1);
+
+	TAILQ_REMOVE(&http->callbacks, http_cb, next);
+	evhttp_cb_free_(http_cb);
+
+	return (0);
+}
+
+int
+evhttp_set_prefix_cb(struct evhttp *http, const char *prefix,
+    void (*cb)(struct evhttp_request *, void *), void *cbarg)
 {
 	struct evhttp_cb *http_cb;
+	int res;
 
-	TAILQ_FOREACH(http_cb, &http->callbacks, next) {
-		if (strcmp(http_cb->what, uri) == 0)
-			break;
+	if (evhttp_cb_new_(prefix, cb, cbarg, &http_cb) < 0)
+		return (-2);
+	http_cb->prefix = 1;
+
+	if ((res = evhttp_route_insert_(&http->prefix_callbacks, http_cb))) {
+		evhttp_cb_free_(http_cb);
+		return (res);
 	}
+	TAILQ_INSERT_TAIL(&http->callbacks, http_cb, next);
+
+	return (0);
+}
+
+int
+evhttp_del_prefix_cb(struct evhttp *http, const char *prefix)
+{
+	struct evhttp_cb *http_cb = NULL;
+
+	if (http->prefix_callbacks != NULL)
+		http_cb = evhttp_route_remove_(http->prefix_callbacks, prefix);
 	if (http_cb == NULL)
 		return (-1);
 
 	TAILQ_REMOVE(&http->callbacks, http_cb, next);
-	mm_free(http_cb->what);
-	mm_free(http_cb);
+	evhttp_cb_free_(http_cb);
 
 	return (0);
 }
@@ -4158,6 +6885,40 @@ evhttp_set_gencb(struct evhttp *http,
 	http->gencbarg = cbarg;
 }
 
+static int
+evhttp_set_cb_flags_(struct evhttp *http, const char *what, int prefix,
+    int flags)
+{
+	struct evhttp_cb *http_cb;
+
+	TAILQ_FOREACH(http_cb, &http->callbacks, next) {
+		if (http_cb->prefix == prefix && !strcmp(http_cb->what, what)) {
+			http_cb->flags = flags;
+			return (0);
+		}
+	}
+	return (-1);
+}
+
+int
+evhttp_set_cb_flags(struct evhttp *http, const char *path, int flags)
+{
+	return evhttp_set_cb_flags_(http, path, 0, flags);
+}
+
+int
+evhttp_set_prefix_cb_flags(struct evhttp *http, const char *prefix,
+    int flags)
+{
+	return evhttp_set_cb_flags_(http, prefix, 1, flags);
+}
+
+void
+evhttp_set_gencb_flags(struct evhttp *http, int flags)
+{
+	http->gencb_flags = flags;
+}
+
 void
 evhttp_set_bevcb(struct evhttp *http,
     struct bufferevent* (*cb)(struct event_base *, void *), void *cbarg)
@@ -4183,8 +6944,9 @@ evhttp_request_new(void (*cb)(struct evhttp_request *, void *), void *arg)
 {
 	struct evhttp_request *req = NULL;
 
-	/* Allocate request structure */
-	if ((req = mm_calloc(1, sizeof(struct evhttp_request))) == NULL) {
+	/* Allocate request structure, with the header lists after it */
+	if ((req = mm_calloc(1, sizeof(struct evhttp_request) +
+		    2 * sizeof(struct evkeyvalq))) == NULL) {
 		event_warn("%s: calloc", __func__);
 		goto error;
 	}
@@ -4193,18 +6955,9 @@ evhttp_request_new(void (*cb)(struct evhttp_request *, void *), void *arg)
 	req->body_size = 0;
 
 	req->kind = EVHTTP_RESPONSE;
-	req->input_headers = mm_calloc(1, sizeof(struct evkeyvalq));
-	if (req->input_headers == NULL) {
-		event_warn("%s: calloc", __func__);
-		goto error;
-	}
+	req->input_headers = (struct evkeyvalq *)(req + 1);
 	TAILQ_INIT(req->input_headers);
-
-	req->output_headers = mm_calloc(1, sizeof(struct evkeyvalq));
-	if (req->output_headers == NULL) {
-		event_warn("%s: calloc", __func__);
-		goto error;
-	}
+	req->output_headers = req->input_headers + 1;
 	TAILQ_INIT(req->output_headers);
 
 	if ((req->input_buffer = evbuffer_new()) == NULL) {
@@ -4236,22 +6989,11 @@ evhttp_request_free(struct evhttp_request *req)
 		return;
 	}
 
-	if (req->remote_host != NULL)
-		mm_free(req->remote_host);
-	if (req->uri != NULL)
-		mm_free(req->uri);
 	if (req->uri_elems != NULL)
 		evhttp_uri_free(req->uri_elems);
-	if (req->response_code_line != NULL)
-		mm_free(req->response_code_line);
-	if (req->host_cache != NULL)
-		mm_free(req->host_cache);
 
-	evhttp_clear_headers(req->input_headers);
-	mm_free(req->input_headers);
-
-	evhttp_clear_headers(req->output_headers);
-	mm_free(req->output_headers);
+	evhttp_clear_headers_(req, req->input_headers);
+	evhttp_clear_headers_(req, req->output_headers);
 
 	if (req->input_buffer != NULL)
 		evbuffer_free(req->input_buffer);
@@ -4259,6 +7001,15 @@ evhttp_request_free(struct evhttp_request *req)
 	if (req->output_buffer != NULL)
 		evbuffer_free(req->output_buffer);
 
+	if (req->pending_output != NULL)
+		evbuffer_free(req->pending_output);
+
+	evhttp_compress_end_(req);
+
+	/* remote_host, uri, response_code_line and host_cache are all in
+	 * here. */
+	evhttp_arena_free_(req->arena);
+
 	mm_free(req);
 }
 
@@ -4307,6 +7058,19 @@ evhttp_request_set_error_cb(struct evhttp_request *req,
 	req->error_cb = cb;
 }
 
+void
+evhttp_request_set_body_cb(struct evhttp_request *req,
+    void (*chunk_cb)(struct evhttp_request *, void *),
+    void (*done_cb)(struct evhttp_request *, void *),
+    void (*error_cb)(enum evhttp_request_error, void *),
+    void *arg)
+{
+	req->body_chunk_cb = chunk_cb;
+	req->body_done_cb = done_cb;
+	req->body_error_cb = error_cb;
+	req->body_cb_arg = arg;
+}
+
 void
 evhttp_request_set_on_complete_cb(struct evhttp_request *req,
     void (*cb)(struct evhttp_request *, void *), void *cb_arg)
@@ -4348,7 +7112,8 @@ evhttp_request_get_host(struct evhttp_request *req)
 		const char *p;
 		size_t len;
 
-		host = evhttp_find_header(req->input_headers, "Host");
+		host = evhttp_find_known_header_(req, req->input_headers,
+		    EVHTTP_HDR_HOST);
 		/* The Host: header may include a port. Remove it here
 		   to be consistent with uri_elems case above. */
 		if (host) {
@@ -4357,13 +7122,10 @@ evhttp_request_get_host(struct evhttp_request *req)
 				--p;
 			if (p > host && *p == ':') {
 				len = p - host;
-				req->host_cache = mm_malloc(len + 1);
-				if (!req->host_cache) {
-					event_warn("%s: malloc", __func__);
+				req->host_cache =
+				    evhttp_request_strndup_(req, host, len);
+				if (!req->host_cache)
 					return NULL;
-				}
-				memcpy(req->host_cache, host, len);
-				req->host_cache[len] = '\0';
 				host = req->host_cache;
 			}
 		}
@@ -4392,12 +7154,14 @@ evhttp_request_get_response_code_line(const struct evhttp_request *req)
 /** Returns the input headers */
 struct evkeyvalq *evhttp_request_get_input_headers(struct evhttp_request *req)
 {
+	evhttp_request_hand_out_list_(req, req->input_headers);
 	return (req->input_headers);
 }
 
 /** Returns the output headers */
 struct evkeyvalq *evhttp_request_get_output_headers(struct evhttp_request *req)
 {
+	evhttp_request_hand_out_list_(req, req->output_headers);
 	return (req->output_headers);
 }
 
@@ -4460,6 +7224,8 @@ evhttp_get_request_connection(
 	evcon->max_body_size = http->default_max_body_size;
 	if (http->flags & EVHTTP_SERVER_LINGERING_CLOSE)
 		evcon->flags |= EVHTTP_CON_LINGERING_CLOSE;
+	if (http->flags & EVHTTP_SERVER_PIPELINING)
+		evcon->pipeline_depth = http->pipeline_depth;
 
 	evcon->flags |= EVHTTP_CON_INCOMING;
 	evcon->state = EVCON_READING_FIRSTLINE;
@@ -4481,18 +7247,19 @@ err:
 	return (NULL);
 }
 
-static int
-evhttp_associate_new_request_with_connection(struct evhttp_connection *evcon)
+struct evhttp_request *
+evhttp_server_request_new_(struct evhttp_connection *evcon)
 {
 	struct evhttp *http = evcon->http_server;
 	struct evhttp_request *req;
 	if ((req = evhttp_request_new(evhttp_handle_request, http)) == NULL)
-		return (-1);
+		return (NULL);
 
-	if ((req->remote_host = mm_strdup(evcon->address)) == NULL) {
-		event_warn("%s: strdup", __func__);
+	evhttp_request_take_spare_arena(evcon, req);
+	if ((req->remote_host =
+		evhttp_request_strdup_(req, evcon->address)) == NULL) {
 		evhttp_request_free(req);
-		return (-1);
+		return (NULL);
 	}
 	req->remote_port = evcon->port;
 
@@ -4509,9 +7276,19 @@ evhttp_associate_new_request_with_connection(struct evhttp_connection *evcon)
 
 	if (http->newreqcb && http->newreqcb(req, http->newreqcbarg) == -1) {
 		evhttp_request_free(req);
-		return (-1);
+		return (NULL);
 	}
 
+	return (req);
+}
+
+static int
+evhttp_associate_new_request_with_connection(struct evhttp_connection *evcon)
+{
+	struct evhttp_request *req;
+	if ((req = evhttp_server_request_new_(evcon)) == NULL)
+		return (-1);
+
 	TAILQ_INSERT_TAIL(&evcon->requests, req, next);
 
 	evhttp_start_read_(evcon);
@@ -4692,6 +7469,11 @@ struct evhttp_uri {
 	char *path; /* path, or "". */
 	char *query; /* query, or NULL */
 	char *fragment; /* fragment or NULL */
+
+	/* The struct, and while strings_in_arena is set its strings, are in
+	 * the arena of the request that the URI was parsed for. */
+	unsigned in_arena : 1;
+	unsigned strings_in_arena : 1;
 };
 
 struct evhttp_uri *
@@ -4830,16 +7612,15 @@ bracket_addr_ok(const char *s, const char *eos)
 }
 
 static int
-parse_authority(struct evhttp_uri *uri, char *s, char *eos)
+parse_authority(struct evhttp_uri *uri, char *s, char *eos,
+    struct evhttp_request *req)
 {
 	char *cp, *port;
 	EVUTIL_ASSERT(eos);
 	if (eos == s) {
-		uri->host = mm_strdup("");
-		if (uri->host == NULL) {
-			event_warn("%s: strdup", __func__);
+		uri->host = evhttp_request_strdup_(req, "");
+		if (uri->host == NULL)
 			return -1;
-		}
 		return 0;
 	}
 
@@ -4850,11 +7631,9 @@ parse_authority(struct evhttp_uri *uri, char *s, char *eos)
 		if (! userinfo_ok(s,cp))
 			return -1;
 		*cp++ = '\0';
-		uri->userinfo = mm_strdup(s);
-		if (uri->userinfo == NULL) {
-			event_warn("%s: strdup", __func__);
+		uri->userinfo = evhttp_request_strdup_(req, s);
+		if (uri->userinfo == NULL)
 			return -1;
-		}
 	} else {
 		cp = s;
 	}
@@ -4881,13 +7660,9 @@ parse_authority(struct evhttp_uri *uri, char *s, char *eos)
 		if (! regname_ok(cp,eos)) /* Match IPv4Address or reg-name */
 			return -1;
 	}
-	uri->host = mm_malloc(eos-cp+1);
-	if (uri->host == NULL) {
-		event_warn("%s: malloc", __func__);
+	uri->host = evhttp_request_strndup_(req, cp, eos-cp);
+	if (uri->host == NULL)
 		return -1;
-	}
-	memcpy(uri->host, cp, eos-cp);
-	uri->host[eos-cp] = '\0';
 	return 0;
 
 }
@@ -4975,24 +7750,46 @@ evhttp_uri_parse(const char *source_uri)
 
 struct evhttp_uri *
 evhttp_uri_parse_with_flags(const char *source_uri, unsigned flags)
+{
+	return evhttp_uri_parse_with_flags_(source_uri, flags, NULL);
+}
+
+/* Allocate a new URI in req's arena, or on the heap if req is NULL. */
+static struct evhttp_uri *
+evhttp_uri_new_(struct evhttp_request *req)
+{
+	struct evhttp_uri *uri;
+
+	if (req == NULL)
+		return evhttp_uri_new();
+	if ((uri = evhttp_request_alloc_(req, sizeof(*uri))) == NULL)
+		return NULL;
+	memset(uri, 0, sizeof(*uri));
+	uri->port = -1;
+	uri->in_arena = uri->strings_in_arena = 1;
+	return uri;
+}
+
+/* Parse source_uri; if req is not NULL, the URI and its parts are
+ * allocated from req's arena. */
+static struct evhttp_uri *
+evhttp_uri_parse_with_flags_(const char *source_uri, unsigned flags,
+    struct evhttp_request *req)
 {
 	char *readbuf = NULL, *readp = NULL, *token = NULL, *query = NULL;
 	char *path = NULL, *fragment = NULL;
 	int got_authority = 0;
 
-	struct evhttp_uri *uri = mm_calloc(1, sizeof(struct evhttp_uri));
+	struct evhttp_uri *uri = evhttp_uri_new_(req);
 	if (uri == NULL) {
 		event_warn("%s: calloc", __func__);
 		goto err;
 	}
-	uri->port = -1;
 	uri->flags = flags;
 
-	readbuf = mm_strdup(source_uri);
-	if (readbuf == NULL) {
-		event_warn("%s: strdup", __func__);
+	readbuf = evhttp_request_strdup_(req, source_uri);
+	if (readbuf == NULL)
 		goto err;
-	}
 
 	readp = readbuf;
 	token = NULL;
@@ -5009,11 +7806,9 @@ evhttp_uri_parse_with_flags(const char *source_uri, unsigned flags)
 	token = strchr(readp, ':');
 	if (token && scheme_ok(readp,token)) {
 		*token = '\0';
-		uri->scheme = mm_strdup(readp);
-		if (uri->scheme == NULL) {
-			event_warn("%s: strdup", __func__);
+		uri->scheme = evhttp_request_strdup_(req, readp);
+		if (uri->scheme == NULL)
 			goto err;
-		}
 		readp = token+1; /* eat : */
 	}
 
@@ -5023,7 +7818,7 @@ evhttp_uri_parse_with_flags(const char *source_uri, unsigned flags)
 		readp += 2;
 		authority = readp;
 		path = end_of_authority(readp);
-		if (parse_authority(uri, authority, path) < 0)
+		if (parse_authority(uri, authority, path, req) < 0)
 			goto err;
 		readp = path;
 		got_authority = 1;
@@ -5069,6 +7864,14 @@ evhttp_uri_parse_with_flags(const char *source_uri, unsigned flags)
 		goto err;
 
 	EVUTIL_ASSERT(path);
+	if (req != NULL) {
+		/* readbuf lasts as long as the URI does; use it. */
+		uri->path = path;
+		uri->query = query;
+		uri->fragment = fragment;
+		return uri;
+	}
+
 	uri->path = mm_strdup(path);
 	if (uri->path == NULL) {
 		event_warn("%s: strdup", __func__);
@@ -5096,33 +7899,30 @@ evhttp_uri_parse_with_flags(const char *source_uri, unsigned flags)
 err:
 	if (uri)
 		evhttp_uri_free(uri);
-	if (readbuf)
+	if (readbuf && req == NULL)
 		mm_free(readbuf);
 	return NULL;
 }
 
 static struct evhttp_uri *
-evhttp_uri_parse_authority(char *source_uri)
+evhttp_uri_parse_authority(char *source_uri, struct evhttp_request *req)
 {
-	struct evhttp_uri *uri = mm_calloc(1, sizeof(struct evhttp_uri));
+	struct evhttp_uri *uri = evhttp_uri_new_(req);
 	char *end;
 
 	if (uri == NULL) {
 		event_warn("%s: calloc", __func__);
 		goto err;
 	}
-	uri->port = -1;
 	uri->flags = 0;
 
 	end = end_of_authority(source_uri);
-	if (parse_authority(uri, source_uri, end) < 0)
+	if (parse_authority(uri, source_uri, end, req) < 0)
 		goto err;
 
-	uri->path = mm_strdup("");
-	if (uri->path == NULL) {
-		event_warn("%s: strdup", __func__);
+	uri->path = evhttp_request_strdup_(req, "");
+	if (uri->path == NULL)
 		goto err;
-	}
 
 	return uri;
 err:
@@ -5139,17 +7939,56 @@ evhttp_uri_free(struct evhttp_uri *uri)
 		mm_free(uri->f);		\
 	}
 
-	URI_FREE_STR_(scheme);
-	URI_FREE_STR_(userinfo);
-	URI_FREE_STR_(host);
-	URI_FREE_STR_(path);
-	URI_FREE_STR_(query);
-	URI_FREE_STR_(fragment);
+	if (!uri->strings_in_arena) {
+		URI_FREE_STR_(scheme);
+		URI_FREE_STR_(userinfo);
+		URI_FREE_STR_(host);
+		URI_FREE_STR_(path);
+		URI_FREE_STR_(query);
+		URI_FREE_STR_(fragment);
+	}
 
-	mm_free(uri);
+	if (!uri->in_arena)
+		mm_free(uri);
 #undef URI_FREE_STR_
 }
 
+/* Copy the strings of a URI that was parsed into a request's arena onto
+ * the heap, so that they can be changed one at a time. */
+static int
+evhttp_uri_own_strings_(struct evhttp_uri *uri)
+{
+	char **fields[6];
+	char *copies[6];
+	int i, n;
+
+	if (!uri->strings_in_arena)
+		return 0;
+	fields[0] = &uri->scheme;
+	fields[1] = &uri->userinfo;
+	fields[2] = &uri->host;
+	fields[3] = &uri->path;
+	fields[4] = &uri->query;
+	fields[5] = &uri->fragment;
+	for (n = 0; n < 6; ++n) {
+		copies[n] = NULL;
+		if (*fields[n] && (copies[n] = mm_strdup(*fields[n])) == NULL) {
+			event_warn("%s: strdup", __func__);
+			goto err;
+		}
+	}
+	for (i = 0; i < 6; ++i)
+		*fields[i] = copies[i];
+	uri->strings_in_arena = 0;
+	return 0;
+err:
+	for (i = 0; i < n; ++i) {
+		if (copies[i])
+			mm_free(copies[i]);
+	}
+	return -1;
+}
+
 char *
 evhttp_uri_join(struct evhttp_uri *uri, char *buf, size_t limit)
 {
@@ -5251,6 +8090,8 @@ evhttp_uri_get_fragment(const struct evhttp_uri *uri)
 }
 
 #define URI_SET_STR_(f) do {					\
+	if (evhttp_uri_own_strings_(uri) < 0)			\
+		return -1;					\
 	if (uri->f)						\
 		mm_free(uri->f);				\
 	if (f) {						\
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * This header file contains definitions for HTTP/2 connections that are
+ * internal to libevent.  As user of the library, you should not need to
+ * know about these.
+ */
+
+#ifndef HTTP2_INTERNAL_H_INCLUDED_
+#define HTTP2_INTERNAL_H_INCLUDED_
+
+#include "event2/util.h"
+
+/* What an HTTP/2 client sends first (RFC 7540, section 3.5).  A server
+ * that sees it knows the client speaks HTTP/2, whether it learned that
+ * from ALPN or just assumed it. */
+#define EVHTTP2_PREFACE		"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define EVHTTP2_PREFACE_LEN	24
+
+struct evbuffer;
+struct evhttp_connection;
+struct evhttp_request;
+struct evhttp2_session;
+
+/* Start speaking HTTP/2 on evcon, which must be connected.  A server
+ * connection must already have read the client preface off its input;
+ * a client connection sends it.  Returns -1 on allocation failure. */
+int evhttp2_session_start_(struct evhttp_connection *evcon);
+
+/* Forget every stream of session and free it.  Requests that a server's
+ * user still has are left without a connection; others are freed. */
+void evhttp2_session_free_(struct evhttp2_session *session);
+
+/* Open a stream for every request waiting on evcon->requests, as many as
+ * the server lets us have at once. */
+void evhttp2_submit_requests_(struct evhttp_connection *evcon);
+
+/* Reset the stream of req, a client request, and free req. */
+void evhttp2_cancel_request_(struct evhttp_request *req);
+
+/* Send the status and the output headers of req, a server request. */
+void evhttp2_send_headers_(struct evhttp_request *req, int end_stream);
+
+/* Queue data, which may be NULL, for the stream of req.  cb is called
+ * once all of it has been written to the connection.  With end_stream,
+ * nothing may be sent on the stream after it; req may be gone when this
+ * returns. */
+void evhttp2_send_data_(struct evhttp_request *req, struct evbuffer *data,
+    int end_stream, void (*cb)(struct evhttp_connection *, void *),
+    void *arg);
+
+/* HPACK header compression (RFC 7541) */
+
+struct evhttp2_hpack_entry;
+
+/* The decoding side of one connection's header compression. */
+struct evhttp2_hpack {
+	/* The dynamic table, oldest first */
+	struct evhttp2_hpack_entry **entries;
+	size_t n_entries;
+	size_t entries_alloc;
+	/* Its size, as section 4.1 counts it, and the most it may have */
+	size_t size;
+	size_t max_size;
+	/* The most that the peer may set max_size to */
+	size_t limit;
+	/* Where decoded strings go before they are handed out */
+	char *buf;
+	size_t buf_alloc;
+};
+
+/* Called for each header that evhttp2_hpack_decode_() decodes.  name and
+ * value are NUL-terminated, and last until the next call.  Return -1 to
+ * stop decoding. */
+typedef int (*evhttp2_header_cb)(const char *name, size_t name_len,
+    const char *value, size_t value_len, void *arg);
+
+EVENT2_EXPORT_SYMBOL
+void evhttp2_hpack_init_(struct evhttp2_hpack *hpack, size_t limit);
+EVENT2_EXPORT_SYMBOL
+void evhttp2_hpack_clear_(struct evhttp2_hpack *hpack);
+/* Decode one whole header block.  Returns -1 if it is not valid HPACK,
+ * after which hpack is of no more use. */
+EVENT2_EXPORT_SYMBOL
+int evhttp2_hpack_decode_(struct evhttp2_hpack *hpack,
+    const unsigned char *block, size_t len, evhttp2_header_cb cb, void *arg);
+/* Append the encoding of one header to out.  name is lowercased. */
+EVENT2_EXPORT_SYMBOL
+int evhttp2_hpack_encode_(struct evbuffer *out,
+    const char *name, const char *value);
+
+#endif /* HTTP2_INTERNAL_H_INCLUDED_ */
@@ -0,0 +1,2184 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * HTTP/2 (RFC 7540) for evhttp.  A connection that speaks it keeps its
+ * struct evhttp_connection, and each stream gets a struct evhttp_request
+ * of its own, so that users see the same requests, callbacks and reply
+ * functions as with HTTP/1.x.  http.c calls in here at the points where
+ * the two differ: when a connection starts, and when a response or a
+ * request goes out.
+ */
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#else
+#include <winsock2.h>
+#endif
+#ifdef EVENT__HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#ifdef EVENT__HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event2/http.h"
+#include "event2/event.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "event2/http_struct.h"
+#include "event2/util.h"
+#include "log-internal.h"
+#include "util-internal.h"
+#include "http-internal.h"
+#include "http2-internal.h"
+#include "mm-internal.h"
+#include "ht-internal.h"
+
+/* Frame types (section 6) */
+#define EVHTTP2_DATA		0x0
+#define EVHTTP2_HEADERS		0x1
+#define EVHTTP2_PRIORITY	0x2
+#define EVHTTP2_RST_STREAM	0x3
+#define EVHTTP2_SETTINGS	0x4
+#define EVHTTP2_PUSH_PROMISE	0x5
+#define EVHTTP2_PING		0x6
+#define EVHTTP2_GOAWAY		0x7
+#define EVHTTP2_WINDOW_UPDATE	0x8
+#define EVHTTP2_CONTINUATION	0x9
+
+/* Frame flags */
+#define EVHTTP2_FLAG_END_STREAM		0x01
+#define EVHTTP2_FLAG_ACK		0x01
+#define EVHTTP2_FLAG_END_HEADERS	0x04
+#define EVHTTP2_FLAG_PADDED		0x08
+#define EVHTTP2_FLAG_PRIORITY		0x20
+
+/* Settings (section 6.5.2) */
+#define EVHTTP2_SETTINGS_HEADER_TABLE_SIZE	0x1
+#define EVHTTP2_SETTINGS_ENABLE_PUSH		0x2
+#define EVHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS	0x3
+#define EVHTTP2_SETTINGS_INITIAL_WINDOW_SIZE	0x4
+#define EVHTTP2_SETTINGS_MAX_FRAME_SIZE		0x5
+
+/* Error codes (section 7) */
+#define EVHTTP2_NO_ERROR		0x0
+#define EVHTTP2_PROTOCOL_ERROR		0x1
+#define EVHTTP2_INTERNAL_ERROR		0x2
+#define EVHTTP2_FLOW_CONTROL_ERROR	0x3
+#define EVHTTP2_STREAM_CLOSED		0x5
+#define EVHTTP2_FRAME_SIZE_ERROR	0x6
+#define EVHTTP2_REFUSED_STREAM		0x7
+#define EVHTTP2_CANCEL			0x8
+#define EVHTTP2_COMPRESSION_ERROR	0x9
+#define EVHTTP2_ENHANCE_YOUR_CALM	0xb
+
+#define EVHTTP2_FRAME_HEADER_LEN	9
+/* The largest frame we take, which we never raise from the default */
+#define EVHTTP2_MAX_FRAME_SIZE		16384
+#define EVHTTP2_DEFAULT_WINDOW		65535
+#define EVHTTP2_MAX_WINDOW		0x7fffffff
+#define EVHTTP2_MAX_STREAM_ID		0x7fffffff
+/* Give the peer more window once it has used this much of it */
+#define EVHTTP2_WINDOW_REFILL		(EVHTTP2_DEFAULT_WINDOW / 2)
+/* How many streams we let the peer have at once, and how many we open
+ * before the peer says how many it allows */
+#define EVHTTP2_MAX_STREAMS		100
+/* The size of our HPACK dynamic table */
+#define EVHTTP2_HEADER_TABLE_SIZE	4096
+/* The most that a header block may take up in its frames */
+#define EVHTTP2_MAX_HEADER_BLOCK	(1024*1024)
+/* Move no more stream data into the connection's output than this; the
+ * rest waits until it has been written, so that one big response does
+ * not hold up the others. */
+#define EVHTTP2_OUTPUT_HIGHWATER	(64*1024)
+
+/* A header in the static table (RFC 7541, appendix A) */
+struct evhttp2_static_header {
+	const char *name;
+	const char *value;
+};
+
+static const struct evhttp2_static_header evhttp2_static_table[] = {
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+#define EVHTTP2_STATIC_TABLE_LEN \
+	(sizeof(evhttp2_static_table) / sizeof(evhttp2_static_table[0]))
+
+/* The Huffman code of RFC 7541, appendix B, which is canonical: the codes
+ * of each length are consecutive numbers, starting at first[length].
+ * count[length] symbols have codes of that length, and they are in syms[],
+ * from offset[length] on, in the order of their codes.  Symbol 256 is
+ * EOS. */
+static const ev_uint16_t evhttp2_huff_syms[257] = {
+	48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+	45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+	95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+	58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+	77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+	106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+	88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+	0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+	195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+	167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+	132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+	173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+	233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+	151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+	183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+	171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+	200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+	255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+	246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+	6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+	21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+	249, 10, 13, 22, 256,
+};
+static const ev_uint32_t evhttp2_huff_first[31] = {
+	0, 0, 0, 0, 0, 0,
+	20, 92, 248, 508, 1016, 2042,
+	4090, 8184, 16380, 32764, 65534, 131068,
+	262136, 524272, 1048550, 2097116, 4194258, 8388568,
+	16777194, 33554412, 67108832, 134217694, 268435426, 536870910,
+	1073741820,
+};
+static const ev_uint16_t evhttp2_huff_offset[31] = {
+	0, 0, 0, 0, 0, 0, 10, 36, 68, 74, 74, 79,
+	82, 84, 90, 92, 95, 95, 95, 95, 98, 106, 119, 145,
+	174, 186, 190, 205, 224, 253, 253,
+};
+static const ev_uint16_t evhttp2_huff_count[31] = {
+	0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3,
+	2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29,
+	12, 4, 15, 19, 29, 0, 4,
+};
+
+/* An entry in an HPACK dynamic table.  The name and the value follow it,
+ * each with a NUL. */
+struct evhttp2_hpack_entry {
+	size_t name_len;
+	size_t value_len;
+};
+#define EVHTTP2_ENTRY_NAME(e)	((char *)((e) + 1))
+#define EVHTTP2_ENTRY_VALUE(e)	(EVHTTP2_ENTRY_NAME(e) + (e)->name_len + 1)
+/* How big section 4.1 says an entry is */
+#define EVHTTP2_ENTRY_SIZE(name_len, value_len) ((name_len) + (value_len) + 32)
+
+void
+evhttp2_hpack_init_(struct evhttp2_hpack *hpack, size_t limit)
+{
+	memset(hpack, 0, sizeof(*hpack));
+	hpack->max_size = hpack->limit = limit;
+}
+
+void
+evhttp2_hpack_clear_(struct evhttp2_hpack *hpack)
+{
+	size_t i;
+
+	for (i = 0; i < hpack->n_entries; ++i)
+		mm_free(hpack->entries[i]);
+	mm_free(hpack->entries);
+	mm_free(hpack->buf);
+	memset(hpack, 0, sizeof(*hpack));
+}
+
+/* Evict the oldest entries until there is room for 'room' more. */
+static void
+evhttp2_hpack_evict_(struct evhttp2_hpack *hpack, size_t room)
+{
+	size_t n = 0;
+
+	while (n < hpack->n_entries && hpack->size + room > hpack->max_size) {
+		struct evhttp2_hpack_entry *e = hpack->entries[n++];
+		hpack->size -= EVHTTP2_ENTRY_SIZE(e->name_len, e->value_len);
+		mm_free(e);
+	}
+	if (n > 0) {
+		hpack->n_entries -= n;
+		memmove(hpack->entries, hpack->entries + n,
+		    hpack->n_entries * sizeof(*hpack->entries));
+	}
+}
+
+static int
+evhttp2_hpack_insert_(struct evhttp2_hpack *hpack, const char *name,
+    size_t name_len, const char *value, size_t value_len)
+{
+	size_t size = EVHTTP2_ENTRY_SIZE(name_len, value_len);
+	struct evhttp2_hpack_entry *e;
+
+	if (size > hpack->max_size) {
+		/* Which empties the table, and adds nothing */
+		evhttp2_hpack_evict_(hpack, size);
+		return (0);
+	}
+	if ((e = mm_malloc(sizeof(*e) + name_len + value_len + 2)) == NULL) {
+		event_warn("%s: malloc", __func__);
+		return (-1);
+	}
+	e->name_len = name_len;
+	e->value_len = value_len;
+	memcpy(EVHTTP2_ENTRY_NAME(e), name, name_len);
+	EVHTTP2_ENTRY_NAME(e)[name_len] = '\0';
+	memcpy(EVHTTP2_ENTRY_VALUE(e), value, value_len);
+	EVHTTP2_ENTRY_VALUE(e)[value_len] = '\0';
+
+	evhttp2_hpack_evict_(hpack, size);
+	if (hpack->n_entries == hpack->entries_alloc) {
+		size_t n = hpack->entries_alloc ? hpack->entries_alloc * 2 : 16;
+		struct evhttp2_hpack_entry **entries =
+		    mm_realloc(hpack->entries, n * sizeof(*entries));
+		if (entries == NULL) {
+			event_warn("%s: realloc", __func__);
+			mm_free(e);
+			return (-1);
+		}
+		hpack->entries = entries;
+		hpack->entries_alloc = n;
+	}
+	hpack->entries[hpack->n_entries++] = e;
+	hpack->size += size;
+	return (0);
+}
+
+/* Find the header with HPACK index idx: 1 to 61 in the static table, and
+ * from 62 on in the dynamic table, newest first. */
+static int
+evhttp2_hpack_lookup_(struct evhttp2_hpack *hpack, ev_uint32_t idx,
+    const char **name, size_t *name_len, const char **value, size_t *value_len)
+{
+	struct evhttp2_hpack_entry *e;
+
+	if (idx == 0)
+		return (-1);
+	if (idx <= EVHTTP2_STATIC_TABLE_LEN) {
+		*name = evhttp2_static_table[idx - 1].name;
+		*value = evhttp2_static_table[idx - 1].value;
+		*name_len = strlen(*name);
+		*value_len = strlen(*value);
+		return (0);
+	}
+	idx -= EVHTTP2_STATIC_TABLE_LEN + 1;
+	if (idx >= hpack->n_entries)
+		return (-1);
+	e = hpack->entries[hpack->n_entries - 1 - idx];
+	*name = EVHTTP2_ENTRY_NAME(e);
+	*name_len = e->name_len;
+	*value = EVHTTP2_ENTRY_VALUE(e);
+	*value_len = e->value_len;
+	return (0);
+}
+
+/* Read an integer with a prefix of 'prefix' bits (section 5.1). */
+static int
+evhttp2_hpack_get_int_(const unsigned char **pp, const unsigned char *end,
+    int prefix, ev_uint32_t *out)
+{
+	const unsigned char *p = *pp;
+	ev_uint32_t mask = (1u << prefix) - 1, v;
+	int shift = 0;
+
+	if (p >= end)
+		return (-1);
+	v = *p++ & mask;
+	if (v == mask) {
+		ev_uint32_t b;
+		do {
+			/* Nothing we take needs more than 28 bits */
+			if (p >= end || shift > 21)
+				return (-1);
+			b = *p++;
+			v += (b & 0x7f) << shift;
+			shift += 7;
+		} while (b & 0x80);
+	}
+	*pp = p;
+	*out = v;
+	return (0);
+}
+
+static int
+evhttp2_hpack_reserve_(struct evhttp2_hpack *hpack, size_t size)
+{
+	size_t n = hpack->buf_alloc ? hpack->buf_alloc : 256;
+	char *buf;
+
+	if (size <= hpack->buf_alloc)
+		return (0);
+	while (n < size)
+		n <<= 1;
+	if ((buf = mm_realloc(hpack->buf, n)) == NULL) {
+		event_warn("%s: realloc", __func__);
+		return (-1);
+	}
+	hpack->buf = buf;
+	hpack->buf_alloc = n;
+	return (0);
+}
+
+static int
+evhttp2_huffman_decode_(const unsigned char *p, size_t len, char *out,
+    size_t *out_len)
+{
+	ev_uint32_t code = 0;
+	int bits = 0;
+	size_t i, n = 0;
+
+	for (i = 0; i < len; ++i) {
+		int bit;
+		for (bit = 7; bit >= 0; --bit) {
+			ev_uint32_t idx;
+			code = (code << 1) | ((p[i] >> bit) & 1);
+			++bits;
+			idx = code - evhttp2_huff_first[bits];
+			if (idx < evhttp2_huff_count[bits]) {
+				ev_uint16_t sym =
+				    evhttp2_huff_syms[evhttp2_huff_offset[bits] + idx];
+				if (sym == 256)
+					return (-1);
+				out[n++] = (char)sym;
+				code = 0;
+				bits = 0;
+			} else if (bits == 30) {
+				return (-1);
+			}
+		}
+	}
+	/* What is left must be padding: fewer than 8 bits of the start of
+	 * EOS, which is all ones (section 5.2). */
+	if (bits > 7 || code != (1u << bits) - 1)
+		return (-1);
+	*out_len = n;
+	return (0);
+}
+
+/* Read a string literal (section 5.2) into hpack->buf, at 'off', with a
+ * NUL after it. */
+static int
+evhttp2_hpack_get_string_(struct evhttp2_hpack *hpack,
+    const unsigned char **pp, const unsigned char *end, size_t off,
+    size_t *len)
+{
+	const unsigned char *p = *pp;
+	int huffman;
+	ev_uint32_t n;
+
+	if (p >= end)
+		return (-1);
+	huffman = (*p & 0x80) != 0;
+	if (evhttp2_hpack_get_int_(&p, end, 7, &n) < 0 ||
+	    n > (size_t)(end - p))
+		return (-1);
+	/* A Huffman code is at least 5 bits long */
+	if (evhttp2_hpack_reserve_(hpack,
+		off + (huffman ? (size_t)n * 8 / 5 : n) + 1) < 0)
+		return (-1);
+	if (huffman) {
+		if (evhttp2_huffman_decode_(p, n, hpack->buf + off, len) < 0)
+			return (-1);
+	} else {
+		memcpy(hpack->buf + off, p, n);
+		*len = n;
+	}
+	hpack->buf[off + *len] = '\0';
+	*pp = p + n;
+	return (0);
+}
+
+int
+evhttp2_hpack_decode_(struct evhttp2_hpack *hpack,
+    const unsigned char *p, size_t len, evhttp2_header_cb cb, void *arg)
+{
+	const unsigned char *end = p + len;
+	int started = 0;
+
+	while (p < end) {
+		const char *name, *value;
+		size_t name_len, value_len;
+		ev_uint32_t idx;
+
+		if (*p & 0x80) {
+			/* Indexed header field */
+			if (evhttp2_hpack_get_int_(&p, end, 7, &idx) < 0 ||
+			    evhttp2_hpack_lookup_(hpack, idx, &name, &name_len,
+				&value, &value_len) < 0)
+				return (-1);
+		} else if ((*p & 0xe0) == 0x20) {
+			/* Dynamic table size update, before any header */
+			if (started ||
+			    evhttp2_hpack_get_int_(&p, end, 5, &idx) < 0 ||
+			    idx > hpack->limit)
+				return (-1);
+			hpack->max_size = idx;
+			evhttp2_hpack_evict_(hpack, 0);
+			continue;
+		} else {
+			/* A literal, to be added to the table or not.  Its
+			 * name goes into our buffer even if it is in a table
+			 * already, since adding it may evict it. */
+			int add = (*p & 0x40) != 0;
+			if (evhttp2_hpack_get_int_(&p, end, add ? 6 : 4,
+				&idx) < 0)
+				return (-1);
+			if (idx != 0) {
+				if (evhttp2_hpack_lookup_(hpack, idx, &name,
+					&name_len, &value, &value_len) < 0 ||
+				    evhttp2_hpack_reserve_(hpack,
+					name_len + 1) < 0)
+					return (-1);
+				memcpy(hpack->buf, name, name_len + 1);
+			} else if (evhttp2_hpack_get_string_(hpack, &p, end,
+				0, &name_len) < 0) {
+				return (-1);
+			}
+			if (evhttp2_hpack_get_string_(hpack, &p, end,
+				name_len + 1, &value_len) < 0)
+				return (-1);
+			name = hpack->buf;
+			value = hpack->buf + name_len + 1;
+			if (add && evhttp2_hpack_insert_(hpack, name, name_len,
+				value, value_len) < 0)
+				return (-1);
+		}
+		started = 1;
+		if (cb(name, name_len, value, value_len, arg) < 0)
+			return (-1);
+	}
+	return (0);
+}
+
+static void
+evhttp2_hpack_put_int_(struct evbuffer *out, int prefix, unsigned char bits,
+    size_t v)
+{
+	unsigned char buf[16];
+	size_t mask = (1u << prefix) - 1;
+	int n = 0;
+
+	if (v < mask) {
+		buf[n++] = bits | (unsigned char)v;
+	} else {
+		buf[n++] = bits | (unsigned char)mask;
+		v -= mask;
+		while (v >= 0x80) {
+			buf[n++] = (unsigned char)(v & 0x7f) | 0x80;
+			v >>= 7;
+		}
+		buf[n++] = (unsigned char)v;
+	}
+	evbuffer_add(out, buf, n);
+}
+
+int
+evhttp2_hpack_encode_(struct evbuffer *out, const char *name,
+    const char *value)
+{
+	size_t i, name_idx = 0, len;
+
+	/* We never add to the peer's table, so that we need not keep one of
+	 * our own, and we do not bother with Huffman codes. */
+	for (i = 0; i < EVHTTP2_STATIC_TABLE_LEN; ++i) {
+		if (evutil_ascii_strcasecmp(evhttp2_static_table[i].name,
+			name))
+			continue;
+		if (!strcmp(evhttp2_static_table[i].value, value)) {
+			evhttp2_hpack_put_int_(out, 7, 0x80, i + 1);
+			return (0);
+		}
+		if (name_idx == 0)
+			name_idx = i + 1;
+	}
+
+	/* A literal without indexing */
+	if (name_idx != 0) {
+		evhttp2_hpack_put_int_(out, 4, 0x00, name_idx);
+	} else {
+		char lower[64];
+		size_t n;
+
+		evhttp2_hpack_put_int_(out, 4, 0x00, 0);
+		len = strlen(name);
+		evhttp2_hpack_put_int_(out, 7, 0x00, len);
+		while (len > 0) {
+			n = len < sizeof(lower) ? len : sizeof(lower);
+			for (i = 0; i < n; ++i)
+				lower[i] = EVUTIL_TOLOWER_(name[i]);
+			evbuffer_add(out, lower, n);
+			name += n;
+			len -= n;
+		}
+	}
+	len = strlen(value);
+	evhttp2_hpack_put_int_(out, 7, 0x00, len);
+	return evbuffer_add(out, value, len);
+}
+
+/* One request on a connection (section 5) */
+struct evhttp2_stream {
+	HT_ENTRY(evhttp2_stream) node;
+	/* In the session's queue of streams with something to send, and in
+	 * its queue of streams whose callback is due */
+	TAILQ_ENTRY(evhttp2_stream) send_next;
+	TAILQ_ENTRY(evhttp2_stream) cb_next;
+
+	ev_uint32_t id;
+	struct evhttp_request *req;
+
+	/* DATA that we have still to send, and how much the peer lets us */
+	struct evbuffer *output;
+	ev_int64_t send_window;
+	/* How much the peer may still send, and how much of what it has
+	 * sent we have dealt with since we last gave it more window */
+	ev_int64_t recv_window;
+	ev_uint32_t recv_unacked;
+
+	/* Called once output has been written to the connection */
+	void (*cb)(struct evhttp_connection *, void *);
+	void *cb_arg;
+
+	unsigned in_sendq : 1;
+	unsigned in_cbq : 1;
+	unsigned end_queued : 1;	/* END_STREAM goes after output */
+	unsigned local_closed : 1;	/* we have sent END_STREAM */
+	unsigned remote_closed : 1;	/* the peer has */
+	unsigned got_headers : 1;	/* the request's, or the final response's */
+	unsigned dispatched : 1;	/* a server's user has the request */
+	unsigned discard : 1;	/* we don't want the rest of the body */
+};
+
+TAILQ_HEAD(evhttp2_streamq, evhttp2_stream);
+
+/* The HTTP/2 state of a connection */
+struct evhttp2_session {
+	/* NULL once the session has been freed while we were running */
+	struct evhttp_connection *evcon;
+
+	HT_HEAD(evhttp2_stream_map, evhttp2_stream) streams;
+	unsigned n_streams;
+	struct evhttp2_streamq sendq;
+	struct evhttp2_streamq cbq;
+
+	/* The highest stream the peer has opened, and the next we will */
+	ev_uint32_t last_peer_id;
+	ev_uint32_t next_id;
+
+	ev_int64_t send_window;
+	ev_int64_t recv_window;
+	ev_uint32_t recv_unacked;
+
+	/* The peer's settings */
+	ev_uint32_t initial_window;
+	ev_uint32_t max_frame_size;
+	ev_uint32_t max_streams;
+
+	struct evhttp2_hpack hpack;
+
+	/* A header block that waits for CONTINUATION frames */
+	struct evbuffer *header_block;
+	ev_uint32_t header_block_id;
+	unsigned header_block_end_stream : 1;
+
+	unsigned server : 1;
+	unsigned goaway_sent : 1;
+	unsigned goaway_received : 1;
+	unsigned closing : 1;	/* close once our output has been written */
+	unsigned flushing : 1;
+	unsigned dead : 1;	/* freed while we were running */
+	/* How deep we are in our own functions; the session is not freed
+	 * until we are out of them all */
+	int running;
+};
+
+static inline unsigned
+evhttp2_stream_hash(struct evhttp2_stream *stream)
+{
+	return stream->id;
+}
+
+static inline int
+evhttp2_stream_eq(struct evhttp2_stream *a, struct evhttp2_stream *b)
+{
+	return a->id == b->id;
+}
+
+HT_PROTOTYPE(evhttp2_stream_map, evhttp2_stream, node, evhttp2_stream_hash,
+    evhttp2_stream_eq)
+HT_GENERATE(evhttp2_stream_map, evhttp2_stream, node, evhttp2_stream_hash,
+    evhttp2_stream_eq, 0.5, mm_malloc, mm_realloc, mm_free)
+
+static void evhttp2_flush_(struct evhttp2_session *session);
+
+static void
+evhttp2_enter_(struct evhttp2_session *session)
+{
+	++session->running;
+}
+
+/* Returns -1 if the session was freed meanwhile. */
+static int
+evhttp2_leave_(struct evhttp2_session *session)
+{
+	if (--session->running == 0 && session->dead) {
+		mm_free(session);
+		return (-1);
+	}
+	return (session->dead ? -1 : 0);
+}
+
+static struct evbuffer *
+evhttp2_output_(struct evhttp2_session *session)
+{
+	return bufferevent_get_output(session->evcon->bufev);
+}
+
+static ev_uint32_t
+evhttp2_get32_(const unsigned char *p)
+{
+	return ((ev_uint32_t)p[0] << 24) | ((ev_uint32_t)p[1] << 16) |
+	    ((ev_uint32_t)p[2] << 8) | p[3];
+}
+
+static void
+evhttp2_set32_(unsigned char *p, ev_uint32_t v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static void
+evhttp2_frame_header_(struct evhttp2_session *session, size_t len, int type,
+    int flags, ev_uint32_t id)
+{
+	unsigned char h[EVHTTP2_FRAME_HEADER_LEN];
+
+	h[0] = (unsigned char)(len >> 16);
+	h[1] = (unsigned char)(len >> 8);
+	h[2] = (unsigned char)len;
+	h[3] = (unsigned char)type;
+	h[4] = (unsigned char)flags;
+	evhttp2_set32_(h + 5, id & EVHTTP2_MAX_STREAM_ID);
+	evbuffer_add(evhttp2_output_(session), h, sizeof(h));
+}
+
+static void
+evhttp2_send_u32_frame_(struct evhttp2_session *session, int type,
+    ev_uint32_t id, ev_uint32_t v)
+{
+	unsigned char p[4];
+
+	evhttp2_set32_(p, v);
+	evhttp2_frame_header_(session, sizeof(p), type, 0, id);
+	evbuffer_add(evhttp2_output_(session), p, sizeof(p));
+}
+
+static void
+evhttp2_send_rst_(struct evhttp2_session *session, ev_uint32_t id,
+    ev_uint32_t error)
+{
+	evhttp2_send_u32_frame_(session, EVHTTP2_RST_STREAM, id, error);
+}
+
+/* Send a GOAWAY.  Unless there was no error, we stop reading, and close
+ * the connection once the GOAWAY has been written. */
+static void
+evhttp2_goaway_(struct evhttp2_session *session, ev_uint32_t error)
+{
+	unsigned char p[8];
+
+	if (!session->goaway_sent) {
+		evhttp2_set32_(p, session->last_peer_id);
+		evhttp2_set32_(p + 4, error);
+		evhttp2_frame_header_(session, sizeof(p), EVHTTP2_GOAWAY, 0, 0);
+		evbuffer_add(evhttp2_output_(session), p, sizeof(p));
+		session->goaway_sent = 1;
+	}
+	if (error != EVHTTP2_NO_ERROR) {
+		event_debug(("%s: closing connection with error %u",
+			__func__, (unsigned)error));
+		session->closing = 1;
+		bufferevent_disable(session->evcon->bufev, EV_READ);
+	}
+}
+
+/* Whether id is of a stream that the peer, or we, could open and has not
+ * yet been opened */
+static int
+evhttp2_id_is_idle_(struct evhttp2_session *session, ev_uint32_t id)
+{
+	int ours = (id & 1) == !session->server;
+	return ours ? id >= session->next_id : id > session->last_peer_id;
+}
+
+static struct evhttp2_stream *
+evhttp2_stream_find_(struct evhttp2_session *session, ev_uint32_t id)
+{
+	struct evhttp2_stream key;
+	key.id = id;
+	return HT_FIND(evhttp2_stream_map, &session->streams, &key);
+}
+
+static struct evhttp2_stream *
+evhttp2_stream_new_(struct evhttp2_session *session, ev_uint32_t id,
+    struct evhttp_request *req)
+{
+	struct evhttp2_stream *stream;
+
+	if ((stream = mm_calloc(1, sizeof(*stream))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return (NULL);
+	}
+	if ((stream->output = evbuffer_new()) == NULL) {
+		event_warn("%s: evbuffer_new", __func__);
+		mm_free(stream);
+		return (NULL);
+	}
+	stream->id = id;
+	stream->req = req;
+	stream->send_window = session->initial_window;
+	stream->recv_window = EVHTTP2_DEFAULT_WINDOW;
+	HT_INSERT(evhttp2_stream_map, &session->streams, stream);
+	++session->n_streams;
+	req->h2_stream = stream;
+	return (stream);
+}
+
+/* Whether stream has something to send and is not queued to send it */
+static int
+evhttp2_stream_ready_(struct evhttp2_stream *stream)
+{
+	return !stream->in_sendq && !stream->local_closed &&
+	    (evbuffer_get_length(stream->output) > 0 || stream->end_queued);
+}
+
+static void
+evhttp2_stream_queue_(struct evhttp2_session *session,
+    struct evhttp2_stream *stream)
+{
+	if (evhttp2_stream_ready_(stream)) {
+		TAILQ_INSERT_TAIL(&session->sendq, stream, send_next);
+		stream->in_sendq = 1;
+	}
+}
+
+/* Take stream out of the session and free it, but not its request. */
+static void
+evhttp2_stream_remove_(struct evhttp2_session *session,
+    struct evhttp2_stream *stream)
+{
+	HT_REMOVE(evhttp2_stream_map, &session->streams, stream);
+	if (stream->in_sendq)
+		TAILQ_REMOVE(&session->sendq, stream, send_next);
+	if (stream->in_cbq)
+		TAILQ_REMOVE(&session->cbq, stream, cb_next);
+	--session->n_streams;
+	if (stream->req != NULL)
+		stream->req->h2_stream = NULL;
+	evbuffer_free(stream->output);
+	mm_free(stream);
+}
+
+/* Tell the user of a client request that it failed, and free it. */
+static void
+evhttp2_request_fail_(struct evhttp_request *req,
+    enum evhttp_request_error error)
+{
+	void (*cb)(struct evhttp_request *, void *) = req->cb;
+	void (*error_cb)(enum evhttp_request_error, void *) = req->error_cb;
+	void *cb_arg = req->cb_arg;
+
+	req->evcon = NULL;
+	if (!evhttp_request_is_owned(req))
+		evhttp_request_free(req);
+
+	if (error_cb != NULL)
+		(*error_cb)(error, cb_arg);
+	/* when the request was canceled, the callback is not executed */
+	if (cb != NULL && error != EVREQ_HTTP_REQUEST_CANCEL)
+		(*cb)(NULL, cb_arg);
+}
+
+/* We are done with stream: if 'error' is negative, because it is
+ * complete, and otherwise because of it.  Server requests that the user
+ * still has are left to the user, without a connection. */
+static void
+evhttp2_stream_close_(struct evhttp2_session *session,
+    struct evhttp2_stream *stream, int error)
+{
+	struct evhttp_request *req = stream->req;
+	int dispatched = stream->dispatched;
+
+	evhttp2_stream_remove_(session, stream);
+	if (req == NULL)
+		return;
+
+	if (session->server) {
+		if (dispatched && !req->userdone) {
+			req->evcon = NULL;
+			return;
+		}
+		if (error < 0 && req->on_complete_cb != NULL)
+			(*req->on_complete_cb)(req, req->on_complete_cb_arg);
+		evhttp_request_free(req);
+		return;
+	}
+
+	if (error >= 0) {
+		evhttp2_request_fail_(req, error);
+		return;
+	}
+	req->evcon = NULL;
+	if (req->cb != NULL)
+		(*req->cb)(req, req->cb_arg);
+	if (!evhttp_request_is_owned(req))
+		evhttp_request_free(req);
+}
+
+/* Reset stream, for a stream error (section 5.4.2). */
+static void
+evhttp2_stream_reset_(struct evhttp2_session *session,
+    struct evhttp2_stream *stream, ev_uint32_t code,
+    enum evhttp_request_error error)
+{
+	evhttp2_send_rst_(session, stream->id, code);
+	evhttp2_stream_close_(session, stream, error);
+}
+
+/* We have sent END_STREAM on stream. */
+static void
+evhttp2_stream_sent_(struct evhttp2_session *session,
+    struct evhttp2_stream *stream)
+{
+	stream->local_closed = 1;
+	if (!session->server)
+		return;
+	/* The response is complete, even if the request is not: tell the
+	 * client to stop sending it (section 8.1). */
+	if (!stream->remote_closed)
+		evhttp2_send_rst_(session, stream->id, EVHTTP2_NO_ERROR);
+	evhttp2_stream_close_(session, stream, -1);
+}
+
+/* Move DATA from the streams into the connection's output, a frame at a
+ * time from each in turn, as far as flow control lets us. */
+static void
+evhttp2_flush_(struct evhttp2_session *session)
+{
+	struct evbuffer *out;
+	struct evhttp2_stream *stream;
+
+	if (session->flushing)
+		return;
+	session->flushing = 1;
+	evhttp2_enter_(session);
+	out = evhttp2_output_(session);
+	while (!session->dead && !session->closing &&
+	    (stream = TAILQ_FIRST(&session->sendq)) != NULL &&
+	    evbuffer_get_length(out) < EVHTTP2_OUTPUT_HIGHWATER) {
+		size_t len = evbuffer_get_length(stream->output);
+		int flags = 0;
+
+		if (len > 0 && session->send_window <= 0)
+			break;
+		TAILQ_REMOVE(&session->sendq, stream, send_next);
+		stream->in_sendq = 0;
+		if (len > 0) {
+			/* Until a WINDOW_UPDATE puts it back */
+			if (stream->send_window <= 0)
+				continue;
+			if ((ev_int64_t)len > session->send_window)
+				len = (size_t)session->send_window;
+			if ((ev_int64_t)len > stream->send_window)
+				len = (size_t)stream->send_window;
+			if (len > session->max_frame_size)
+				len = session->max_frame_size;
+		}
+		if (stream->end_queued &&
+		    len == evbuffer_get_length(stream->output))
+			flags = EVHTTP2_FLAG_END_STREAM;
+
+		evhttp2_frame_header_(session, len, EVHTTP2_DATA, flags,
+		    stream->id);
+		evbuffer_remove_buffer(stream->output, out, len);
+		session->send_window -= len;
+		stream->send_window -= len;
+
+		if (evbuffer_get_length(stream->output) > 0) {
+			TAILQ_INSERT_TAIL(&session->sendq, stream, send_next);
+			stream->in_sendq = 1;
+			continue;
+		}
+		if (stream->cb != NULL && !stream->in_cbq) {
+			TAILQ_INSERT_TAIL(&session->cbq, stream, cb_next);
+			stream->in_cbq = 1;
+		}
+		if (flags)
+			evhttp2_stream_sent_(session, stream);
+	}
+	if (!session->dead)
+		session->flushing = 0;
+	evhttp2_leave_(session);
+}
+
+/* Write a header block as a HEADERS frame and as many CONTINUATION frames
+ * as it needs. */
+static void
+evhttp2_send_header_block_(struct evhttp2_session *session, ev_uint32_t id,
+    struct evbuffer *block, int end_stream)
+{
+	struct evbuffer *out = evhttp2_output_(session);
+	int type = EVHTTP2_HEADERS;
+	int flags = end_stream ? EVHTTP2_FLAG_END_STREAM : 0;
+
+	do {
+		size_t len = evbuffer_get_length(block);
+		if (len > session->max_frame_size)
+			len = session->max_frame_size;
+		else
+			flags |= EVHTTP2_FLAG_END_HEADERS;
+		evhttp2_frame_header_(session, len, type, flags, id);
+		evbuffer_remove_buffer(block, out, len);
+		type = EVHTTP2_CONTINUATION;
+		flags = 0;
+	} while (evbuffer_get_length(block) > 0);
+}
+
+/* Headers that are about an HTTP/1.x connection, not the message, and so
+ * have no place in HTTP/2 (section 8.1.2.2) */
+static int
+evhttp2_is_connection_header_(const char *name, const char *value)
+{
+	return !evutil_ascii_strcasecmp(name, "connection") ||
+	    !evutil_ascii_strcasecmp(name, "keep-alive") ||
+	    !evutil_ascii_strcasecmp(name, "proxy-connection") ||
+	    !evutil_ascii_strcasecmp(name, "transfer-encoding") ||
+	    !evutil_ascii_strcasecmp(name, "upgrade") ||
+	    (!evutil_ascii_strcasecmp(name, "te") &&
+		evutil_ascii_strcasecmp(value, "trailers"));
+}
+
+/* What we found in the header block of a request or a response */
+struct evhttp2_header_ctx {
+	/* Where the headers go; NULL if we only decode them to keep our
+	 * HPACK state right */
+	struct evhttp_request *req;
+	struct evkeyvalq *headers;
+	int server;
+	int trailers;
+
+	/* The pseudo-headers, in req's arena */
+	char *method;
+	char *path;
+	char *authority;
+	int status;
+
+	/* The size of the headers, as SETTINGS_MAX_HEADER_LIST_SIZE counts */
+	size_t size;
+	unsigned malformed : 1;
+	unsigned regular : 1;	/* we have seen a header other than these */
+};
+
+static int
+evhttp2_add_cookie_(struct evhttp2_header_ctx *h, const char *value,
+    size_t value_len)
+{
+	struct evkeyval *kv;
+
+	/* A request may split its cookies into separate headers, which we
+	 * put back together (section 8.1.2.5). */
+	TAILQ_FOREACH(kv, h->headers, next) {
+		size_t len;
+		char *v;
+
+		if (strcmp(kv->key, "cookie"))
+			continue;
+		len = strlen(kv->value);
+		if ((v = evhttp_request_alloc_(h->req,
+			    len + value_len + 3)) == NULL)
+			return (-1);
+		memcpy(v, kv->value, len);
+		memcpy(v + len, "; ", 2);
+		memcpy(v + len + 2, value, value_len + 1);
+		kv->value = v;
+		return (0);
+	}
+	return evhttp_request_add_header_(h->req, h->headers, "cookie", value);
+}
+
+static int
+evhttp2_on_header_(const char *name, size_t name_len, const char *value,
+    size_t value_len, void *arg)
+{
+	struct evhttp2_header_ctx *h = arg;
+	char **slot = NULL;
+	size_t i;
+
+	h->size += EVHTTP2_ENTRY_SIZE(name_len, value_len);
+	if (h->req == NULL || h->malformed)
+		return (0);
+	if (strlen(name) != name_len || strlen(value) != value_len) {
+		h->malformed = 1;
+		return (0);
+	}
+
+	if (name[0] == ':') {
+		/* Pseudo-headers come first, and not in trailers */
+		if (h->regular || h->trailers) {
+			h->malformed = 1;
+		} else if (!h->server) {
+			if (strcmp(name, ":status") || h->status ||
+			    value_len != 3 || !EVUTIL_ISDIGIT_(value[0]) ||
+			    !EVUTIL_ISDIGIT_(value[1]) ||
+			    !EVUTIL_ISDIGIT_(value[2]))
+				h->malformed = 1;
+			else
+				h->status = atoi(value);
+		} else {
+			if (!strcmp(name, ":method"))
+				slot = &h->method;
+			else if (!strcmp(name, ":path"))
+				slot = &h->path;
+			else if (!strcmp(name, ":authority"))
+				slot = &h->authority;
+			else if (strcmp(name, ":scheme"))
+				h->malformed = 1;
+			if (slot != NULL && (*slot != NULL ||
+				(*slot = evhttp_request_strndup_(h->req,
+				    value, value_len)) == NULL))
+				h->malformed = 1;
+		}
+		return (0);
+	}
+
+	h->regular = 1;
+	for (i = 0; i < name_len; ++i) {
+		if (EVUTIL_TOLOWER_(name[i]) != name[i]) {
+			h->malformed = 1;
+			return (0);
+		}
+	}
+	if (evhttp2_is_connection_header_(name, value)) {
+		h->malformed = 1;
+		return (0);
+	}
+	if (!strcmp(name, "cookie") && h->server && !h->trailers) {
+		if (evhttp2_add_cookie_(h, value, value_len) < 0)
+			h->malformed = 1;
+		return (0);
+	}
+	if (evhttp_request_add_header_(h->req, h->headers, name, value) < 0)
+		h->malformed = 1;
+	return (0);
+}
+
+/* Decode a header block into h.  Returns an error code for the connection
+ * if we could not. */
+static int
+evhttp2_decode_headers_(struct evhttp2_session *session,
+    struct evhttp2_header_ctx *h, const unsigned char *block, size_t len)
+{
+	if (evhttp2_hpack_decode_(&session->hpack, block, len,
+		evhttp2_on_header_, h) < 0)
+		return (EVHTTP2_COMPRESSION_ERROR);
+	return (0);
+}
+
+static void
+evhttp2_dispatch_(struct evhttp2_session *session,
+    struct evhttp2_stream *stream)
+{
+	struct evhttp_request *req = stream->req;
+
+	stream->dispatched = 1;
+	(*req->cb)(req, req->cb_arg);
+}
+
+/* Give the server's user a request that we won't serve, so that it will
+ * answer with the error 'code'. */
+static void
+evhttp2_dispatch_error_(struct evhttp2_session *session,
+    struct evhttp2_stream *stream, int code)
+{
+	struct evhttp_request *req = stream->req;
+
+	stream->discard = 1;
+	if (req->uri_elems != NULL) {
+		evhttp_uri_free(req->uri_elems);
+		req->uri_elems = NULL;
+	}
+	req->uri = NULL;
+	req->response_code = code;
+	evhttp2_dispatch_(session, stream);
+}
+
+/* The header block of a new stream that a client opened */
+static int
+evhttp2_on_request_headers_(struct evhttp2_session *session, ev_uint32_t id,
+    int end_stream, const unsigned char *block, size_t len)
+{
+	struct evhttp_connection *evcon = session->evcon;
+	struct evhttp2_header_ctx h;
+	struct evhttp2_stream *stream = NULL;
+	struct evhttp_request *req = NULL;
+	int error;
+
+	if ((id & 1) == 0)
+		return (EVHTTP2_PROTOCOL_ERROR);
+	memset(&h, 0, sizeof(h));
+	h.server = 1;
+
+	if (!evhttp2_id_is_idle_(session, id)) {
+		/* A stream we have closed */
+		if ((error = evhttp2_decode_headers_(session, &h, block, len)))
+			return (error);
+		evhttp2_send_rst_(session, id, EVHTTP2_STREAM_CLOSED);
+		return (0);
+	}
+	session->last_peer_id = id;
+
+	if (!session->goaway_sent &&
+	    session->n_streams < EVHTTP2_MAX_STREAMS &&
+	    (req = evhttp_server_request_new_(evcon)) != NULL &&
+	    (stream = evhttp2_stream_new_(session, id, req)) == NULL) {
+		evhttp_request_free(req);
+		req = NULL;
+	}
+	h.req = req;
+	h.headers = req != NULL ? req->input_headers : NULL;
+	if ((error = evhttp2_decode_headers_(session, &h, block, len))) {
+		if (stream != NULL)
+			evhttp2_stream_close_(session, stream,
+			    EVREQ_HTTP_INVALID_HEADER);
+		return (error);
+	}
+	if (stream == NULL) {
+		evhttp2_send_rst_(session, id, EVHTTP2_REFUSED_STREAM);
+		return (0);
+	}
+
+	stream->got_headers = 1;
+	if (end_stream)
+		stream->remote_closed = 1;
+	req->headers_size = h.size;
+
+	if (h.malformed || h.method == NULL ||
+	    (h.path == NULL && h.authority == NULL)) {
+		evhttp2_stream_reset_(session, stream,
+		    EVHTTP2_PROTOCOL_ERROR, EVREQ_HTTP_INVALID_HEADER);
+		return (0);
+	}
+	if (h.authority != NULL &&
+	    evhttp_find_header(req->input_headers, "Host") == NULL)
+		evhttp_request_add_header_(req, req->input_headers, "host",
+		    h.authority);
+
+	if (h.size > evcon->max_headers_size) {
+		evhttp2_dispatch_error_(session, stream, HTTP_ENTITYTOOLARGE);
+		return (0);
+	}
+	/* CONNECT has only an :authority (section 8.3) */
+	if (evhttp_request_set_target_(req, h.method,
+		h.path != NULL ? h.path : h.authority) < 0) {
+		evhttp2_dispatch_error_(session, stream, HTTP_BADREQUEST);
+		return (0);
+	}
+	if (end_stream)
+		evhttp2_dispatch_(session, stream);
+	return (0);
+}
+
+/* The header block of a response, or of a server's request trailers */
+static int
+evhttp2_on_stream_headers_(struct evhttp2_session *session,
+    struct evhttp2_stream *stream, int end_stream,
+    const unsigned char *block, size_t len)
+{
+	struct evhttp_request *req = stream->req;
+	struct evhttp2_header_ctx h;
+	int error;
+
+	memset(&h, 0, sizeof(h));
+	h.server = session->server;
+	h.trailers = stream->got_headers;
+	if (!stream->discard && !stream->remote_closed) {
+		h.req = req;
+		h.headers = req->input_headers;
+	}
+	if ((error = evhttp2_decode_headers_(session, &h, block, len)))
+		return (error);
+
+	if (stream->remote_closed) {
+		evhttp2_stream_reset_(session, stream, EVHTTP2_STREAM_CLOSED,
+		    EVREQ_HTTP_INVALID_HEADER);
+		return (0);
+	}
+	if (h.malformed || (h.trailers && !end_stream) ||
+	    (!h.trailers && !session->server && !h.status)) {
+		evhttp2_stream_reset_(session, stream, EVHTTP2_PROTOCOL_ERROR,
+		    EVREQ_HTTP_INVALID_HEADER);
+		return (0);
+	}
+	if (end_stream)
+		stream->remote_closed = 1;
+
+	if (session->server) {
+		/* Trailers: the request is complete */
+		if (!stream->dispatched)
+			evhttp2_dispatch_(session, stream);
+		return (0);
+	}
+
+	if (!h.trailers) {
+		/* An interim response, which we skip */
+		if (h.status < 200) {
+			if (end_stream)
+				evhttp2_stream_reset_(session, stream,
+				    EVHTTP2_PROTOCOL_ERROR,
+				    EVREQ_HTTP_INVALID_HEADER);
+			return (0);
+		}
+		stream->got_headers = 1;
+		evhttp_response_code_(req, h.status, NULL);
+		req->major = 2;
+		req->minor = 0;
+		req->headers_size = h.size;
+		if (h.size > session->evcon->max_headers_size) {
+			evhttp2_stream_reset_(session, stream, EVHTTP2_CANCEL,
+			    EVREQ_HTTP_DATA_TOO_LONG);
+			return (0);
+		}
+		if (req->header_cb != NULL &&
+		    (*req->header_cb)(req, req->cb_arg) < 0) {
+			if (!session->dead && req->h2_stream == stream)
+				evhttp2_stream_reset_(session, stream,
+				    EVHTTP2_CANCEL, EVREQ_HTTP_EOF);
+			return (0);
+		}
+		if (session->dead || req->h2_stream != stream)
+			return (0);
+	}
+	if (end_stream)
+		evhttp2_stream_close_(session, stream, -1);
+	return (0);
+}
+
+static int
+evhttp2_on_header_block_(struct evhttp2_session *session, ev_uint32_t id,
+    int end_stream, const unsigned char *block, size_t len)
+{
+	struct evhttp2_stream *stream = evhttp2_stream_find_(session, id);
+	struct evhttp2_header_ctx h;
+
+	if (stream != NULL)
+		return evhttp2_on_stream_headers_(session, stream, end_stream,
+		    block, len);
+	if (session->server)
+		return evhttp2_on_request_headers_(session, id, end_stream,
+		    block, len);
+
+	/* A server can't open streams, with push turned off; but this may
+	 * be the response to a request that we have canceled. */
+	if (evhttp2_id_is_idle_(session, id) || (id & 1) == 0)
+		return (EVHTTP2_PROTOCOL_ERROR);
+	memset(&h, 0, sizeof(h));
+	return evhttp2_decode_headers_(session, &h, block, len);
+}
+
+/* Strip the padding, and the priority fields of a HEADERS frame, off the
+ * payload of a frame. */
+static int
+evhttp2_unpad_(int flags, int priority, const unsigned char **p,
+    size_t *len)
+{
+	size_t pad = 0;
+
+	if (flags & EVHTTP2_FLAG_PADDED) {
+		if (*len < 1)
+			return (-1);
+		pad = (*p)[0];
+		++*p;
+		--*len;
+	}
+	if (priority && (flags & EVHTTP2_FLAG_PRIORITY)) {
+		if (*len < 5)
+			return (-1);
+		*p += 5;
+		*len -= 5;
+	}
+	if (pad > *len)
+		return (-1);
+	*len -= pad;
+	return (0);
+}
+
+static int
+evhttp2_on_headers_(struct evhttp2_session *session, int flags,
+    ev_uint32_t id, const unsigned char *p, size_t len)
+{
+	int end_stream = (flags & EVHTTP2_FLAG_END_STREAM) != 0;
+
+	if (id == 0 || evhttp2_unpad_(flags, 1, &p, &len) < 0)
+		return (EVHTTP2_PROTOCOL_ERROR);
+	if (flags & EVHTTP2_FLAG_END_HEADERS)
+		return evhttp2_on_header_block_(session, id, end_stream,
+		    p, len);
+
+	if ((session->header_block = evbuffer_new()) == NULL)
+		return (EVHTTP2_INTERNAL_ERROR);
+	session->header_block_id = id;
+	session->header_block_end_stream = end_stream;
+	evbuffer_add(session->header_block, p, len);
+	return (0);
+}
+
+static int
+evhttp2_on_continuation_(struct evhttp2_session *session, int flags,
+    ev_uint32_t id, const unsigned char *p, size_t len)
+{
+	struct evbuffer *block = session->header_block;
+	size_t block_len;
+	int error;
+
+	if (block == NULL || id != session->header_block_id)
+		return (EVHTTP2_PROTOCOL_ERROR);
+	evbuffer_add(block, p, len);
+	block_len = evbuffer_get_length(block);
+	if (block_len > EVHTTP2_MAX_HEADER_BLOCK)
+		return (EVHTTP2_ENHANCE_YOUR_CALM);
+	if (!(flags & EVHTTP2_FLAG_END_HEADERS))
+		return (0);
+
+	session->header_block = NULL;
+	error = evhttp2_on_header_block_(session, id,
+	    session->header_block_end_stream,
+	    evbuffer_pullup(block, block_len), block_len);
+	evbuffer_free(block);
+	return (error);
+}
+
+/* We are done with len bytes of DATA that the peer sent on stream, or only
+ * on the connection if stream is NULL: once enough of its window has been
+ * used up that way, give it back. */
+static void
+evhttp2_consumed_(struct evhttp2_session *session,
+    struct evhttp2_stream *stream, size_t len)
+{
+	if (session->dead)
+		return;
+
+	session->recv_unacked += len;
+	if (session->recv_unacked >= EVHTTP2_WINDOW_REFILL) {
+		evhttp2_send_u32_frame_(session, EVHTTP2_WINDOW_UPDATE, 0,
+		    session->recv_unacked);
+		session->recv_window += session->recv_unacked;
+		session->recv_unacked = 0;
+	}
+
+	/* A stream that the peer has closed gets no more */
+	if (stream == NULL || stream->remote_closed)
+		return;
+	stream->recv_unacked += len;
+	if (stream->recv_unacked >= EVHTTP2_WINDOW_REFILL) {
+		evhttp2_send_u32_frame_(session, EVHTTP2_WINDOW_UPDATE,
+		    stream->id, stream->recv_unacked);
+		stream->recv_window += stream->recv_unacked;
+		stream->recv_unacked = 0;
+	}
+}
+
+static int
+evhttp2_on_data_(struct evhttp2_session *session, int flags, ev_uint32_t id,
+    const unsigned char *p, size_t len)
+{
+	struct evhttp2_stream *stream;
+	struct evhttp_request *req;
+	size_t frame_len = len;
+
+	if (id == 0 || evhttp2_unpad_(flags, 0, &p, &len) < 0)
+		return (EVHTTP2_PROTOCOL_ERROR);
+
+	/* Padding counts against the window too */
+	if ((ev_int64_t)frame_len > session->recv_window)
+		return (EVHTTP2_FLOW_CONTROL_ERROR);
+	session->recv_window -= frame_len;
+
+	if ((stream = evhttp2_stream_find_(session, id)) == NULL) {
+		evhttp2_consumed_(session, NULL, frame_len);
+		return evhttp2_id_is_idle_(session, id) ?
+		    EVHTTP2_PROTOCOL_ERROR : 0;
+	}
+	if ((ev_int64_t)frame_len > stream->recv_window) {
+		evhttp2_consumed_(session, NULL, frame_len);
+		evhttp2_stream_reset_(session, stream,
+		    EVHTTP2_FLOW_CONTROL_ERROR, EVREQ_HTTP_INVALID_HEADER);
+		return (0);
+	}
+	stream->recv_window -= frame_len;
+	if (stream->remote_closed || !stream->got_headers) {
+		evhttp2_consumed_(session, NULL, frame_len);
+		evhttp2_stream_reset_(session, stream, EVHTTP2_STREAM_CLOSED,
+		    EVREQ_HTTP_INVALID_HEADER);
+		return (0);
+	}
+	if (flags & EVHTTP2_FLAG_END_STREAM)
+		stream->remote_closed = 1;
+
+	req = stream->req;
+	if (!stream->discard) {
+		req->body_size += len;
+		if (req->body_size > session->evcon->max_body_size) {
+			evhttp2_consumed_(session, NULL, frame_len);
+			if (session->server) {
+				evhttp2_dispatch_error_(session, stream,
+				    HTTP_ENTITYTOOLARGE);
+			} else {
+				evhttp2_stream_reset_(session, stream,
+				    EVHTTP2_CANCEL, EVREQ_HTTP_DATA_TOO_LONG);
+			}
+			return (0);
+		}
+		evbuffer_add(req->input_buffer, p, len);
+	}
+
+	/* A body that we keep until the request is done is bounded by
+	 * max_body_size, so what we keep of it is dealt with. */
+	if (session->server) {
+		evhttp2_consumed_(session, stream, frame_len);
+		if (stream->remote_closed && !stream->dispatched)
+			evhttp2_dispatch_(session, stream);
+		return (0);
+	}
+
+	/* One that goes to chunk_cb is not, until chunk_cb has had it */
+	if (len > 0 && req->chunk_cb != NULL) {
+		req->flags |= EVHTTP_REQ_DEFER_FREE;
+		(*req->chunk_cb)(req, req->cb_arg);
+		req->flags &= ~EVHTTP_REQ_DEFER_FREE;
+		evbuffer_drain(req->input_buffer,
+		    evbuffer_get_length(req->input_buffer));
+		if ((req->flags & EVHTTP_REQ_NEEDS_FREE) != 0) {
+			/* canceled, which took it off its stream */
+			evhttp_request_free(req);
+			evhttp2_consumed_(session, NULL, frame_len);
+			return (0);
+		}
+		if (session->dead)
+			return (0);
+		if (req->h2_stream != stream) {
+			evhttp2_consumed_(session, NULL, frame_len);
+			return (0);
+		}
+	}
+	evhttp2_consumed_(session, stream, frame_len);
+	if (stream->remote_closed)
+		evhttp2_stream_close_(session, stream, -1);
+	return (0);
+}
+
+static int
+evhttp2_on_rst_stream_(struct evhttp2_session *session, ev_uint32_t id,
+    const unsigned char *p, size_t len)
+{
+	struct evhttp2_stream *stream;
+
+	if (id == 0)
+		return (EVHTTP2_PROTOCOL_ERROR);
+	if (len != 4)
+		return (EVHTTP2_FRAME_SIZE_ERROR);
+	if ((stream = evhttp2_stream_find_(session, id)) == NULL)
+		return evhttp2_id_is_idle_(session, id) ?
+		    EVHTTP2_PROTOCOL_ERROR : 0;
+	event_debug(("%s: stream %u reset with error %u", __func__,
+		(unsigned)id, (unsigned)evhttp2_get32_(p)));
+	evhttp2_stream_close_(session, stream, EVREQ_HTTP_EOF);
+	return (0);
+}
+
+static int
+evhttp2_on_settings_(struct evhttp2_session *session, int flags,
+    ev_uint32_t id, const unsigned char *p, size_t len)
+{
+	struct evhttp2_stream **sp;
+
+	if (id != 0)
+		return (EVHTTP2_PROTOCOL_ERROR);
+	if (flags & EVHTTP2_FLAG_ACK)
+		return (len ? EVHTTP2_FRAME_SIZE_ERROR : 0);
+	if (len % 6)
+		return (EVHTTP2_FRAME_SIZE_ERROR);
+
+	for (; len > 0; p += 6, len -= 6) {
+		ev_uint32_t v = evhttp2_get32_(p + 2);
+		ev_int64_t delta;
+
+		switch ((p[0] << 8) | p[1]) {
+		case EVHTTP2_SETTINGS_ENABLE_PUSH:
+			if (v > 1)
+				return (EVHTTP2_PROTOCOL_ERROR);
+			break;
+		case EVHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS:
+			session->max_streams = v;
+			break;
+		case EVHTTP2_SETTINGS_INITIAL_WINDOW_SIZE:
+			if (v > EVHTTP2_MAX_WINDOW)
+				return (EVHTTP2_FLOW_CONTROL_ERROR);
+			delta = (ev_int64_t)v - session->initial_window;
+			session->initial_window = v;
+			HT_FOREACH(sp, evhttp2_stream_map, &session->streams) {
+				(*sp)->send_window += delta;
+				if ((*sp)->send_window > EVHTTP2_MAX_WINDOW)
+					return (EVHTTP2_FLOW_CONTROL_ERROR);
+				if ((*sp)->send_window > 0)
+					evhttp2_stream_queue_(session, *sp);
+			}
+			break;
+		case EVHTTP2_SETTINGS_MAX_FRAME_SIZE:
+			if (v < 16384 || v > 16777215)
+				return (EVHTTP2_PROTOCOL_ERROR);
+			session->max_frame_size = v;
+			break;
+		default:
+			/* Our encoder never indexes, so HEADER_TABLE_SIZE does
+			 * not matter to us */
+			break;
+		}
+	}
+	evhttp2_frame_header_(session, 0, EVHTTP2_SETTINGS,
+	    EVHTTP2_FLAG_ACK, 0);
+	evhttp2_flush_(session);
+	return (0);
+}
+
+static int
+evhttp2_on_ping_(struct evhttp2_session *session, int flags, ev_uint32_t id,
+    const unsigned char *p, size_t len)
+{
+	if (id != 0)
+		return (EVHTTP2_PROTOCOL_ERROR);
+	if (len != 8)
+		return (EVHTTP2_FRAME_SIZE_ERROR);
+	if (!(flags & EVHTTP2_FLAG_ACK)) {
+		evhttp2_frame_header_(session, len, EVHTTP2_PING,
+		    EVHTTP2_FLAG_ACK, 0);
+		evbuffer_add(evhttp2_output_(session), p, len);
+	}
+	return (0);
+}
+
+static int
+evhttp2_on_goaway_(struct evhttp2_session *session, ev_uint32_t id,
+    const unsigned char *p, size_t len)
+{
+	ev_uint32_t last;
+
+	if (id != 0)
+		return (EVHTTP2_PROTOCOL_ERROR);
+	if (len < 8)
+		return (EVHTTP2_FRAME_SIZE_ERROR);
+	last = evhttp2_get32_(p) & EVHTTP2_MAX_STREAM_ID;
+	event_debug(("%s: last stream %u, error %u", __func__,
+		(unsigned)last, (unsigned)evhttp2_get32_(p + 4)));
+	session->goaway_received = 1;
+	if (session->server)
+		return (0);
+
+	/* The server will not answer the streams after 'last' */
+	for (;;) {
+		struct evhttp2_stream **sp, *stream = NULL;
+		HT_FOREACH(sp, evhttp2_stream_map, &session->streams) {
+			if ((*sp)->id > last) {
+				stream = *sp;
+				break;
+			}
+		}
+		if (stream == NULL)
+			break;
+		evhttp2_stream_close_(session, stream, EVREQ_HTTP_EOF);
+		if (session->dead)
+			break;
+	}
+	return (0);
+}
+
+static int
+evhttp2_on_window_update_(struct evhttp2_session *session, ev_uint32_t id,
+    const unsigned char *p, size_t len)
+{
+	struct evhttp2_stream *stream;
+	ev_uint32_t inc;
+
+	if (len != 4)
+		return (EVHTTP2_FRAME_SIZE_ERROR);
+	inc = evhttp2_get32_(p) & EVHTTP2_MAX_WINDOW;
+	if (id == 0) {
+		if (inc == 0)
+			return (EVHTTP2_PROTOCOL_ERROR);
+		session->send_window += inc;
+		if (session->send_window > EVHTTP2_MAX_WINDOW)
+			return (EVHTTP2_FLOW_CONTROL_ERROR);
+	} else {
+		if ((stream = evhttp2_stream_find_(session, id)) == NULL)
+			return evhttp2_id_is_idle_(session, id) ?
+			    EVHTTP2_PROTOCOL_ERROR : 0;
+		stream->send_window += inc;
+		if (inc == 0 || stream->send_window > EVHTTP2_MAX_WINDOW) {
+			evhttp2_stream_reset_(session, stream,
+			    inc ? EVHTTP2_FLOW_CONTROL_ERROR :
+			    EVHTTP2_PROTOCOL_ERROR, EVREQ_HTTP_INVALID_HEADER);
+			return (0);
+		}
+		evhttp2_stream_queue_(session, stream);
+	}
+	evhttp2_flush_(session);
+	return (0);
+}
+
+/* Handle one frame.  Returns 0, or an error code for the connection. */
+static int
+evhttp2_frame_(struct evhttp2_session *session, int type, int flags,
+    ev_uint32_t id, const unsigned char *p, size_t len)
+{
+	/* Nothing may come between HEADERS and its CONTINUATIONs */
+	if (session->header_block != NULL && type != EVHTTP2_CONTINUATION)
+		return (EVHTTP2_PROTOCOL_ERROR);
+
+	switch (type) {
+	case EVHTTP2_DATA:
+		return evhttp2_on_data_(session, flags, id, p, len);
+	case EVHTTP2_HEADERS:
+		return evhttp2_on_headers_(session, flags, id, p, len);
+	case EVHTTP2_PRIORITY:
+		/* We don't prioritize */
+		if (id == 0)
+			return (EVHTTP2_PROTOCOL_ERROR);
+		return (len != 5 ? EVHTTP2_FRAME_SIZE_ERROR : 0);
+	case EVHTTP2_RST_STREAM:
+		return evhttp2_on_rst_stream_(session, id, p, len);
+	case EVHTTP2_SETTINGS:
+		return evhttp2_on_settings_(session, flags, id, p, len);
+	case EVHTTP2_PUSH_PROMISE:
+		/* Clients can't push, and we tell servers not to */
+		return (EVHTTP2_PROTOCOL_ERROR);
+	case EVHTTP2_PING:
+		return evhttp2_on_ping_(session, flags, id, p, len);
+	case EVHTTP2_GOAWAY:
+		return evhttp2_on_goaway_(session, id, p, len);
+	case EVHTTP2_WINDOW_UPDATE:
+		return evhttp2_on_window_update_(session, id, p, len);
+	case EVHTTP2_CONTINUATION:
+		return evhttp2_on_continuation_(session, flags, id, p, len);
+	default:
+		/* Unknown frames are ignored (section 4.1) */
+		return (0);
+	}
+}
+
+/* Close a client connection: fail the requests that were on it, and
+ * connect again for the ones waiting to be sent. */
+static void
+evhttp2_client_close_(struct evhttp2_session *session,
+    enum evhttp_request_error error)
+{
+	struct evhttp_connection *evcon = session->evcon;
+	struct evcon_requestq failed;
+	struct evhttp2_stream **sp;
+	struct evhttp_request *req;
+	int autofree;
+
+	TAILQ_INIT(&failed);
+	HT_FOREACH(sp, evhttp2_stream_map, &session->streams) {
+		if ((req = (*sp)->req) != NULL) {
+			req->h2_stream = NULL;
+			(*sp)->req = NULL;
+			TAILQ_INSERT_TAIL(&failed, req, next);
+		}
+	}
+	evhttp2_session_free_(session);
+
+	evhttp_connection_reset_(evcon);
+	autofree = (evcon->flags & EVHTTP_CON_AUTOFREE) &&
+	    TAILQ_FIRST(&evcon->requests) == NULL;
+	if (autofree)
+		evhttp_connection_free(evcon);
+	else if (TAILQ_FIRST(&evcon->requests) != NULL)
+		evhttp_connection_connect_(evcon);
+
+	while ((req = TAILQ_FIRST(&failed)) != NULL) {
+		TAILQ_REMOVE(&failed, req, next);
+		evhttp2_request_fail_(req, error);
+	}
+}
+
+static void
+evhttp2_close_(struct evhttp2_session *session,
+    enum evhttp_request_error error)
+{
+	if (session->server)
+		evhttp_connection_free(session->evcon);
+	else
+		evhttp2_client_close_(session, error);
+}
+
+/* What to do after reading or writing: send more requests, or close the
+ * connection if we are done with it. */
+static void
+evhttp2_after_(struct evhttp2_session *session)
+{
+	if (!session->server && !session->closing &&
+	    !session->goaway_received)
+		evhttp2_submit_requests_(session->evcon);
+	if (session->dead)
+		return;
+	if ((session->goaway_sent || session->goaway_received) &&
+	    session->n_streams == 0) {
+		if (session->server && !session->goaway_sent)
+			evhttp2_goaway_(session, EVHTTP2_NO_ERROR);
+		session->closing = 1;
+	}
+	if (session->closing &&
+	    evbuffer_get_length(evhttp2_output_(session)) == 0)
+		evhttp2_close_(session, EVREQ_HTTP_EOF);
+}
+
+static void
+evhttp2_read_cb(struct bufferevent *bev, void *arg)
+{
+	struct evhttp_connection *evcon = arg;
+	struct evhttp2_session *session = evcon->h2;
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	event_deferred_cb_cancel_(evcon->base, &evcon->read_more_deferred_cb);
+
+	evhttp2_enter_(session);
+	while (!session->dead && !session->closing) {
+		size_t avail = evbuffer_get_length(input), len;
+		unsigned char *p;
+		int error;
+
+		if (avail < EVHTTP2_FRAME_HEADER_LEN)
+			break;
+		p = evbuffer_pullup(input, EVHTTP2_FRAME_HEADER_LEN);
+		len = ((size_t)p[0] << 16) | ((size_t)p[1] << 8) | p[2];
+		if (len > EVHTTP2_MAX_FRAME_SIZE) {
+			evhttp2_goaway_(session, EVHTTP2_FRAME_SIZE_ERROR);
+			break;
+		}
+		if (avail < EVHTTP2_FRAME_HEADER_LEN + len)
+			break;
+		if ((p = evbuffer_pullup(input,
+			    EVHTTP2_FRAME_HEADER_LEN + len)) == NULL) {
+			evhttp2_goaway_(session, EVHTTP2_INTERNAL_ERROR);
+			break;
+		}
+
+		error = evhttp2_frame_(session, p[3], p[4],
+		    evhttp2_get32_(p + 5) & EVHTTP2_MAX_STREAM_ID,
+		    p + EVHTTP2_FRAME_HEADER_LEN, len);
+		if (session->dead)
+			break;
+		evbuffer_drain(input, EVHTTP2_FRAME_HEADER_LEN + len);
+		if (error)
+			evhttp2_goaway_(session, error);
+	}
+	if (!session->dead)
+		evhttp2_after_(session);
+	evhttp2_leave_(session);
+}
+
+static void
+evhttp2_write_cb(struct bufferevent *bev, void *arg)
+{
+	struct evhttp_connection *evcon = arg;
+	struct evhttp2_session *session = evcon->h2;
+	struct evhttp2_stream *stream;
+
+	evhttp2_enter_(session);
+	/* All that we had moved into the output has been written now */
+	while (!session->dead &&
+	    (stream = TAILQ_FIRST(&session->cbq)) != NULL) {
+		void (*cb)(struct evhttp_connection *, void *) = stream->cb;
+		TAILQ_REMOVE(&session->cbq, stream, cb_next);
+		stream->in_cbq = 0;
+		stream->cb = NULL;
+		if (cb != NULL)
+			(*cb)(evcon, stream->cb_arg);
+	}
+	if (!session->dead)
+		evhttp2_flush_(session);
+	if (!session->dead)
+		evhttp2_after_(session);
+	evhttp2_leave_(session);
+}
+
+static void
+evhttp2_event_cb(struct bufferevent *bev, short what, void *arg)
+{
+	struct evhttp_connection *evcon = arg;
+	struct evhttp2_session *session = evcon->h2;
+	enum evhttp_request_error error = EVREQ_HTTP_EOF;
+
+	if (what & BEV_EVENT_TIMEOUT) {
+		/* A server's user may take its time with a request */
+		if (session->server && session->n_streams > 0 &&
+		    (what & BEV_EVENT_READING)) {
+			bufferevent_enable(bev, EV_READ);
+			return;
+		}
+		error = EVREQ_HTTP_TIMEOUT;
+	} else if (what & BEV_EVENT_ERROR) {
+		error = EVREQ_HTTP_BUFFER_ERROR;
+	}
+
+	evhttp2_enter_(session);
+	evhttp2_close_(session, error);
+	evhttp2_leave_(session);
+}
+
+int
+evhttp2_session_start_(struct evhttp_connection *evcon)
+{
+	struct evhttp2_session *session;
+	unsigned char settings[6];
+	evutil_socket_t fd;
+	int on = 1;
+
+	if ((session = mm_calloc(1, sizeof(*session))) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return (-1);
+	}
+	session->evcon = evcon;
+	HT_INIT(evhttp2_stream_map, &session->streams);
+	TAILQ_INIT(&session->sendq);
+	TAILQ_INIT(&session->cbq);
+	session->server = (evcon->flags & EVHTTP_CON_INCOMING) != 0;
+	session->next_id = session->server ? 2 : 1;
+	session->send_window = EVHTTP2_DEFAULT_WINDOW;
+	session->recv_window = EVHTTP2_DEFAULT_WINDOW;
+	session->initial_window = EVHTTP2_DEFAULT_WINDOW;
+	session->max_frame_size = EVHTTP2_MAX_FRAME_SIZE;
+	session->max_streams = EVHTTP2_MAX_STREAMS;
+	evhttp2_hpack_init_(&session->hpack, EVHTTP2_HEADER_TABLE_SIZE);
+
+	evcon->h2 = session;
+	evcon->state = EVCON_IDLE;
+
+	/* Small frames like WINDOW_UPDATE must not wait for an ACK that the
+	 * peer delays, or flow control stalls.  This fails harmlessly on a
+	 * socket that is not TCP. */
+	fd = bufferevent_getfd(evcon->bufev);
+	if (fd != EVUTIL_INVALID_SOCKET)
+		(void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+		    (void *)&on, sizeof(on));
+
+	/* A server says how many streams it takes; a client, that it does
+	 * not want pushed ones. */
+	if (session->server) {
+		settings[1] = EVHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS;
+		evhttp2_set32_(settings + 2, EVHTTP2_MAX_STREAMS);
+	} else {
+		evbuffer_add(evhttp2_output_(session), EVHTTP2_PREFACE,
+		    EVHTTP2_PREFACE_LEN);
+		settings[1] = EVHTTP2_SETTINGS_ENABLE_PUSH;
+		evhttp2_set32_(settings + 2, 0);
+	}
+	settings[0] = 0;
+	evhttp2_frame_header_(session, sizeof(settings), EVHTTP2_SETTINGS, 0, 0);
+	evbuffer_add(evhttp2_output_(session), settings, sizeof(settings));
+
+	bufferevent_setcb(evcon->bufev,
+	    evhttp2_read_cb,
+	    evhttp2_write_cb,
+	    evhttp2_event_cb,
+	    evcon);
+	bufferevent_enable(evcon->bufev, EV_READ|EV_WRITE);
+
+	/* Frames that came with the preface */
+	if (evbuffer_get_length(bufferevent_get_input(evcon->bufev)))
+		event_deferred_cb_schedule_(evcon->base,
+		    &evcon->read_more_deferred_cb);
+	return (0);
+}
+
+void
+evhttp2_session_free_(struct evhttp2_session *session)
+{
+	struct evhttp2_stream *stream, **sp;
+
+	for (sp = HT_START(evhttp2_stream_map, &session->streams); sp != NULL;) {
+		struct evhttp_request *req;
+
+		stream = *sp;
+		sp = HT_NEXT_RMV(evhttp2_stream_map, &session->streams, sp);
+		if ((req = stream->req) != NULL) {
+			req->h2_stream = NULL;
+			if (session->server && stream->dispatched &&
+			    !req->userdone) {
+				req->evcon = NULL;
+			} else {
+				req->evcon = NULL;
+				if (session->server ||
+				    !evhttp_request_is_owned(req))
+					evhttp_request_free(req);
+			}
+		}
+		evbuffer_free(stream->output);
+		mm_free(stream);
+	}
+	HT_CLEAR(evhttp2_stream_map, &session->streams);
+	TAILQ_INIT(&session->sendq);
+	TAILQ_INIT(&session->cbq);
+	session->n_streams = 0;
+
+	evhttp2_hpack_clear_(&session->hpack);
+	if (session->header_block != NULL) {
+		evbuffer_free(session->header_block);
+		session->header_block = NULL;
+	}
+
+	if (session->evcon != NULL)
+		session->evcon->h2 = NULL;
+	session->evcon = NULL;
+	if (session->running) {
+		session->dead = 1;
+		return;
+	}
+	mm_free(session);
+}
+
+/* Open a stream for req, a client request. */
+static void
+evhttp2_submit_(struct evhttp2_session *session, struct evhttp_request *req)
+{
+	struct evhttp_connection *evcon = session->evcon;
+	struct evhttp2_stream *stream;
+	struct evbuffer *block;
+	struct evkeyval *kv;
+	const char *method, *authority;
+	char buf[300];
+	size_t body_len = evbuffer_get_length(req->output_buffer);
+
+	if ((method = evhttp_request_method_(req)) == NULL ||
+	    (block = evbuffer_new()) == NULL) {
+		evhttp2_request_fail_(req, EVREQ_HTTP_INVALID_HEADER);
+		return;
+	}
+	if ((stream = evhttp2_stream_new_(session, session->next_id,
+		    req)) == NULL) {
+		evbuffer_free(block);
+		evhttp2_request_fail_(req, EVREQ_HTTP_BUFFER_ERROR);
+		return;
+	}
+	session->next_id += 2;
+	req->kind = EVHTTP_RESPONSE;
+
+	if ((authority = evhttp_find_header(req->output_headers,
+		    "Host")) == NULL) {
+		evutil_snprintf(buf, sizeof(buf),
+		    strchr(evcon->address, ':') ? "[%s]:%d" : "%s:%d",
+		    evcon->address, (int)evcon->port);
+		authority = buf;
+	}
+	evhttp2_hpack_encode_(block, ":method", method);
+	evhttp2_hpack_encode_(block, ":scheme", "http");
+	evhttp2_hpack_encode_(block, ":authority", authority);
+	evhttp2_hpack_encode_(block, ":path", req->uri);
+	TAILQ_FOREACH(kv, req->output_headers, next) {
+		if (evutil_ascii_strcasecmp(kv->key, "host") &&
+		    !evhttp2_is_connection_header_(kv->key, kv->value))
+			evhttp2_hpack_encode_(block, kv->key, kv->value);
+	}
+	if (body_len > 0 &&
+	    evhttp_find_header(req->output_headers, "Content-Length") == NULL) {
+		evutil_snprintf(buf, sizeof(buf), EV_SIZE_FMT,
+		    EV_SIZE_ARG(body_len));
+		evhttp2_hpack_encode_(block, "content-length", buf);
+	}
+	evhttp2_send_header_block_(session, stream->id, block, body_len == 0);
+	evbuffer_free(block);
+
+	if (body_len == 0) {
+		evhttp2_stream_sent_(session, stream);
+		return;
+	}
+	evbuffer_add_buffer(stream->output, req->output_buffer);
+	stream->end_queued = 1;
+	evhttp2_stream_queue_(session, stream);
+}
+
+void
+evhttp2_submit_requests_(struct evhttp_connection *evcon)
+{
+	struct evhttp2_session *session = evcon->h2;
+	struct evhttp_request *req;
+
+	evhttp2_enter_(session);
+	while (!session->dead && !session->closing &&
+	    !session->goaway_received &&
+	    session->n_streams < session->max_streams &&
+	    session->next_id <= EVHTTP2_MAX_STREAM_ID &&
+	    (req = TAILQ_FIRST(&evcon->requests)) != NULL) {
+		TAILQ_REMOVE(&evcon->requests, req, next);
+		evhttp2_submit_(session, req);
+	}
+	if (!session->dead)
+		evhttp2_flush_(session);
+	evhttp2_leave_(session);
+}
+
+void
+evhttp2_cancel_request_(struct evhttp_request *req)
+{
+	struct evhttp2_stream *stream = req->h2_stream;
+	struct evhttp2_session *session = req->evcon->h2;
+
+	evhttp2_enter_(session);
+	if (!stream->local_closed || !stream->remote_closed)
+		evhttp2_send_rst_(session, stream->id, EVHTTP2_CANCEL);
+	evhttp2_stream_remove_(session, stream);
+	evhttp2_leave_(session);
+
+	req->evcon = NULL;
+	if (!evhttp_request_is_owned(req))
+		evhttp_request_free(req);
+}
+
+void
+evhttp2_send_headers_(struct evhttp_request *req, int end_stream)
+{
+	struct evhttp2_stream *stream = req->h2_stream;
+	struct evhttp2_session *session = req->evcon->h2;
+	struct evbuffer *block;
+	struct evkeyval *kv;
+	char status[16];
+
+	evhttp2_enter_(session);
+	if ((block = evbuffer_new()) == NULL) {
+		evhttp2_stream_reset_(session, stream, EVHTTP2_INTERNAL_ERROR,
+		    EVREQ_HTTP_BUFFER_ERROR);
+		evhttp2_leave_(session);
+		return;
+	}
+	evutil_snprintf(status, sizeof(status), "%d", req->response_code);
+	evhttp2_hpack_encode_(block, ":status", status);
+	TAILQ_FOREACH(kv, req->output_headers, next) {
+		if (!evhttp2_is_connection_header_(kv->key, kv->value))
+			evhttp2_hpack_encode_(block, kv->key, kv->value);
+	}
+	evhttp2_send_header_block_(session, stream->id, block, end_stream);
+	evbuffer_free(block);
+	if (end_stream)
+		evhttp2_stream_sent_(session, stream);
+	evhttp2_leave_(session);
+}
+
+void
+evhttp2_send_data_(struct evhttp_request *req, struct evbuffer *data,
+    int end_stream, void (*cb)(struct evhttp_connection *, void *),
+    void *arg)
+{
+	struct evhttp2_stream *stream = req->h2_stream;
+	struct evhttp2_session *session = req->evcon->h2;
+
+	if (data != NULL)
+		evbuffer_add_buffer(stream->output, data);
+	stream->cb = cb;
+	stream->cb_arg = arg;
+	if (end_stream)
+		stream->end_queued = 1;
+	evhttp2_stream_queue_(session, stream);
+	evhttp2_flush_(session);
+}
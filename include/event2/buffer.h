@@ -229,6 +229,33 @@ void evbuffer_unlock(struct evbuffer *buf);
  */
 #define EVBUFFER_FLAG_DRAINS_TO_FD 1
 
+/** If this flag is set, evbuffer_write() and evbuffer_write_atmost() try
+ * to send large amounts of data with MSG_ZEROCOPY, so that the kernel
+ * transmits straight out of the evbuffer's memory instead of copying it.
+ *
+ * The chains that such a send used are kept alive and unmodified until
+ * the kernel reports that it is done with them.  Those reports are
+ * collected by every later evbuffer_write() call on the buffer, and, for
+ * the output buffer of a socket bufferevent, whenever the bufferevent's
+ * socket becomes readable or writable.  If you write from this buffer
+ * with your own events, keep calling evbuffer_write() after the socket
+ * reports an error condition, or the event loop may spin.
+ *
+ * Zero-copy sends are only made from buffers that belong to an event
+ * base: the buffers of a bufferevent, or a buffer given to
+ * evbuffer_defer_callbacks().  If such a buffer is freed while the kernel
+ * is still sending from it, the event base keeps the chains, and the
+ * socket, until the kernel is done with them, and its loop keeps running
+ * until then.
+ *
+ * Zero-copy sends only pay off for large writes; a bufferevent will
+ * rarely use them unless you raise its maximum single write with
+ * bufferevent_set_max_single_write().  The flag is ignored on systems
+ * and sockets that do not support MSG_ZEROCOPY, and once the kernel
+ * reports that it had to copy the data anyway.
+ */
+#define EVBUFFER_FLAG_ZEROCOPY 2
+
 /** Change the flags that are set for an evbuffer by adding more.
  *
  * @param buffer the evbuffer that the callback is watching.
@@ -1077,6 +1104,79 @@ struct event_base;
 EVENT2_EXPORT_SYMBOL
 int evbuffer_defer_callbacks(struct evbuffer *buffer, struct event_base *base);
 
+/**
+   Keep the memory of freed evbuffer chains around for reuse.
+
+   By default, every chain that an evbuffer allocates comes from malloc,
+   and goes back to free as soon as it is drained.  With many short-lived
+   connections, that is a lot of allocator traffic, and can fragment the
+   heap badly.  With this option, chains freed by evbuffers that use
+   base's cache are kept, in power-of-two size classes, and handed out
+   again to any evbuffer on base that needs a chain of that size.
+
+   The cache is shared by the input and output buffers of every
+   bufferevent created on base after this call, and by any evbuffer given
+   to evbuffer_set_chain_cache().  It is safe to use from several threads.
+
+   Calling this again changes the limits, releasing memory if the cache
+   now holds too much.  Setting max_bytes to 0 empties the cache and turns
+   it off.
+
+   @param base the event_base whose cache to configure
+   @param max_bytes the most memory to keep in freed chains
+   @param max_chain_size the size of the largest chain to keep, or 0 for
+     the default of 64 KiB
+   @return 0 on success, -1 on failure.
+   @see event_base_get_evbuffer_cache_stats(), evbuffer_set_chain_cache()
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_set_evbuffer_cache(struct event_base *base, size_t max_bytes,
+    size_t max_chain_size);
+
+/** Counters reported by event_base_get_evbuffer_cache_stats() */
+struct evbuffer_cache_stats {
+	/** Chains taken from the cache instead of being allocated */
+	ev_uint64_t hits;
+	/** Chains small enough for the cache that had to be allocated */
+	ev_uint64_t misses;
+	/** Freed chains that were kept in the cache */
+	ev_uint64_t stores;
+	/** Freed chains small enough for the cache that were released
+	 * because it was full */
+	ev_uint64_t drops;
+	/** The number of chains in the cache now */
+	size_t n_chains;
+	/** The memory held by the chains in the cache now */
+	size_t n_bytes;
+};
+
+/**
+   Report how well the evbuffer chain cache of an event_base is doing.
+
+   @param base the event_base to look at
+   @param stats set to the counters of base's cache
+   @return 0 on success, -1 if base has no cache.
+   @see event_base_set_evbuffer_cache()
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_get_evbuffer_cache_stats(struct event_base *base,
+    struct evbuffer_cache_stats *stats);
+
+/**
+   Make an evbuffer get its chains from, and give them back to, the chain
+   cache of an event_base.
+
+   Bufferevents do this for their own buffers; you only need it for other
+   evbuffers.  The evbuffer does not need to be used with base otherwise.
+
+   @param buf the evbuffer
+   @param base the event_base whose cache to use
+   @return 0 on success, -1 if base has no cache.
+   @see event_base_set_evbuffer_cache()
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_set_chain_cache(struct evbuffer *buf, struct event_base *base);
+
 /**
   Append data from 1 or more iovec's to an evbuffer
 
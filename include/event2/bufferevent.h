@@ -56,6 +56,11 @@
       <dd>A bufferevent that reads and writes data onto a network
           socket. Created with bufferevent_socket_new().</dd>
 
+    <dt>io_uring-based bufferevents</dt>
+      <dd>A socket bufferevent that lets the kernel complete its reads and
+          writes through io_uring, instead of waiting for readiness and then
+          calling read() or write().  Created with bufferevent_uring_new().</dd>
+
     <dt>Paired bufferevents</dt>
       <dd>A pair of bufferevents that send and receive data to one
           another without touching the network.  Created with
@@ -170,7 +175,19 @@ enum bufferevent_options {
 	* bufferevent.  This option currently requires that
 	* BEV_OPT_DEFER_CALLBACKS also be set; a future version of Libevent
 	* might remove the requirement.*/
-	BEV_OPT_UNLOCK_CALLBACKS = (1<<3)
+	BEV_OPT_UNLOCK_CALLBACKS = (1<<3),
+
+	/** If set, a socket bufferevent reads into a buffer shared by all
+	 * such bufferevents on its event_base, and lends that memory to its
+	 * input buffer while the read callback runs.  Whatever the callback
+	 * leaves in the input buffer is then copied into memory of the
+	 * bufferevent's own.  A connection whose callback consumes all that
+	 * it reads holds no input buffer memory between reads, which saves
+	 * a lot with many mostly idle connections.
+	 *
+	 * This has no effect together with BEV_OPT_DEFER_CALLBACKS, or for
+	 * bufferevents other than socket bufferevents. */
+	BEV_OPT_SHARED_READ_BUFFER = (1<<4)
 };
 
 /**
@@ -189,6 +206,33 @@ enum bufferevent_options {
 EVENT2_EXPORT_SYMBOL
 struct bufferevent *bufferevent_socket_new(struct event_base *base, evutil_socket_t fd, int options);
 
+/**
+  Create a new socket bufferevent that does its I/O with io_uring.
+
+  Instead of waiting for the socket to become readable or writable, this
+  kind of bufferevent submits its reads and writes to the event_base's ring,
+  and the kernel completes them directly into and out of the bufferevent's
+  evbuffers.  While a connection is idle, reads are posted against a pool
+  of kernel-selected buffers shared by the event_base, so that idle
+  connections don't hold any buffer memory.
+
+  It otherwise behaves like a bufferevent made with
+  bufferevent_socket_new(), and works with bufferevent_socket_connect(),
+  watermarks, timeouts, and rate limits.
+
+  @param base the event base to associate with the new bufferevent.  It must
+	    be using the "io_uring" method.
+  @param fd the file descriptor from which data is read and written to.
+	    It is safe to set the fd to -1, so long as you later
+	    set it with bufferevent_setfd or bufferevent_socket_connect().
+  @param options Zero or more BEV_OPT_* flags
+  @return a pointer to a newly allocated bufferevent struct, or NULL if an
+	  error occurred or if base does not use io_uring.
+  @see bufferevent_free(), bufferevent_socket_new()
+  */
+EVENT2_EXPORT_SYMBOL
+struct bufferevent *bufferevent_uring_new(struct event_base *base, evutil_socket_t fd, int options);
+
 /**
    Launch a connect() attempt with a socket-based bufferevent.
 
@@ -769,6 +813,60 @@ int bufferevent_pair_new(struct event_base *base, int options,
 EVENT2_EXPORT_SYMBOL
 struct bufferevent *bufferevent_pair_get_partner(struct bufferevent *bev);
 
+/**
+   A relay that copies everything that one bufferevent reads to another,
+   and the other way around.
+ */
+struct bufferevent_relay;
+
+/**
+   Start relaying data between two bufferevents, as a proxy does.
+
+   Everything read from either bufferevent is written to the other one.
+   When two socket bufferevents are relayed on Linux, the data is moved
+   from one socket to the other with splice() and never copied into user
+   space; otherwise it goes through the bufferevents' buffers.
+
+   The relay enables reading and writing on both bufferevents, and takes
+   over their read, write and event callbacks; don't change them until the
+   relay is freed, and don't relay a bufferevent that another bufferevent
+   is filtering.  Timeouts,
+   watermarks and rate limits still apply: reading from one side stops
+   while the amount of data waiting to be written to the other side is at
+   its read high-watermark (64 KiB if it has none), and both bufferevents'
+   rate limits are respected.
+
+   When one side reaches EOF, the relay finishes writing to the other side
+   and then shuts down that side's writing half (for sockets), so that the
+   EOF reaches it too.  Once both directions have been shut down, eventcb
+   is invoked with BEV_EVENT_EOF.  Errors, timeouts and connections are
+   passed to eventcb as they happen, along with the bufferevent that they
+   happened on.  In either case, you'll usually want to free the relay and
+   both bufferevents.
+
+   Both bufferevents must use the same event_base.
+
+   @param a the first bufferevent
+   @param b the second bufferevent
+   @param eventcb callback to invoke for events on the relay, or NULL
+   @param cbarg an argument that will be supplied to eventcb
+   @return a new relay, or NULL on failure.
+   @see bufferevent_relay_free()
+ */
+EVENT2_EXPORT_SYMBOL
+struct bufferevent_relay *bufferevent_relay_new(struct bufferevent *a,
+    struct bufferevent *b, bufferevent_event_cb eventcb, void *cbarg);
+
+/**
+   Stop relaying and free a relay.
+
+   The bufferevents themselves are not freed, and are left with no
+   callbacks.  Any data that was spliced out of one of them but not yet
+   written to the other is lost.
+ */
+EVENT2_EXPORT_SYMBOL
+void bufferevent_relay_free(struct bufferevent_relay *relay);
+
 /**
    Abstract type used to configure rate-limiting on a bufferevent or a group
    of bufferevents.
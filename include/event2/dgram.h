@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef EVENT2_DGRAM_H_INCLUDED_
+#define EVENT2_DGRAM_H_INCLUDED_
+
+/** @file event2/dgram.h
+
+  @brief Batched datagram sockets.
+
+  An evdgram wraps a datagram (usually UDP) socket.  It reads as many
+  datagrams as it can at once into buffers of its own, with recvmmsg()
+  where the system has it, and hands them to its read callback as one
+  batch.  Datagrams sent with evdgram_send() while the read callback runs,
+  or while the socket can't take more, are queued and sent together, with
+  sendmmsg() where the system has it.
+ */
+
+#include <event2/visibility.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <event2/event.h>
+
+struct sockaddr;
+struct evdgram;
+
+/** One datagram received by an evdgram. */
+struct evdgram_msg {
+	/** The contents of the datagram. */
+	void *data;
+	/** The length of data. */
+	size_t len;
+	/** The address that the datagram came from. */
+	struct sockaddr *addr;
+	/** The length of addr. */
+	ev_socklen_t addrlen;
+	/** EVDGRAM_MSG_* flags for the datagram. */
+	int flags;
+};
+
+/** Flag for evdgram_msg: the datagram was longer than the evdgram's
+ * buffers, and has been cut short. */
+#define EVDGRAM_MSG_TRUNCATED	(1<<0)
+
+/**
+   A callback that we invoke when an evdgram has read one or more datagrams.
+
+   The datagrams, and their addresses, are only valid until the callback
+   returns.
+
+   @param dgram The evdgram
+   @param msgs The datagrams read, in the order they arrived
+   @param n_msgs The number of datagrams in msgs
+   @param user_arg The pointer passed to evdgram_new()
+ */
+typedef void (*evdgram_read_cb)(struct evdgram *, struct evdgram_msg *msgs,
+    int n_msgs, void *);
+
+/**
+   A callback that we invoke when an evdgram encounters a non-retriable
+   error.
+
+   @param dgram The evdgram
+   @param what EV_READ if the error came from reading, or EV_WRITE if it
+      came from sending a queued datagram, which has been dropped
+   @param err The socket error
+   @param user_arg The pointer passed to evdgram_new()
+ */
+typedef void (*evdgram_error_cb)(struct evdgram *, short what, int err,
+    void *);
+
+/** Flag: Indicates that freeing the evdgram should close the underlying
+ * socket. */
+#define EVDGRAM_OPT_CLOSE_ON_FREE	(1u<<0)
+/** Flag: Indicates that the evdgram should be locked so it's safe to use
+ * from multiple threads at once. */
+#define EVDGRAM_OPT_THREADSAFE		(1u<<1)
+/** Flag: Indicates that the evdgram should be created without reading.
+ * Use evdgram_enable() to start reading later. */
+#define EVDGRAM_OPT_DISABLED		(1u<<2)
+/** Flag: Indicates that the kernel may hand us runs of datagrams from the
+ * same sender as one buffer, which we split again before the read callback
+ * sees them (UDP GRO).  This makes every read buffer 64k long.  Ignored on
+ * platforms that do not support it. */
+#define EVDGRAM_OPT_GRO			(1u<<3)
+/** Flag: Indicates that runs of queued datagrams of the same size to the
+ * same address should be given to the kernel as one buffer, to be split
+ * there or by the network card (UDP GSO).  Ignored on platforms that do
+ * not support it. */
+#define EVDGRAM_OPT_GSO			(1u<<4)
+
+/**
+   Allocate a new evdgram object to read and send datagrams on a socket.
+
+   @param base The event base to associate the evdgram with.
+   @param fd The datagram socket to use.  It should be nonblocking, and
+      already bound.
+   @param flags Any number of EVDGRAM_OPT_* flags
+   @param readcb A callback to invoke with the datagrams that are read, or
+      NULL to only send.
+   @param errorcb A callback to invoke on non-retriable errors, or NULL.
+   @param user_arg A pointer to pass to the callbacks.
+   @return the new evdgram, or NULL on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+struct evdgram *evdgram_new(struct event_base *base, evutil_socket_t fd,
+    unsigned flags, evdgram_read_cb readcb, evdgram_error_cb errorcb,
+    void *user_arg);
+
+/**
+   Free an evdgram.
+
+   Queued datagrams that can be sent without blocking are sent; the rest
+   are dropped.  It is safe to call this from the evdgram's callbacks.
+ */
+EVENT2_EXPORT_SYMBOL
+void evdgram_free(struct evdgram *dgram);
+
+/**
+   Set how many datagrams an evdgram reads at once, and the longest one it
+   can read.
+
+   The default is 32 datagrams of up to 2048 bytes.  Longer datagrams are
+   truncated, and marked EVDGRAM_MSG_TRUNCATED.  This can't be called from
+   the read callback.
+
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_set_batch(struct evdgram *dgram, int max_msgs, size_t max_msg_size);
+
+/**
+   Set how many bytes of datagrams an evdgram may queue for sending.
+
+   When the queue is full, evdgram_send() fails.  The default is 1MB.
+ */
+EVENT2_EXPORT_SYMBOL
+void evdgram_set_max_pending(struct evdgram *dgram, size_t max_bytes);
+
+/** Start reading datagrams, after EVDGRAM_OPT_DISABLED or
+ * evdgram_disable().  @return 0 on success, -1 on failure. */
+EVENT2_EXPORT_SYMBOL
+int evdgram_enable(struct evdgram *dgram);
+
+/** Stop reading datagrams.  Sending is unaffected.
+ * @return 0 on success, -1 on failure. */
+EVENT2_EXPORT_SYMBOL
+int evdgram_disable(struct evdgram *dgram);
+
+/**
+   Send a datagram, or queue it to be sent.
+
+   The data is copied.  From the read callback, and while earlier datagrams
+   are still queued, the datagram is always queued; the evdgram sends its
+   queue when the read callback returns and whenever the socket becomes
+   writable.
+
+   @param dgram The evdgram to send from
+   @param data The contents of the datagram
+   @param len The length of data
+   @param to The address to send to, or NULL on a connected socket
+   @param tolen The length of to
+   @return 0 if the datagram was sent or queued, -1 if it was not, because
+      of an error or because the queue is full.
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_send(struct evdgram *dgram, const void *data, size_t len,
+    const struct sockaddr *to, ev_socklen_t tolen);
+
+/**
+   Send as many queued datagrams as the socket will take without blocking.
+
+   @return 0 on success, -1 if a datagram was dropped because of an error.
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_flush(struct evdgram *dgram);
+
+/** Return the number of bytes of datagrams queued for sending. */
+EVENT2_EXPORT_SYMBOL
+size_t evdgram_get_pending(struct evdgram *dgram);
+
+/** Return the socket that an evdgram is using. */
+EVENT2_EXPORT_SYMBOL
+evutil_socket_t evdgram_get_fd(struct evdgram *dgram);
+
+/** Return the event base that an evdgram is using. */
+EVENT2_EXPORT_SYMBOL
+struct event_base *evdgram_get_base(struct evdgram *dgram);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT2_DGRAM_H_INCLUDED_ */
@@ -191,6 +191,7 @@ extern "C" {
  * - attempts:
  * - randomize-case:
  * - initial-probe-timeout:
+ * - cache-size:
  */
 #define DNS_OPTION_MISC 4
 /* Load hosts file (i.e. "/etc/hosts") */
@@ -455,7 +456,14 @@ void evdns_cancel_request(struct evdns_base *base, struct evdns_request *req);
   The currently available configuration options are:
 
     ndots, timeout, max-timeouts, max-inflight, attempts, randomize-case,
-    bind-to, initial-probe-timeout, getaddrinfo-allow-skew.
+    bind-to, initial-probe-timeout, getaddrinfo-allow-skew, cache-size.
+
+  cache-size is the number of answers to remember, until their TTL runs
+  out, so that asking the same question again doesn't need the network.
+  NXDOMAIN and NODATA replies are remembered too, for the TTL given by
+  their SOA record (see RFC 2308).  Answers from the cache are delivered
+  from the event loop, like any other.  It is 0, turning the cache off,
+  by default.
 
   In versions before Libevent 2.0.3-alpha, the option name needed to end with
   a colon.
@@ -652,6 +660,41 @@ typedef void (*evdns_request_callback_fn_type)(struct evdns_server_request *, vo
  */
 EVENT2_EXPORT_SYMBOL
 struct evdns_server_port *evdns_add_server_port_with_base(struct event_base *base, evutil_socket_t socket, int flags, evdns_request_callback_fn_type callback, void *user_data);
+
+/** Flag for evdns_add_server_port_bind(): set SO_REUSEPORT on the socket,
+    so that several server ports can bind the same address.  The kernel then
+    spreads the requests between them.  Give each thread its own
+    event_base and its own port, and they answer requests in parallel.
+
+    This is only supported on Linux; elsewhere evdns_add_server_port_bind()
+    fails when given this flag.
+ */
+#define EVDNS_SERVER_PORT_REUSEPORT	0x1
+
+/** Create a new DNS server port on a new UDP socket bound to an address.
+
+    @param base The event base to handle events for the server port.
+    @param sa The address to bind to.
+    @param socklen The length of sa.
+    @param flags Any of EVDNS_SERVER_PORT_REUSEPORT.
+    @param callback A function to invoke whenever we get a DNS request
+      on the socket.
+    @param user_data Data to pass to the callback.
+    @return an evdns_server_port structure for this server port or NULL if
+      an error occurred.
+    @see evdns_server_port_get_fd()
+ */
+EVENT2_EXPORT_SYMBOL
+struct evdns_server_port *evdns_add_server_port_bind(struct event_base *base, const struct sockaddr *sa, int socklen, int flags, evdns_request_callback_fn_type callback, void *user_data);
+
+/** Return the socket that a DNS server port reads requests from.
+
+    After binding to port 0 with evdns_add_server_port_bind(), use this
+    with getsockname() to learn the port to give the next ones.
+ */
+EVENT2_EXPORT_SYMBOL
+evutil_socket_t evdns_server_port_get_fd(struct evdns_server_port *port);
+
 /** Close down a DNS server port, and free associated structures. */
 EVENT2_EXPORT_SYMBOL
 void evdns_close_server_port(struct evdns_server_port *port);
@@ -44,7 +44,7 @@
 
 
   Currently, Libevent supports /dev/poll, kqueue(2), select(2), poll(2),
-  epoll(4), and evports. The internal event mechanism is completely
+  epoll(4), io_uring(7), and evports. The internal event mechanism is completely
   independent of the exposed event API, and a simple update of Libevent can
   provide new functionality without having to redesign the applications. As a
   result, Libevent allows for portable application development and provides
@@ -570,7 +570,25 @@ enum event_base_config_flag {
 	    however, we use less efficient more precise timer, assuming one is
 	    present.
 	 */
-	EVENT_BASE_FLAG_PRECISE_TIMER = 0x20
+	EVENT_BASE_FLAG_PRECISE_TIMER = 0x20,
+
+	/** Keep the timeouts in a hierarchical timing wheel instead of a
+	    binary heap.  Adding and removing a timeout then take constant
+	    time, which helps when you have very many of them, such as idle
+	    timeouts on lots of connections.
+
+	    Timeouts are grouped into ticks of one millisecond (or one
+	    microsecond with EVENT_BASE_FLAG_PRECISE_TIMER), and all the
+	    timeouts in a tick run together once it has passed: never early,
+	    but up to one tick late.  The loop may also wake up before the
+	    first timeout, to move timeouts within the wheel.  Common
+	    timeouts (see event_base_init_common_timeout()) are handled as
+	    usual.
+
+	    This flag can also be activated by setting the EVENT_TIMER_WHEEL
+	    environment variable.
+	 */
+	EVENT_BASE_FLAG_TIMER_WHEEL = 0x40
 };
 
 /**
@@ -126,6 +126,7 @@ struct event {
 	/* for managing timeouts */
 	union {
 		TAILQ_ENTRY(event) ev_next_with_common_timeout;
+		LIST_ENTRY(event) ev_next_in_timer_wheel;
 		size_t min_heap_idx;
 	} ev_timeout_pos;
 	evutil_socket_t ev_fd;
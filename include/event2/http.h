@@ -286,6 +286,32 @@ int evhttp_set_cb(struct evhttp *http, const char *path,
 EVENT2_EXPORT_SYMBOL
 int evhttp_del_cb(struct evhttp *, const char *);
 
+/**
+   Set a callback for every URI whose path starts with a given prefix
+
+   A callback set with evhttp_set_cb() for the exact path of a request wins
+   over any prefix callback; otherwise the callback for the longest prefix
+   that matches is invoked.  Like paths, prefixes are matched against the
+   %-decoded path of the request, and are matched as plain strings, so a
+   prefix of "/static" matches "/staticfoo" as well as "/static/foo".
+
+   Finding the callback for a request takes time in the length of its path,
+   not in the number of callbacks set.
+
+   @param http the http server on which to set the callback
+   @param prefix the path prefix for which to invoke the callback
+   @param cb the callback function that gets invoked on a matching path
+   @param cb_arg an additional context argument for the callback
+   @return 0 on success, -1 if the callback existed already, -2 on failure
+*/
+EVENT2_EXPORT_SYMBOL
+int evhttp_set_prefix_cb(struct evhttp *http, const char *prefix,
+    void (*cb)(struct evhttp_request *, void *), void *cb_arg);
+
+/** Removes the callback for a specified path prefix */
+EVENT2_EXPORT_SYMBOL
+int evhttp_del_prefix_cb(struct evhttp *http, const char *prefix);
+
 /**
     Set a callback for all requests that are not caught by specific callbacks
 
@@ -301,6 +327,55 @@ EVENT2_EXPORT_SYMBOL
 void evhttp_set_gencb(struct evhttp *http,
     void (*cb)(struct evhttp_request *, void *), void *arg);
 
+/**
+   Call the callback as soon as the headers of a request have been read,
+   and pass it the body of the request as it arrives.
+
+   The callback should set callbacks for the body with
+   evhttp_request_set_body_cb(); if it does not, the body is read and
+   thrown away.  It may answer the request at any time.  If it does so
+   before the whole body has been read, the rest of the body is not read,
+   and the connection is closed after the response.
+
+   The body is not all kept in memory: reading stops while
+   evhttp_request_get_input_buffer() holds 64 KiB of it, until the
+   callback drains some.
+
+   Requests that come over HTTP/2 are passed to the callback once their
+   whole body has been read, as usual.
+ */
+#define EVHTTP_CB_STREAM_BODY	0x0001
+
+/**
+   Set flags for the callback set with evhttp_set_cb() for a path.
+
+   @param http the http server on which the callback is set
+   @param path the path for which the callback is set
+   @param flags any of EVHTTP_CB_* flags
+   @return 0 on success, -1 if there is no such callback
+   @see EVHTTP_CB_STREAM_BODY
+ */
+EVENT2_EXPORT_SYMBOL
+int evhttp_set_cb_flags(struct evhttp *http, const char *path, int flags);
+
+/**
+   Set flags for the callback set with evhttp_set_prefix_cb() for a prefix.
+
+   @return 0 on success, -1 if there is no such callback
+   @see evhttp_set_cb_flags()
+ */
+EVENT2_EXPORT_SYMBOL
+int evhttp_set_prefix_cb_flags(struct evhttp *http, const char *prefix,
+    int flags);
+
+/**
+   Set flags for the callback set with evhttp_set_gencb().
+
+   @see evhttp_set_cb_flags()
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_set_gencb_flags(struct evhttp *http, int flags);
+
 /**
    Set a callback used to create new bufferevents for connections
    to a given evhttp object.
@@ -439,6 +514,21 @@ void evhttp_set_write_timeout_tv(struct evhttp *http, const struct timeval* tv);
 /* Read all the clients body, and only after this respond with an error if the
  * clients body exceed max_body_size */
 #define EVHTTP_SERVER_LINGERING_CLOSE	0x0001
+/* Read pipelined requests on a connection while earlier ones are still
+ * being answered, and run their callbacks without waiting.  Responses are
+ * still sent in the order the requests came in: a response that is ready
+ * early is held until the ones before it have been sent.
+ * @see evhttp_set_pipeline_depth() */
+#define EVHTTP_SERVER_PIPELINING	0x0002
+/* Take HTTP/2 (RFC 7540) from clients that send its connection preface
+ * rather than an HTTP/1.x request: those that know the server speaks it
+ * (h2c with prior knowledge), and TLS clients for which the server has
+ * chosen "h2" with ALPN, e.g. in an SSL_CTX_set_alpn_select_cb()
+ * callback.  Each stream is a request of its own, which is answered with
+ * the usual evhttp_send_reply() and evhttp_send_reply_chunk() functions;
+ * Connection and Transfer-Encoding headers are left out of the
+ * response. */
+#define EVHTTP_SERVER_HTTP2	0x0004
 /**
  * Set connection flags for HTTP server.
  *
@@ -449,6 +539,147 @@ void evhttp_set_write_timeout_tv(struct evhttp *http, const struct timeval* tv);
 EVENT2_EXPORT_SYMBOL
 int evhttp_set_flags(struct evhttp *http, int flags);
 
+/**
+ * Set how many requests a connection may have read and not yet answered
+ * with EVHTTP_SERVER_PIPELINING.  Once it has this many, the server stops
+ * reading until one of them has been answered.  The default is 8.
+ *
+ * @param http an evhttp object
+ * @param depth the number of requests; values below 1 are treated as 1.
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_set_pipeline_depth(struct evhttp *http, int depth);
+
+/** Passed to an evhttp_encoder_cb: everything given so far should be
+ * written out, so that the peer can decode it without waiting for more. */
+#define EVHTTP_ENCODE_FLUSH	0x0001
+/** Passed to an evhttp_encoder_cb: there will be no more input, and the
+ * end of the encoded data should be written out. */
+#define EVHTTP_ENCODE_FINISH	0x0002
+
+/**
+   Starts compressing a response with a content coding added with
+   evhttp_add_content_encoder().
+
+   @param level the level set with evhttp_set_compression()
+   @param arg the argument given to evhttp_add_content_encoder()
+   @return the state for the other callbacks, or NULL to send the response
+     uncompressed
+ */
+typedef void *(*evhttp_encoder_init_cb)(int level, void *arg);
+/**
+   Compresses some of a response.
+
+   Reads from the in_len bytes at in, and writes to the out_len bytes at
+   out; then sets in_len and out_len to how much it read and wrote.
+
+   @param ctx the state returned by the evhttp_encoder_init_cb
+   @param flags 0, EVHTTP_ENCODE_FLUSH or EVHTTP_ENCODE_FINISH
+   @return 0 once all of the input has been read (and, with flags set,
+     all of the output written); 1 if it ran out of space at out, and
+     should be called again; -1 on error.
+ */
+typedef int (*evhttp_encoder_cb)(void *ctx,
+    const unsigned char *in, size_t *in_len,
+    unsigned char *out, size_t *out_len, int flags);
+/**
+   Frees the state returned by an evhttp_encoder_init_cb.
+ */
+typedef void (*evhttp_encoder_free_cb)(void *ctx, void *arg);
+
+/**
+   Adds a content coding, such as gzip or deflate, that responses from this
+   server may be compressed with.
+
+   Responses are compressed, as they are sent, with the first content
+   coding added that the request's Accept-Encoding header accepts.  The
+   compressed data is written straight into the connection's output
+   buffer.  Responses that have no body, that already have a
+   Content-Encoding, whose Content-Type is of data that is already
+   compressed (images, audio, video and archives), or whose length is
+   known and below the size set with evhttp_set_compression(), are sent as
+   they are.
+
+   A compressed response has no Content-Length unless it is sent all at
+   once with evhttp_send_reply(); each evhttp_send_reply_chunk() is
+   flushed with EVHTTP_ENCODE_FLUSH.
+
+   For a virtual host, the content codings of the virtual host that the
+   request is for are used.
+
+   @param http the http server on which to add the content coding
+   @param name the name of the content coding, e.g. "gzip"
+   @param init_cb called to start compressing a response
+   @param encode_cb called to compress each part of a response
+   @param free_cb called once the response has been compressed, or NULL
+   @param arg an additional argument for the callbacks
+   @return 0 on success, -1 on failure
+   @see evhttp_set_compression()
+ */
+EVENT2_EXPORT_SYMBOL
+int evhttp_add_content_encoder(struct evhttp *http, const char *name,
+    evhttp_encoder_init_cb init_cb, evhttp_encoder_cb encode_cb,
+    evhttp_encoder_free_cb free_cb, void *arg);
+
+/**
+   Sets how responses from this server are compressed with the content
+   codings added with evhttp_add_content_encoder().
+
+   @param http the http server on which to set the compression
+   @param level passed to each evhttp_encoder_init_cb; the default is -1
+   @param min_size responses whose length is known and below this are not
+     compressed; the default is 256 bytes
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_set_compression(struct evhttp *http, int level, size_t min_size);
+
+/**
+   Serve the files in a directory for GET and HEAD requests whose path
+   starts with a prefix.
+
+   The rest of the %-decoded path is looked up under root; for a path that
+   ends in '/', index.html is served.  Paths with ".." segments are not
+   found.  Responses have Content-Type (guessed from the file name),
+   Last-Modified, ETag and Accept-Ranges headers, and requests with
+   If-None-Match, If-Modified-Since, Range and If-Range headers get 304,
+   206 and 416 responses as they should.  Only single byte ranges are
+   sent; a request for several gets the whole file.
+
+   The files stay open in a cache, so a request for one that is cached
+   takes no system calls until it is written.  Files are written with
+   sendfile() where the connection and the system allow it, and read from
+   a memory map otherwise.
+
+   Not available on Windows.
+
+   @param http the http server on which to serve the files
+   @param prefix the path prefix, as for evhttp_set_prefix_cb()
+   @param root the directory to serve the files from
+   @return 0 on success, -1 if the prefix has a callback already, -2 on
+     failure
+   @see evhttp_set_static_cache()
+ */
+EVENT2_EXPORT_SYMBOL
+int evhttp_set_static_root(struct evhttp *http, const char *prefix,
+    const char *root);
+
+/**
+   Set how the files served with evhttp_set_static_root() are cached.
+
+   Each file stays open until it is one of the least recently used when
+   there are too many, or until a timer finds, with stat(), that it has
+   changed or gone.
+
+   @param http the http server on which the files are served
+   @param max_files how many files to keep open; the default is 256, and
+     values below 1 are treated as 1
+   @param revalidate how often to check the open files, or NULL never to;
+     the default is 5 seconds
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_set_static_cache(struct evhttp *http, int max_files,
+    const struct timeval *revalidate);
+
 /* Request/Response functionality */
 
 /**
@@ -718,6 +949,31 @@ EVENT2_EXPORT_SYMBOL
 void evhttp_request_set_on_complete_cb(struct evhttp_request *req,
     void (*cb)(struct evhttp_request *, void *), void *cb_arg);
 
+/**
+ * Set the callbacks for the body of a request on a server, for a
+ * request callback with EVHTTP_CB_STREAM_BODY.
+ *
+ * chunk_cb is called each time more of the body has been read into
+ * evhttp_request_get_input_buffer(); it should drain what it has used.
+ * done_cb is called once the whole body has been read, and error_cb if
+ * it cannot be, because the connection failed or the body is too long.
+ * After error_cb the request no longer has a connection; answering it
+ * frees it.
+ *
+ * @param req a request passed to a request callback
+ * @param chunk_cb called as the body is read, or NULL
+ * @param done_cb called when the body has been read, or NULL
+ * @param error_cb called if the body cannot be read, or NULL
+ * @param arg an additional argument for the callbacks
+ * @see EVHTTP_CB_STREAM_BODY
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_request_set_body_cb(struct evhttp_request *req,
+    void (*chunk_cb)(struct evhttp_request *, void *),
+    void (*done_cb)(struct evhttp_request *, void *),
+    void (*error_cb)(enum evhttp_request_error, void *),
+    void *arg);
+
 /** Frees the request object and removes associated events. */
 EVENT2_EXPORT_SYMBOL
 void evhttp_request_free(struct evhttp_request *req);
@@ -755,6 +1011,11 @@ void evhttp_connection_set_family(struct evhttp_connection *evcon,
 #define EVHTTP_CON_READ_ON_WRITE_ERROR	0x0010
 /* @see EVHTTP_SERVER_LINGERING_CLOSE */
 #define EVHTTP_CON_LINGERING_CLOSE	0x0020
+/* Speak HTTP/2 to the server from the start (prior knowledge, or "h2"
+ * negotiated with ALPN on the bufferevent's TLS connection).  Requests
+ * made on the connection are sent at once, as concurrent streams, up to
+ * the number that the server allows. */
+#define EVHTTP_CON_HTTP2	0x0040
 /* Padding for public flags, @see EVHTTP_CON_* in http-internal.h */
 #define EVHTTP_CON_PUBLIC_FLAGS_END	0x100000
 /**
@@ -960,6 +1221,98 @@ int evhttp_make_request(struct evhttp_connection *evcon,
 EVENT2_EXPORT_SYMBOL
 void evhttp_cancel_request(struct evhttp_request *req);
 
+/**
+ * A set of keep-alive connections to upstream servers, for making requests
+ * without choosing a connection for each.
+ *
+ * A pool keeps the connections to each address and port apart.  A request
+ * goes to an idle connection to its address and port if there is one, and
+ * otherwise to a new connection, up to the pool's limit.  Beyond that, it
+ * waits for the first connection to finish its request.  Connections that
+ * stay idle for too long are closed.
+ *
+ * A request that fails because the server closed a kept-alive connection
+ * before answering is sent again on another connection, as long as its
+ * method is idempotent (GET, HEAD, PUT, DELETE, OPTIONS or TRACE) and it
+ * has no body.
+ */
+struct evhttp_connection_pool;
+
+/**
+ * Create a new connection pool.
+ *
+ * @param base the event_base to use for the pool's connections
+ * @param dnsbase the dns_base to use for resolving host names; if not
+ *     specified host name resolution will block.
+ * @return a new evhttp_connection_pool, or NULL on error
+ * @see evhttp_connection_pool_free()
+ */
+EVENT2_EXPORT_SYMBOL
+struct evhttp_connection_pool *evhttp_connection_pool_new(
+	struct event_base *base, struct evdns_base *dnsbase);
+
+/**
+ * Free a connection pool and all of its connections.
+ *
+ * Requests that are still pending on them are freed without their
+ * callbacks being run, as by evhttp_connection_free().
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_connection_pool_free(struct evhttp_connection_pool *pool);
+
+/**
+ * Set the most connections that a pool has to each address and port.
+ *
+ * The default is 8.  Connections beyond a new, lower limit are closed as
+ * they become idle.
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_connection_pool_set_max_connections(
+	struct evhttp_connection_pool *pool, int max_connections);
+
+/**
+ * Set how long a pool's connections may stay idle before they are closed.
+ *
+ * The default is 60 seconds; NULL keeps idle connections until the server
+ * closes them.
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_connection_pool_set_idle_timeout_tv(
+	struct evhttp_connection_pool *pool, const struct timeval *tv);
+
+/**
+ * Set a callback to be called for each connection the pool creates,
+ * before it is used for a request.
+ *
+ * It can set timeouts, retries, flags and the like on the connection.
+ * The connection belongs to the pool, which frees it; it must not be
+ * freed, or set to be freed on completion, by the callback.
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_connection_pool_set_connection_cb(
+	struct evhttp_connection_pool *pool,
+	void (*cb)(struct evhttp_connection *, void *), void *cbarg);
+
+/**
+ * Make an HTTP request on a connection from the pool.
+ *
+ * The request behaves as with evhttp_make_request(), and can be canceled
+ * with evhttp_cancel_request().
+ *
+ * @param pool the connection pool
+ * @param address the address of the server
+ * @param port the port of the server
+ * @param req the request to send
+ * @param type the request type, e.g. EVHTTP_REQ_GET
+ * @param uri the URI associated with the request
+ * @return 0 on success, -1 on failure
+ * @see evhttp_make_request()
+ */
+EVENT2_EXPORT_SYMBOL
+int evhttp_connection_pool_make_request(struct evhttp_connection_pool *pool,
+    const char *address, ev_uint16_t port, struct evhttp_request *req,
+    enum evhttp_cmd_type type, const char *uri);
+
 /**
  * A structure to hold a parsed URI or Relative-Ref conforming to RFC3986.
  */
@@ -77,7 +77,20 @@ struct {
 #define EVHTTP_REQ_DEFER_FREE		0x0008
 /** The request should be freed upstack */
 #define EVHTTP_REQ_NEEDS_FREE		0x0010
-
+/** The body of the request is passed to its handler as it is read */
+#define EVHTTP_REQ_STREAM_BODY		0x0020
+/** The response could not be compressed; the rest of it is not sent */
+#define EVHTTP_REQ_COMPRESS_FAILED	0x0040
+/** The request expects a 100 Continue, which waits for the responses
+ * pipelined before it */
+#define EVHTTP_REQ_NEEDS_CONTINUE	0x0080
+/** The input (output) headers have been handed out, and are on the heap */
+#define EVHTTP_REQ_INPUT_HEADERS_OUT	0x0100
+#define EVHTTP_REQ_OUTPUT_HEADERS_OUT	0x0200
+
+	/* Until they are fetched with evhttp_request_get_input_headers() and
+	 * evhttp_request_get_output_headers(), these may hold headers that
+	 * evhttp_remove_header() and evhttp_clear_headers() must not free. */
 	struct evkeyvalq *input_headers;
 	struct evkeyvalq *output_headers;
 
@@ -142,6 +155,55 @@ struct {
 	 */
 	void (*on_complete_cb)(struct evhttp_request *, void *);
 	void *on_complete_cb_arg;
+
+	/*
+	 * Header parsing state: how far into the input we have looked for
+	 * the end of the headers, and how many lines we saw on the way.
+	 */
+	size_t headers_scanned;
+	int header_lines;
+	/*
+	 * Memory for things that last exactly as long as the request: the
+	 * parsed headers, the URI, and so on.  Freed all at once with the
+	 * request, or kept by its connection for the next one.
+	 */
+	struct evhttp_arena_chunk *arena;
+	/*
+	 * Indexes of the input and output headers, in the arena, or NULL
+	 * until we first need one.
+	 */
+	struct evhttp_header_index *header_index;
+	/*
+	 * With pipelining, the response so far to a request that must wait
+	 * for earlier ones on its connection to be sent, and the callback
+	 * to give evhttp_write_buffer() when it gets its turn.
+	 */
+	struct evbuffer *pending_output;
+	void (*pending_cb)(struct evhttp_connection *, void *);
+	void *pending_cb_arg;
+	/*
+	 * On an HTTP/2 connection, the stream that the request is on.
+	 */
+	struct evhttp2_stream *h2_stream;
+	/*
+	 * For a server request whose body is streamed to its handler, the
+	 * callbacks set with evhttp_request_set_body_cb().
+	 */
+	void (*body_chunk_cb)(struct evhttp_request *, void *);
+	void (*body_done_cb)(struct evhttp_request *, void *);
+	void (*body_error_cb)(enum evhttp_request_error, void *);
+	void *body_cb_arg;
+	/*
+	 * For a server request, the content coding that its response may be
+	 * compressed with, chosen from its Accept-Encoding header, with the
+	 * compression settings of its server.  Once the response is being
+	 * compressed, the encoder's state, and a buffer for its output.
+	 */
+	struct evhttp_content_encoder *encoder;
+	int compress_level;
+	size_t compress_min_size;
+	void *encoder_ctx;
+	struct evbuffer *encoder_buf;
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef EVENT2_POOL_H_INCLUDED_
+#define EVENT2_POOL_H_INCLUDED_
+
+/** @file event2/pool.h
+
+  A pool of event_bases, each running its own loop in its own thread.
+
+  A server that wants to use several cores usually runs one event_base per
+  thread and binds one listener per base to the same port with
+  LEV_OPT_REUSEABLE_PORT, so that the kernel spreads incoming connections
+  between them.  An event_base_pool does that setup for you: it starts the
+  threads, creates one listener per base, and runs each accept callback in
+  the thread whose listener accepted the connection.  Anything that the
+  callback creates on evconnlistener_get_base() stays on that thread.
+
+  The pool functions live in libevent_pthreads, and are only available
+  where Posix threads are.
+ */
+
+#include <event2/visibility.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <event2/event-config.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+
+struct sockaddr;
+struct event_config;
+struct event_base_pool;
+
+/** Flag: Pin the thread running base i to CPU i, and ask the kernel (with
+ * SO_ATTACH_REUSEPORT_CBPF) to hand each connection to the listener of the
+ * CPU that received it.  Works best when there are no more bases than CPUs.
+ * Only supported on Linux; ignored elsewhere.
+ */
+#define EVENT_BASE_POOL_CPU_AFFINITY	(1u<<0)
+
+/**
+   Create a pool of event_bases and start a thread looping on each one.
+
+   This function calls evthread_use_pthreads(), since the bases are used
+   from more than one thread.
+
+   @param n_bases The number of bases and threads; if it is 0 or negative,
+      use one per online CPU.
+   @param cfg The configuration to create each base with, or NULL for the
+      default.
+   @param flags Any number of EVENT_BASE_POOL_* flags.
+   @return a new event_base_pool, or NULL on error.
+ */
+EVENT2_EXPORT_SYMBOL
+struct event_base_pool *event_base_pool_new(int n_bases,
+    const struct event_config *cfg, unsigned flags);
+
+/**
+   Stop every thread in the pool, wait for it to finish, and free every
+   listener and base in the pool.
+
+   Must not be called from one of the pool's own threads.  Anything else
+   still using the bases (bufferevents and so on) must be freed first.
+ */
+EVENT2_EXPORT_SYMBOL
+void event_base_pool_free(struct event_base_pool *pool);
+
+/** Return the number of event_bases in the pool. */
+EVENT2_EXPORT_SYMBOL
+int event_base_pool_get_n_bases(const struct event_base_pool *pool);
+
+/** Return the i'th event_base in the pool, or NULL if there is none. */
+EVENT2_EXPORT_SYMBOL
+struct event_base *event_base_pool_get_base(struct event_base_pool *pool,
+    int i);
+
+/**
+   Listen for connections on an address with one evconnlistener per base.
+
+   Each listener is bound with LEV_OPT_REUSEABLE_PORT and LEV_OPT_THREADSAFE
+   in addition to the flags given.  When cb runs, it runs in the thread of
+   the listener that accepted the connection; use evconnlistener_get_base()
+   to find the base to put the connection on.
+
+   If the address has a port of 0, all the listeners share the port that
+   the first one was given.
+
+   @param pool The pool to listen with.
+   @param cb, ptr, flags, backlog As for evconnlistener_new_bind().
+   @param sa The address to listen for connections on.
+   @param socklen The length of the address.
+   @return the listener on the pool's first base, or NULL on error.  The
+      listeners belong to the pool, and are freed by event_base_pool_free().
+ */
+EVENT2_EXPORT_SYMBOL
+struct evconnlistener *event_base_pool_listen(struct event_base_pool *pool,
+    evconnlistener_cb cb, void *ptr, unsigned flags, int backlog,
+    const struct sockaddr *sa, int socklen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT2_POOL_H_INCLUDED_ */
@@ -36,10 +36,36 @@
 #include "util-internal.h"
 #include "mm-internal.h"
 
+#include <string.h>
+
+/* A d-ary min-heap of events, ordered by ev_timeout.
+ *
+ * Each node keeps a copy of its event's timeout as an integer, so that
+ * comparisons never have to look at the events themselves; the only time
+ * we touch an event is to tell it its new index.  The array is aligned so
+ * that the MIN_HEAP_ARITY children of each node start a cache line: with
+ * the default arity of 4, the children that shift_down compares fill
+ * exactly one line. */
+
+/* Number of children per node.  Must be a power of two. */
+#ifndef MIN_HEAP_ARITY
+#define MIN_HEAP_ARITY 4
+#endif
+#define MIN_HEAP_CACHELINE 64
+
+struct min_heap_node
+{
+	/* ev->ev_timeout, packed so that it compares like evutil_timercmp */
+	ev_uint64_t key;
+	struct event* ev;
+};
+
 typedef struct min_heap
 {
-	struct event** p;
+	struct min_heap_node* p;
 	size_t n, a;
+	/* The memory that p points into. */
+	void* mem;
 } min_heap_t;
 
 static inline void	     min_heap_ctor_(min_heap_t* s);
@@ -49,30 +75,58 @@ static inline int	     min_heap_elt_is_top_(const struct event *e);
 static inline int	     min_heap_empty_(min_heap_t* s);
 static inline size_t	     min_heap_size_(min_heap_t* s);
 static inline struct event*  min_heap_top_(min_heap_t* s);
+static inline struct event*  min_heap_get_(min_heap_t* s, size_t i);
 static inline int	     min_heap_reserve_(min_heap_t* s, size_t n);
 static inline int	     min_heap_push_(min_heap_t* s, struct event* e);
 static inline struct event*  min_heap_pop_(min_heap_t* s);
 static inline int	     min_heap_adjust_(min_heap_t *s, struct event* e);
 static inline int	     min_heap_erase_(min_heap_t* s, struct event* e);
-static inline void	     min_heap_shift_up_(min_heap_t* s, size_t hole_index, struct event* e);
-static inline void	     min_heap_shift_up_unconditional_(min_heap_t* s, size_t hole_index, struct event* e);
-static inline void	     min_heap_shift_down_(min_heap_t* s, size_t hole_index, struct event* e);
+static inline void	     min_heap_shift_up_(min_heap_t* s, size_t hole_index, struct min_heap_node n);
+static inline void	     min_heap_shift_up_unconditional_(min_heap_t* s, size_t hole_index, struct min_heap_node n);
+static inline void	     min_heap_shift_down_(min_heap_t* s, size_t hole_index, struct min_heap_node n);
+
+#define min_heap_parent_(i) (((i) - 1) / MIN_HEAP_ARITY)
+#define min_heap_first_child_(i) ((i) * MIN_HEAP_ARITY + 1)
+
+static inline ev_uint64_t
+min_heap_key_(const struct event *e)
+{
+	/* tv_usec must fit in the low 20 bits; event_add() keeps it below
+	 * 1000000 */
+	EVUTIL_ASSERT(e->ev_timeout.tv_usec >= 0 &&
+	    e->ev_timeout.tv_usec < (1 << 20));
+	return ((ev_uint64_t)e->ev_timeout.tv_sec << 20) |
+	    (ev_uint32_t)e->ev_timeout.tv_usec;
+}
 
-#define min_heap_elem_greater(a, b) \
-	(evutil_timercmp(&(a)->ev_timeout, &(b)->ev_timeout, >))
+static inline struct min_heap_node
+min_heap_node_(struct event *e)
+{
+	struct min_heap_node n;
+	n.key = min_heap_key_(e);
+	n.ev = e;
+	return n;
+}
 
-void min_heap_ctor_(min_heap_t* s) { s->p = 0; s->n = 0; s->a = 0; }
-void min_heap_dtor_(min_heap_t* s) { if (s->p) mm_free(s->p); }
+/* Put n at index i of s, and tell its event. */
+#define min_heap_set_(s, i, node) do {					\
+		(s)->p[i] = (node);					\
+		(s)->p[i].ev->ev_timeout_pos.min_heap_idx = (i);	\
+	} while (0)
+
+void min_heap_ctor_(min_heap_t* s) { s->p = 0; s->n = 0; s->a = 0; s->mem = 0; }
+void min_heap_dtor_(min_heap_t* s) { if (s->mem) mm_free(s->mem); }
 void min_heap_elem_init_(struct event* e) { e->ev_timeout_pos.min_heap_idx = EV_SIZE_MAX; }
 int min_heap_empty_(min_heap_t* s) { return 0 == s->n; }
 size_t min_heap_size_(min_heap_t* s) { return s->n; }
-struct event* min_heap_top_(min_heap_t* s) { return s->n ? *s->p : 0; }
+struct event* min_heap_top_(min_heap_t* s) { return s->n ? s->p[0].ev : 0; }
+struct event* min_heap_get_(min_heap_t* s, size_t i) { return s->p[i].ev; }
 
 int min_heap_push_(min_heap_t* s, struct event* e)
 {
 	if (min_heap_reserve_(s, s->n + 1))
 		return -1;
-	min_heap_shift_up_(s, s->n++, e);
+	min_heap_shift_up_(s, s->n++, min_heap_node_(e));
 	return 0;
 }
 
@@ -80,8 +134,9 @@ struct event* min_heap_pop_(min_heap_t* s)
 {
 	if (s->n)
 	{
-		struct event* e = *s->p;
-		min_heap_shift_down_(s, 0, s->p[--s->n]);
+		struct event* e = s->p[0].ev;
+		if (--s->n)
+			min_heap_shift_down_(s, 0, s->p[s->n]);
 		e->ev_timeout_pos.min_heap_idx = EV_SIZE_MAX;
 		return e;
 	}
@@ -95,19 +150,21 @@ int min_heap_elt_is_top_(const struct event *e)
 
 int min_heap_erase_(min_heap_t* s, struct event* e)
 {
-	if (EV_SIZE_MAX != e->ev_timeout_pos.min_heap_idx)
+	size_t idx = e->ev_timeout_pos.min_heap_idx;
+	if (EV_SIZE_MAX != idx)
 	{
-		struct event *last = s->p[--s->n];
-		size_t parent = (e->ev_timeout_pos.min_heap_idx - 1) / 2;
+		struct min_heap_node last = s->p[--s->n];
 		/* we replace e with the last element in the heap.  We might need to
 		   shift it upward if it is less than its parent, or downward if it is
-		   greater than one or both its children. Since the children are known
-		   to be less than the parent, it can't need to shift both up and
-		   down. */
-		if (e->ev_timeout_pos.min_heap_idx > 0 && min_heap_elem_greater(s->p[parent], last))
-			min_heap_shift_up_unconditional_(s, e->ev_timeout_pos.min_heap_idx, last);
-		else
-			min_heap_shift_down_(s, e->ev_timeout_pos.min_heap_idx, last);
+		   greater than one or more of its children. Since the children are
+		   known to be less than the parent, it can't need to shift both up
+		   and down. */
+		if (idx < s->n) {
+			if (idx > 0 && s->p[min_heap_parent_(idx)].key > last.key)
+				min_heap_shift_up_unconditional_(s, idx, last);
+			else
+				min_heap_shift_down_(s, idx, last);
+		}
 		e->ev_timeout_pos.min_heap_idx = EV_SIZE_MAX;
 		return 0;
 	}
@@ -116,16 +173,17 @@ int min_heap_erase_(min_heap_t* s, struct event* e)
 
 int min_heap_adjust_(min_heap_t *s, struct event *e)
 {
-	if (EV_SIZE_MAX == e->ev_timeout_pos.min_heap_idx) {
+	size_t idx = e->ev_timeout_pos.min_heap_idx;
+	if (EV_SIZE_MAX == idx) {
 		return min_heap_push_(s, e);
 	} else {
-		size_t parent = (e->ev_timeout_pos.min_heap_idx - 1) / 2;
+		struct min_heap_node n = min_heap_node_(e);
 		/* The position of e has changed; we shift it up or down
 		 * as needed.  We can't need to do both. */
-		if (e->ev_timeout_pos.min_heap_idx > 0 && min_heap_elem_greater(s->p[parent], e))
-			min_heap_shift_up_unconditional_(s, e->ev_timeout_pos.min_heap_idx, e);
+		if (idx > 0 && s->p[min_heap_parent_(idx)].key > n.key)
+			min_heap_shift_up_unconditional_(s, idx, n);
 		else
-			min_heap_shift_down_(s, e->ev_timeout_pos.min_heap_idx, e);
+			min_heap_shift_down_(s, idx, n);
 		return 0;
 	}
 }
@@ -134,55 +192,73 @@ int min_heap_reserve_(min_heap_t* s, size_t n)
 {
 	if (s->a < n)
 	{
-		struct event** p;
+		void* mem;
+		char* start;
 		size_t a = s->a ? s->a * 2 : 8;
+		size_t old_offset = s->mem ? (char*)s->p - (char*)s->mem : 0;
+		size_t offset;
 		if (a < n)
 			a = n;
-		if (!(p = (struct event**)mm_realloc(s->p, a * sizeof *p)))
+		/* Leave room to line p[1] up with a cache line. */
+		if (!(mem = mm_realloc(s->mem,
+			    a * sizeof(struct min_heap_node) + MIN_HEAP_CACHELINE)))
 			return -1;
-		s->p = p;
+		start = (char*)mem + sizeof(struct min_heap_node);
+		offset = (MIN_HEAP_CACHELINE -
+		    ((ev_uintptr_t)start & (MIN_HEAP_CACHELINE - 1))) &
+		    (MIN_HEAP_CACHELINE - 1);
+		if (offset != old_offset && s->n)
+			memmove((char*)mem + offset, (char*)mem + old_offset,
+			    s->n * sizeof(struct min_heap_node));
+		s->mem = mem;
+		s->p = (struct min_heap_node*)((char*)mem + offset);
 		s->a = a;
 	}
 	return 0;
 }
 
-void min_heap_shift_up_unconditional_(min_heap_t* s, size_t hole_index, struct event* e)
+void min_heap_shift_up_unconditional_(min_heap_t* s, size_t hole_index, struct min_heap_node n)
 {
-    size_t parent = (hole_index - 1) / 2;
+    size_t parent = min_heap_parent_(hole_index);
     do
     {
-	(s->p[hole_index] = s->p[parent])->ev_timeout_pos.min_heap_idx = hole_index;
+	min_heap_set_(s, hole_index, s->p[parent]);
 	hole_index = parent;
-	parent = (hole_index - 1) / 2;
-    } while (hole_index && min_heap_elem_greater(s->p[parent], e));
-    (s->p[hole_index] = e)->ev_timeout_pos.min_heap_idx = hole_index;
+	parent = min_heap_parent_(hole_index);
+    } while (hole_index && s->p[parent].key > n.key);
+    min_heap_set_(s, hole_index, n);
 }
 
-void min_heap_shift_up_(min_heap_t* s, size_t hole_index, struct event* e)
+void min_heap_shift_up_(min_heap_t* s, size_t hole_index, struct min_heap_node n)
 {
-    size_t parent = (hole_index - 1) / 2;
-    while (hole_index && min_heap_elem_greater(s->p[parent], e))
+    size_t parent = min_heap_parent_(hole_index);
+    while (hole_index && s->p[parent].key > n.key)
     {
-	(s->p[hole_index] = s->p[parent])->ev_timeout_pos.min_heap_idx = hole_index;
+	min_heap_set_(s, hole_index, s->p[parent]);
 	hole_index = parent;
-	parent = (hole_index - 1) / 2;
+	parent = min_heap_parent_(hole_index);
     }
-    (s->p[hole_index] = e)->ev_timeout_pos.min_heap_idx = hole_index;
+    min_heap_set_(s, hole_index, n);
 }
 
-void min_heap_shift_down_(min_heap_t* s, size_t hole_index, struct event* e)
+void min_heap_shift_down_(min_heap_t* s, size_t hole_index, struct min_heap_node n)
 {
-    size_t min_child = 2 * (hole_index + 1);
-    while (min_child <= s->n)
-	{
-	min_child -= min_child == s->n || min_heap_elem_greater(s->p[min_child], s->p[min_child - 1]);
-	if (!(min_heap_elem_greater(e, s->p[min_child])))
+    size_t child = min_heap_first_child_(hole_index);
+    while (child < s->n)
+    {
+	size_t end = child + MIN_HEAP_ARITY, min_child = child, i;
+	if (end > s->n)
+	    end = s->n;
+	for (i = child + 1; i < end; ++i)
+	    if (s->p[i].key < s->p[min_child].key)
+		min_child = i;
+	if (!(n.key > s->p[min_child].key))
 	    break;
-	(s->p[hole_index] = s->p[min_child])->ev_timeout_pos.min_heap_idx = hole_index;
+	min_heap_set_(s, hole_index, s->p[min_child]);
 	hole_index = min_child;
-	min_child = 2 * (hole_index + 1);
-	}
-    (s->p[hole_index] = e)->ev_timeout_pos.min_heap_idx = hole_index;
+	child = min_heap_first_child_(hole_index);
+    }
+    min_heap_set_(s, hole_index, n);
 }
 
 #endif /* MINHEAP_INTERNAL_H_INCLUDED_ */
@@ -0,0 +1,212 @@
+/*
+ * Copyright 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <getopt.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <event2/buffer.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark measures how fast evbuffer_search() and
+ * evbuffer_search_eol() get through the data.  It fills a buffer with
+ * text lines split over chains of a given size, then finds every line end
+ * in each EOL style, and searches for a few patterns: the end of an HTTP
+ * header block, which appears once at the end, and a string that is never
+ * there but whose first bytes often are.  The cost of each is printed in
+ * megabytes per second.
+ */
+
+static struct timeval ts;
+
+static void
+start(void)
+{
+	evutil_gettimeofday(&ts, NULL);
+}
+
+static void
+report(const char *what, size_t bytes, int rounds)
+{
+	struct timeval te;
+	double usec;
+
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000.0 + te.tv_usec;
+	if (usec < 1)
+		usec = 1;
+	fprintf(stdout, "%-18s %10.1f MB/s\n", what,
+	    (double)bytes * rounds / usec);
+}
+
+static int
+count_lines(struct evbuffer *buf, enum evbuffer_eol_style style)
+{
+	struct evbuffer_ptr pos;
+	size_t eol_len;
+	int n = 0;
+
+	pos = evbuffer_search_eol(buf, NULL, &eol_len, style);
+	while (pos.pos >= 0) {
+		++n;
+		if (evbuffer_ptr_set(buf, &pos, eol_len, EVBUFFER_PTR_ADD) < 0)
+			break;
+		pos = evbuffer_search_eol(buf, &pos, &eol_len, style);
+	}
+	return n;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct evbuffer *buf, *tmp;
+	struct evbuffer_ptr pos;
+	char *data;
+	size_t size = 16 * 1024 * 1024, chain_size = 4096, line_len = 80;
+	size_t i, n;
+	int rounds = 10, r, c, lines = 0, failed = 0;
+
+	while ((c = getopt(argc, argv, "s:c:l:r:")) != -1) {
+		switch (c) {
+		case 's':
+			size = (size_t)atol(optarg);
+			break;
+		case 'c':
+			chain_size = (size_t)atol(optarg);
+			break;
+		case 'l':
+			line_len = (size_t)atol(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (size < 16 || chain_size < 1 || line_len < 3 || rounds < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+	data = malloc(size);
+	if (data == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	/* Lines of text like "Header-Name: some value\r\n", with spaces and
+	 * colons that look like the start of the patterns below. */
+	for (i = 0; i < size; ++i)
+		data[i] = (i % 7 == 6) ? ' ' : (i % 11 == 10) ? ':' :
+		    'a' + i % 26;
+	for (i = line_len - 2; i + 1 < size; i += line_len) {
+		data[i] = '\r';
+		data[i + 1] = '\n';
+	}
+	memcpy(data + size - 4, "\r\n\r\n", 4);
+
+	buf = evbuffer_new();
+	tmp = evbuffer_new();
+	if (buf == NULL || tmp == NULL) {
+		perror("evbuffer_new");
+		exit(1);
+	}
+	for (i = 0; i < size; i += n) {
+		n = size - i < chain_size ? size - i : chain_size;
+		evbuffer_add(tmp, data + i, n);
+		evbuffer_add_buffer(buf, tmp);
+	}
+
+	fprintf(stdout, "%lu bytes in %lu byte chains, %lu byte lines\n",
+	    (unsigned long)size, (unsigned long)chain_size,
+	    (unsigned long)line_len);
+
+	start();
+	for (r = 0; r < rounds; ++r)
+		count_lines(buf, EVBUFFER_EOL_ANY);
+	report("eol-any", size, rounds);
+
+	start();
+	for (r = 0; r < rounds; ++r)
+		lines = count_lines(buf, EVBUFFER_EOL_CRLF);
+	report("eol-crlf", size, rounds);
+
+	start();
+	for (r = 0; r < rounds; ++r)
+		if (count_lines(buf, EVBUFFER_EOL_CRLF_STRICT) != lines)
+			failed = 1;
+	report("eol-crlf-strict", size, rounds);
+
+	start();
+	for (r = 0; r < rounds; ++r)
+		if (count_lines(buf, EVBUFFER_EOL_LF) != lines)
+			failed = 1;
+	report("eol-lf", size, rounds);
+
+	start();
+	for (r = 0; r < rounds; ++r) {
+		pos = evbuffer_search(buf, "\r\n\r\n", 4, NULL);
+		if (pos.pos < 0)
+			failed = 1;
+	}
+	report("search-crlfcrlf", size, rounds);
+
+	start();
+	for (r = 0; r < rounds; ++r) {
+		pos = evbuffer_search(buf, ": missing", 9, NULL);
+		if (pos.pos != -1)
+			failed = 1;
+	}
+	report("search-missing", size, rounds);
+
+	evbuffer_free(tmp);
+	evbuffer_free(buf);
+	free(data);
+
+	if (failed) {
+		fprintf(stderr, "Search results were wrong\n");
+		exit(1);
+	}
+
+	exit(0);
+}
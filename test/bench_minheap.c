@@ -0,0 +1,184 @@
+/*
+ * Copyright 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "../minheap-internal.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <getopt.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <event2/event.h>
+#include <event2/event_struct.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark measures the timeout heap on its own.  It pushes a large
+ * number of timers with random deadlines (shift-up), moves them earlier
+ * (shift-up) and later (shift-down) in place the way event_add() re-arms a
+ * pending timer, erases half of them, and finally pops everything
+ * (shift-down).  The cost of each phase is printed in nanoseconds per
+ * operation.  Rebuild with -DMIN_HEAP_ARITY=2 to compare against a binary
+ * heap.
+ */
+
+static ev_uint32_t rng_state = 12345;
+
+static ev_uint32_t
+rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static void
+set_timeout(struct event *ev, long sec)
+{
+	ev->ev_timeout.tv_sec = sec;
+	ev->ev_timeout.tv_usec = rng() % 1000000;
+}
+
+static struct timeval ts;
+
+static void
+start(void)
+{
+	evutil_gettimeofday(&ts, NULL);
+}
+
+static void
+report(const char *what, int n)
+{
+	struct timeval te;
+	double usec;
+
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000.0 + te.tv_usec;
+	fprintf(stdout, "%-14s %8.1f ns/op\n", what, usec * 1000.0 / n);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct min_heap heap;
+	struct event *events;
+	struct event *ev, *last;
+	int i, c;
+	int num_timers = 1000000;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_timers = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (num_timers < 2) {
+		fprintf(stderr, "Need at least 2 timers\n");
+		exit(1);
+	}
+
+	events = calloc(num_timers, sizeof(struct event));
+	if (events == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	min_heap_ctor_(&heap);
+	if (min_heap_reserve_(&heap, num_timers) < 0) {
+		perror("malloc");
+		exit(1);
+	}
+
+	fprintf(stdout, "%d timers, arity %d\n", num_timers, MIN_HEAP_ARITY);
+
+	for (i = 0; i < num_timers; ++i) {
+		min_heap_elem_init_(&events[i]);
+		set_timeout(&events[i], 1000 + rng() % 1000);
+	}
+
+	start();
+	for (i = 0; i < num_timers; ++i)
+		min_heap_push_(&heap, &events[i]);
+	report("push", num_timers);
+
+	start();
+	for (i = 0; i < num_timers; ++i) {
+		ev = &events[rng() % num_timers];
+		set_timeout(ev, ev->ev_timeout.tv_sec - rng() % 100);
+		min_heap_adjust_(&heap, ev);
+	}
+	report("adjust-earlier", num_timers);
+
+	start();
+	for (i = 0; i < num_timers; ++i) {
+		ev = &events[rng() % num_timers];
+		set_timeout(ev, ev->ev_timeout.tv_sec + rng() % 100);
+		min_heap_adjust_(&heap, ev);
+	}
+	report("adjust-later", num_timers);
+
+	start();
+	for (i = 0; i < num_timers; i += 2)
+		min_heap_erase_(&heap, &events[i]);
+	report("erase", num_timers / 2);
+
+	start();
+	c = 0;
+	last = min_heap_pop_(&heap);
+	while ((ev = min_heap_pop_(&heap)) != NULL) {
+		if (evutil_timercmp(&ev->ev_timeout, &last->ev_timeout, <))
+			c = 1;
+		last = ev;
+	}
+	report("pop", num_timers - num_timers / 2);
+
+	min_heap_dtor_(&heap);
+	free(events);
+
+	if (c) {
+		fprintf(stderr, "Heap order violated\n");
+		exit(1);
+	}
+
+	exit(0);
+}
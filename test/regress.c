@@ -741,6 +741,18 @@ test_common_timeout(void *ptr)
 
 	const struct timeval *ms_100, *ms_200, *sec_5;
 
+	if (data->setup_data && !strcmp(data->setup_data, "wheel")) {
+		/* Mix the common timeouts with ones in a timing wheel. */
+		struct event_config *cfg = event_config_new();
+		tt_assert(cfg);
+		event_config_set_flag(cfg, EVENT_BASE_FLAG_TIMER_WHEEL);
+		base = event_base_new_with_config(cfg);
+		event_config_free(cfg);
+		tt_assert(base);
+		event_base_free(data->base);
+		data->base = base;
+	}
+
 	ms_100 = event_base_init_common_timeout(base, &tmp_100_ms);
 	ms_200 = event_base_init_common_timeout(base, &tmp_200_ms);
 	sec_5 = event_base_init_common_timeout(base, &tmp_5_sec);
@@ -1942,6 +1954,55 @@ end:
 	event_free(ev[4]);
 }
 
+struct timeout_order_param {
+	int *fired;
+	int *n;
+	int id;
+};
+static void
+record_order_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct timeout_order_param *p = arg;
+	p->fired[(*p->n)++] = p->id;
+}
+
+/* Timeouts whose tv_usec is out of range still fire in order. */
+static void
+test_event_unnormalized_timeout(void *ptr)
+{
+	struct basic_test_data *data = ptr;
+	struct event_base *base = data->base;
+	struct event *ev[3] = { NULL, NULL, NULL };
+	struct timeout_order_param param[3];
+	struct timeval tv[3] = {
+		{ -3, 3200*1000 },	/* 200 msec */
+		{ 0, 100*1000 },	/* 100 msec */
+		{ 1, -850*1000 },	/* 150 msec */
+	};
+	int fired[3] = { -1, -1, -1 }, n = 0, i;
+
+	for (i = 0; i < 3; ++i) {
+		param[i].fired = fired;
+		param[i].n = &n;
+		param[i].id = i;
+		ev[i] = evtimer_new(base, record_order_cb, &param[i]);
+		tt_assert(ev[i]);
+		tt_int_op(event_add(ev[i], &tv[i]), ==, 0);
+	}
+	event_base_assert_ok_(base);
+
+	event_base_dispatch(base);
+
+	tt_int_op(n, ==, 3);
+	tt_int_op(fired[0], ==, 1);
+	tt_int_op(fired[1], ==, 2);
+	tt_int_op(fired[2], ==, 0);
+end:
+	for (i = 0; i < 3; ++i)
+		if (ev[i])
+			event_free(ev[i]);
+}
+
 static void
 test_event_base_new(void *ptr)
 {
@@ -2898,6 +2959,47 @@ end:
 	}
 }
 
+/* Deleting the event on a listener, closing it, and binding its address
+ * again has to work without a trip through the loop in between, even on
+ * backends where a pending poll holds the socket open. */
+static void
+test_event_del_close_rebind(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct sockaddr_in sin;
+	ev_socklen_t slen = sizeof(sin);
+	evutil_socket_t fd = EVUTIL_INVALID_SOCKET;
+	struct event *ev = NULL;
+	int i = 0;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001);
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	tt_assert(fd != EVUTIL_INVALID_SOCKET);
+	tt_assert(!bind(fd, (struct sockaddr *)&sin, sizeof(sin)));
+	tt_assert(!listen(fd, 5));
+	tt_assert(!getsockname(fd, (struct sockaddr *)&sin, &slen));
+
+	ev = event_new(data->base, fd, EV_READ|EV_PERSIST, dfd_cb, &i);
+	tt_assert(ev);
+	tt_assert(!event_add(ev, NULL));
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_assert(!event_del(ev));
+	evutil_closesocket(fd);
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	tt_assert(fd != EVUTIL_INVALID_SOCKET);
+	tt_assert(!bind(fd, (struct sockaddr *)&sin, sizeof(sin)));
+	tt_int_op(i, ==, 0);
+
+end:
+	if (ev)
+		event_free(ev);
+	if (fd != EVUTIL_INVALID_SOCKET)
+		evutil_closesocket(fd);
+}
+
 #ifndef _WIN32
 /* You can't do this test on windows, since dup2 doesn't work on sockets */
 
@@ -3449,6 +3551,7 @@ struct testcase_t main_testcases[] = {
 	BASIC(bad_reentrant, TT_FORK|TT_NEED_BASE|TT_NO_LOGS),
 	BASIC(active_later, TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR|TT_RETRIABLE),
 	BASIC(event_remove_timeout, TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR),
+	BASIC(event_unnormalized_timeout, TT_FORK|TT_NEED_BASE),
 
 	/* These are still using the old API */
 	LEGACY(persistent_timeout, TT_FORK|TT_NEED_BASE),
@@ -3459,6 +3562,8 @@ struct testcase_t main_testcases[] = {
 	BASIC(priority_active_inversion, TT_FORK|TT_NEED_BASE),
 	{ "common_timeout", test_common_timeout, TT_FORK|TT_NEED_BASE,
 	  &basic_setup, NULL },
+	{ "common_timeout_wheel", test_common_timeout, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, (void*)"wheel" },
 
 	/* These legacy tests may not all need all of these flags. */
 	LEGACY(simpleread, TT_ISOLATED),
@@ -3482,6 +3587,8 @@ struct testcase_t main_testcases[] = {
 	  NULL },
 	{ "event_closed_fd_poll", test_event_closed_fd_poll, TT_ISOLATED, &basic_setup,
 	  NULL },
+	{ "event_del_close_rebind", test_event_del_close_rebind,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
 
 #ifndef _WIN32
 	{ "dup_fd", test_dup_fd, TT_ISOLATED, &basic_setup, NULL },
@@ -48,9 +48,11 @@ extern struct testcase_t dns_testcases[];
 extern struct testcase_t rpc_testcases[];
 extern struct testcase_t edgetriggered_testcases[];
 extern struct testcase_t minheap_testcases[];
+extern struct testcase_t timerwheel_testcases[];
 extern struct testcase_t iocp_testcases[];
 extern struct testcase_t ssl_testcases[];
 extern struct testcase_t listener_testcases[];
+extern struct testcase_t dgram_testcases[];
 extern struct testcase_t listener_iocp_testcases[];
 extern struct testcase_t thread_testcases[];
 extern struct testcase_t watch_testcases[];
@@ -55,6 +55,7 @@
 #include "event2/event.h"
 #include "event2/buffer.h"
 #include "event2/buffer_compat.h"
+#include "event2/bufferevent.h"
 #include "event2/util.h"
 
 #include "defer-internal.h"
@@ -1890,6 +1891,145 @@ end:
 		evbuffer_free(tmp);
 }
 
+/* Return the first match of what in the len bytes of s at or after
+ * from, or -1. */
+static ev_ssize_t
+naive_search(const char *s, size_t len, const char *what, size_t what_len,
+    size_t from)
+{
+	size_t i;
+	for (i = from; i + what_len <= len; ++i) {
+		if (!memcmp(s + i, what, what_len))
+			return i;
+	}
+	return -1;
+}
+
+static void
+test_evbuffer_search_long(void *ptr)
+{
+	static const char *patterns[] = {
+		"\r\n", "\r\n\r\n", "ab", "abc", "aab", "\n", "a", "ba",
+		"abababab", "zz"
+	};
+	static const size_t chain_sizes[] = { 1, 3, 17, 33, 64, 100, 4096 };
+	struct evbuffer *buf = NULL;
+	struct evbuffer_ptr pos;
+	char *data = NULL;
+	size_t len = 9000, i, j, k, n, eol_len;
+	ev_ssize_t expect;
+	ev_uint32_t r = 1;
+
+	data = malloc(len);
+	tt_assert(data);
+	/* Mostly a, b and CR, with the odd LF, so that there are lots of
+	 * near misses for each pattern. */
+	for (i = 0; i < len; ++i) {
+		r = r * 1103515245 + 12345;
+		switch ((r >> 16) % 13) {
+		case 0: data[i] = '\n'; break;
+		case 1: case 2: data[i] = '\r'; break;
+		case 3: case 4: case 5: case 6: data[i] = 'b'; break;
+		default: data[i] = 'a'; break;
+		}
+	}
+	/* Keep some long runs free of EOLs for the wide loops. */
+	memset(data + 1000, 'a', 200);
+	memset(data + 5000, 'b', 3000);
+
+	for (k = 0; k < ARRAY_SIZE(chain_sizes); ++k) {
+		buf = evbuffer_new();
+		tt_assert(buf);
+		for (i = 0; i < len; i += n) {
+			struct evbuffer *tmp = evbuffer_new();
+			n = chain_sizes[k];
+			if (n > len - i)
+				n = len - i;
+			evbuffer_add(tmp, data + i, n);
+			evbuffer_add_buffer(buf, tmp);
+			evbuffer_free(tmp);
+		}
+		tt_int_op(evbuffer_get_length(buf), ==, len);
+
+		for (j = 0; j < ARRAY_SIZE(patterns); ++j) {
+			const char *what = patterns[j];
+			size_t what_len = strlen(what);
+			expect = naive_search(data, len, what, what_len, 0);
+			pos = evbuffer_search(buf, what, what_len, NULL);
+			while (expect >= 0) {
+				tt_int_op(pos.pos, ==, expect);
+				expect = naive_search(data, len, what,
+				    what_len, expect + 1);
+				evbuffer_ptr_set(buf, &pos, 1, EVBUFFER_PTR_ADD);
+				pos = evbuffer_search(buf, what, what_len, &pos);
+			}
+			tt_int_op(pos.pos, ==, -1);
+		}
+
+		/* Walk the lines in every style, checking each one. */
+		pos = evbuffer_search_eol(buf, NULL, &eol_len,
+		    EVBUFFER_EOL_CRLF_STRICT);
+		expect = naive_search(data, len, "\r\n", 2, 0);
+		while (expect >= 0) {
+			tt_int_op(pos.pos, ==, expect);
+			tt_int_op(eol_len, ==, 2);
+			evbuffer_ptr_set(buf, &pos, 2, EVBUFFER_PTR_ADD);
+			pos = evbuffer_search_eol(buf, &pos, &eol_len,
+			    EVBUFFER_EOL_CRLF_STRICT);
+			expect = naive_search(data, len, "\r\n", 2,
+			    expect + 2);
+		}
+		tt_int_op(pos.pos, ==, -1);
+
+		pos = evbuffer_search_eol(buf, NULL, &eol_len,
+		    EVBUFFER_EOL_CRLF);
+		i = 0;
+		while ((expect = naive_search(data, len, "\n", 1, i)) >= 0) {
+			size_t want = 1;
+			if ((size_t)expect > i && data[expect - 1] == '\r') {
+				--expect;
+				want = 2;
+			}
+			tt_int_op(pos.pos, ==, expect);
+			tt_int_op(eol_len, ==, want);
+			i = expect + want;
+			evbuffer_ptr_set(buf, &pos, want, EVBUFFER_PTR_ADD);
+			pos = evbuffer_search_eol(buf, &pos, &eol_len,
+			    EVBUFFER_EOL_CRLF);
+		}
+		tt_int_op(pos.pos, ==, -1);
+
+		pos = evbuffer_search_eol(buf, NULL, &eol_len,
+		    EVBUFFER_EOL_ANY);
+		i = 0;
+		for (;;) {
+			while (i < len && data[i] != '\r' && data[i] != '\n')
+				++i;
+			if (i == len)
+				break;
+			tt_int_op(pos.pos, ==, i);
+			for (n = 0; i + n < len; ++n) {
+				if (data[i + n] != '\r' && data[i + n] != '\n')
+					break;
+			}
+			tt_int_op(eol_len, ==, n);
+			i += n;
+			evbuffer_ptr_set(buf, &pos, n, EVBUFFER_PTR_ADD);
+			pos = evbuffer_search_eol(buf, &pos, &eol_len,
+			    EVBUFFER_EOL_ANY);
+		}
+		tt_int_op(pos.pos, ==, -1);
+
+		evbuffer_free(buf);
+		buf = NULL;
+	}
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+	free(data);
+}
+
 static void
 log_change_callback(struct evbuffer *buffer,
     const struct evbuffer_cb_info *cbinfo,
@@ -2084,6 +2224,148 @@ end:
 		evbuffer_free(buf2);
 }
 
+struct zerocopy_reader {
+	struct evbuffer *dest;
+	size_t want;
+	struct event *ev;
+};
+
+static void
+zerocopy_read_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct zerocopy_reader *reader = arg;
+
+	evbuffer_read(reader->dest, fd, -1);
+	if (evbuffer_get_length(reader->dest) >= reader->want)
+		event_del(reader->ev);
+}
+
+static void
+test_evbuffer_zerocopy(void *ptr)
+{
+	struct basic_test_data *data = ptr;
+	struct evbuffer *src = NULL, *dest = NULL;
+	evutil_socket_t pair[2] = {-1, -1};
+	const size_t reflen = 512*1024, memlen = 100*1024;
+	char *refdata = NULL, *memdata = NULL;
+	struct zerocopy_reader reader = { NULL, 0, NULL };
+	int sndbuf = 1024*1024;
+	int i, n;
+
+	/* MSG_ZEROCOPY needs a real TCP socket. */
+	if (evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, pair) == -1)
+		tt_abort_msg("ersatz_socketpair failed");
+	evutil_make_socket_nonblocking(pair[0]);
+	evutil_make_socket_nonblocking(pair[1]);
+
+	refdata = malloc(reflen);
+	memdata = malloc(memlen);
+	tt_assert(refdata);
+	tt_assert(memdata);
+	for (i = 0; i < (int)reflen; ++i)
+		refdata[i] = (char)(i % 251);
+	for (i = 0; i < (int)memlen; ++i)
+		memdata[i] = (char)(i % 241);
+
+	src = evbuffer_new();
+	dest = evbuffer_new();
+	tt_assert(src);
+	tt_assert(dest);
+	/* Only a buffer with an event base makes zero-copy sends. */
+	tt_int_op(evbuffer_defer_callbacks(src, data->base), ==, 0);
+	tt_int_op(evbuffer_set_flags(src, EVBUFFER_FLAG_ZEROCOPY), ==, 0);
+
+	ref_done_cb_called_count = 0;
+	tt_int_op(evbuffer_add_reference(src, refdata, reflen, ref_done_cb,
+		    (void*)111), ==, 0);
+	tt_int_op(evbuffer_add(src, memdata, memlen), ==, 0);
+
+	for (i = 0; i < 10000 &&
+		 evbuffer_get_length(dest) < reflen + memlen; ++i) {
+		if (evbuffer_get_length(src)) {
+			n = evbuffer_write(src, pair[0]);
+			tt_assert(n >= 0 || EVUTIL_ERR_RW_RETRIABLE(errno));
+			evbuffer_validate(src);
+		}
+		n = evbuffer_read(dest, pair[1], -1);
+		tt_assert(n > 0 || EVUTIL_ERR_RW_RETRIABLE(errno));
+	}
+	tt_int_op(evbuffer_get_length(src), ==, 0);
+	tt_int_op(evbuffer_get_length(dest), ==, reflen + memlen);
+	tt_assert(!memcmp(evbuffer_pullup(dest, reflen), refdata, reflen));
+	tt_int_op(evbuffer_drain(dest, reflen), ==, 0);
+	tt_assert(!memcmp(evbuffer_pullup(dest, memlen), memdata, memlen));
+	tt_int_op(evbuffer_drain(dest, memlen), ==, 0);
+
+	/* Prepending must not scribble on anything still being sent. */
+	tt_int_op(evbuffer_prepend(src, "x", 1), ==, 0);
+	evbuffer_validate(src);
+
+	/* The reference is let go of exactly once, by the time the loop has
+	 * nothing left to wait for. */
+	tt_int_op(ref_done_cb_called_count, <=, 1);
+	evbuffer_free(src);
+	src = NULL;
+	event_base_dispatch(data->base);
+	tt_int_op(ref_done_cb_called_count, ==, 1);
+	tt_assert(ref_done_cb_called_with == (void*)111);
+
+	/* Now free a buffer while most of what it sent is still waiting for
+	 * the peer to make room.  The kernel is sending straight from the
+	 * reference, so we must hold on to it until the kernel is done. */
+	evutil_closesocket(pair[0]);
+	evutil_closesocket(pair[1]);
+	if (evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, pair) == -1)
+		tt_abort_msg("ersatz_socketpair failed");
+	evutil_make_socket_nonblocking(pair[0]);
+	evutil_make_socket_nonblocking(pair[1]);
+	setsockopt(pair[0], SOL_SOCKET, SO_SNDBUF, (void*)&sndbuf,
+	    sizeof(sndbuf));
+
+	src = evbuffer_new();
+	tt_assert(src);
+	tt_int_op(evbuffer_defer_callbacks(src, data->base), ==, 0);
+	tt_int_op(evbuffer_set_flags(src, EVBUFFER_FLAG_ZEROCOPY), ==, 0);
+	ref_done_cb_called_count = 0;
+	tt_int_op(evbuffer_add_reference(src, refdata, reflen, ref_done_cb,
+		    (void*)222), ==, 0);
+	n = evbuffer_write(src, pair[0]);
+	tt_int_op(n, >, 0);
+	evbuffer_free(src);
+	src = NULL;
+	tt_int_op(ref_done_cb_called_count, ==, 0);
+
+	/* The loop runs until we have read everything, and the kernel has
+	 * told the event base that it is done. */
+	reader.dest = dest;
+	reader.want = n;
+	reader.ev = event_new(data->base, pair[1], EV_READ|EV_PERSIST,
+	    zerocopy_read_cb, &reader);
+	tt_assert(reader.ev);
+	tt_int_op(event_add(reader.ev, NULL), ==, 0);
+	event_base_dispatch(data->base);
+	tt_int_op(evbuffer_get_length(dest), ==, n);
+	tt_assert(!memcmp(evbuffer_pullup(dest, n), refdata, n));
+	tt_int_op(ref_done_cb_called_count, ==, 1);
+	tt_assert(ref_done_cb_called_with == (void*)222);
+
+end:
+	if (reader.ev)
+		event_free(reader.ev);
+	if (src)
+		evbuffer_free(src);
+	if (dest)
+		evbuffer_free(dest);
+	if (pair[0] >= 0)
+		evutil_closesocket(pair[0]);
+	if (pair[1] >= 0)
+		evutil_closesocket(pair[1]);
+	if (refdata)
+		free(refdata);
+	if (memdata)
+		free(memdata);
+}
+
 static void
 test_evbuffer_multicast(void *ptr)
 {
@@ -2153,6 +2435,129 @@ end:
 		evbuffer_free(buf2);
 }
 
+static void
+test_evbuffer_chain_cache(void *ptr)
+{
+	struct event_base *base = NULL;
+	struct evbuffer *buf = NULL, *other = NULL;
+	struct evbuffer *bufs[6];
+	struct bufferevent *bev = NULL;
+	struct evbuffer_cache_stats st;
+	char data[3000];
+	int i;
+
+	memset(bufs, 0, sizeof(bufs));
+	memset(data, 'x', sizeof(data));
+	base = event_base_new();
+	buf = evbuffer_new();
+	tt_assert(base);
+	tt_assert(buf);
+
+	/* No cache until we ask for one. */
+	tt_int_op(event_base_get_evbuffer_cache_stats(base, &st), ==, -1);
+	tt_int_op(evbuffer_set_chain_cache(buf, base), ==, -1);
+	tt_int_op(event_base_set_evbuffer_cache(base, 16384, 0), ==, 0);
+	tt_int_op(evbuffer_set_chain_cache(buf, base), ==, 0);
+
+	/* A chain freed by a drain is reused by the next add. */
+	evbuffer_add(buf, data, 100);
+	evbuffer_drain(buf, 100);
+	evbuffer_add(buf, data, 100);
+	tt_int_op(event_base_get_evbuffer_cache_stats(base, &st), ==, 0);
+	tt_int_op(st.misses, ==, 1);
+	tt_int_op(st.stores, ==, 1);
+	tt_int_op(st.hits, ==, 1);
+	tt_int_op(st.n_chains, ==, 0);
+	evbuffer_drain(buf, 100);
+
+	/* Chains bigger than the largest size class bypass the cache. */
+	{
+		char *big = calloc(1, 100000);
+		tt_assert(big);
+		evbuffer_add(buf, big, 100000);
+		free(big);
+	}
+	evbuffer_drain(buf, 100000);
+	tt_int_op(event_base_get_evbuffer_cache_stats(base, &st), ==, 0);
+	tt_int_op(st.misses, ==, 1);
+	tt_int_op(st.stores, ==, 2);
+	tt_int_op(st.n_chains, ==, 1);
+
+	/* The cache holds no more than its limit. */
+	for (i = 0; i < 6; ++i) {
+		bufs[i] = evbuffer_new();
+		tt_assert(bufs[i]);
+		tt_int_op(evbuffer_set_chain_cache(bufs[i], base), ==, 0);
+		evbuffer_add(bufs[i], data, sizeof(data));
+	}
+	for (i = 0; i < 6; ++i) {
+		evbuffer_free(bufs[i]);
+		bufs[i] = NULL;
+	}
+	tt_int_op(event_base_get_evbuffer_cache_stats(base, &st), ==, 0);
+	tt_int_op(st.misses, ==, 7);
+	tt_int_op(st.stores, ==, 5);
+	tt_int_op(st.drops, ==, 3);
+	tt_int_op(st.n_bytes, <=, 16384);
+	tt_int_op(st.n_chains, ==, 4);
+
+	/* Lowering the limit releases memory. */
+	tt_int_op(event_base_set_evbuffer_cache(base, 4096, 0), ==, 0);
+	tt_int_op(event_base_get_evbuffer_cache_stats(base, &st), ==, 0);
+	tt_int_op(st.n_bytes, <=, 4096);
+
+	/* A chain moved to a buffer without the cache is freed as usual. */
+	other = evbuffer_new();
+	tt_assert(other);
+	evbuffer_add(buf, data, 100);
+	evbuffer_add_buffer(other, buf);
+	evbuffer_free(other);
+	other = NULL;
+	tt_int_op(event_base_get_evbuffer_cache_stats(base, &st), ==, 0);
+	tt_int_op(st.hits, ==, 2);
+	tt_int_op(st.stores, ==, 5);
+
+	/* Bufferevents made after the cache was set up use it. */
+	bev = bufferevent_socket_new(base, -1, 0);
+	tt_assert(bev);
+	bufferevent_write(bev, data, 100);
+	bufferevent_free(bev);
+	bev = NULL;
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(event_base_get_evbuffer_cache_stats(base, &st), ==, 0);
+	tt_int_op(st.stores, ==, 6);
+
+	/* Turning the cache off empties it. */
+	tt_int_op(event_base_set_evbuffer_cache(base, 0, 0), ==, 0);
+	tt_int_op(event_base_get_evbuffer_cache_stats(base, &st), ==, 0);
+	tt_int_op(st.n_chains, ==, 0);
+	evbuffer_add(buf, data, 100);
+	evbuffer_drain(buf, 100);
+	tt_int_op(event_base_get_evbuffer_cache_stats(base, &st), ==, 0);
+	tt_int_op(st.n_chains, ==, 0);
+
+	/* The cache lasts as long as any evbuffer that uses it. */
+	tt_int_op(event_base_set_evbuffer_cache(base, 16384, 0), ==, 0);
+	event_base_free(base);
+	base = NULL;
+	evbuffer_add(buf, data, 100);
+	evbuffer_drain(buf, 100);
+
+end:
+	for (i = 0; i < 6; ++i) {
+		if (bufs[i])
+			evbuffer_free(bufs[i]);
+	}
+	if (bev)
+		bufferevent_free(bev);
+	if (other)
+		evbuffer_free(other);
+	if (buf)
+		evbuffer_free(buf);
+	if (base)
+		event_base_free(base);
+}
+
 static void
 test_evbuffer_multicast_drain(void *ptr)
 {
@@ -2739,10 +3144,14 @@ struct testcase_t evbuffer_testcases[] = {
 	{ "find", test_evbuffer_find, 0, NULL, NULL },
 	{ "ptr_set", test_evbuffer_ptr_set, 0, NULL, NULL },
 	{ "search", test_evbuffer_search, 0, NULL, NULL },
+	{ "search_long", test_evbuffer_search_long, 0, NULL, NULL },
 	{ "callbacks", test_evbuffer_callbacks, 0, NULL, NULL },
 	{ "add_reference", test_evbuffer_add_reference, 0, NULL, NULL },
+	{ "zerocopy", test_evbuffer_zerocopy, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, NULL },
 	{ "multicast", test_evbuffer_multicast, 0, NULL, NULL },
 	{ "multicast_drain", test_evbuffer_multicast_drain, 0, NULL, NULL },
+	{ "chain_cache", test_evbuffer_chain_cache, TT_FORK, NULL, NULL },
 	{ "prepend", test_evbuffer_prepend, TT_FORK, NULL, NULL },
 	{ "empty_reference_prepend", test_evbuffer_empty_reference_prepend, TT_FORK, NULL, NULL },
 	{ "empty_reference_prepend_buffer", test_evbuffer_empty_reference_prepend_buffer, TT_FORK, NULL, NULL },
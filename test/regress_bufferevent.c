@@ -1326,6 +1326,385 @@ end:
 		bufferevent_free(filter);
 }
 
+struct uring_echo_state {
+	struct event_base *base;
+	struct evbuffer *got;
+	size_t expected;
+};
+
+static void
+uring_echo_readcb(struct bufferevent *bev, void *ctx)
+{
+	struct uring_echo_state *st = ctx;
+
+	evbuffer_add_buffer(st->got, bufferevent_get_input(bev));
+	if (evbuffer_get_length(st->got) >= st->expected)
+		event_base_loopexit(st->base, NULL);
+}
+
+static void
+test_bufferevent_uring(void *arg)
+{
+	struct event_config *cfg = NULL;
+	struct event_base *base = NULL;
+	struct bufferevent *bev1 = NULL, *bev2 = NULL, *bev3 = NULL;
+	struct evconnlistener *lev = NULL;
+	struct uring_echo_state st;
+	struct sockaddr_in localhost;
+	struct sockaddr_storage ss;
+	struct sockaddr *sa;
+	ev_socklen_t slen;
+	evutil_socket_t pair[2] = { -1, -1 };
+	char *payload = NULL;
+	size_t i, payload_size = 256 * 1024;
+
+	memset(&st, 0, sizeof(st));
+
+	cfg = event_config_new();
+	tt_assert(cfg);
+	event_config_avoid_method(cfg, "epoll");
+	event_config_avoid_method(cfg, "poll");
+	event_config_avoid_method(cfg, "select");
+	base = event_base_new_with_config(cfg);
+	if (!base || strcmp(event_base_get_method(base), "io_uring")) {
+		tt_skip();
+	}
+
+	tt_assert(evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+
+	/* Send more data than a single read or write can move. */
+	bev1 = bufferevent_uring_new(base, pair[0], BEV_OPT_CLOSE_ON_FREE);
+	bev2 = bufferevent_uring_new(base, pair[1], BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(bev1);
+	tt_assert(bev2);
+	pair[0] = pair[1] = -1;
+
+	payload = malloc(payload_size);
+	tt_assert(payload);
+	for (i = 0; i < payload_size; ++i)
+		payload[i] = (char)(i * 7);
+
+	st.base = base;
+	st.got = evbuffer_new();
+	st.expected = payload_size;
+	bufferevent_setcb(bev2, uring_echo_readcb, NULL, NULL, &st);
+	tt_assert(!bufferevent_enable(bev1, EV_WRITE));
+	tt_assert(!bufferevent_enable(bev2, EV_READ));
+	tt_assert(!bufferevent_write(bev1, payload, payload_size));
+
+	event_base_dispatch(base);
+
+	tt_int_op(evbuffer_get_length(st.got), ==, payload_size);
+	tt_assert(!memcmp(evbuffer_pullup(st.got, -1), payload, payload_size));
+
+	/* Now connect to a listener, which sends TEST_STR and closes. */
+	bufferevent_connect_test_flags = BEV_OPT_CLOSE_ON_FREE;
+	n_strings_read = 1;
+	memset(&localhost, 0, sizeof(localhost));
+	localhost.sin_port = 0; /* pick-a-port */
+	localhost.sin_addr.s_addr = htonl(0x7f000001L);
+	localhost.sin_family = AF_INET;
+	sa = (struct sockaddr *)&localhost;
+	lev = evconnlistener_new_bind(base, listen_cb, base,
+	    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE,
+	    16, sa, sizeof(localhost));
+	tt_assert(lev);
+
+	sa = (struct sockaddr *)&ss;
+	slen = sizeof(ss);
+	if (regress_get_listener_addr(lev, sa, &slen) < 0) {
+		tt_abort_perror("getsockname");
+	}
+
+	bev3 = bufferevent_uring_new(base, -1, BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(bev3);
+	bufferevent_setcb(bev3, reader_readcb, NULL, reader_eventcb, base);
+	tt_want(!bufferevent_socket_connect(bev3, sa, slen));
+
+	event_base_dispatch(base);
+
+	tt_int_op(n_strings_read, ==, 2);
+
+end:
+	if (lev)
+		evconnlistener_free(lev);
+	if (bev1)
+		bufferevent_free(bev1);
+	if (bev2)
+		bufferevent_free(bev2);
+	if (bev3)
+		bufferevent_free(bev3);
+	if (pair[0] >= 0)
+		evutil_closesocket(pair[0]);
+	if (pair[1] >= 0)
+		evutil_closesocket(pair[1]);
+	if (st.got)
+		evbuffer_free(st.got);
+	if (payload)
+		free(payload);
+	if (base)
+		event_base_free(base);
+	if (cfg)
+		event_config_free(cfg);
+}
+
+struct relay_end {
+	struct event_base *base;
+	struct evbuffer *got;
+	int eof;
+	int *n_done;
+};
+
+static void
+relay_end_readcb(struct bufferevent *bev, void *arg)
+{
+	struct relay_end *e = arg;
+	evbuffer_add_buffer(e->got, bufferevent_get_input(bev));
+}
+
+static void
+relay_end_writecb(struct bufferevent *bev, void *arg)
+{
+	/* Everything is sent: tell the other end that's all. */
+	if (bufferevent_getfd(bev) != EVUTIL_INVALID_SOCKET)
+		shutdown(bufferevent_getfd(bev), EVUTIL_SHUT_WR);
+	else
+		bufferevent_flush(bev, EV_WRITE, BEV_FINISHED);
+	bufferevent_disable(bev, EV_WRITE);
+}
+
+static void
+relay_end_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct relay_end *e = arg;
+	if (what & BEV_EVENT_EOF) {
+		evbuffer_add_buffer(e->got, bufferevent_get_input(bev));
+		e->eof = 1;
+		if (++*e->n_done == 2)
+			event_base_loopexit(e->base, NULL);
+	} else {
+		TT_FAIL(("Unexpected event %d on a relayed connection", what));
+	}
+}
+
+static void
+relay_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	int *relay_done = arg;
+	tt_int_op(what, ==, BEV_EVENT_EOF);
+	++*relay_done;
+end:
+	;
+}
+
+static void
+test_bufferevent_relay(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *ends[2] = { NULL, NULL };
+	struct bufferevent *mid[2] = { NULL, NULL };
+	struct bufferevent_relay *relay = NULL;
+	struct relay_end st[2];
+	evutil_socket_t p1[2] = { -1, -1 }, p2[2] = { -1, -1 };
+	char *payload[2] = { NULL, NULL };
+	size_t payload_size[2] = { 300 * 1024, 70 * 1024 };
+	int use_pair = strstr((char*)data->setup_data, "pair") != NULL;
+	int n_done = 0, relay_done = 0;
+	size_t i;
+	int j;
+
+	memset(st, 0, sizeof(st));
+
+	if (evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, p1) == -1)
+		tt_abort_msg("ersatz_socketpair failed");
+	tt_assert(!evutil_make_socket_nonblocking(p1[0]));
+	tt_assert(!evutil_make_socket_nonblocking(p1[1]));
+	ends[0] = bufferevent_socket_new(data->base, p1[0], BEV_OPT_CLOSE_ON_FREE);
+	mid[0] = bufferevent_socket_new(data->base, p1[1], BEV_OPT_CLOSE_ON_FREE);
+	p1[0] = p1[1] = -1;
+	if (use_pair) {
+		/* A pair can't splice: this uses the buffers. */
+		struct bufferevent *pair[2];
+		tt_assert(!bufferevent_pair_new(data->base, 0, pair));
+		mid[1] = pair[0];
+		ends[1] = pair[1];
+	} else {
+		if (evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, p2) == -1)
+			tt_abort_msg("ersatz_socketpair failed");
+		tt_assert(!evutil_make_socket_nonblocking(p2[0]));
+		tt_assert(!evutil_make_socket_nonblocking(p2[1]));
+		mid[1] = bufferevent_socket_new(data->base, p2[0],
+		    BEV_OPT_CLOSE_ON_FREE);
+		ends[1] = bufferevent_socket_new(data->base, p2[1],
+		    BEV_OPT_CLOSE_ON_FREE);
+		p2[0] = p2[1] = -1;
+	}
+	tt_assert(ends[0] && ends[1] && mid[0] && mid[1]);
+
+	/* Make the relay stop and start reading a lot. */
+	bufferevent_setwatermark(mid[0], EV_READ, 0, 4096);
+	bufferevent_setwatermark(mid[1], EV_READ, 0, 4096);
+
+	relay = bufferevent_relay_new(mid[0], mid[1], relay_eventcb, &relay_done);
+	tt_assert(relay);
+#if defined(EVENT__HAVE_SPLICE) && defined(EVENT__HAVE_PIPE2)
+	tt_int_op(BEV_UPCAST(mid[0])->relay != NULL, ==, !use_pair);
+#endif
+
+	for (j = 0; j < 2; ++j) {
+		payload[j] = malloc(payload_size[j]);
+		tt_assert(payload[j]);
+		for (i = 0; i < payload_size[j]; ++i)
+			payload[j][i] = (char)(i * (j ? 13 : 7));
+		st[j].base = data->base;
+		st[j].got = evbuffer_new();
+		st[j].n_done = &n_done;
+		tt_assert(st[j].got);
+		bufferevent_setcb(ends[j], relay_end_readcb, relay_end_writecb,
+		    relay_end_eventcb, &st[j]);
+		tt_assert(!bufferevent_enable(ends[j], EV_READ|EV_WRITE));
+		tt_assert(!bufferevent_write(ends[j], payload[j],
+			payload_size[j]));
+	}
+
+	/* The relay reports EOF as it shuts down the second end. */
+	event_base_dispatch(data->base);
+
+	tt_assert(st[0].eof);
+	tt_assert(st[1].eof);
+	tt_int_op(relay_done, ==, 1);
+	for (j = 0; j < 2; ++j) {
+		struct evbuffer *got = st[1 - j].got;
+		tt_int_op(evbuffer_get_length(got), ==, payload_size[j]);
+		tt_assert(!memcmp(evbuffer_pullup(got, -1), payload[j],
+			payload_size[j]));
+	}
+
+end:
+	if (relay)
+		bufferevent_relay_free(relay);
+	for (j = 0; j < 2; ++j) {
+		if (ends[j])
+			bufferevent_free(ends[j]);
+		if (mid[j])
+			bufferevent_free(mid[j]);
+		if (st[j].got)
+			evbuffer_free(st[j].got);
+		if (payload[j])
+			free(payload[j]);
+	}
+	if (p1[0] >= 0)
+		evutil_closesocket(p1[0]);
+	if (p1[1] >= 0)
+		evutil_closesocket(p1[1]);
+	if (p2[0] >= 0)
+		evutil_closesocket(p2[0]);
+	if (p2[1] >= 0)
+		evutil_closesocket(p2[1]);
+}
+
+struct shared_read_conn {
+	struct bufferevent *bev;
+	evutil_socket_t fd;
+	struct evbuffer *saved;
+	int mode;
+	int n_reads;
+};
+
+static void
+shared_read_readcb(struct bufferevent *bev, void *arg)
+{
+	struct shared_read_conn *c = arg;
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	++c->n_reads;
+	switch (c->mode) {
+	case 0:
+		/* Take a copy and empty the input. */
+		evbuffer_remove_buffer(input, c->saved,
+		    evbuffer_get_length(input));
+		break;
+	case 1:
+		/* Leave everything in the input. */
+		break;
+	case 2:
+		/* Move the chains themselves elsewhere. */
+		evbuffer_add_buffer(c->saved, input);
+		break;
+	}
+}
+
+static void
+test_bufferevent_shared_read(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct shared_read_conn c[4];
+	static const char *round[2] = { "first round ", "second round" };
+	char expect[64];
+	int i, r, n;
+
+	memset(c, 0, sizeof(c));
+	for (i = 0; i < 4; ++i)
+		c[i].fd = EVUTIL_INVALID_SOCKET;
+
+	for (i = 0; i < 4; ++i) {
+		evutil_socket_t pair[2];
+		tt_assert(evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+		tt_assert(!evutil_make_socket_nonblocking(pair[0]));
+		c[i].fd = pair[1];
+		c[i].mode = i < 3 ? i : 1;
+		c[i].saved = evbuffer_new();
+		tt_assert(c[i].saved);
+		c[i].bev = bufferevent_socket_new(data->base, pair[0],
+		    BEV_OPT_CLOSE_ON_FREE|BEV_OPT_SHARED_READ_BUFFER);
+		tt_assert(c[i].bev);
+		bufferevent_setcb(c[i].bev, shared_read_readcb, NULL, NULL,
+		    &c[i]);
+		tt_assert(!bufferevent_enable(c[i].bev, EV_READ));
+	}
+	/* The last one never gets enough to call its callback. */
+	bufferevent_setwatermark(c[3].bev, EV_READ, 1000, 0);
+
+	/* Each round reads into the same shared memory, which must not
+	 * show through in what an earlier round left behind. */
+	for (r = 0; r < 2; ++r) {
+		for (i = 0; i < 4; ++i)
+			tt_int_op(send(c[i].fd, round[r], strlen(round[r]), 0),
+			    ==, (int)strlen(round[r]));
+		for (n = 0; n < 100; ++n) {
+			event_base_loop(data->base, EVLOOP_NONBLOCK);
+			if (c[0].n_reads > r && c[1].n_reads > r &&
+			    c[2].n_reads > r &&
+			    evbuffer_get_length(bufferevent_get_input(
+				c[3].bev)) == strlen(round[0]) * (r + 1))
+				break;
+		}
+		tt_int_op(n, <, 100);
+	}
+
+	evutil_snprintf(expect, sizeof(expect), "%s%s", round[0], round[1]);
+	tt_int_op(c[3].n_reads, ==, 0);
+	for (i = 0; i < 4; ++i) {
+		struct evbuffer *got = c[i].mode == 1 ?
+		    bufferevent_get_input(c[i].bev) : c[i].saved;
+		tt_int_op(evbuffer_get_length(got), ==, strlen(expect));
+		tt_assert(!memcmp(evbuffer_pullup(got, -1), expect,
+			strlen(expect)));
+	}
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(c[0].bev)), ==, 0);
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(c[2].bev)), ==, 0);
+
+end:
+	for (i = 0; i < 4; ++i) {
+		if (c[i].bev)
+			bufferevent_free(c[i].bev);
+		if (c[i].saved)
+			evbuffer_free(c[i].saved);
+		if (c[i].fd != EVUTIL_INVALID_SOCKET)
+			evutil_closesocket(c[i].fd);
+	}
+}
+
 struct testcase_t bufferevent_testcases[] = {
 
 	LEGACY(bufferevent, TT_ISOLATED),
@@ -1401,6 +1780,13 @@ struct testcase_t bufferevent_testcases[] = {
 	{ "bufferevent_filter_data_stuck",
 	  test_bufferevent_filter_data_stuck,
 	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_uring", test_bufferevent_uring, TT_FORK, NULL, NULL },
+	{ "bufferevent_relay", test_bufferevent_relay,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"" },
+	{ "bufferevent_relay_pair", test_bufferevent_relay,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"pair" },
+	{ "bufferevent_shared_read", test_bufferevent_shared_read,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
 
 	END_OF_TESTCASES,
 };
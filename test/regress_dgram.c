@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util-internal.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#endif
+
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+# ifdef _XOPEN_SOURCE_EXTENDED
+#  include <arpa/inet.h>
+# endif
+#include <unistd.h>
+#endif
+
+#include <string.h>
+
+#include "event2/dgram.h"
+#include "event2/event.h"
+#include "event2/util.h"
+
+#include "regress.h"
+#include "tinytest.h"
+#include "tinytest_macros.h"
+
+#define N_DGRAMS 100
+#define DGRAM_LEN 100
+
+/* Bind a UDP socket to a port of its choosing on 127.0.0.1, and say which
+ * in sin. */
+static evutil_socket_t
+bind_udp(struct sockaddr_in *sin)
+{
+	evutil_socket_t fd;
+	ev_socklen_t slen = sizeof(*sin);
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == EVUTIL_INVALID_SOCKET)
+		return fd;
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0x7f000001);
+	if (bind(fd, (struct sockaddr *)sin, sizeof(*sin)) < 0 ||
+	    getsockname(fd, (struct sockaddr *)sin, &slen) < 0) {
+		evutil_closesocket(fd);
+		return EVUTIL_INVALID_SOCKET;
+	}
+	return fd;
+}
+
+struct dgram_echo {
+	struct event_base *base;
+	int n_batches;
+	int max_batch;
+	int n_msgs;
+	int n_bad;
+	int n_failed;
+	size_t pending_in_cb;
+	unsigned char seen[N_DGRAMS];
+};
+
+static void
+echo_readcb(struct evdgram *dg, struct evdgram_msg *msgs, int n_msgs,
+    void *arg)
+{
+	struct dgram_echo *e = arg;
+	int i;
+
+	++e->n_batches;
+	if (n_msgs > e->max_batch)
+		e->max_batch = n_msgs;
+	for (i = 0; i < n_msgs; ++i) {
+		if (evdgram_send(dg, msgs[i].data, msgs[i].len, msgs[i].addr,
+			msgs[i].addrlen) < 0)
+			++e->n_failed;
+	}
+	/* Nothing goes out until we return. */
+	e->pending_in_cb = evdgram_get_pending(dg);
+}
+
+static void
+client_readcb(struct evdgram *dg, struct evdgram_msg *msgs, int n_msgs,
+    void *arg)
+{
+	struct dgram_echo *e = arg;
+	unsigned char *p;
+	int i, j;
+
+	for (i = 0; i < n_msgs; ++i) {
+		p = msgs[i].data;
+		if (msgs[i].len != DGRAM_LEN || p[0] >= N_DGRAMS ||
+		    e->seen[p[0]]) {
+			++e->n_bad;
+			continue;
+		}
+		for (j = 1; j < DGRAM_LEN; ++j)
+			if (p[j] != (unsigned char)(p[0] + j))
+				break;
+		if (j < DGRAM_LEN) {
+			++e->n_bad;
+			continue;
+		}
+		e->seen[p[0]] = 1;
+		if (++e->n_msgs == N_DGRAMS)
+			event_base_loopexit(e->base, NULL);
+	}
+}
+
+static void
+test_dgram_echo(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evdgram *server = NULL, *client = NULL;
+	struct sockaddr_in server_sin, client_sin;
+	evutil_socket_t server_fd, client_fd = EVUTIL_INVALID_SOCKET;
+	struct dgram_echo srv, cli;
+	struct timeval tv = { 10, 0 };
+	unsigned char buf[DGRAM_LEN];
+	unsigned flags = EVDGRAM_OPT_CLOSE_ON_FREE;
+	int i, j;
+
+	if (data->setup_data && strstr((char*)data->setup_data, "ts"))
+		flags |= EVDGRAM_OPT_THREADSAFE;
+	if (data->setup_data && strstr((char*)data->setup_data, "gso"))
+		flags |= EVDGRAM_OPT_GSO|EVDGRAM_OPT_GRO;
+
+	memset(&srv, 0, sizeof(srv));
+	memset(&cli, 0, sizeof(cli));
+	srv.base = cli.base = data->base;
+
+	server_fd = bind_udp(&server_sin);
+	tt_assert(server_fd != EVUTIL_INVALID_SOCKET);
+	server = evdgram_new(data->base, server_fd, flags, echo_readcb, NULL,
+	    &srv);
+	tt_assert(server);
+	tt_int_op(evdgram_get_fd(server), ==, server_fd);
+	tt_ptr_op(evdgram_get_base(server), ==, data->base);
+
+	client_fd = bind_udp(&client_sin);
+	tt_assert(client_fd != EVUTIL_INVALID_SOCKET);
+	client = evdgram_new(data->base, client_fd, flags, client_readcb, NULL,
+	    &cli);
+	tt_assert(client);
+	client_fd = EVUTIL_INVALID_SOCKET;
+
+	/* Everything is waiting before the server first reads, so that it
+	 * gets the datagrams in batches. */
+	for (i = 0; i < N_DGRAMS; ++i) {
+		for (j = 0; j < DGRAM_LEN; ++j)
+			buf[j] = (unsigned char)(i + j);
+		tt_int_op(evdgram_send(client, buf, sizeof(buf),
+			(struct sockaddr *)&server_sin, sizeof(server_sin)),
+		    ==, 0);
+	}
+
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+
+	tt_int_op(cli.n_msgs, ==, N_DGRAMS);
+	tt_int_op(cli.n_bad, ==, 0);
+	tt_int_op(srv.n_failed, ==, 0);
+	tt_int_op(srv.max_batch, >, 1);
+	tt_int_op(srv.n_batches, <, N_DGRAMS);
+	tt_int_op(srv.pending_in_cb, >, 0);
+	tt_int_op(evdgram_get_pending(server), ==, 0);
+
+end:
+	if (server)
+		evdgram_free(server);
+	if (client)
+		evdgram_free(client);
+	if (client_fd != EVUTIL_INVALID_SOCKET)
+		evutil_closesocket(client_fd);
+}
+
+static void
+test_dgram_queue(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evdgram *dg = NULL;
+	struct sockaddr_in sin, to;
+	evutil_socket_t fd;
+	char buf[1000];
+
+	memset(buf, 'x', sizeof(buf));
+	fd = bind_udp(&sin);
+	tt_assert(fd != EVUTIL_INVALID_SOCKET);
+	dg = evdgram_new(data->base, fd,
+	    EVDGRAM_OPT_CLOSE_ON_FREE|EVDGRAM_OPT_DISABLED, NULL, NULL, NULL);
+	tt_assert(dg);
+
+	tt_int_op(evdgram_set_batch(dg, 0, 100), ==, -1);
+	tt_int_op(evdgram_set_batch(dg, 10, 0), ==, -1);
+	tt_int_op(evdgram_set_batch(dg, 4, 512), ==, 0);
+
+	/* Sending to ourself works straight away. */
+	tt_int_op(evdgram_send(dg, buf, 10, (struct sockaddr *)&sin,
+		sizeof(sin)), ==, 0);
+	tt_int_op(evdgram_get_pending(dg), ==, 0);
+	tt_int_op(evdgram_flush(dg), ==, 0);
+
+	/* An address too long for anything is refused. */
+	memset(&to, 0, sizeof(to));
+	tt_int_op(evdgram_send(dg, buf, 10, (struct sockaddr *)&to, 1000),
+	    ==, -1);
+
+	/* With nothing queued, a datagram goes straight out, whatever the
+	 * limit on the queue. */
+	evdgram_set_max_pending(dg, 0);
+	tt_int_op(evdgram_send(dg, buf, sizeof(buf), (struct sockaddr *)&sin,
+		sizeof(sin)), ==, 0);
+
+end:
+	if (dg)
+		evdgram_free(dg);
+}
+
+struct dgram_free_state {
+	struct event_base *base;
+	struct evdgram *dg;
+	int n_calls;
+};
+
+static void
+free_readcb(struct evdgram *dg, struct evdgram_msg *msgs, int n_msgs,
+    void *arg)
+{
+	struct dgram_free_state *st = arg;
+
+	++st->n_calls;
+	/* Queue a reply, then free the evdgram with it still queued. */
+	evdgram_send(dg, msgs[0].data, msgs[0].len, msgs[0].addr,
+	    msgs[0].addrlen);
+	evdgram_free(dg);
+	st->dg = NULL;
+	event_base_loopexit(st->base, NULL);
+}
+
+static void
+test_dgram_free_in_cb(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct dgram_free_state st;
+	struct sockaddr_in sin, csin;
+	evutil_socket_t fd, cfd = EVUTIL_INVALID_SOCKET;
+	struct timeval tv = { 5, 0 };
+	char buf[16];
+	int i;
+
+	memset(&st, 0, sizeof(st));
+	st.base = data->base;
+	fd = bind_udp(&sin);
+	tt_assert(fd != EVUTIL_INVALID_SOCKET);
+	st.dg = evdgram_new(data->base, fd, EVDGRAM_OPT_CLOSE_ON_FREE,
+	    free_readcb, NULL, &st);
+	tt_assert(st.dg);
+
+	cfd = bind_udp(&csin);
+	tt_assert(cfd != EVUTIL_INVALID_SOCKET);
+	for (i = 0; i < 3; ++i)
+		tt_int_op(sendto(cfd, "hello", 5, 0, (struct sockaddr *)&sin,
+			sizeof(sin)), ==, 5);
+
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+	tt_int_op(st.n_calls, ==, 1);
+	tt_ptr_op(st.dg, ==, NULL);
+
+	/* The reply queued before the free was still sent. */
+	tt_int_op(recv(cfd, buf, sizeof(buf), 0), ==, 5);
+	tt_assert(!memcmp(buf, "hello", 5));
+
+end:
+	if (st.dg)
+		evdgram_free(st.dg);
+	if (cfd != EVUTIL_INVALID_SOCKET)
+		evutil_closesocket(cfd);
+}
+
+struct testcase_t dgram_testcases[] = {
+	{ "echo", test_dgram_echo, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, NULL },
+	{ "echo_ts", test_dgram_echo, TT_FORK|TT_NEED_BASE|TT_NEED_THREADS,
+	  &basic_setup, (char*)"ts" },
+	{ "echo_gso", test_dgram_echo, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, (char*)"gso" },
+	{ "queue", test_dgram_queue, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, NULL },
+	{ "free_in_cb", test_dgram_free_in_cb, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, NULL },
+
+	END_OF_TESTCASES,
+};
@@ -619,6 +619,160 @@ end:
 	if (dns)
 		evdns_base_free(dns, 0);
 }
+static struct regress_dns_server_table cache_table[] = {
+	{ "host.b.example.com", "errsoa", "3", 0, 0 },
+	{ "host.a.example.com", "A", "11.22.33.44", 0, 0 },
+	{ "nodata.example.com", "errsoa", "0", 0, 0 },
+	{ "nosoa.example.com", "err", "3", 0, 0 },
+	{ NULL, NULL, NULL, 0, 0 }
+};
+static void
+dns_cache_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *base = data->base;
+	struct evdns_base *dns = NULL;
+	ev_uint16_t portnum = 0;
+	char buf[64];
+	struct generic_dns_callback_result r[3];
+	int round;
+
+	tt_assert(regress_dnsserver(base, &portnum, cache_table));
+	evutil_snprintf(buf, sizeof(buf), "127.0.0.1:%d", (int)portnum);
+
+	dns = evdns_base_new(base, 0);
+	tt_assert(!evdns_base_nameserver_ip_add(dns, buf));
+	tt_assert(!evdns_base_set_option(dns, "cache-size:", "16"));
+	evdns_base_search_add(dns, "a.example.com");
+	evdns_base_search_add(dns, "b.example.com");
+	exit_base = base;
+
+	for (round = 0; round < 3; ++round) {
+		if (round == 2)
+			tt_assert(!evdns_base_set_option(dns, "cache-size:", "0"));
+
+		memset(r, 0, sizeof(r));
+		n_replies_left = ARRAY_SIZE(r);
+		evdns_base_resolve_ipv4(dns, "host", 0,
+		    generic_dns_callback, &r[0]);
+		evdns_base_resolve_ipv4(dns, "nodata.example.com",
+		    DNS_NO_SEARCH, generic_dns_callback, &r[1]);
+		evdns_base_resolve_ipv4(dns, "nosoa.example.com",
+		    DNS_NO_SEARCH, generic_dns_callback, &r[2]);
+		event_base_dispatch(base);
+
+		/* The most recently added search domain goes first, so the
+		 * search goes through the cached NXDOMAIN for
+		 * host.b.example.com to the cached answer for
+		 * host.a.example.com. */
+		tt_int_op(r[0].result, ==, DNS_ERR_NONE);
+		tt_int_op(r[0].type, ==, DNS_IPv4_A);
+		tt_int_op(r[0].count, ==, 1);
+		tt_int_op(((ev_uint32_t*)r[0].addrs)[0], ==, htonl(0x0b16212c));
+		tt_int_op(r[0].ttl, >, 0);
+		tt_int_op(r[0].ttl, <=, 100);
+		tt_int_op(r[1].result, ==, DNS_ERR_NODATA);
+		tt_int_op(r[1].ttl, >, 0);
+		tt_int_op(r[1].ttl, <=, 42);
+		tt_int_op(r[2].result, ==, DNS_ERR_NOTEXIST);
+
+		/* Only the first round, and the one with the cache turned
+		 * off, should have asked the server anything.  Without an
+		 * SOA record, an NXDOMAIN isn't cached. */
+		tt_int_op(cache_table[0].seen, ==, (round < 2 ? 1 : 2));
+		tt_int_op(cache_table[1].seen, ==, (round < 2 ? 1 : 2));
+		tt_int_op(cache_table[2].seen, ==, (round < 2 ? 1 : 2));
+		tt_int_op(cache_table[3].seen, ==, round + 1);
+	}
+
+end:
+	if (dns)
+		evdns_base_free(dns, 0);
+
+	regress_clean_dnsserver();
+}
+
+static struct regress_dns_server_table coalesce_table[] = {
+	{ "host.a.example.com", "A", "11.22.33.44", 0, 0 },
+	{ "gone.example.com", "err", "3", 0, 0 },
+	{ NULL, NULL, NULL, 0, 0 }
+};
+static void
+dns_coalesce_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *base = data->base;
+	struct evdns_base *dns = NULL;
+	struct evdns_request *req;
+	ev_uint16_t portnum = 0;
+	char buf[64];
+	struct generic_dns_callback_result r[6];
+	int i;
+
+	tt_assert(regress_dnsserver(base, &portnum, coalesce_table));
+	evutil_snprintf(buf, sizeof(buf), "127.0.0.1:%d", (int)portnum);
+
+	dns = evdns_base_new(base, 0);
+	tt_assert(!evdns_base_nameserver_ip_add(dns, buf));
+	evdns_base_search_add(dns, "a.example.com");
+	exit_base = base;
+
+	/* Everything asking about host.a.example.com, whatever the case and
+	 * whether or not it got there by searching, waits on the first
+	 * request; so does everything asking about gone.example.com. */
+	memset(r, 0, sizeof(r));
+	n_replies_left = ARRAY_SIZE(r);
+	evdns_base_resolve_ipv4(dns, "host.a.example.com", DNS_NO_SEARCH,
+	    generic_dns_callback, &r[0]);
+	evdns_base_resolve_ipv4(dns, "HOST.A.example.com", DNS_NO_SEARCH,
+	    generic_dns_callback, &r[1]);
+	evdns_base_resolve_ipv4(dns, "host", 0, generic_dns_callback, &r[2]);
+	req = evdns_base_resolve_ipv4(dns, "host.a.example.com",
+	    DNS_NO_SEARCH, generic_dns_callback, &r[3]);
+	evdns_base_resolve_ipv4(dns, "gone.example.com", DNS_NO_SEARCH,
+	    generic_dns_callback, &r[4]);
+	evdns_base_resolve_ipv4(dns, "gone.example.com", DNS_NO_SEARCH,
+	    generic_dns_callback, &r[5]);
+	evdns_cancel_request(dns, req);
+	event_base_dispatch(base);
+
+	for (i = 0; i < 3; ++i) {
+		tt_int_op(r[i].result, ==, DNS_ERR_NONE);
+		tt_int_op(r[i].type, ==, DNS_IPv4_A);
+		tt_int_op(r[i].count, ==, 1);
+		tt_int_op(((ev_uint32_t*)r[i].addrs)[0], ==, htonl(0x0b16212c));
+	}
+	tt_int_op(r[3].result, ==, DNS_ERR_CANCEL);
+	tt_int_op(r[4].result, ==, DNS_ERR_NOTEXIST);
+	tt_int_op(r[5].result, ==, DNS_ERR_NOTEXIST);
+	tt_int_op(coalesce_table[0].seen, ==, 1);
+	tt_int_op(coalesce_table[1].seen, ==, 1);
+
+	/* If the request everyone is waiting on is cancelled, one of the
+	 * others has to ask again. */
+	memset(r, 0, sizeof(r));
+	n_replies_left = 3;
+	req = evdns_base_resolve_ipv4(dns, "host.a.example.com",
+	    DNS_NO_SEARCH, generic_dns_callback, &r[0]);
+	evdns_base_resolve_ipv4(dns, "host.a.example.com", DNS_NO_SEARCH,
+	    generic_dns_callback, &r[1]);
+	evdns_base_resolve_ipv4(dns, "host.a.example.com", DNS_NO_SEARCH,
+	    generic_dns_callback, &r[2]);
+	evdns_cancel_request(dns, req);
+	event_base_dispatch(base);
+
+	tt_int_op(r[0].result, ==, DNS_ERR_CANCEL);
+	tt_int_op(r[1].result, ==, DNS_ERR_NONE);
+	tt_int_op(r[2].result, ==, DNS_ERR_NONE);
+	tt_int_op(((ev_uint32_t*)r[2].addrs)[0], ==, htonl(0x0b16212c));
+
+end:
+	if (dns)
+		evdns_base_free(dns, 0);
+
+	regress_clean_dnsserver();
+}
+
 static void dns_search_test(void *arg) { dns_search_test_impl(arg, 0); }
 static void dns_search_lower_test(void *arg) { dns_search_test_impl(arg, 1); }
 
@@ -1879,6 +2033,8 @@ gaic_getaddrinfo_cb(int result, struct evutil_addrinfo *res, void *arg)
 		tt_assert(status->canceled);
 	}
 	event_del(&status->cancel_event);
+	if (res)
+		evutil_freeaddrinfo(res);
 
 	memset(status, 0xf0, sizeof(*status));
 	free(status);
@@ -2221,6 +2377,112 @@ end:
 	evdns_close_server_port(dns_port);
 }
 
+#if defined(__linux__) && defined(SO_REUSEPORT)
+#define REUSEPORT_N_CLIENTS 16
+#define REUSEPORT_N_QUERIES 4
+
+static void
+reuseport_server_cb(struct evdns_server_request *req, void *arg)
+{
+	int *n_served = arg;
+	ev_uint32_t addr = htonl(0x7f000001);
+
+	++*n_served;
+	evdns_server_request_add_a_reply(req, req->questions[0]->name, 1,
+	    &addr, 10);
+	evdns_server_request_respond(req, 0);
+}
+
+static void
+reuseport_client_cb(int result, char type, int count, int ttl,
+    void *addresses, void *arg)
+{
+	int *n_answered = arg;
+	if (result == DNS_ERR_NONE && type == DNS_IPv4_A && count == 1)
+		++*n_answered;
+}
+
+static void
+dns_server_reuseport_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *server_base[2] = { NULL, NULL };
+	struct evdns_server_port *port[2] = { NULL, NULL };
+	struct evdns_base *client[REUSEPORT_N_CLIENTS];
+	struct sockaddr_in sin;
+	ev_socklen_t slen = sizeof(sin);
+	struct timeval start, now;
+	int n_served[2] = { 0, 0 }, n_answered = 0;
+	char buf[64], name[64];
+	int i, j;
+
+	memset(client, 0, sizeof(client));
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001);
+
+	/* Two ports on one address, each with its own base, as if each
+	 * had a thread of its own. */
+	for (i = 0; i < 2; ++i) {
+		server_base[i] = event_base_new();
+		tt_assert(server_base[i]);
+		port[i] = evdns_add_server_port_bind(server_base[i],
+		    (struct sockaddr *)&sin, sizeof(sin),
+		    EVDNS_SERVER_PORT_REUSEPORT, reuseport_server_cb,
+		    &n_served[i]);
+		tt_assert(port[i]);
+		if (i == 0)
+			tt_assert(getsockname(evdns_server_port_get_fd(port[0]),
+				(struct sockaddr *)&sin, &slen) == 0);
+	}
+	tt_ptr_op(evdns_add_server_port_bind(server_base[0],
+		(struct sockaddr *)&sin, sizeof(sin), 0x100,
+		reuseport_server_cb, NULL), ==, NULL);
+
+	/* Each client has a socket of its own, so they are spread over the
+	 * ports. */
+	evutil_snprintf(buf, sizeof(buf), "127.0.0.1:%d",
+	    (int)ntohs(sin.sin_port));
+	for (i = 0; i < REUSEPORT_N_CLIENTS; ++i) {
+		client[i] = evdns_base_new(data->base, 0);
+		tt_assert(client[i]);
+		tt_assert(!evdns_base_nameserver_ip_add(client[i], buf));
+		for (j = 0; j < REUSEPORT_N_QUERIES; ++j) {
+			evutil_snprintf(name, sizeof(name), "host%d.example.com", j);
+			tt_assert(evdns_base_resolve_ipv4(client[i], name,
+				DNS_NO_SEARCH, reuseport_client_cb, &n_answered));
+		}
+	}
+
+	evutil_gettimeofday(&start, NULL);
+	while (n_answered < REUSEPORT_N_CLIENTS * REUSEPORT_N_QUERIES) {
+		event_base_loop(data->base, EVLOOP_NONBLOCK);
+		for (i = 0; i < 2; ++i)
+			event_base_loop(server_base[i], EVLOOP_NONBLOCK);
+		evutil_gettimeofday(&now, NULL);
+		if (now.tv_sec - start.tv_sec > 10)
+			break;
+	}
+
+	tt_int_op(n_answered, ==, REUSEPORT_N_CLIENTS * REUSEPORT_N_QUERIES);
+	tt_int_op(n_served[0] + n_served[1], ==, n_answered);
+	/* Linux hashes each client to one of the ports. */
+	tt_int_op(n_served[0], >, 0);
+	tt_int_op(n_served[1], >, 0);
+
+end:
+	for (i = 0; i < REUSEPORT_N_CLIENTS; ++i)
+		if (client[i])
+			evdns_base_free(client[i], 0);
+	for (i = 0; i < 2; ++i) {
+		if (port[i])
+			evdns_close_server_port(port[i]);
+		if (server_base[i])
+			event_base_free(server_base[i]);
+	}
+}
+#endif
+
 #ifdef EVTHREAD_USE_PTHREADS_IMPLEMENTED
 struct race_param
 {
@@ -2382,6 +2644,8 @@ struct testcase_t dns_testcases[] = {
 	{ "search_empty", dns_search_empty_test, TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
 	{ "search", dns_search_test, TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
 	{ "search_lower", dns_search_lower_test, TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "cache", dns_cache_test, TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "coalesce", dns_coalesce_test, TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
 	{ "search_cancel", dns_search_cancel_test,
 	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
 	{ "retry", dns_retry_test, TT_FORK|TT_NEED_BASE|TT_NO_LOGS, &basic_setup, NULL },
@@ -2434,6 +2698,10 @@ struct testcase_t dns_testcases[] = {
 	{ "client_fail_requests_getaddrinfo",
 	  dns_client_fail_requests_getaddrinfo_test,
 	  TT_FORK|TT_NEED_BASE|TT_NO_LOGS, &basic_setup, NULL },
+#if defined(__linux__) && defined(SO_REUSEPORT)
+	{ "server_reuseport", dns_server_reuseport_test,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+#endif
 #ifdef EVTHREAD_USE_PTHREADS_IMPLEMENTED
 	{ "getaddrinfo_race_gotresolve",
 	  getaddrinfo_race_gotresolve_test,
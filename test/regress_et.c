@@ -56,6 +56,7 @@ static int base_supports_et(struct event_base *base)
 	return
 		(!strcmp(event_base_get_method(base), "epoll") ||
 		!strcmp(event_base_get_method(base), "epoll (with changelist)") ||
+		!strcmp(event_base_get_method(base), "io_uring") ||
 		!strcmp(event_base_get_method(base), "kqueue"));
 }
 
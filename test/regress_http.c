@@ -56,6 +56,7 @@
 
 #include "event2/event.h"
 #include "event2/http.h"
+#include "event2/http_struct.h"
 #include "event2/buffer.h"
 #include "event2/bufferevent.h"
 #include "event2/bufferevent_ssl.h"
@@ -63,6 +64,7 @@
 #include "event2/listener.h"
 #include "log-internal.h"
 #include "http-internal.h"
+#include "http2-internal.h"
 #include "regress.h"
 #include "regress_testutils.h"
 
@@ -4238,6 +4240,1553 @@ http_multi_line_header_test(void *arg)
 		evhttp_free(http);
 }
 
+static void
+http_parse_headers_test(void *arg)
+{
+	struct evhttp_request *req = evhttp_request_new(NULL, NULL);
+	struct evbuffer *buf = evbuffer_new();
+	struct evkeyvalq *headers;
+	struct evkeyval *header;
+	int n = 0;
+
+	tt_assert(req);
+	tt_assert(buf);
+	headers = evhttp_request_get_input_headers(req);
+
+	/* Nothing is taken from the buffer until all the headers are
+	 * there, even if they arrive a little at a time. */
+	evbuffer_add_printf(buf, "Host: somehost\r\nX-Multi:  aaa\r\n");
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, MORE_DATA_EXPECTED);
+	evbuffer_add_printf(buf, " bbb  \r\n\tccc\r\nX-Bare-LF: lf\n");
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, MORE_DATA_EXPECTED);
+	evbuffer_add_printf(buf, "X-Empty:\r\nX-Last:  last  \r");
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, MORE_DATA_EXPECTED);
+	tt_assert(TAILQ_EMPTY(headers));
+	evbuffer_add_printf(buf, "\n\r\nBODY");
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, ALL_DATA_READ);
+	tt_int_op(evbuffer_get_length(buf), ==, 4);
+
+	TAILQ_FOREACH(header, headers, next)
+		++n;
+	tt_int_op(n, ==, 5);
+	tt_str_op(evhttp_find_header(headers, "host"), ==, "somehost");
+	tt_str_op(evhttp_find_header(headers, "X-Multi"), ==, "aaa bbb ccc");
+	tt_str_op(evhttp_find_header(headers, "X-Bare-LF"), ==, "lf");
+	tt_str_op(evhttp_find_header(headers, "X-Empty"), ==, "");
+	tt_str_op(evhttp_find_header(headers, "X-Last"), ==, "last");
+
+	/* Parsed headers can be changed like any others. */
+	tt_int_op(evhttp_remove_header(headers, "X-Multi"), ==, 0);
+	tt_int_op(evhttp_add_header(headers, "X-Multi", "new"), ==, 0);
+	tt_str_op(evhttp_find_header(headers, "X-Multi"), ==, "new");
+	tt_int_op(evhttp_remove_header(headers, "Host"), ==, 0);
+	tt_ptr_op(evhttp_find_header(headers, "Host"), ==, NULL);
+
+	/* So can headers that were allocated outside of libevent. */
+	header = malloc(sizeof(*header));
+	tt_assert(header);
+	header->key = strdup("X-Own");
+	header->value = strdup("own");
+	TAILQ_INSERT_TAIL(headers, header, next);
+	tt_str_op(evhttp_find_header(headers, "X-Own"), ==, "own");
+	tt_int_op(evhttp_remove_header(headers, "X-Own"), ==, 0);
+	tt_ptr_op(evhttp_find_header(headers, "X-Own"), ==, NULL);
+
+	/* Trailers are added to the same headers. */
+	evbuffer_drain(buf, 4);
+	evbuffer_add_printf(buf, "X-Trailer: t\r\n\r\n");
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, ALL_DATA_READ);
+	tt_str_op(evhttp_find_header(headers, "X-Trailer"), ==, "t");
+	tt_str_op(evhttp_find_header(headers, "X-Last"), ==, "last");
+	tt_int_op(evbuffer_get_length(buf), ==, 0);
+
+	evhttp_clear_headers(headers);
+	evbuffer_add_printf(buf, "No-Colon\r\n\r\n");
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, DATA_CORRUPTED);
+	evbuffer_drain(buf, evbuffer_get_length(buf));
+	evbuffer_add_printf(buf, " continued\r\n\r\n");
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, DATA_CORRUPTED);
+
+ end:
+	if (buf)
+		evbuffer_free(buf);
+	if (req)
+		evhttp_request_free(req);
+}
+
+static struct evhttp_arena_chunk *arena_seen[2];
+static int arena_n_seen;
+
+static void
+http_arena_server_cb(struct evhttp_request *req, void *arg)
+{
+	const char *hdr = evhttp_find_header(
+		evhttp_request_get_input_headers(req), "X-Seq");
+
+	/* What we parsed out of the request is still good, even though it
+	 * lives in memory that the last request on the connection used. */
+	if (arena_n_seen < 2 && hdr && !strcmp(hdr, arena_n_seen ? "2" : "1") &&
+	    !strcmp(evhttp_request_get_uri(req),
+		arena_n_seen ? "/two?b=2" : "/one?a=1"))
+		arena_seen[arena_n_seen++] = req->arena;
+	evhttp_send_reply(req, HTTP_OK, "OK", NULL);
+}
+
+static void
+http_arena_done(struct evhttp_request *req, void *arg)
+{
+	if (req && evhttp_request_get_response_code(req) == HTTP_OK)
+		++test_ok;
+	event_base_loopexit(arg, NULL);
+}
+
+static void
+http_arena_reuse_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evhttp *http = evhttp_new(data->base);
+	struct evhttp_connection *evcon = NULL;
+	struct evhttp_request *req;
+	ev_uint16_t port = 0;
+
+	test_ok = 0;
+	arena_n_seen = 0;
+	tt_assert(http);
+	tt_assert(!http_bind(http, &port, 0));
+	evhttp_set_gencb(http, http_arena_server_cb, NULL);
+
+	evcon = evhttp_connection_base_new(data->base, NULL, "127.0.0.1", port);
+	tt_assert(evcon);
+
+	req = evhttp_request_new(http_arena_done, data->base);
+	evhttp_add_header(evhttp_request_get_output_headers(req), "X-Seq", "1");
+	tt_assert(!evhttp_make_request(evcon, req, EVHTTP_REQ_GET, "/one?a=1"));
+	event_base_dispatch(data->base);
+
+	req = evhttp_request_new(http_arena_done, data->base);
+	evhttp_add_header(evhttp_request_get_output_headers(req), "X-Seq", "2");
+	tt_assert(!evhttp_make_request(evcon, req, EVHTTP_REQ_GET, "/two?b=2"));
+	event_base_dispatch(data->base);
+
+	tt_int_op(test_ok, ==, 2);
+	tt_int_op(arena_n_seen, ==, 2);
+	tt_assert(arena_seen[0] != NULL);
+	/* The second request on the connection got the first one's arena. */
+	tt_ptr_op(arena_seen[1], ==, arena_seen[0]);
+
+ end:
+	if (evcon)
+		evhttp_connection_free(evcon);
+	if (http)
+		evhttp_free(http);
+}
+
+static const char *route_matched;
+
+static void
+http_route_cb(struct evhttp_request *req, void *arg)
+{
+	route_matched = arg;
+	evhttp_send_reply(req, HTTP_OK, "OK", NULL);
+}
+
+static void
+http_route_done(struct evhttp_request *req, void *arg)
+{
+	event_base_loopexit(arg, NULL);
+}
+
+/* Make a request for path, and return the name of the callback that the
+ * server ran for it. */
+static const char *
+http_route_request(struct basic_test_data *data,
+    struct evhttp_connection *evcon, const char *path)
+{
+	struct evhttp_request *req;
+
+	route_matched = NULL;
+	req = evhttp_request_new(http_route_done, data->base);
+	if (!req || evhttp_make_request(evcon, req, EVHTTP_REQ_GET, path))
+		return NULL;
+	event_base_dispatch(data->base);
+	return route_matched;
+}
+
+static void
+http_prefix_cb_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evhttp *http = evhttp_new(data->base);
+	struct evhttp_connection *evcon = NULL;
+	ev_uint16_t port = 0;
+
+	tt_assert(http);
+	tt_assert(!http_bind(http, &port, 0));
+	evhttp_set_gencb(http, http_route_cb, (void *)"gen");
+	tt_int_op(evhttp_set_cb(http, "/api/users", http_route_cb,
+		(void *)"users"), ==, 0);
+	tt_int_op(evhttp_set_cb(http, "/api/users", http_route_cb,
+		(void *)"users"), ==, -1);
+	tt_int_op(evhttp_set_prefix_cb(http, "/api/", http_route_cb,
+		(void *)"api"), ==, 0);
+	tt_int_op(evhttp_set_prefix_cb(http, "/api/v2/", http_route_cb,
+		(void *)"v2"), ==, 0);
+	/* This one splits the node for "/api/v2/" in two. */
+	tt_int_op(evhttp_set_prefix_cb(http, "/api/v1", http_route_cb,
+		(void *)"v1"), ==, 0);
+	tt_int_op(evhttp_set_prefix_cb(http, "/static", http_route_cb,
+		(void *)"static"), ==, 0);
+	tt_int_op(evhttp_set_prefix_cb(http, "/api/", http_route_cb,
+		(void *)"api"), ==, -1);
+
+	evcon = evhttp_connection_base_new(data->base, NULL, "127.0.0.1", port);
+	tt_assert(evcon);
+
+	tt_str_op(http_route_request(data, evcon, "/api/users"), ==, "users");
+	tt_str_op(http_route_request(data, evcon, "/api/user%73"), ==, "users");
+	tt_str_op(http_route_request(data, evcon, "/api/users?x=1"), ==,
+	    "users");
+	tt_str_op(http_route_request(data, evcon, "/api/users/1"), ==, "api");
+	tt_str_op(http_route_request(data, evcon, "/api/v2/x"), ==, "v2");
+	tt_str_op(http_route_request(data, evcon, "/api/v2"), ==, "api");
+	tt_str_op(http_route_request(data, evcon, "/api/v1/x"), ==, "v1");
+	tt_str_op(http_route_request(data, evcon, "/api"), ==, "gen");
+	tt_str_op(http_route_request(data, evcon, "/static%2Fa.css"), ==,
+	    "static");
+	tt_str_op(http_route_request(data, evcon, "/other"), ==, "gen");
+
+	tt_int_op(evhttp_del_prefix_cb(http, "/api/v"), ==, -1);
+	tt_int_op(evhttp_del_prefix_cb(http, "/api/v2/"), ==, 0);
+	tt_int_op(evhttp_del_prefix_cb(http, "/api/v2/"), ==, -1);
+	tt_str_op(http_route_request(data, evcon, "/api/v2/x"), ==, "api");
+	tt_str_op(http_route_request(data, evcon, "/api/v1/x"), ==, "v1");
+	tt_int_op(evhttp_del_prefix_cb(http, "/api/"), ==, 0);
+	tt_str_op(http_route_request(data, evcon, "/api/users/1"), ==, "gen");
+	tt_str_op(http_route_request(data, evcon, "/api/v1/x"), ==, "v1");
+	tt_int_op(evhttp_del_cb(http, "/api/users"), ==, 0);
+	tt_int_op(evhttp_del_cb(http, "/api/users"), ==, -1);
+	tt_str_op(http_route_request(data, evcon, "/api/users"), ==, "gen");
+
+ end:
+	if (evcon)
+		evhttp_connection_free(evcon);
+	if (http)
+		evhttp_free(http);
+}
+
+static int header_changes_closed;
+static struct evhttp_connection *header_changes_evcon[3];
+static int header_changes_n;
+
+static void
+http_header_changes_closecb(struct evhttp_connection *evcon, void *arg)
+{
+	++header_changes_closed;
+}
+
+static void
+http_header_changes_cb(struct evhttp_request *req, void *arg)
+{
+	struct evkeyvalq *headers = evhttp_request_get_input_headers(req);
+	struct evhttp_connection *evcon = evhttp_request_get_connection(req);
+
+	/* evhttp has looked at the request's headers already; what we do to
+	 * them here must still count when it looks again. */
+	if (header_changes_n == 0) {
+		evhttp_add_header(headers, "Connection", "close");
+	} else if (header_changes_n == 1) {
+		evhttp_add_header(headers, "Connection", "close");
+		evhttp_remove_header(headers, "Connection");
+	}
+	if (header_changes_n < 3)
+		header_changes_evcon[header_changes_n++] = evcon;
+	evhttp_connection_set_closecb(evcon, http_header_changes_closecb, NULL);
+	evhttp_send_reply(req, HTTP_OK, "OK", NULL);
+}
+
+static void
+http_input_header_changes_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evhttp *http = evhttp_new(data->base);
+	struct evhttp_connection *evcon = NULL;
+	ev_uint16_t port = 0;
+	int i;
+
+	header_changes_closed = header_changes_n = 0;
+	tt_assert(http);
+	tt_assert(!http_bind(http, &port, 0));
+	evhttp_set_gencb(http, http_header_changes_cb, NULL);
+
+	evcon = evhttp_connection_base_new(data->base, NULL, "127.0.0.1", port);
+	tt_assert(evcon);
+
+	for (i = 0; i < 3; ++i) {
+		struct evhttp_request *req =
+		    evhttp_request_new(http_route_done, data->base);
+		tt_assert(req);
+		evhttp_add_header(evhttp_request_get_output_headers(req),
+		    "Host", "somehost");
+		tt_assert(!evhttp_make_request(evcon, req, EVHTTP_REQ_GET,
+			"/"));
+		event_base_dispatch(data->base);
+	}
+
+	tt_int_op(header_changes_n, ==, 3);
+	/* The first request added "Connection: close", so the server hung
+	 * up after it.  The second added it and took it out again, so the
+	 * third came on the same connection. */
+	tt_int_op(header_changes_closed, ==, 1);
+	tt_assert(header_changes_evcon[1] == header_changes_evcon[2]);
+
+ end:
+	if (evcon)
+		evhttp_connection_free(evcon);
+	if (http)
+		evhttp_free(http);
+}
+
+static struct event_base *pipeline_base;
+static char pipeline_replied[64];
+
+static void
+http_pipeline_reply(evutil_socket_t fd, short what, void *arg)
+{
+	struct evhttp_request *req = arg;
+	const char *uri = evhttp_request_get_uri(req);
+	struct evbuffer *buf = evbuffer_new();
+
+	strcat(pipeline_replied, uri);
+	evbuffer_add_printf(buf, "<body:%s>", uri);
+	if (!strcmp(uri, "/chunked")) {
+		evhttp_send_reply_start(req, HTTP_OK, "OK");
+		evhttp_send_reply_chunk(req, buf);
+		evhttp_send_reply_end(req);
+	} else {
+		evhttp_send_reply(req, HTTP_OK, "OK", buf);
+	}
+	evbuffer_free(buf);
+}
+
+static void
+http_pipeline_cb(struct evhttp_request *req, void *arg)
+{
+	const char *uri = evhttp_request_get_uri(req);
+	struct timeval tv = { 0, 0 };
+
+	if (!strcmp(uri, "/slow"))
+		tv.tv_usec = 200 * 1000;
+	else if (!strcmp(uri, "/medium"))
+		tv.tv_usec = 100 * 1000;
+	else {
+		/* answered at once, and held until the ones before it */
+		http_pipeline_reply(-1, EV_TIMEOUT, req);
+		return;
+	}
+	event_base_once(pipeline_base, -1, EV_TIMEOUT, http_pipeline_reply,
+	    req, &tv);
+}
+
+static void
+http_pipeline_errorcb(struct bufferevent *bev, short what, void *arg)
+{
+	/* the server hangs up after the request with "Connection: close" */
+	event_base_loopexit(arg, NULL);
+}
+
+/* Send four requests at once to a pipelining server that lets depth of
+ * them wait, and return the responses' bodies in the order they came. */
+static void
+http_pipeline_run(struct basic_test_data *data, int depth, char *bodies,
+    size_t bodies_len)
+{
+	struct evhttp *http = evhttp_new(data->base);
+	struct bufferevent *bev = NULL;
+	struct evbuffer *input;
+	struct evbuffer_ptr ptr;
+	ev_uint16_t port = 0;
+	evutil_socket_t fd;
+	const char *paths[] = { "/slow", "/fast", "/chunked", "/medium" };
+	int i;
+
+	pipeline_base = data->base;
+	pipeline_replied[0] = '\0';
+	bodies[0] = '\0';
+	tt_assert(http);
+	tt_assert(!http_bind(http, &port, 0));
+	tt_int_op(evhttp_set_flags(http, EVHTTP_SERVER_PIPELINING), ==, 0);
+	evhttp_set_pipeline_depth(http, depth);
+	evhttp_set_gencb(http, http_pipeline_cb, NULL);
+
+	fd = http_connect("127.0.0.1", port);
+	bev = bufferevent_socket_new(data->base, fd, BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(bev);
+	bufferevent_setcb(bev, NULL, NULL, http_pipeline_errorcb, data->base);
+	bufferevent_enable(bev, EV_READ);
+	for (i = 0; i < 4; ++i) {
+		bufferevent_write(bev, "GET ", 4);
+		bufferevent_write(bev, paths[i], strlen(paths[i]));
+		bufferevent_write(bev, " HTTP/1.1\r\nHost: somehost\r\n", 27);
+		if (i == 3)
+			bufferevent_write(bev, "Connection: close\r\n", 19);
+		bufferevent_write(bev, "\r\n", 2);
+	}
+
+	event_base_dispatch(data->base);
+
+	input = bufferevent_get_input(bev);
+	ptr = evbuffer_search(input, "<body:", 6, NULL);
+	while (ptr.pos != -1) {
+		struct evbuffer_ptr end;
+		char *p;
+
+		evbuffer_drain(input, ptr.pos + 6);
+		end = evbuffer_search(input, ">", 1, NULL);
+		if (end.pos == -1 ||
+		    strlen(bodies) + end.pos >= bodies_len)
+			break;
+		p = bodies + strlen(bodies);
+		evbuffer_remove(input, p, end.pos);
+		p[end.pos] = '\0';
+		ptr = evbuffer_search(input, "<body:", 6, NULL);
+	}
+
+ end:
+	if (bev)
+		bufferevent_free(bev);
+	if (http)
+		evhttp_free(http);
+}
+
+static void
+http_pipelining_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	char bodies[64];
+
+	/* All four are read and dispatched at once; the responses are
+	 * ready in another order, but go out in the order asked for. */
+	http_pipeline_run(data, 8, bodies, sizeof(bodies));
+	tt_str_op(pipeline_replied, ==, "/fast/chunked/medium/slow");
+	tt_str_op(bodies, ==, "/slow/fast/chunked/medium");
+
+	/* Only two may wait at a time, so the last two are not read until
+	 * the slow one is answered. */
+	http_pipeline_run(data, 2, bodies, sizeof(bodies));
+	tt_str_op(pipeline_replied, ==, "/fast/slow/chunked/medium");
+	tt_str_op(bodies, ==, "/slow/fast/chunked/medium");
+
+ end:
+	;
+}
+
+static int pipeline_continued;
+
+static void
+http_pipeline_continue_readcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	if (!pipeline_continued &&
+	    evbuffer_search(input, "100 Continue", 12, NULL).pos != -1) {
+		bufferevent_write(bev, "abcd", 4);
+		pipeline_continued = 1;
+	}
+}
+
+/* A request that waits for a 100 Continue behind another one gets it once
+ * the response before it has gone out. */
+static void
+http_pipelining_continue_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evhttp *http = evhttp_new(data->base);
+	struct bufferevent *bev = NULL;
+	struct evbuffer *input;
+	struct timeval tv = { 2, 0 };
+	ev_uint16_t port = 0;
+	evutil_socket_t fd;
+	const char *s;
+
+	pipeline_base = data->base;
+	pipeline_replied[0] = '\0';
+	pipeline_continued = 0;
+	tt_assert(http);
+	tt_assert(!http_bind(http, &port, 0));
+	tt_int_op(evhttp_set_flags(http, EVHTTP_SERVER_PIPELINING), ==, 0);
+	evhttp_set_pipeline_depth(http, 8);
+	evhttp_set_gencb(http, http_pipeline_cb, NULL);
+
+	fd = http_connect("127.0.0.1", port);
+	bev = bufferevent_socket_new(data->base, fd, BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(bev);
+	bufferevent_setcb(bev, http_pipeline_continue_readcb, NULL,
+	    http_pipeline_errorcb, data->base);
+	bufferevent_set_timeouts(bev, &tv, NULL);
+	bufferevent_enable(bev, EV_READ);
+	s = "GET /slow HTTP/1.1\r\nHost: somehost\r\n\r\n"
+	    "POST /post HTTP/1.1\r\nHost: somehost\r\n"
+	    "Expect: 100-continue\r\nContent-Length: 4\r\n"
+	    "Connection: close\r\n\r\n";
+	bufferevent_write(bev, s, strlen(s));
+
+	event_base_dispatch(data->base);
+
+	tt_int_op(pipeline_continued, ==, 1);
+	tt_str_op(pipeline_replied, ==, "/slow/post");
+	input = bufferevent_get_input(bev);
+	tt_int_op(evbuffer_search(input, "<body:/post>", 12, NULL).pos, !=, -1);
+
+ end:
+	if (bev)
+		bufferevent_free(bev);
+	if (http)
+		evhttp_free(http);
+}
+
+static struct evhttp_connection *h2_server_evcon;
+static int h2_server_evcons;
+static char h2_done[64];
+static int h2_pending;
+
+static void
+http2_slow_reply(evutil_socket_t fd, short what, void *arg)
+{
+	struct evhttp_request *req = arg;
+	struct evbuffer *buf = evbuffer_new();
+
+	evbuffer_add_printf(buf, "slow");
+	evhttp_send_reply(req, HTTP_OK, "OK", buf);
+	evbuffer_free(buf);
+}
+
+static void
+http2_server_cb(struct evhttp_request *req, void *arg)
+{
+	struct event_base *base = arg;
+	const char *uri = evhttp_request_get_uri(req);
+	struct evbuffer *buf = evbuffer_new();
+	struct timeval tv = { 0, 100 * 1000 };
+	const char *host;
+
+	if (evhttp_request_get_connection(req) != h2_server_evcon) {
+		h2_server_evcon = evhttp_request_get_connection(req);
+		++h2_server_evcons;
+	}
+	host = evhttp_find_header(evhttp_request_get_input_headers(req),
+	    "Host");
+	if (req->major != 2 || !host || strcmp(host, "somehost")) {
+		evhttp_send_error(req, HTTP_BADREQUEST, NULL);
+	} else if (!strcmp(uri, "/slow")) {
+		event_base_once(base, -1, EV_TIMEOUT, http2_slow_reply,
+		    req, &tv);
+	} else if (!strcmp(uri, "/get")) {
+		evbuffer_add_printf(buf, "get");
+		evhttp_add_header(evhttp_request_get_output_headers(req),
+		    "X-Reply", "yes");
+		evhttp_send_reply(req, HTTP_OK, "OK", buf);
+	} else if (!strcmp(uri, "/echo") &&
+	    evhttp_request_get_command(req) == EVHTTP_REQ_POST) {
+		evhttp_send_reply(req, HTTP_OK, "OK",
+		    evhttp_request_get_input_buffer(req));
+	} else if (!strcmp(uri, "/chunked")) {
+		evhttp_send_reply_start(req, HTTP_OK, "OK");
+		evbuffer_add_printf(buf, "one");
+		evhttp_send_reply_chunk(req, buf);
+		evbuffer_add_printf(buf, "two");
+		evhttp_send_reply_chunk(req, buf);
+		evhttp_send_reply_end(req);
+	} else {
+		evhttp_send_error(req, HTTP_NOTFOUND, NULL);
+	}
+	evbuffer_free(buf);
+}
+
+static void
+http2_client_cb(struct evhttp_request *req, void *arg)
+{
+	const char *what = arg;
+	struct evbuffer *body;
+	char expect[16];
+	size_t len;
+
+	strcat(h2_done, what);
+	if (--h2_pending == 0)
+		event_base_loopexit(exit_base, NULL);
+	tt_assert(req);
+	tt_int_op(req->major, ==, 2);
+	body = evhttp_request_get_input_buffer(req);
+	len = evbuffer_get_length(body);
+	if (!strcmp(what, "/missing")) {
+		tt_int_op(evhttp_request_get_response_code(req), ==,
+		    HTTP_NOTFOUND);
+		return;
+	}
+	tt_int_op(evhttp_request_get_response_code(req), ==, HTTP_OK);
+	if (!strcmp(what, "/echo")) {
+		/* bigger than the initial windows on both sides */
+		tt_int_op(len, ==, 200000);
+		tt_assert(evbuffer_search(body, "b", 1, NULL).pos == -1);
+		return;
+	}
+	if (!strcmp(what, "/get"))
+		tt_str_op(evhttp_find_header(
+		    evhttp_request_get_input_headers(req), "X-Reply"), ==, "yes");
+	evutil_snprintf(expect, sizeof(expect), "%s",
+	    !strcmp(what, "/chunked") ? "onetwo" : what + 1);
+	tt_int_op(len, ==, strlen(expect));
+	tt_assert(!memcmp(evbuffer_pullup(body, -1), expect, len));
+ end:
+	;
+}
+
+static void
+http_http2_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evhttp *http = evhttp_new(data->base);
+	struct evhttp_connection *evcon = NULL;
+	const char *paths[] = { "/slow", "/get", "/echo", "/chunked",
+				"/missing" };
+	ev_uint16_t port = 0;
+	size_t i;
+
+	exit_base = data->base;
+	h2_server_evcon = NULL;
+	h2_server_evcons = 0;
+	h2_done[0] = '\0';
+	tt_assert(http);
+	tt_assert(!http_bind(http, &port, 0));
+	tt_int_op(evhttp_set_flags(http, EVHTTP_SERVER_HTTP2), ==, 0);
+	evhttp_set_gencb(http, http2_server_cb, data->base);
+
+	evcon = evhttp_connection_base_new(data->base, NULL, "127.0.0.1", port);
+	tt_assert(evcon);
+	tt_int_op(evhttp_connection_set_flags(evcon, EVHTTP_CON_HTTP2), ==, 0);
+
+	h2_pending = (sizeof(paths) / sizeof(paths[0]));
+	for (i = 0; i < (sizeof(paths) / sizeof(paths[0])); ++i) {
+		struct evhttp_request *req = evhttp_request_new(
+		    http2_client_cb, (void *)paths[i]);
+		enum evhttp_cmd_type type = EVHTTP_REQ_GET;
+		tt_assert(req);
+		evhttp_add_header(evhttp_request_get_output_headers(req),
+		    "Host", "somehost");
+		if (!strcmp(paths[i], "/echo")) {
+			struct evbuffer *out =
+			    evhttp_request_get_output_buffer(req);
+			char chunk[1000];
+			int j;
+			memset(chunk, 'a', sizeof(chunk));
+			for (j = 0; j < 200; ++j)
+				evbuffer_add(out, chunk, sizeof(chunk));
+			type = EVHTTP_REQ_POST;
+		}
+		tt_int_op(evhttp_make_request(evcon, req, type, paths[i]),
+		    ==, 0);
+	}
+
+	event_base_dispatch(data->base);
+
+	tt_int_op(h2_pending, ==, 0);
+	/* all five went over one connection, and the slow one did not hold
+	 * up the others */
+	tt_int_op(h2_server_evcons, ==, 1);
+	tt_int_op(strlen(h2_done), >, 5);
+	tt_str_op(h2_done + strlen(h2_done) - 5, ==, "/slow");
+
+ end:
+	if (evcon)
+		evhttp_connection_free(evcon);
+	if (http)
+		evhttp_free(http);
+}
+
+struct h2_hpack_collect {
+	char out[256];
+};
+
+static int
+http2_hpack_collect(const char *name, size_t name_len,
+    const char *value, size_t value_len, void *arg)
+{
+	struct h2_hpack_collect *c = arg;
+	size_t len = strlen(c->out);
+
+	evutil_snprintf(c->out + len, sizeof(c->out) - len, "%s: %s\n",
+	    name, value);
+	return 0;
+}
+
+/* The requests of RFC 7541, appendix C.4, which use Huffman coding and
+ * the dynamic table. */
+static void
+http_h2_hpack_test(void *arg)
+{
+	static const unsigned char c41[] = {
+		0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5, 0xf2,
+		0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff };
+	static const unsigned char c42[] = {
+		0x82, 0x86, 0x84, 0xbe, 0x58, 0x86, 0xa8, 0xeb, 0x10, 0x64,
+		0x9c, 0xbf };
+	static const unsigned char c43[] = {
+		0x82, 0x87, 0x85, 0xbf, 0x40, 0x88, 0x25, 0xa8, 0x49, 0xe9,
+		0x5b, 0xa9, 0x7d, 0x7f, 0x89, 0x25, 0xa8, 0x49, 0xe9, 0x5b,
+		0xb8, 0xe8, 0xb4, 0xbf };
+	/* a literal whose Huffman padding is not all ones */
+	static const unsigned char bad[] = { 0x40, 0x81, 0x00, 0x81, 0x1f };
+	struct evhttp2_hpack hpack;
+	struct h2_hpack_collect c;
+
+	evhttp2_hpack_init_(&hpack, 4096);
+
+	c.out[0] = '\0';
+	tt_int_op(evhttp2_hpack_decode_(&hpack, c41, sizeof(c41),
+		http2_hpack_collect, &c), ==, 0);
+	tt_str_op(c.out, ==, ":method: GET\n:scheme: http\n:path: /\n"
+	    ":authority: www.example.com\n");
+	tt_int_op(hpack.size, ==, 57);
+
+	c.out[0] = '\0';
+	tt_int_op(evhttp2_hpack_decode_(&hpack, c42, sizeof(c42),
+		http2_hpack_collect, &c), ==, 0);
+	tt_str_op(c.out, ==, ":method: GET\n:scheme: http\n:path: /\n"
+	    ":authority: www.example.com\ncache-control: no-cache\n");
+	tt_int_op(hpack.size, ==, 110);
+
+	c.out[0] = '\0';
+	tt_int_op(evhttp2_hpack_decode_(&hpack, c43, sizeof(c43),
+		http2_hpack_collect, &c), ==, 0);
+	tt_str_op(c.out, ==, ":method: GET\n:scheme: https\n"
+	    ":path: /index.html\n:authority: www.example.com\n"
+	    "custom-key: custom-value\n");
+	tt_int_op(hpack.size, ==, 164);
+	tt_int_op(hpack.n_entries, ==, 3);
+
+	evhttp2_hpack_clear_(&hpack);
+	evhttp2_hpack_init_(&hpack, 4096);
+	c.out[0] = '\0';
+	tt_int_op(evhttp2_hpack_decode_(&hpack, bad, sizeof(bad),
+		http2_hpack_collect, &c), ==, -1);
+
+ end:
+	evhttp2_hpack_clear_(&hpack);
+}
+
+/* A server that answers every request on a connection at once, except
+ * that it hangs up, without an answer, on the second request of the
+ * connection given by pool_drop_conn. */
+static struct bufferevent *pool_bevs[16];
+static int pool_conns;
+static int pool_closed;
+static int pool_drop_conn;
+static int pool_requests[16];
+static int pool_pending;
+
+static void
+http_pool_server_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	int i;
+
+	for (i = 0; i < pool_conns; ++i) {
+		if (pool_bevs[i] == bev) {
+			bufferevent_free(bev);
+			pool_bevs[i] = NULL;
+			++pool_closed;
+		}
+	}
+}
+
+static void
+http_pool_server_readcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *input = bufferevent_get_input(bev);
+	int i = (int)(ev_intptr_t)arg;
+	struct evbuffer_ptr end;
+
+	while ((end = evbuffer_search(input, "\r\n\r\n", 4, NULL)).pos != -1) {
+		evbuffer_drain(input, end.pos + 4);
+		if (++pool_requests[i] == 2 && i == pool_drop_conn) {
+			http_pool_server_eventcb(bev, BEV_EVENT_EOF, NULL);
+			return;
+		}
+		evbuffer_add_printf(bufferevent_get_output(bev),
+		    "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok");
+	}
+}
+
+static void
+http_pool_server_acceptcb(struct evconnlistener *listener,
+    evutil_socket_t fd, struct sockaddr *addr, int socklen, void *arg)
+{
+	struct bufferevent *bev;
+
+	if (pool_conns == (int)(sizeof(pool_bevs) / sizeof(pool_bevs[0]))) {
+		evutil_closesocket(fd);
+		return;
+	}
+	bev = bufferevent_socket_new(evconnlistener_get_base(listener), fd,
+	    BEV_OPT_CLOSE_ON_FREE);
+	bufferevent_setcb(bev, http_pool_server_readcb, NULL,
+	    http_pool_server_eventcb, (void *)(ev_intptr_t)pool_conns);
+	bufferevent_enable(bev, EV_READ);
+	pool_requests[pool_conns] = 0;
+	pool_bevs[pool_conns++] = bev;
+}
+
+static struct evconnlistener *
+http_pool_server(struct event_base *base, ev_uint16_t *pport)
+{
+	struct evconnlistener *listener;
+	struct sockaddr_in sin;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001);
+	listener = evconnlistener_new_bind(base, http_pool_server_acceptcb,
+	    NULL, LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE, -1,
+	    (struct sockaddr *)&sin, sizeof(sin));
+	if (listener)
+		*pport = regress_get_socket_port(
+		    evconnlistener_get_fd(listener));
+	pool_conns = pool_closed = 0;
+	pool_drop_conn = -1;
+	return listener;
+}
+
+static void
+http_pool_server_free(struct evconnlistener *listener)
+{
+	int i;
+
+	for (i = 0; i < pool_conns; ++i)
+		if (pool_bevs[i])
+			bufferevent_free(pool_bevs[i]);
+	if (listener)
+		evconnlistener_free(listener);
+}
+
+static void
+http_pool_done(struct evhttp_request *req, void *arg)
+{
+	int *result = arg;
+
+	*result = req ? evhttp_request_get_response_code(req) : -1;
+	if (--pool_pending == 0)
+		event_base_loopexit(exit_base, NULL);
+}
+
+static void
+http_connection_pool_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evhttp_connection_pool *pool = NULL;
+	struct evconnlistener *listener;
+	struct timeval tv = { 0, 100 * 1000 };
+	ev_uint16_t port = 0;
+	int results[5];
+	int i;
+
+	exit_base = data->base;
+	listener = http_pool_server(data->base, &port);
+	tt_assert(listener);
+	pool = evhttp_connection_pool_new(data->base, NULL);
+	tt_assert(pool);
+	evhttp_connection_pool_set_max_connections(pool, 2);
+	evhttp_connection_pool_set_idle_timeout_tv(pool, &tv);
+
+	/* five at once take two connections */
+	pool_pending = 5;
+	for (i = 0; i < 5; ++i) {
+		struct evhttp_request *req =
+		    evhttp_request_new(http_pool_done, &results[i]);
+		results[i] = 0;
+		tt_int_op(evhttp_connection_pool_make_request(pool,
+			"127.0.0.1", port, req, EVHTTP_REQ_GET, "/"), ==, 0);
+	}
+	event_base_dispatch(data->base);
+	for (i = 0; i < 5; ++i)
+		tt_int_op(results[i], ==, HTTP_OK);
+	tt_int_op(pool_conns, ==, 2);
+	tt_int_op(pool_requests[0] + pool_requests[1], ==, 5);
+
+	/* the next goes on one of them, and then both are closed once idle
+	 * for long enough */
+	pool_pending = 1;
+	tt_int_op(evhttp_connection_pool_make_request(pool, "127.0.0.1", port,
+		evhttp_request_new(http_pool_done, &results[0]),
+		EVHTTP_REQ_GET, "/"), ==, 0);
+	event_base_dispatch(data->base);
+	tt_int_op(results[0], ==, HTTP_OK);
+	tt_int_op(pool_conns, ==, 2);
+	tt_int_op(pool_closed, ==, 0);
+
+	tv.tv_usec = 300 * 1000;
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+	tt_int_op(pool_closed, ==, 2);
+
+ end:
+	if (pool)
+		evhttp_connection_pool_free(pool);
+	http_pool_server_free(listener);
+}
+
+static void
+http_pool_first_done(struct evhttp_request *req, void *arg)
+{
+	int *result = arg;
+
+	*result = req ? evhttp_request_get_response_code(req) : -1;
+	event_base_loopexit(exit_base, NULL);
+}
+
+/* A kept-alive connection that the server drops as the next request goes
+ * out: a GET is sent again on a new connection, a POST fails. */
+static void
+http_connection_pool_stale_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evhttp_connection_pool *pool = NULL;
+	struct evconnlistener *listener;
+	struct evhttp_request *req;
+	ev_uint16_t port = 0;
+	int first = 0, result = 0;
+	enum evhttp_cmd_type types[] = { EVHTTP_REQ_GET, EVHTTP_REQ_POST };
+	int i;
+
+	exit_base = data->base;
+	listener = http_pool_server(data->base, &port);
+	tt_assert(listener);
+
+	for (i = 0; i < 2; ++i) {
+		int conns = pool_conns;
+
+		if (pool)
+			evhttp_connection_pool_free(pool);
+		pool = evhttp_connection_pool_new(data->base, NULL);
+		tt_assert(pool);
+		pool_drop_conn = conns;
+		req = evhttp_request_new(http_pool_first_done, &first);
+		tt_int_op(evhttp_connection_pool_make_request(pool,
+			"127.0.0.1", port, req, EVHTTP_REQ_GET, "/"), ==, 0);
+		event_base_dispatch(data->base);
+		tt_int_op(first, ==, HTTP_OK);
+		tt_int_op(pool_conns, ==, conns + 1);
+
+		/* the server has not hung up yet when this goes out */
+		pool_pending = 1;
+		req = evhttp_request_new(http_pool_done, &result);
+		if (types[i] == EVHTTP_REQ_POST)
+			evbuffer_add_printf(
+			    evhttp_request_get_output_buffer(req), "body");
+		tt_int_op(evhttp_connection_pool_make_request(pool,
+			"127.0.0.1", port, req, types[i], "/"), ==, 0);
+		event_base_dispatch(data->base);
+		tt_int_op(pool_requests[conns], ==, 2);
+		if (types[i] == EVHTTP_REQ_GET) {
+			tt_int_op(result, ==, HTTP_OK);
+			tt_int_op(pool_conns, ==, conns + 2);
+		} else {
+			tt_int_op(result, ==, -1);
+			tt_int_op(pool_conns, ==, conns + 1);
+		}
+	}
+
+ end:
+	if (pool)
+		evhttp_connection_pool_free(pool);
+	http_pool_server_free(listener);
+}
+
+struct stream_body_state {
+	struct evhttp_request *req;
+	struct event_base *base;
+	size_t received;
+	size_t most_buffered;
+	int calls_before_body;
+	int error;
+};
+static struct stream_body_state stream_state;
+
+static void
+http_stream_body_drain(evutil_socket_t fd, short what, void *arg)
+{
+	struct stream_body_state *st = arg;
+	struct evbuffer *input;
+
+	if (st->req == NULL)
+		return;
+	input = evhttp_request_get_input_buffer(st->req);
+	st->received += evbuffer_get_length(input);
+	evbuffer_drain(input, -1);
+}
+
+static void
+http_stream_body_chunk(struct evhttp_request *req, void *arg)
+{
+	struct stream_body_state *st = arg;
+	struct timeval tv = { 0, 1000 };
+	size_t len = evbuffer_get_length(evhttp_request_get_input_buffer(req));
+
+	if (len > st->most_buffered)
+		st->most_buffered = len;
+	/* leave it for a while, so that the buffer fills up */
+	event_base_once(st->base, -1, EV_TIMEOUT, http_stream_body_drain, st,
+	    &tv);
+}
+
+static void
+http_stream_body_done(struct evhttp_request *req, void *arg)
+{
+	struct stream_body_state *st = arg;
+	struct evbuffer *buf = evbuffer_new();
+
+	http_stream_body_drain(-1, EV_TIMEOUT, st);
+	evbuffer_add_printf(buf, "<got:%u>", (unsigned)st->received);
+	evhttp_send_reply(req, HTTP_OK, "OK", buf);
+	evbuffer_free(buf);
+	st->req = NULL;
+}
+
+static void
+http_stream_body_error(enum evhttp_request_error error, void *arg)
+{
+	struct stream_body_state *st = arg;
+
+	st->error = error;
+	/* answering it frees it */
+	evhttp_send_error(st->req, HTTP_BADREQUEST, NULL);
+	st->req = NULL;
+	event_base_loopexit(st->base, NULL);
+}
+
+static void
+http_stream_body_cb(struct evhttp_request *req, void *arg)
+{
+	struct stream_body_state *st = &stream_state;
+
+	st->req = req;
+	if (!strcmp(evhttp_request_get_uri(req), "/reject")) {
+		evhttp_send_error(req, HTTP_ENTITYTOOLARGE, NULL);
+		st->req = NULL;
+		return;
+	}
+	if (evbuffer_get_length(evhttp_request_get_input_buffer(req)) == 0)
+		++st->calls_before_body;
+	evhttp_request_set_body_cb(req, http_stream_body_chunk,
+	    http_stream_body_done, http_stream_body_error, st);
+}
+
+static void
+http_stream_body_client_eventcb(struct bufferevent *bev, short what,
+    void *arg)
+{
+	event_base_loopexit(arg, NULL);
+}
+
+/* Send a request with a body of 'len' bytes, chunked if 'chunked', to
+ * the server on 'port', and return what comes back until the server
+ * closes the connection; or, with 'partial', send half the body and hang
+ * up. */
+static void
+http_stream_body_run(struct basic_test_data *data, ev_uint16_t port,
+    const char *uri, size_t len, int chunked, int partial, char *reply,
+    size_t reply_len)
+{
+	struct bufferevent *bev;
+	struct evbuffer *out;
+	char block[4096];
+	size_t sent = 0;
+	ev_ssize_t n;
+
+	memset(&stream_state, 0, sizeof(stream_state));
+	stream_state.base = data->base;
+	memset(block, 'x', sizeof(block));
+	bev = bufferevent_socket_new(data->base,
+	    http_connect("127.0.0.1", port), BEV_OPT_CLOSE_ON_FREE);
+	bufferevent_setcb(bev, NULL, NULL, http_stream_body_client_eventcb,
+	    data->base);
+	out = bufferevent_get_output(bev);
+	evbuffer_add_printf(out, "POST %s HTTP/1.1\r\nHost: somehost\r\n"
+	    "Connection: close\r\n", uri);
+	if (chunked)
+		evbuffer_add_printf(out, "Transfer-Encoding: chunked\r\n\r\n");
+	else
+		evbuffer_add_printf(out, "Content-Length: %u\r\n\r\n",
+		    (unsigned)len);
+	if (partial)
+		len /= 2;
+	while (sent < len) {
+		size_t k = len - sent < sizeof(block) ? len - sent :
+		    sizeof(block);
+		if (chunked)
+			evbuffer_add_printf(out, "%x\r\n", (unsigned)k);
+		evbuffer_add(out, block, k);
+		if (chunked)
+			evbuffer_add(out, "\r\n", 2);
+		sent += k;
+	}
+	if (chunked && !partial)
+		evbuffer_add_printf(out, "0\r\n\r\n");
+	bufferevent_enable(bev, EV_READ);
+
+	if (partial) {
+		/* hang up once it is all out */
+		while (evbuffer_get_length(out) > 0 &&
+		    event_base_loop(data->base, EVLOOP_ONCE) == 0)
+			;
+		bufferevent_free(bev);
+		event_base_dispatch(data->base);
+		return;
+	}
+
+	event_base_dispatch(data->base);
+	n = evbuffer_remove(bufferevent_get_input(bev), reply, reply_len - 1);
+	reply[n < 0 ? 0 : n] = '\0';
+	bufferevent_free(bev);
+}
+
+static void
+http_stream_body_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evhttp *http = evhttp_new(data->base);
+	ev_uint16_t port = 0;
+	const size_t len = 1024 * 1024 + 17;
+	char reply[1024], expect[32];
+	int chunked;
+
+	tt_assert(http);
+	tt_assert(!http_bind(http, &port, 0));
+	tt_int_op(evhttp_set_cb_flags(http, "/upload", EVHTTP_CB_STREAM_BODY),
+	    ==, -1);
+	tt_int_op(evhttp_set_cb(http, "/upload", http_stream_body_cb, NULL),
+	    ==, 0);
+	tt_int_op(evhttp_set_cb_flags(http, "/upload", EVHTTP_CB_STREAM_BODY),
+	    ==, 0);
+	tt_int_op(evhttp_set_prefix_cb(http, "/r", http_stream_body_cb, NULL),
+	    ==, 0);
+	tt_int_op(evhttp_set_prefix_cb_flags(http, "/r",
+		EVHTTP_CB_STREAM_BODY), ==, 0);
+
+	/* The handler gets the request before its body, and never holds
+	 * more than a bounded part of it */
+	evutil_snprintf(expect, sizeof(expect), "<got:%u>", (unsigned)len);
+	for (chunked = 0; chunked < 2; ++chunked) {
+		http_stream_body_run(data, port, "/upload", len, chunked, 0,
+		    reply, sizeof(reply));
+		tt_assert(!strncmp(reply, "HTTP/1.1 200", 12));
+		tt_assert(strstr(reply, expect));
+		tt_int_op(stream_state.calls_before_body, ==, 1);
+		tt_int_op(stream_state.received, ==, len);
+		tt_assert(stream_state.most_buffered > 0);
+		tt_assert(stream_state.most_buffered <= 64 * 1024);
+	}
+
+	/* Answered before the body comes: the connection is closed */
+	http_stream_body_run(data, port, "/reject", len, 0, 0,
+	    reply, sizeof(reply));
+	tt_assert(!strncmp(reply, "HTTP/1.1 413", 12));
+	tt_assert(strstr(reply, "Connection: close"));
+
+	/* The client goes away half way */
+	http_stream_body_run(data, port, "/upload", len, 0, 1, NULL, 0);
+	tt_int_op(stream_state.error, ==, EVREQ_HTTP_EOF);
+	tt_assert(stream_state.received < len);
+
+ end:
+	if (http)
+		evhttp_free(http);
+}
+
+/* A content coding for the tests: every byte plus one, a '|' where it is
+ * flushed and a '$' at the end.  It writes at most 100 bytes at a time, so
+ * that evhttp has to call it again. */
+static int compress_encoders;
+static int compress_level;
+
+static void *
+http_compress_init(int level, void *arg)
+{
+	++compress_encoders;
+	compress_level = level;
+	return arg;
+}
+
+static int
+http_compress_encode(void *ctx, const unsigned char *in, size_t *in_len,
+    unsigned char *out, size_t *out_len, int flags)
+{
+	size_t room = *out_len < 100 ? *out_len : 100;
+	size_t n = *in_len < room ? *in_len : room, i;
+
+	for (i = 0; i < n; ++i)
+		out[i] = in[i] + 1;
+	*out_len = n;
+	if (n < *in_len) {
+		*in_len = n;
+		return 1;
+	}
+	if (flags) {
+		if (n == room)
+			return 1;
+		out[(*out_len)++] =
+		    (flags & EVHTTP_ENCODE_FINISH) ? '$' : '|';
+	}
+	return 0;
+}
+
+static void
+http_compress_free(void *ctx, void *arg)
+{
+	--compress_encoders;
+}
+
+static void
+http_compress_body(struct evbuffer *buf, size_t from, size_t len)
+{
+	size_t i;
+
+	for (i = from; i < from + len; ++i)
+		evbuffer_add_printf(buf, "%c", 'a' + (int)(i % 26));
+}
+
+static void
+http_compress_cb(struct evhttp_request *req, void *arg)
+{
+	const char *uri = evhttp_request_get_uri(req);
+	struct evbuffer *buf = evbuffer_new();
+
+	if (!strcmp(uri, "/small")) {
+		evbuffer_add_printf(buf, "tiny");
+	} else if (!strcmp(uri, "/png")) {
+		evhttp_add_header(evhttp_request_get_output_headers(req),
+		    "Content-Type", "image/png");
+		http_compress_body(buf, 0, 1000);
+	} else if (!strcmp(uri, "/stream")) {
+		evhttp_send_reply_start(req, HTTP_OK, "OK");
+		http_compress_body(buf, 0, 300);
+		evhttp_send_reply_chunk(req, buf);
+		http_compress_body(buf, 300, 300);
+		evhttp_send_reply_chunk(req, buf);
+		evhttp_send_reply_end(req);
+		evbuffer_free(buf);
+		return;
+	} else {
+		http_compress_body(buf, 0, 1000);
+	}
+	evhttp_send_reply(req, HTTP_OK, "OK", buf);
+	evbuffer_free(buf);
+}
+
+static char compress_encoding[32];
+static char compress_length[32];
+static char compress_reply[2048];
+
+static void
+http_compress_done(struct evhttp_request *req, void *arg)
+{
+	struct evkeyvalq *headers;
+	const char *value;
+	ev_ssize_t n;
+
+	compress_encoding[0] = compress_length[0] = compress_reply[0] = '\0';
+	if (req != NULL) {
+		headers = evhttp_request_get_input_headers(req);
+		if ((value = evhttp_find_header(headers,
+			    "Content-Encoding")) != NULL)
+			evutil_snprintf(compress_encoding,
+			    sizeof(compress_encoding), "%s", value);
+		if ((value = evhttp_find_header(headers,
+			    "Content-Length")) != NULL)
+			evutil_snprintf(compress_length,
+			    sizeof(compress_length), "%s", value);
+		n = evbuffer_remove(evhttp_request_get_input_buffer(req),
+		    compress_reply, sizeof(compress_reply) - 1);
+		compress_reply[n < 0 ? 0 : n] = '\0';
+	}
+	event_base_loopexit(arg, NULL);
+}
+
+static void
+http_compress_get(struct basic_test_data *data,
+    struct evhttp_connection *evcon, const char *uri, const char *host,
+    const char *accept)
+{
+	struct evhttp_request *req;
+
+	req = evhttp_request_new(http_compress_done, data->base);
+	evhttp_add_header(evhttp_request_get_output_headers(req), "Host",
+	    host);
+	if (accept != NULL)
+		evhttp_add_header(evhttp_request_get_output_headers(req),
+		    "Accept-Encoding", accept);
+	evhttp_make_request(evcon, req, EVHTTP_REQ_GET, uri);
+	event_base_dispatch(data->base);
+}
+
+/* Whether the reply is the body of http_compress_body() in our coding */
+static int
+http_compress_check(const char *reply, size_t len, const char *marks)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i, ++reply) {
+		if (i && i % 300 == 0 && *marks == '|' &&
+		    *reply++ != *marks++)
+			return 0;
+		if (*reply != 'a' + (int)(i % 26) + 1)
+			return 0;
+	}
+	return !strcmp(reply, marks);
+}
+
+static void
+http_compress_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evhttp *http = evhttp_new(data->base);
+	struct evhttp *vhost = evhttp_new(data->base);
+	struct evhttp_connection *evcon = NULL;
+	ev_uint16_t port = 0;
+
+	tt_assert(http);
+	tt_assert(vhost);
+	tt_assert(!http_bind(http, &port, 0));
+	evhttp_set_gencb(http, http_compress_cb, NULL);
+	evhttp_set_gencb(vhost, http_compress_cb, NULL);
+	tt_int_op(evhttp_add_virtual_host(http, "plain.example", vhost),
+	    ==, 0);
+	tt_int_op(evhttp_add_content_encoder(http, "x-test",
+		http_compress_init, http_compress_encode, http_compress_free,
+		&compress_encoders), ==, 0);
+	evhttp_set_compression(http, 5, 16);
+
+	evcon = evhttp_connection_base_new(data->base, NULL, "127.0.0.1",
+	    port);
+	tt_assert(evcon);
+
+	/* The whole body at once: compressed, with its new length */
+	http_compress_get(data, evcon, "/", "somehost", "gzip;q=0.5, x-test");
+	tt_str_op(compress_encoding, ==, "x-test");
+	tt_str_op(compress_length, ==, "1001");
+	tt_assert(http_compress_check(compress_reply, 1000, "$"));
+	tt_int_op(compress_level, ==, 5);
+
+	/* Chunks, each flushed */
+	http_compress_get(data, evcon, "/stream", "somehost", "*");
+	tt_str_op(compress_encoding, ==, "x-test");
+	tt_str_op(compress_length, ==, "");
+	tt_assert(http_compress_check(compress_reply, 600, "||$"));
+
+	/* Not accepted, too small, or compressed already */
+	http_compress_get(data, evcon, "/", "somehost", NULL);
+	tt_str_op(compress_encoding, ==, "");
+	tt_str_op(compress_length, ==, "1000");
+	http_compress_get(data, evcon, "/", "somehost", "x-test;q=0, *");
+	tt_str_op(compress_encoding, ==, "");
+	http_compress_get(data, evcon, "/small", "somehost", "x-test");
+	tt_str_op(compress_encoding, ==, "");
+	tt_str_op(compress_reply, ==, "tiny");
+	http_compress_get(data, evcon, "/png", "somehost", "x-test");
+	tt_str_op(compress_encoding, ==, "");
+	tt_str_op(compress_length, ==, "1000");
+
+	/* A virtual host has codings of its own */
+	http_compress_get(data, evcon, "/", "plain.example", "x-test");
+	tt_str_op(compress_encoding, ==, "");
+	tt_str_op(compress_length, ==, "1000");
+
+	tt_int_op(compress_encoders, ==, 0);
+
+ end:
+	if (evcon)
+		evhttp_connection_free(evcon);
+	if (http)
+		evhttp_free(http);
+}
+
+#ifndef _WIN32
+static int static_code;
+static char static_etag[64];
+static char static_range[64];
+static char static_reply[256];
+
+static void
+http_static_done(struct evhttp_request *req, void *arg)
+{
+	struct evkeyvalq *headers;
+	const char *value;
+	ev_ssize_t n;
+
+	static_code = 0;
+	static_etag[0] = static_range[0] = static_reply[0] = '\0';
+	if (req != NULL) {
+		static_code = evhttp_request_get_response_code(req);
+		headers = evhttp_request_get_input_headers(req);
+		if ((value = evhttp_find_header(headers, "ETag")) != NULL)
+			evutil_snprintf(static_etag, sizeof(static_etag),
+			    "%s", value);
+		if ((value = evhttp_find_header(headers,
+			    "Content-Range")) != NULL)
+			evutil_snprintf(static_range, sizeof(static_range),
+			    "%s", value);
+		n = evbuffer_remove(evhttp_request_get_input_buffer(req),
+		    static_reply, sizeof(static_reply) - 1);
+		static_reply[n < 0 ? 0 : n] = '\0';
+	}
+	event_base_loopexit(arg, NULL);
+}
+
+static void
+http_static_get(struct basic_test_data *data,
+    struct evhttp_connection *evcon, const char *uri,
+    const char *header, const char *value)
+{
+	struct evhttp_request *req;
+
+	req = evhttp_request_new(http_static_done, data->base);
+	evhttp_add_header(evhttp_request_get_output_headers(req), "Host",
+	    "somehost");
+	if (header != NULL)
+		evhttp_add_header(evhttp_request_get_output_headers(req),
+		    header, value);
+	evhttp_make_request(evcon, req, EVHTTP_REQ_GET, uri);
+	event_base_dispatch(data->base);
+}
+
+static int
+http_static_write(const char *dir, const char *name, const char *contents)
+{
+	char path[128];
+	FILE *f;
+
+	evutil_snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if ((f = fopen(path, "w")) == NULL)
+		return -1;
+	fputs(contents, f);
+	return fclose(f);
+}
+
+static void
+http_static_unlink(const char *dir, const char *name)
+{
+	char path[128];
+
+	evutil_snprintf(path, sizeof(path), "%s/%s", dir, name);
+	unlink(path);
+}
+
+static void
+http_static_root_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evhttp *http = evhttp_new(data->base);
+	struct evhttp_connection *evcon = NULL;
+	struct timeval tv = { 0, 20 * 1000 };
+	char dir[32], etag[64];
+	ev_uint16_t port = 0;
+
+	strcpy(dir, "/tmp/eventtmp.XXXXXX");
+	tt_assert(mkdtemp(dir) != NULL);
+	tt_int_op(http_static_write(dir, "a.txt", "0123456789"), ==, 0);
+	tt_int_op(http_static_write(dir, "b.txt", "bbb"), ==, 0);
+	tt_int_op(http_static_write(dir, "index.html", "<p>index</p>"), ==, 0);
+
+	tt_assert(http);
+	tt_assert(!http_bind(http, &port, 0));
+	tt_int_op(evhttp_set_static_root(http, "/files", dir), ==, 0);
+	tt_int_op(evhttp_set_static_root(http, "/files", dir), ==, -1);
+	evhttp_set_static_cache(http, 1, NULL);
+
+	evcon = evhttp_connection_base_new(data->base, NULL, "127.0.0.1",
+	    port);
+	tt_assert(evcon);
+
+	http_static_get(data, evcon, "/files/a.txt", NULL, NULL);
+	tt_int_op(static_code, ==, HTTP_OK);
+	tt_str_op(static_reply, ==, "0123456789");
+	tt_assert(static_etag[0] == '"');
+	evutil_snprintf(etag, sizeof(etag), "%s", static_etag);
+
+	/* Ranges */
+	http_static_get(data, evcon, "/files/a.txt", "Range", "bytes=2-5");
+	tt_int_op(static_code, ==, 206);
+	tt_str_op(static_range, ==, "bytes 2-5/10");
+	tt_str_op(static_reply, ==, "2345");
+	http_static_get(data, evcon, "/files/a.txt", "Range", "bytes=-3");
+	tt_int_op(static_code, ==, 206);
+	tt_str_op(static_reply, ==, "789");
+	http_static_get(data, evcon, "/files/a.txt", "Range", "bytes=10-");
+	tt_int_op(static_code, ==, 416);
+	tt_str_op(static_range, ==, "bytes */10");
+	http_static_get(data, evcon, "/files/a.txt", "Range", "bytes=0-1,4-5");
+	tt_int_op(static_code, ==, HTTP_OK);
+	tt_str_op(static_reply, ==, "0123456789");
+
+	/* Conditional requests */
+	http_static_get(data, evcon, "/files/a.txt", "If-None-Match", etag);
+	tt_int_op(static_code, ==, HTTP_NOTMODIFIED);
+	tt_str_op(static_reply, ==, "");
+	http_static_get(data, evcon, "/files/a.txt", "If-None-Match",
+	    "\"other\"");
+	tt_int_op(static_code, ==, HTTP_OK);
+	http_static_get(data, evcon, "/files/a.txt", "If-Modified-Since",
+	    "Fri, 31 Dec 2100 23:59:59 GMT");
+	tt_int_op(static_code, ==, HTTP_NOTMODIFIED);
+	http_static_get(data, evcon, "/files/a.txt", "If-Modified-Since",
+	    "Thu, 01 Jan 1970 00:00:00 GMT");
+	tt_int_op(static_code, ==, HTTP_OK);
+
+	/* Directories, and paths that are not in the root */
+	http_static_get(data, evcon, "/files/", NULL, NULL);
+	tt_int_op(static_code, ==, HTTP_OK);
+	tt_str_op(static_reply, ==, "<p>index</p>");
+	http_static_get(data, evcon, "/files/%2e%2e/etc/passwd", NULL, NULL);
+	tt_int_op(static_code, ==, HTTP_NOTFOUND);
+	http_static_get(data, evcon, "/filesa.txt", NULL, NULL);
+	tt_int_op(static_code, ==, HTTP_NOTFOUND);
+	http_static_get(data, evcon, "/files/none", NULL, NULL);
+	tt_int_op(static_code, ==, HTTP_NOTFOUND);
+
+	/* A cached file is still there once it is gone, until it is pushed
+	 * out of the cache */
+	http_static_get(data, evcon, "/files/b.txt", NULL, NULL);
+	tt_str_op(static_reply, ==, "bbb");
+	http_static_unlink(dir, "b.txt");
+	http_static_get(data, evcon, "/files/b.txt", NULL, NULL);
+	tt_int_op(static_code, ==, HTTP_OK);
+	tt_str_op(static_reply, ==, "bbb");
+	http_static_get(data, evcon, "/files/a.txt", NULL, NULL);
+	http_static_get(data, evcon, "/files/b.txt", NULL, NULL);
+	tt_int_op(static_code, ==, HTTP_NOTFOUND);
+
+	/* or until the timer sees that it has changed */
+	evhttp_set_static_cache(http, 8, &tv);
+	http_static_get(data, evcon, "/files/a.txt", NULL, NULL);
+	tt_str_op(static_reply, ==, "0123456789");
+	tt_int_op(http_static_write(dir, "a.txt", "changed"), ==, 0);
+	tv.tv_usec = 100 * 1000;
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+	http_static_get(data, evcon, "/files/a.txt", NULL, NULL);
+	tt_int_op(static_code, ==, HTTP_OK);
+	tt_str_op(static_reply, ==, "changed");
+	tt_str_op(static_etag, !=, etag);
+
+ end:
+	if (evcon)
+		evhttp_connection_free(evcon);
+	if (http)
+		evhttp_free(http);
+	http_static_unlink(dir, "a.txt");
+	http_static_unlink(dir, "b.txt");
+	http_static_unlink(dir, "index.html");
+	rmdir(dir);
+}
+#endif
+
 static void
 http_request_bad(struct evhttp_request *req, void *arg)
 {
@@ -5192,6 +6741,21 @@ struct testcase_t http_testcases[] = {
 	{ "primitives", http_primitives, 0, NULL, NULL },
 	{ "base", http_base_test, TT_FORK, NULL, NULL },
 	{ "bad_headers", http_bad_header_test, 0, NULL, NULL },
+	{ "parse_headers", http_parse_headers_test, 0, NULL, NULL },
+	HTTP(arena_reuse),
+	HTTP(prefix_cb),
+	HTTP(input_header_changes),
+	HTTP(pipelining),
+	HTTP(pipelining_continue),
+	HTTP(http2),
+	HTTP(h2_hpack),
+	HTTP(connection_pool),
+	HTTP(connection_pool_stale),
+	HTTP(stream_body),
+	HTTP(compress),
+#ifndef _WIN32
+	HTTP(static_root),
+#endif
 	{ "parse_query", http_parse_query_test, 0, NULL, NULL },
 	{ "parse_query_str", http_parse_query_str_test, 0, NULL, NULL },
 	{ "parse_query_str_flags", http_parse_query_str_flags_test, 0, NULL, NULL },
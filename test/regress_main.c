@@ -368,6 +368,7 @@ struct testcase_t thread_testcases[] = {
 struct testgroup_t testgroups[] = {
 	{ "main/", main_testcases },
 	{ "heap/", minheap_testcases },
+	{ "timerwheel/", timerwheel_testcases },
 	{ "et/", edgetriggered_testcases },
 	{ "finalize/", finalize_testcases },
 	{ "evbuffer/", evbuffer_testcases },
@@ -380,6 +381,7 @@ struct testgroup_t testgroups[] = {
 	{ "rpc/", rpc_testcases },
 	{ "thread/", thread_testcases },
 	{ "listener/", listener_testcases },
+	{ "dgram/", dgram_testcases },
 	{ "watch/", watch_testcases },
 #ifdef _WIN32
 	{ "iocp/", iocp_testcases },
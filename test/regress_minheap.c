@@ -45,10 +45,16 @@ check_heap(struct min_heap *heap)
 {
 	unsigned i;
 	for (i = 1; i < heap->n; ++i) {
-		unsigned parent_idx = (i-1)/2;
-		tt_want(evutil_timercmp(&heap->p[i]->ev_timeout,
-			&heap->p[parent_idx]->ev_timeout, >=));
+		unsigned parent_idx = (i-1)/MIN_HEAP_ARITY;
+		tt_want(evutil_timercmp(&heap->p[i].ev->ev_timeout,
+			&heap->p[parent_idx].ev->ev_timeout, >=));
+		tt_want(heap->p[i].ev->ev_timeout_pos.min_heap_idx == i);
+		tt_want(heap->p[i].key == min_heap_key_(heap->p[i].ev));
 	}
+	/* The children of each node share a cache line. */
+	if (heap->n > 1)
+		tt_want(((ev_uintptr_t)&heap->p[1] &
+			(MIN_HEAP_CACHELINE - 1)) == 0);
 }
 
 static void
@@ -93,7 +99,65 @@ end:
 	min_heap_dtor_(&heap);
 }
 
+static void
+test_heap_churn(void *ptr)
+{
+	struct min_heap heap;
+	struct event *inserted[4096];
+	struct event *e, *last_e;
+	int i, j;
+
+	min_heap_ctor_(&heap);
+
+	for (i = 0; i < 4096; ++i) {
+		inserted[i] = malloc(sizeof(struct event));
+		set_random_timeout(inserted[i]);
+	}
+
+	/* Grow the heap a piece at a time, so that it gets reallocated (and
+	 * maybe realigned) while it has elements in it, and re-arm random
+	 * timers in place the way event_add() does. */
+	for (i = 0; i < 4096; ++i) {
+		tt_int_op(min_heap_push_(&heap, inserted[i]), ==, 0);
+		for (j = 0; j < 4; ++j) {
+			e = inserted[evutil_weakrand_range_(&test_weakrand_state,
+				i + 1)];
+			tt_int_op(min_heap_erase_(&heap, e), ==, 0);
+			set_random_timeout(e);
+			tt_int_op(min_heap_push_(&heap, e), ==, 0);
+		}
+		if (0 == (i % 256))
+			check_heap(&heap);
+	}
+	check_heap(&heap);
+	tt_assert(min_heap_size_(&heap) == 4096);
+
+	for (i = 0; i < 4096; i += 2) {
+		e = inserted[i];
+		e->ev_timeout.tv_sec = test_weakrand();
+		tt_int_op(min_heap_adjust_(&heap, e), ==, 0);
+	}
+	check_heap(&heap);
+	tt_assert(min_heap_size_(&heap) == 4096);
+
+	last_e = min_heap_pop_(&heap);
+	tt_assert(last_e);
+	tt_assert(last_e->ev_timeout_pos.min_heap_idx == EV_SIZE_MAX);
+	while ((e = min_heap_pop_(&heap))) {
+		tt_want(evutil_timercmp(&last_e->ev_timeout,
+			&e->ev_timeout, <=));
+		last_e = e;
+	}
+	tt_assert(min_heap_size_(&heap) == 0);
+end:
+	for (i = 0; i < 4096; ++i)
+		free(inserted[i]);
+
+	min_heap_dtor_(&heap);
+}
+
 struct testcase_t minheap_testcases[] = {
 	{ "randomized", test_heap_randomized, 0, NULL, NULL },
+	{ "churn", test_heap_churn, 0, NULL, NULL },
 	END_OF_TESTCASES
 };
@@ -40,6 +40,9 @@
 #ifdef EVENT__HAVE_SYS_WAIT_H
 #include <sys/wait.h>
 #endif
+#ifdef EVENT__HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
 
 #ifdef EVENT__HAVE_PTHREADS
 #include <pthread.h>
@@ -58,6 +61,11 @@
 #include "event2/event_struct.h"
 #include "event2/thread.h"
 #include "event2/util.h"
+#include "event2/bufferevent.h"
+#include "event2/listener.h"
+#ifdef EVENT__HAVE_PTHREADS
+#include "event2/pool.h"
+#endif
 #include "evthread-internal.h"
 #include "event-internal.h"
 #include "defer-internal.h"
@@ -564,6 +572,271 @@ end:
 	;
 }
 
+#define INBOX_N_PRODUCERS 8
+#define INBOX_N_EVENTS 256
+
+struct inbox_test {
+	struct event_base *base;
+	struct event events[INBOX_N_PRODUCERS][INBOX_N_EVENTS];
+	short res[INBOX_N_PRODUCERS][INBOX_N_EVENTS];
+	int n_called;
+	int n_wrong_res;
+	THREAD_T threads[INBOX_N_PRODUCERS];
+};
+
+static struct inbox_test *inbox_test;
+
+static void
+inbox_cb(evutil_socket_t fd, short what, void *arg)
+{
+	short *expected = arg;
+	if (what != *expected)
+		++inbox_test->n_wrong_res;
+	if (++inbox_test->n_called == INBOX_N_PRODUCERS * INBOX_N_EVENTS)
+		event_base_loopbreak(inbox_test->base);
+}
+
+static THREAD_FN
+inbox_producer(void *arg)
+{
+	struct event *events = arg;
+	int i;
+	for (i = 0; i < INBOX_N_EVENTS; ++i) {
+		/* The second activation should get merged into the first,
+		 * whether or not the loop has seen it yet. */
+		event_active(&events[i], EV_READ, 1);
+		event_active(&events[i], EV_WRITE, 1);
+	}
+	THREAD_RETURN();
+}
+
+static void
+inbox_timeout_cb(evutil_socket_t fd, short what, void *arg)
+{
+	event_base_loopbreak(arg);
+}
+
+static void
+inbox_start_cb(evutil_socket_t fd, short what, void *arg)
+{
+	int i;
+	for (i = 0; i < INBOX_N_PRODUCERS; ++i)
+		THREAD_START(inbox_test->threads[i], inbox_producer,
+		    inbox_test->events[i]);
+}
+
+static void
+thread_active_inbox(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct timeval tv = {10, 0};
+	struct inbox_test *t;
+	int i, j;
+
+	t = inbox_test = calloc(1, sizeof(*t));
+	t->base = data->base;
+	for (i = 0; i < INBOX_N_PRODUCERS; ++i) {
+		for (j = 0; j < INBOX_N_EVENTS; ++j) {
+			t->res[i][j] = EV_READ|EV_WRITE;
+			event_assign(&t->events[i][j], data->base, -1, 0,
+			    inbox_cb, &t->res[i][j]);
+		}
+	}
+
+	event_base_once(data->base, -1, EV_TIMEOUT, inbox_start_cb, NULL,
+	    NULL);
+	/* Don't hang forever if something is lost. */
+	event_base_once(data->base, -1, EV_TIMEOUT, inbox_timeout_cb,
+	    data->base, &tv);
+	event_base_loop(data->base, EVLOOP_NO_EXIT_ON_EMPTY);
+
+	for (i = 0; i < INBOX_N_PRODUCERS; ++i)
+		THREAD_JOIN(t->threads[i]);
+
+	tt_int_op(t->n_called, ==, INBOX_N_PRODUCERS * INBOX_N_EVENTS);
+	tt_int_op(t->n_wrong_res, ==, 0);
+	tt_int_op(event_base_get_num_events(data->base,
+		EVENT_BASE_COUNT_ACTIVE), ==, 0);
+
+	/* An event deleted before the loop picks up its activation must not
+	 * run. */
+	t->n_called = 0;
+	THREAD_START(t->threads[0], inbox_producer, t->events[0]);
+	THREAD_JOIN(t->threads[0]);
+	for (j = 0; j < INBOX_N_EVENTS; ++j)
+		event_del(&t->events[0][j]);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(t->n_called, ==, 0);
+
+end:
+	free(inbox_test);
+	inbox_test = NULL;
+}
+
+#ifdef EVENT__HAVE_PTHREADS
+#define POOL_N_BASES 4
+#define POOL_N_CONNS 32
+
+struct pool_test {
+	struct event_base_pool *pool;
+	void *lock;
+	int accepted[POOL_N_BASES];
+	int echoed;
+	int closed;
+	int wrong_thread;
+};
+
+struct pool_conn {
+	struct pool_test *t;
+	pthread_t thread;
+};
+
+static void
+pool_conn_readcb(struct bufferevent *bev, void *arg)
+{
+	struct pool_conn *c = arg;
+	if (!pthread_equal(pthread_self(), c->thread)) {
+		EVLOCK_LOCK(c->t->lock, 0);
+		++c->t->wrong_thread;
+		EVLOCK_UNLOCK(c->t->lock, 0);
+	}
+	bufferevent_write_buffer(bev, bufferevent_get_input(bev));
+	EVLOCK_LOCK(c->t->lock, 0);
+	++c->t->echoed;
+	EVLOCK_UNLOCK(c->t->lock, 0);
+}
+
+static void
+pool_conn_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct pool_conn *c = arg;
+	if (what & (BEV_EVENT_EOF|BEV_EVENT_ERROR)) {
+		if (!pthread_equal(pthread_self(), c->thread)) {
+			EVLOCK_LOCK(c->t->lock, 0);
+			++c->t->wrong_thread;
+			EVLOCK_UNLOCK(c->t->lock, 0);
+		}
+		EVLOCK_LOCK(c->t->lock, 0);
+		++c->t->closed;
+		EVLOCK_UNLOCK(c->t->lock, 0);
+		bufferevent_free(bev);
+		free(c);
+	}
+}
+
+static void
+pool_acceptcb(struct evconnlistener *listener, evutil_socket_t fd,
+    struct sockaddr *addr, int socklen, void *arg)
+{
+	struct pool_test *t = arg;
+	struct event_base *base = evconnlistener_get_base(listener);
+	struct bufferevent *bev;
+	struct pool_conn *c;
+	int i;
+
+	for (i = 0; i < POOL_N_BASES; ++i) {
+		if (event_base_pool_get_base(t->pool, i) == base) {
+			EVLOCK_LOCK(t->lock, 0);
+			++t->accepted[i];
+			EVLOCK_UNLOCK(t->lock, 0);
+		}
+	}
+
+	c = calloc(1, sizeof(*c));
+	c->t = t;
+	c->thread = pthread_self();
+	bev = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE);
+	bufferevent_setcb(bev, pool_conn_readcb, NULL, pool_conn_eventcb, c);
+	bufferevent_enable(bev, EV_READ);
+}
+
+static void
+thread_base_pool(void *arg)
+{
+	struct basic_test_data *data = arg;
+	int affinity = data->setup_data && !strcmp(data->setup_data, "affinity");
+	struct pool_test t;
+	struct evconnlistener *listener;
+	struct sockaddr_in sin;
+	struct sockaddr_storage ss;
+	ev_socklen_t slen = sizeof(ss);
+	evutil_socket_t fds[POOL_N_CONNS];
+	int i, n_used = 0, total = 0;
+
+	memset(&t, 0, sizeof(t));
+	for (i = 0; i < POOL_N_CONNS; ++i)
+		fds[i] = EVUTIL_INVALID_SOCKET;
+	EVTHREAD_ALLOC_LOCK(t.lock, 0);
+
+	t.pool = event_base_pool_new(POOL_N_BASES, NULL,
+	    affinity ? EVENT_BASE_POOL_CPU_AFFINITY : 0);
+	tt_assert(t.pool);
+	tt_int_op(event_base_pool_get_n_bases(t.pool), ==, POOL_N_BASES);
+	tt_assert(event_base_pool_get_base(t.pool, POOL_N_BASES) == NULL);
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001);
+	listener = event_base_pool_listen(t.pool, pool_acceptcb, &t,
+	    LEV_OPT_CLOSE_ON_FREE, -1, (struct sockaddr *)&sin, sizeof(sin));
+	tt_assert(listener);
+	tt_assert(evconnlistener_get_base(listener) ==
+	    event_base_pool_get_base(t.pool, 0));
+	tt_assert(getsockname(evconnlistener_get_fd(listener),
+		(struct sockaddr *)&ss, &slen) == 0);
+
+	/* Use blocking sockets from this thread as the clients. */
+	for (i = 0; i < POOL_N_CONNS; ++i) {
+		char ch = 'x';
+		fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+		tt_assert(fds[i] != EVUTIL_INVALID_SOCKET);
+		tt_int_op(connect(fds[i], (struct sockaddr *)&ss, slen), ==, 0);
+		tt_int_op(send(fds[i], &ch, 1, 0), ==, 1);
+		ch = 0;
+		tt_int_op(recv(fds[i], &ch, 1, 0), ==, 1);
+		tt_int_op(ch, ==, 'x');
+	}
+	for (i = 0; i < POOL_N_CONNS; ++i) {
+		evutil_closesocket(fds[i]);
+		fds[i] = EVUTIL_INVALID_SOCKET;
+	}
+	for (i = 0; i < 200; ++i) {
+		int closed;
+		EVLOCK_LOCK(t.lock, 0);
+		closed = t.closed;
+		EVLOCK_UNLOCK(t.lock, 0);
+		if (closed == POOL_N_CONNS)
+			break;
+		SLEEP_MS(10);
+	}
+
+	EVLOCK_LOCK(t.lock, 0);
+	for (i = 0; i < POOL_N_BASES; ++i) {
+		TT_BLATHER(("base %d accepted %d", i, t.accepted[i]));
+		total += t.accepted[i];
+		if (t.accepted[i])
+			++n_used;
+	}
+	tt_int_op(total, ==, POOL_N_CONNS);
+	tt_int_op(t.echoed, ==, POOL_N_CONNS);
+	tt_int_op(t.closed, ==, POOL_N_CONNS);
+	tt_int_op(t.wrong_thread, ==, 0);
+	/* The kernel hashes connections between the listeners; with CPU
+	 * steering they might all arrive on one CPU. */
+	if (!affinity)
+		tt_int_op(n_used, >, 1);
+	EVLOCK_UNLOCK(t.lock, 0);
+
+end:
+	for (i = 0; i < POOL_N_CONNS; ++i)
+		if (fds[i] != EVUTIL_INVALID_SOCKET)
+			evutil_closesocket(fds[i]);
+	if (t.pool)
+		event_base_pool_free(t.pool);
+	EVTHREAD_FREE_LOCK(t.lock, 0);
+}
+#endif
+
 #define TEST(name, f)							\
 	{ #name, thread_##name, TT_FORK|TT_NEED_THREADS|TT_NEED_BASE|(f),	\
 	  &basic_setup, NULL }
@@ -584,6 +857,14 @@ struct testcase_t thread_testcases[] = {
 	 * looking into it now. / ellzey
 	 ******/
 	TEST(no_events, TT_RETRIABLE),
+#endif
+	TEST(active_inbox, 0),
+#ifdef EVENT__HAVE_PTHREADS
+	{ "base_pool", thread_base_pool, TT_FORK|TT_NEED_THREADS,
+	  &basic_setup, NULL },
+	{ "base_pool_affinity", thread_base_pool,
+	  TT_FORK|TT_NEED_THREADS,
+	  &basic_setup, (char*)"affinity" },
 #endif
 	END_OF_TESTCASES
 };
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "../timerwheel-internal.h"
+
+#include <stdlib.h>
+#include "event2/event_struct.h"
+
+#include "tinytest.h"
+#include "tinytest_macros.h"
+#include "regress.h"
+
+#define N_EVENTS 1024
+#define TICK 1000
+
+static ev_uint64_t
+tv_to_usec(const struct timeval *tv)
+{
+	return (ev_uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static void
+usec_to_tv(ev_uint64_t usec, struct timeval *tv)
+{
+	tv->tv_sec = (long)(usec / 1000000);
+	tv->tv_usec = (long)(usec % 1000000);
+}
+
+/* Return the first time at which ev may expire. */
+static ev_uint64_t
+due(const struct event *ev)
+{
+	return (tv_to_usec(&ev->ev_timeout) + TICK - 1) / TICK * TICK;
+}
+
+static void
+test_timerwheel_randomized(void *ptr)
+{
+	timer_wheel_t *w = NULL;
+	struct event *inserted[N_EVENTS];
+	int erased[N_EVENTS];
+	ev_uint64_t now, prev, start = 1000000000;
+	struct timeval tv;
+	struct event *e;
+	int i, n_left = 0, n_queued = 0, n_expired = 0;
+
+	memset(inserted, 0, sizeof(inserted));
+	memset(erased, 0, sizeof(erased));
+
+	w = malloc(sizeof(*w));
+	tt_assert(w);
+	usec_to_tv(start, &tv);
+	timer_wheel_ctor_(w, TICK, &tv);
+	tt_assert(timer_wheel_next_(w, &tv) < 0);
+
+	for (i = 0; i < N_EVENTS; ++i) {
+		ev_uint64_t delay;
+		inserted[i] = calloc(1, sizeof(struct event));
+		tt_assert(inserted[i]);
+		/* Spread the timeouts over all the levels of the wheel, and
+		 * a few beyond it. */
+		switch (i % 4) {
+		case 0: delay = test_weakrand() % 100000; break;
+		case 1: delay = test_weakrand() % 100000000; break;
+		case 2: delay = (ev_uint64_t)test_weakrand() * 1000; break;
+		default: delay = (ev_uint64_t)test_weakrand() * 100000000; break;
+		}
+		usec_to_tv(start + delay, &inserted[i]->ev_timeout);
+		timer_wheel_push_(w, inserted[i]);
+	}
+	tt_int_op(timer_wheel_size_(w), ==, N_EVENTS);
+
+	n_left = N_EVENTS;
+	for (i = 0; i < N_EVENTS; i += 3) {
+		timer_wheel_erase_(w, inserted[i]);
+		erased[i] = 1;
+		--n_left;
+	}
+	tt_int_op(timer_wheel_size_(w), ==, n_left);
+	n_queued = n_left;
+
+	/* Run the clock forward, sometimes to the time that the wheel asks
+	 * for, and sometimes by a random amount. */
+	now = start;
+	prev = start - 1;
+	while (n_left) {
+		ev_uint64_t when, earliest = EV_UINT64_MAX;
+		for (i = 0; i < N_EVENTS; ++i) {
+			if (!erased[i] && due(inserted[i]) < earliest)
+				earliest = due(inserted[i]);
+		}
+		tt_assert(timer_wheel_next_(w, &tv) == 0);
+		when = tv_to_usec(&tv);
+		/* We must never be told to sleep through a timeout. */
+		tt_assert(when <= earliest);
+		if (when <= now ||
+		    evutil_weakrand_range_(&test_weakrand_state, 2))
+			now += 1 + evutil_weakrand_range_(&test_weakrand_state, 5000);
+		else
+			now = when;
+		usec_to_tv(now, &tv);
+		timer_wheel_expire_(w, &tv);
+		while ((e = timer_wheel_first_expired_(w))) {
+			timer_wheel_erase_(w, e);
+			/* Not early, and not in a later tick. */
+			tt_assert(due(e) <= now);
+			tt_assert(due(e) > prev);
+			for (i = 0; i < N_EVENTS; ++i) {
+				if (inserted[i] == e) {
+					tt_assert(!erased[i]);
+					erased[i] = 1;
+				}
+			}
+			--n_left;
+			++n_expired;
+		}
+		prev = now;
+		tt_int_op(timer_wheel_size_(w), ==, n_left);
+	}
+	tt_int_op(n_expired, ==, n_queued);
+	tt_assert(timer_wheel_any_(w) == NULL);
+
+end:
+	for (i = 0; i < N_EVENTS; ++i)
+		free(inserted[i]);
+	free(w);
+}
+
+struct testcase_t timerwheel_testcases[] = {
+	{ "randomized", test_timerwheel_randomized, 0, NULL, NULL },
+	END_OF_TESTCASES
+};
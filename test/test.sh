@@ -1,6 +1,6 @@
 #!/bin/sh
 
-BACKENDS="EVPORT KQUEUE EPOLL DEVPOLL POLL SELECT WIN32"
+BACKENDS="EVPORT KQUEUE EPOLL IO_URING DEVPOLL POLL SELECT WIN32"
 TESTS="test-eof test-closed test-weof test-time test-changelist test-fdleak"
 FAILED=no
 TEST_OUTPUT_FILE=${TEST_OUTPUT_FILE:-/dev/null}
@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TIMERWHEEL_INTERNAL_H_INCLUDED_
+#define TIMERWHEEL_INTERNAL_H_INCLUDED_
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+#include <sys/queue.h>
+#include "event2/event.h"
+#include "event2/event_struct.h"
+#include "event2/util.h"
+#include "util-internal.h"
+
+/*
+  A hierarchical timing wheel, used instead of the min-heap when a base is
+  created with EVENT_BASE_FLAG_TIMER_WHEEL.
+
+  Time is cut into ticks of tick_usec microseconds, and an event that times
+  out at T belongs to tick ceil(T / tick_usec).  Level 0 of the wheel has a
+  slot for each of the next TIMER_WHEEL_SLOTS ticks; each slot of level l
+  covers TIMER_WHEEL_SLOTS**l ticks, and is "cascaded" (its events are put
+  back into lower levels) when the wheel reaches its first tick.  So adding
+  and removing an event are O(1), and each event moves at most
+  TIMER_WHEEL_LEVELS-1 times before it expires.
+
+  All the events in tick t expire together once t * tick_usec has passed:
+  never early, and at most one tick late.
+
+  Events link through ev_timeout_pos.ev_next_in_timer_wheel.
+*/
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 6
+/* Number of ticks that the wheel can hold; later events are parked at the
+ * far end of the top level until they are closer. */
+#define TIMER_WHEEL_SPAN \
+	((ev_uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+LIST_HEAD(timer_wheel_list, event);
+
+typedef struct timer_wheel
+{
+	struct timer_wheel_list slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	/* Events whose tick has passed, waiting to be activated. */
+	struct timer_wheel_list expired;
+	/* Bit s of nonempty[l] is set if slots[l][s] might be nonempty;
+	 * bits are cleared lazily, when we find the slot empty. */
+	ev_uint64_t nonempty[TIMER_WHEEL_LEVELS];
+	/* The first tick that hasn't expired yet. */
+	ev_uint64_t curr;
+	/* The tick that timer_wheel_next_() last told the caller to wait
+	 * for, or EV_UINT64_MAX. */
+	ev_uint64_t wake;
+	ev_uint32_t tick_usec;
+	size_t n;
+} timer_wheel_t;
+
+/* Number of lists that hold a wheel's events, for iterating over them all
+ * with timer_wheel_list_(). */
+#define TIMER_WHEEL_N_LISTS (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS + 1)
+
+static inline void timer_wheel_ctor_(timer_wheel_t *w, ev_uint32_t tick_usec, const struct timeval *now);
+static inline int timer_wheel_empty_(const timer_wheel_t *w);
+static inline size_t timer_wheel_size_(const timer_wheel_t *w);
+static inline int timer_wheel_push_(timer_wheel_t *w, struct event *e);
+static inline int timer_wheel_wakes_late_(const timer_wheel_t *w, const struct event *e);
+static inline void timer_wheel_erase_(timer_wheel_t *w, struct event *e);
+static inline int timer_wheel_next_(timer_wheel_t *w, struct timeval *when);
+static inline void timer_wheel_expire_(timer_wheel_t *w, const struct timeval *now);
+static inline struct event *timer_wheel_first_expired_(timer_wheel_t *w);
+static inline struct event *timer_wheel_any_(timer_wheel_t *w);
+static inline struct timer_wheel_list *timer_wheel_list_(timer_wheel_t *w, int i);
+
+#define TIMER_WHEEL_LINK ev_timeout_pos.ev_next_in_timer_wheel
+
+static inline ev_uint64_t
+timer_wheel_tv_to_usec_(const struct timeval *tv)
+{
+	return (ev_uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* Return the index of the lowest set bit in the nonzero x. */
+static inline int
+timer_wheel_ffs_(ev_uint64_t x)
+{
+#if defined(__GNUC__) && __GNUC__ >= 4
+	return __builtin_ctzll(x);
+#else
+	int r = 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		++r;
+	}
+	return r;
+#endif
+}
+
+void timer_wheel_ctor_(timer_wheel_t *w, ev_uint32_t tick_usec,
+    const struct timeval *now)
+{
+	int l, s;
+	for (l = 0; l < TIMER_WHEEL_LEVELS; ++l) {
+		for (s = 0; s < TIMER_WHEEL_SLOTS; ++s)
+			LIST_INIT(&w->slots[l][s]);
+		w->nonempty[l] = 0;
+	}
+	LIST_INIT(&w->expired);
+	w->tick_usec = tick_usec;
+	w->curr = timer_wheel_tv_to_usec_(now) / tick_usec;
+	w->wake = EV_UINT64_MAX;
+	w->n = 0;
+}
+
+int timer_wheel_empty_(const timer_wheel_t *w) { return 0 == w->n; }
+size_t timer_wheel_size_(const timer_wheel_t *w) { return w->n; }
+
+/* Put e in the slot for its tick; don't count it. */
+static inline void
+timer_wheel_place_(timer_wheel_t *w, struct event *e)
+{
+	ev_uint64_t t = timer_wheel_tv_to_usec_(&e->ev_timeout);
+	ev_uint64_t tick = (t + w->tick_usec - 1) / w->tick_usec;
+	ev_uint64_t d;
+	int l = 0, s;
+
+	if (tick < w->curr) {
+		LIST_INSERT_HEAD(&w->expired, e, TIMER_WHEEL_LINK);
+		return;
+	}
+	d = tick - w->curr;
+	if (d >= TIMER_WHEEL_SPAN) {
+		tick = w->curr + TIMER_WHEEL_SPAN - 1;
+		d = TIMER_WHEEL_SPAN - 1;
+	}
+	while (d >> ((l + 1) * TIMER_WHEEL_BITS))
+		++l;
+	s = (int)(tick >> (l * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+	LIST_INSERT_HEAD(&w->slots[l][s], e, TIMER_WHEEL_LINK);
+	w->nonempty[l] |= (ev_uint64_t)1 << s;
+}
+
+int timer_wheel_push_(timer_wheel_t *w, struct event *e)
+{
+	timer_wheel_place_(w, e);
+	++w->n;
+	return 0;
+}
+
+/* Return true iff e expires before the time that the last call to
+ * timer_wheel_next_() returned. */
+int timer_wheel_wakes_late_(const timer_wheel_t *w, const struct event *e)
+{
+	ev_uint64_t t = timer_wheel_tv_to_usec_(&e->ev_timeout);
+	return (t + w->tick_usec - 1) / w->tick_usec < w->wake;
+}
+
+void timer_wheel_erase_(timer_wheel_t *w, struct event *e)
+{
+	LIST_REMOVE(e, TIMER_WHEEL_LINK);
+	--w->n;
+}
+
+/* Return the first tick after w->curr when something happens in level l:
+ * either some events expire, or a slot gets cascaded.  Return
+ * EV_UINT64_MAX if the level is empty. */
+static inline ev_uint64_t
+timer_wheel_level_next_(timer_wheel_t *w, int l)
+{
+	int shift = l * TIMER_WHEEL_BITS;
+	int first = (int)(w->curr >> shift) & TIMER_WHEEL_MASK;
+	ev_uint64_t period = (ev_uint64_t)1 << (shift + TIMER_WHEEL_BITS);
+	ev_uint64_t bits, tick;
+	int s;
+
+	/* Unless we're at its start, the slot holding w->curr only has
+	 * events for its next time around, so it comes last. */
+	if (w->curr & (((ev_uint64_t)1 << shift) - 1))
+		first = (first + 1) & TIMER_WHEEL_MASK;
+
+	while ((bits = w->nonempty[l])) {
+		/* Rotate the bitmap so that we look at 'first' first. */
+		if (first)
+			bits = (bits >> first) | (bits << (TIMER_WHEEL_SLOTS - first));
+		s = (first + timer_wheel_ffs_(bits)) & TIMER_WHEEL_MASK;
+		if (LIST_EMPTY(&w->slots[l][s])) {
+			w->nonempty[l] &= ~((ev_uint64_t)1 << s);
+			continue;
+		}
+		tick = (w->curr & ~(period - 1)) + ((ev_uint64_t)s << shift);
+		if (tick < w->curr)
+			tick += period;
+		return tick;
+	}
+	return EV_UINT64_MAX;
+}
+
+/* Return the first tick after w->curr when something happens in w. */
+static inline ev_uint64_t
+timer_wheel_next_tick_(timer_wheel_t *w)
+{
+	ev_uint64_t next = EV_UINT64_MAX, t;
+	int l;
+	for (l = 0; l < TIMER_WHEEL_LEVELS; ++l) {
+		t = timer_wheel_level_next_(w, l);
+		if (t < next)
+			next = t;
+	}
+	return next;
+}
+
+/* Set *when to the time when timer_wheel_expire_() next needs to run, and
+ * return 0; or return -1 if the wheel is empty. */
+int timer_wheel_next_(timer_wheel_t *w, struct timeval *when)
+{
+	ev_uint64_t tick, usec;
+
+	if (!w->n) {
+		w->wake = EV_UINT64_MAX;
+		return -1;
+	}
+	if (!LIST_EMPTY(&w->expired))
+		tick = 0;
+	else
+		tick = timer_wheel_next_tick_(w);
+	w->wake = tick;
+	usec = tick * w->tick_usec;
+	when->tv_sec = (long)(usec / 1000000);
+	when->tv_usec = (long)(usec % 1000000);
+	return 0;
+}
+
+/* Put back the events from every higher-level slot that begins at tick,
+ * which must be w->curr. */
+static inline void
+timer_wheel_cascade_(timer_wheel_t *w, ev_uint64_t tick)
+{
+	int l;
+	for (l = TIMER_WHEEL_LEVELS - 1; l > 0; --l) {
+		int shift = l * TIMER_WHEEL_BITS;
+		struct timer_wheel_list *slot;
+		struct event *e;
+		if (tick & (((ev_uint64_t)1 << shift) - 1))
+			continue;
+		slot = &w->slots[l][(tick >> shift) & TIMER_WHEEL_MASK];
+		while ((e = LIST_FIRST(slot))) {
+			LIST_REMOVE(e, TIMER_WHEEL_LINK);
+			timer_wheel_place_(w, e);
+		}
+	}
+}
+
+/* Move every event whose tick is over at 'now' to the expired list. */
+void timer_wheel_expire_(timer_wheel_t *w, const struct timeval *now)
+{
+	ev_uint64_t last = timer_wheel_tv_to_usec_(now) / w->tick_usec;
+	struct event *tail = NULL, *e;
+	struct timer_wheel_list *slot;
+
+	if (!w->n) {
+		if (w->curr <= last)
+			w->curr = last + 1;
+		return;
+	}
+
+	/* Keep the expired events in order of tick. */
+	LIST_FOREACH(e, &w->expired, TIMER_WHEEL_LINK)
+		tail = e;
+
+	while (w->curr <= last) {
+		timer_wheel_cascade_(w, w->curr);
+		slot = &w->slots[0][w->curr & TIMER_WHEEL_MASK];
+		while ((e = LIST_FIRST(slot))) {
+			LIST_REMOVE(e, TIMER_WHEEL_LINK);
+			if (tail)
+				LIST_INSERT_AFTER(tail, e, TIMER_WHEEL_LINK);
+			else
+				LIST_INSERT_HEAD(&w->expired, e, TIMER_WHEEL_LINK);
+			tail = e;
+		}
+		++w->curr;
+		/* Skip the ticks when nothing happens. */
+		if (w->curr <= last) {
+			ev_uint64_t next = timer_wheel_next_tick_(w);
+			w->curr = next <= last ? next : last + 1;
+		}
+	}
+}
+
+struct event *timer_wheel_first_expired_(timer_wheel_t *w)
+{
+	return LIST_FIRST(&w->expired);
+}
+
+/* Return some event in w, or NULL if w is empty. */
+struct event *timer_wheel_any_(timer_wheel_t *w)
+{
+	int i;
+	if (!w->n)
+		return NULL;
+	for (i = 0; i < TIMER_WHEEL_N_LISTS; ++i) {
+		struct event *e = LIST_FIRST(timer_wheel_list_(w, i));
+		if (e)
+			return e;
+	}
+	return NULL;
+}
+
+struct timer_wheel_list *timer_wheel_list_(timer_wheel_t *w, int i)
+{
+	if (i == TIMER_WHEEL_N_LISTS - 1)
+		return &w->expired;
+	return &w->slots[i / TIMER_WHEEL_SLOTS][i % TIMER_WHEEL_SLOTS];
+}
+
+#endif /* TIMERWHEEL_INTERNAL_H_INCLUDED_ */
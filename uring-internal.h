@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef URING_INTERNAL_H_INCLUDED_
+#define URING_INTERNAL_H_INCLUDED_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+/* This whole file is only useful with the io_uring backend; like
+ * iocp-internal.h it is safe to include anywhere. */
+#ifdef EVENT__HAVE_IO_URING
+
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "event2/event_struct.h"
+#include "defer-internal.h"
+
+struct event_base;
+struct evbuffer;
+struct evbuffer_chain;
+struct bufferevent;
+
+/**
+   Internal use only.  An io_uring request that some part of Libevent other
+   than the backend has put into an event_base's ring.  The request's
+   user_data points at this structure.  When the request completes, the
+   backend stores the completion's result and flags in 'res' and
+   'cqe_flags', and schedules 'evcb' as a deferred callback, so that the
+   completion is handled from the main loop without the base lock held.
+
+   Only one request may be outstanding on an event_uring_op at a time.
+ */
+struct event_uring_op {
+	struct event_callback evcb;
+	int res;
+	unsigned cqe_flags;
+};
+
+/** Initialize the fields in an event_uring_op.
+
+    @param op The struct event_uring_op to initialize
+    @param base The event_base whose ring the op will be used with
+    @param cb The callback that should be invoked once each request on op
+	has finished.
+    @param arg The callback's second argument.
+ */
+void event_uring_op_init_(struct event_uring_op *op, struct event_base *base,
+    deferred_cb_fn cb, void *arg);
+
+/** Return true iff base is using the io_uring backend. */
+int event_base_is_uring_(struct event_base *base);
+
+/** Return a zeroed sqe from base's ring whose completion will be reported
+    to 'op', or NULL on failure.  If op is NULL, the completion is ignored.
+
+    The caller must hold the base lock, and must call event_uring_commit_()
+    once it has filled in the sqe.  The request is normally submitted by the
+    next io_uring_enter() of the event loop.
+ */
+struct io_uring_sqe *event_uring_get_sqe_(struct event_base *base,
+    struct event_uring_op *op);
+
+/** Make sure that the sqes handed out since the last call will be
+    submitted.  Requires the base lock. */
+void event_uring_commit_(struct event_base *base);
+
+/** The size of each buffer in a base's provided-buffer ring. */
+#define EVENT_URING_BUFFER_SIZE 8192
+
+/** Return the buffer group id of base's provided-buffer ring, creating
+    the ring if necessary, or -1 if the kernel doesn't support one.
+    Requires the base lock. */
+int event_uring_buffer_group_(struct event_base *base);
+
+/** Return the memory of provided buffer 'bid' in base's buffer ring.
+    Requires the base lock. */
+void *event_uring_buffer_(struct event_base *base, unsigned bid);
+
+/** Give provided buffer 'bid' back to the kernel.  Requires the base
+    lock. */
+void event_uring_buffer_release_(struct event_base *base, unsigned bid);
+
+/** The largest number of iovecs we use for a single read or write. */
+#define EVBUFFER_URING_MAX_IOVECS 16
+
+/**
+   Internal use only.  The state of a read or write that is running on an
+   evbuffer through io_uring.  The chains that the request reads into or
+   writes from are pinned, and the affected end of the buffer is frozen,
+   until the matching commit function is called.
+ */
+struct evbuffer_uring_io {
+	struct event_uring_op op;
+	/** The first pinned chain in the buffer. */
+	struct evbuffer_chain *first_pinned;
+	/** How many chains are pinned; how many of the fields in iov
+	 * are we using. */
+	int n_iov;
+	struct iovec iov[EVBUFFER_URING_MAX_IOVECS];
+	unsigned in_progress : 1;
+};
+
+/** Start reading up to 'at_most' bytes from fd onto the end of buf.
+
+    The read is submitted through base's ring; evbuffer_uring_commit_read_()
+    must be called from io's completion callback.
+
+    @return 0 on success, -1 on error.
+ */
+int evbuffer_uring_launch_read_(struct evbuffer *buf, struct event_base *base,
+    evutil_socket_t fd, size_t at_most, struct evbuffer_uring_io *io);
+
+/** Start writing up to 'at_most' bytes from the start of buf to fd.
+
+    evbuffer_uring_commit_write_() must be called from io's completion
+    callback.
+
+    @return 0 on success, -1 on error.
+ */
+int evbuffer_uring_launch_write_(struct evbuffer *buf, struct event_base *base,
+    evutil_socket_t fd, ev_ssize_t at_most, struct evbuffer_uring_io *io);
+
+/** Finish a read started with evbuffer_uring_launch_read_(), which
+    transferred nbytes bytes. */
+void evbuffer_uring_commit_read_(struct evbuffer *buf,
+    struct evbuffer_uring_io *io, ev_ssize_t nbytes);
+
+/** Finish a write started with evbuffer_uring_launch_write_(), which
+    transferred nbytes bytes. */
+void evbuffer_uring_commit_write_(struct evbuffer *buf,
+    struct evbuffer_uring_io *io, ev_ssize_t nbytes);
+
+/** Return true iff bufferevent_socket_connect() should hand bev to
+    bufferevent_uring_connect_(). */
+int bufferevent_uring_can_connect_(struct bufferevent *bev);
+
+/** Start an io_uring connect on bev's fd. */
+int bufferevent_uring_connect_(struct bufferevent *bev, evutil_socket_t fd,
+    const struct sockaddr *sa, int socklen);
+
+#endif /* EVENT__HAVE_IO_URING */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
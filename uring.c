@@ -0,0 +1,823 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef EVENT__HAVE_IO_URING
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <sys/queue.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "event-internal.h"
+#include "evsignal-internal.h"
+#include "event2/thread.h"
+#include "evthread-internal.h"
+#include "log-internal.h"
+#include "evmap-internal.h"
+#include "changelist-internal.h"
+#include "time-internal.h"
+#include "defer-internal.h"
+#include "uring-internal.h"
+
+#ifndef POLLRDHUP
+#define POLLRDHUP 0
+#define EARLY_CLOSE_IF_HAVE_RDHUP 0
+#else
+#define EARLY_CLOSE_IF_HAVE_RDHUP EV_FEATURE_EARLY_CLOSE
+#endif
+
+/*
+  This backend keeps one poll request in the ring for every fd that has
+  events.  All adds and deletes go through the changelist, and the
+  resulting POLL_ADD/POLL_REMOVE requests are submitted in the same
+  io_uring_enter() call that waits for completions, so an event loop
+  iteration costs a single syscall no matter how many fds changed.
+
+  Edge-triggered events use multishot polls, which stay armed in the
+  kernel and post a completion for every wakeup.  Level-triggered events
+  use one-shot polls instead: a one-shot poll checks for readiness when it
+  is armed, so re-arming it on the next iteration gives the same
+  semantics as a level-triggered epoll registration.  The re-arm rides
+  along with the next io_uring_enter(), so it costs no extra syscall.
+
+  Unlike an epoll registration, a pending poll holds a reference to the
+  underlying file.  So when the last event on an fd is deleted, we cancel
+  its poll at once instead of at the next dispatch: the caller is probably
+  about to close the fd, and may want to bind its address again right
+  after.  An fd that is deleted, closed, reopened and re-added between two
+  dispatches gets a fresh poll request, but closing an fd that still has
+  events added keeps the file open until its poll completes.
+ */
+
+/* A poll request's user_data has this bit set; the rest of it holds the
+ * fd in the low 32 bits and the generation of the request above that.
+ * Completions whose user_data is 0 are internal and are ignored.  Any
+ * other user_data points to the struct event_uring_op that made the
+ * request. */
+#define URING_UD_POLL ((ev_uint64_t)1 << 63)
+#define URING_UD_MAKE(fd, gen) \
+	(URING_UD_POLL | ((ev_uint64_t)((gen) & 0x7fffffff) << 32) | \
+	    (ev_uint32_t)(fd))
+#define URING_UD_FD(ud) ((evutil_socket_t)(ev_uint32_t)(ud))
+#define URING_UD_GEN(ud) ((ev_uint32_t)((ud) >> 32) & 0x7fffffff)
+
+#define URING_EVENTS (EV_READ|EV_WRITE|EV_CLOSED)
+
+#define INITIAL_NFDS 32
+#define URING_ENTRIES 256
+
+/* Size and number of the provided buffers that reads can ask the kernel to
+ * pick from, so that idle connections don't need to hold a buffer. */
+#define URING_PBUF_COUNT 256
+#define URING_PBUF_GROUP 0
+
+/* Per-fd state.  'wanted' is what the event map wants us to listen for;
+ * 'armed' is what the poll request currently in the kernel listens for,
+ * or 0 if there is none.  'stale' is set when the poll request may refer
+ * to a file that has since been closed. */
+struct uring_fd {
+	ev_uint32_t gen;
+	short wanted;
+	short armed;
+	char queued;
+	char stale;
+};
+
+struct uringop {
+	int ring_fd;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned sq_local_tail;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	/* Per-fd state, indexed by fd. */
+	struct uring_fd *fds;
+	int nfds;
+
+	/* fds whose poll request needs to be (re)submitted. */
+	evutil_socket_t *pending;
+	int npending;
+	int pending_alloc;
+
+	/* Set if the kernel rejected a multishot poll. */
+	int no_multishot;
+
+	/* The provided-buffer ring, if we have set one up.  pbuf_state is 0
+	 * if we haven't tried yet, 1 if the ring works, -1 if it doesn't. */
+	int pbuf_state;
+	struct io_uring_buf_ring *pbuf_ring;
+	size_t pbuf_ring_size;
+	char *pbuf_mem;
+	unsigned short pbuf_tail;
+};
+
+static void *uring_init(struct event_base *);
+static int uring_del(struct event_base *, evutil_socket_t, short, short,
+    void *);
+static int uring_dispatch(struct event_base *, struct timeval *);
+static void uring_dealloc(struct event_base *);
+
+const struct eventop uringops = {
+	"io_uring",
+	uring_init,
+	event_changelist_add_,
+	uring_del,
+	uring_dispatch,
+	uring_dealloc,
+	1, /* need reinit */
+	EV_FEATURE_ET|EV_FEATURE_O1|EARLY_CLOSE_IF_HAVE_RDHUP,
+	EVENT_CHANGELIST_FDINFO_SIZE
+};
+
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags, const void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+	    flags, arg, argsz);
+}
+
+static void
+uring_unmap(struct uringop *uop)
+{
+	if (uop->sqes)
+		munmap(uop->sqes, uop->sqes_size);
+	if (uop->cq_ring && uop->cq_ring != uop->sq_ring)
+		munmap(uop->cq_ring, uop->cq_ring_size);
+	if (uop->sq_ring)
+		munmap(uop->sq_ring, uop->sq_ring_size);
+}
+
+static void *
+uring_init(struct event_base *base)
+{
+	struct io_uring_params p;
+	struct uringop *uop;
+	unsigned *sq_array;
+	unsigned i;
+	char *sq, *cq;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	if ((fd = sys_io_uring_setup(URING_ENTRIES, &p)) < 0) {
+		if (errno != ENOSYS && errno != EPERM)
+			event_warn("io_uring_setup");
+		return (NULL);
+	}
+
+	/* We need the extended-argument form of io_uring_enter to wait
+	 * with a timeout, and we can't tolerate dropped completions. */
+	if (!(p.features & IORING_FEAT_EXT_ARG) ||
+	    !(p.features & IORING_FEAT_NODROP)) {
+		close(fd);
+		return (NULL);
+	}
+
+	if (!(uop = mm_calloc(1, sizeof(struct uringop)))) {
+		close(fd);
+		return (NULL);
+	}
+	uop->ring_fd = fd;
+
+	uop->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	uop->cq_ring_size = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (uop->cq_ring_size > uop->sq_ring_size)
+			uop->sq_ring_size = uop->cq_ring_size;
+		uop->cq_ring_size = uop->sq_ring_size;
+	}
+
+	uop->sq_ring = mmap(NULL, uop->sq_ring_size, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (uop->sq_ring == MAP_FAILED) {
+		uop->sq_ring = NULL;
+		event_warn("mmap(IORING_OFF_SQ_RING)");
+		goto err;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		uop->cq_ring = uop->sq_ring;
+	} else {
+		uop->cq_ring = mmap(NULL, uop->cq_ring_size,
+		    PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd,
+		    IORING_OFF_CQ_RING);
+		if (uop->cq_ring == MAP_FAILED) {
+			uop->cq_ring = NULL;
+			event_warn("mmap(IORING_OFF_CQ_RING)");
+			goto err;
+		}
+	}
+	uop->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	uop->sqes = mmap(NULL, uop->sqes_size, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (uop->sqes == MAP_FAILED) {
+		uop->sqes = NULL;
+		event_warn("mmap(IORING_OFF_SQES)");
+		goto err;
+	}
+
+	sq = uop->sq_ring;
+	cq = uop->cq_ring;
+	uop->sq_head = (unsigned *)(sq + p.sq_off.head);
+	uop->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	uop->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	uop->sq_entries = p.sq_entries;
+	uop->sq_local_tail = *uop->sq_tail;
+	uop->cq_head = (unsigned *)(cq + p.cq_off.head);
+	uop->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	uop->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	uop->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	/* We always fill the SQEs in ring order, so the indirection array
+	 * can be set up once. */
+	sq_array = (unsigned *)(sq + p.sq_off.array);
+	for (i = 0; i < p.sq_entries; ++i)
+		sq_array[i] = i;
+
+	uop->fds = mm_calloc(INITIAL_NFDS, sizeof(struct uring_fd));
+	if (uop->fds == NULL)
+		goto err;
+	uop->nfds = INITIAL_NFDS;
+
+	evsig_init_(base);
+
+	return (uop);
+err:
+	uring_unmap(uop);
+	close(fd);
+	mm_free(uop);
+	return (NULL);
+}
+
+/* Hand every SQE we have filled in so far to the kernel without waiting. */
+static int
+uring_submit(struct uringop *uop)
+{
+	unsigned to_submit;
+	int res;
+
+	__atomic_store_n(uop->sq_tail, uop->sq_local_tail, __ATOMIC_RELEASE);
+	to_submit = uop->sq_local_tail -
+	    __atomic_load_n(uop->sq_head, __ATOMIC_ACQUIRE);
+	while (to_submit) {
+		res = sys_io_uring_enter(uop->ring_fd, to_submit, 0, 0,
+		    NULL, 0);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			event_warn("io_uring_enter");
+			return (-1);
+		}
+		to_submit -= res;
+	}
+	return (0);
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(struct uringop *uop)
+{
+	struct io_uring_sqe *sqe;
+	unsigned head = __atomic_load_n(uop->sq_head, __ATOMIC_ACQUIRE);
+
+	if (uop->sq_local_tail - head >= uop->sq_entries) {
+		/* The submission queue is full; flush it early. */
+		if (uring_submit(uop) < 0)
+			return (NULL);
+		head = __atomic_load_n(uop->sq_head, __ATOMIC_ACQUIRE);
+		if (uop->sq_local_tail - head >= uop->sq_entries)
+			return (NULL);
+	}
+
+	sqe = &uop->sqes[uop->sq_local_tail & uop->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	++uop->sq_local_tail;
+	return (sqe);
+}
+
+static int
+uring_grow_fds(struct uringop *uop, evutil_socket_t fd)
+{
+	struct uring_fd *new_fds;
+	int new_nfds = uop->nfds;
+
+	while (new_nfds <= fd)
+		new_nfds <<= 1;
+	new_fds = mm_realloc(uop->fds, new_nfds * sizeof(struct uring_fd));
+	if (new_fds == NULL)
+		return (-1);
+	memset(new_fds + uop->nfds, 0,
+	    (new_nfds - uop->nfds) * sizeof(struct uring_fd));
+	uop->fds = new_fds;
+	uop->nfds = new_nfds;
+	return (0);
+}
+
+/* Remember that the poll request for 'fd' has to be reconciled with what
+ * we want before the next wait. */
+static int
+uring_queue_fd(struct uringop *uop, evutil_socket_t fd)
+{
+	struct uring_fd *ufd = &uop->fds[fd];
+
+	if (ufd->queued)
+		return (0);
+	if (uop->npending == uop->pending_alloc) {
+		int new_alloc = uop->pending_alloc ? uop->pending_alloc * 2 :
+		    INITIAL_NFDS;
+		evutil_socket_t *new_pending = mm_realloc(uop->pending,
+		    new_alloc * sizeof(evutil_socket_t));
+		if (new_pending == NULL)
+			return (-1);
+		uop->pending = new_pending;
+		uop->pending_alloc = new_alloc;
+	}
+	uop->pending[uop->npending++] = fd;
+	ufd->queued = 1;
+	return (0);
+}
+
+static int
+uring_apply_changes(struct event_base *base)
+{
+	struct event_changelist *changelist = &base->changelist;
+	struct uringop *uop = base->evbase;
+	int i, r = 0;
+
+	for (i = 0; i < changelist->n_changes; ++i) {
+		const struct event_change *ch = &changelist->changes[i];
+		short events = ch->old_events & URING_EVENTS;
+
+		if (ch->fd >= uop->nfds && uring_grow_fds(uop, ch->fd) < 0) {
+			r = -1;
+			continue;
+		}
+
+		if (ch->read_change & EV_CHANGE_ADD)
+			events |= EV_READ;
+		else if (ch->read_change & EV_CHANGE_DEL)
+			events &= ~EV_READ;
+		if (ch->write_change & EV_CHANGE_ADD)
+			events |= EV_WRITE;
+		else if (ch->write_change & EV_CHANGE_DEL)
+			events &= ~EV_WRITE;
+		if (ch->close_change & EV_CHANGE_ADD)
+			events |= EV_CLOSED;
+		else if (ch->close_change & EV_CHANGE_DEL)
+			events &= ~EV_CLOSED;
+		if (events &&
+		    ((ch->read_change|ch->write_change|ch->close_change) &
+			EV_CHANGE_ET))
+			events |= EV_ET;
+
+		/* An add of an event that was already there means that it was
+		 * deleted and re-added since the last dispatch.  The fd may
+		 * have been closed and reopened in between, so the poll
+		 * request we have must be replaced. */
+		if (((ch->read_change & EV_CHANGE_ADD) &&
+			(ch->old_events & EV_READ)) ||
+		    ((ch->write_change & EV_CHANGE_ADD) &&
+			(ch->old_events & EV_WRITE)) ||
+		    ((ch->close_change & EV_CHANGE_ADD) &&
+			(ch->old_events & EV_CLOSED)))
+			uop->fds[ch->fd].stale = 1;
+		else if (uop->fds[ch->fd].wanted == events)
+			continue;
+		uop->fds[ch->fd].wanted = events;
+		if (uring_queue_fd(uop, ch->fd) < 0)
+			r = -1;
+	}
+
+	return (r);
+}
+
+static int
+uring_arm_pending(struct uringop *uop)
+{
+	struct io_uring_sqe *sqe;
+	int i, r = 0;
+
+	for (i = 0; i < uop->npending; ++i) {
+		evutil_socket_t fd = uop->pending[i];
+		struct uring_fd *ufd = &uop->fds[fd];
+		unsigned mask = 0;
+
+		ufd->queued = 0;
+
+		if (ufd->armed && (ufd->armed != ufd->wanted || ufd->stale)) {
+			if (!(sqe = uring_get_sqe(uop))) {
+				r = -1;
+				continue;
+			}
+			sqe->opcode = IORING_OP_POLL_REMOVE;
+			sqe->fd = -1;
+			sqe->addr = URING_UD_MAKE(fd, ufd->gen);
+			sqe->user_data = 0;
+			ufd->armed = 0;
+		}
+		ufd->stale = 0;
+		if (ufd->armed || !(ufd->wanted & URING_EVENTS))
+			continue;
+
+		if (ufd->wanted & EV_READ)
+			mask |= POLLIN;
+		if (ufd->wanted & EV_WRITE)
+			mask |= POLLOUT;
+		if (ufd->wanted & EV_CLOSED)
+			mask |= POLLRDHUP;
+
+		if (!(sqe = uring_get_sqe(uop))) {
+			r = -1;
+			continue;
+		}
+		++ufd->gen;
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		mask = (mask << 16) | (mask >> 16);
+#endif
+		sqe->poll32_events = mask;
+		if ((ufd->wanted & EV_ET) && !uop->no_multishot)
+			sqe->len = IORING_POLL_ADD_MULTI;
+		sqe->user_data = URING_UD_MAKE(fd, ufd->gen);
+		ufd->armed = ufd->wanted;
+	}
+	uop->npending = 0;
+
+	return (r);
+}
+
+static int
+uring_del(struct event_base *base, evutil_socket_t fd, short old,
+    short events, void *p)
+{
+	struct uringop *uop = base->evbase;
+	struct uring_fd *ufd;
+	struct io_uring_sqe *sqe;
+
+	if (event_changelist_del_(base, fd, old, events, p) < 0)
+		return (-1);
+
+	/* If the fd keeps some events, or has no poll in the kernel, the
+	 * changelist will sort it out at the next dispatch. */
+	if ((old & ~events & URING_EVENTS) || fd >= uop->nfds)
+		return (0);
+	ufd = &uop->fds[fd];
+	if (!ufd->armed)
+		return (0);
+
+	if (!(sqe = uring_get_sqe(uop)))
+		return (0);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = URING_UD_MAKE(fd, ufd->gen);
+	sqe->user_data = 0;
+	ufd->armed = 0;
+	ufd->wanted = 0;
+	return (uring_submit(uop));
+}
+
+static void
+uring_process_cqe(struct event_base *base, struct uringop *uop,
+    const struct io_uring_cqe *cqe)
+{
+	evutil_socket_t fd;
+	struct uring_fd *ufd;
+	short ev = 0;
+
+	if (!(cqe->user_data & URING_UD_POLL)) {
+		struct event_uring_op *op;
+		if (!cqe->user_data)
+			return;
+		op = (struct event_uring_op *)(ev_uintptr_t)cqe->user_data;
+		op->res = cqe->res;
+		op->cqe_flags = cqe->flags;
+		event_callback_activate_nolock_(base, &op->evcb);
+		return;
+	}
+
+	fd = URING_UD_FD(cqe->user_data);
+	if (fd >= uop->nfds)
+		return;
+	ufd = &uop->fds[fd];
+	if (URING_UD_GEN(cqe->user_data) != (ufd->gen & 0x7fffffff) ||
+	    !ufd->armed) {
+		/* A completion for a poll we have since replaced. */
+		return;
+	}
+
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		/* The poll request is gone; arm a fresh one before we wait
+		 * again if the fd still has events. */
+		ufd->armed = 0;
+		if (cqe->res == -EINVAL && (ufd->wanted & EV_ET) &&
+		    !uop->no_multishot) {
+			event_debug(("%s: multishot poll unsupported; "
+				"falling back to one-shot polls", __func__));
+			uop->no_multishot = 1;
+		}
+		if (ufd->wanted & URING_EVENTS)
+			uring_queue_fd(uop, fd);
+	}
+
+	if (cqe->res < 0) {
+		if (cqe->res != -ECANCELED && cqe->res != -EINVAL) {
+			event_debug(("%s: poll on fd %d failed: %s", __func__,
+				(int)fd, strerror(-cqe->res)));
+			/* Don't spin re-arming a poll on a bad fd. */
+			if (cqe->res == -EBADF)
+				ufd->wanted = 0;
+		}
+		return;
+	}
+
+	if (cqe->res & (POLLHUP|POLLERR)) {
+		ev = EV_READ | EV_WRITE;
+	} else {
+		if (cqe->res & POLLIN)
+			ev |= EV_READ;
+		if (cqe->res & POLLOUT)
+			ev |= EV_WRITE;
+		if (cqe->res & POLLRDHUP)
+			ev |= EV_CLOSED;
+	}
+
+	if (ev)
+		evmap_io_active_(base, fd, ev | EV_ET);
+}
+
+static int
+uring_dispatch(struct event_base *base, struct timeval *tv)
+{
+	struct uringop *uop = base->evbase;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned wait_nr = 1;
+	unsigned head, tail, to_submit;
+	int res;
+
+	uring_apply_changes(base);
+	event_changelist_remove_all_(&base->changelist, base);
+	uring_arm_pending(uop);
+
+	memset(&arg, 0, sizeof(arg));
+	if (tv != NULL) {
+		ts.tv_sec = tv->tv_sec;
+		ts.tv_nsec = tv->tv_usec * 1000;
+		arg.ts = (ev_uint64_t)(ev_uintptr_t)&ts;
+		if (tv->tv_sec == 0 && tv->tv_usec == 0)
+			wait_nr = 0;
+	}
+
+	__atomic_store_n(uop->sq_tail, uop->sq_local_tail, __ATOMIC_RELEASE);
+	to_submit = uop->sq_local_tail -
+	    __atomic_load_n(uop->sq_head, __ATOMIC_ACQUIRE);
+
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	res = sys_io_uring_enter(uop->ring_fd, to_submit, wait_nr,
+	    IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+
+	if (res == -1) {
+		switch (errno) {
+		case EINTR:
+		case ETIME:
+		case EAGAIN:
+		case EBUSY:
+			/* Timed out, interrupted, or the completion queue is
+			 * backed up; reap whatever is there. */
+			break;
+		default:
+			event_warn("io_uring_enter");
+			return (-1);
+		}
+	}
+
+	head = *uop->cq_head;
+	tail = __atomic_load_n(uop->cq_tail, __ATOMIC_ACQUIRE);
+	event_debug(("%s: io_uring_enter reports %u completions", __func__,
+		tail - head));
+	for (; head != tail; ++head)
+		uring_process_cqe(base, uop, &uop->cqes[head & uop->cq_mask]);
+	__atomic_store_n(uop->cq_head, head, __ATOMIC_RELEASE);
+
+	return (0);
+}
+
+static void
+uring_pbuf_free(struct uringop *uop)
+{
+	if (uop->pbuf_ring)
+		munmap(uop->pbuf_ring, uop->pbuf_ring_size);
+	if (uop->pbuf_mem)
+		mm_free(uop->pbuf_mem);
+	uop->pbuf_ring = NULL;
+	uop->pbuf_mem = NULL;
+}
+
+static void
+uring_dealloc(struct event_base *base)
+{
+	struct uringop *uop = base->evbase;
+
+	evsig_dealloc_(base);
+	uring_unmap(uop);
+	/* Closing the ring unregisters the buffer ring. */
+	if (uop->ring_fd >= 0)
+		close(uop->ring_fd);
+	uring_pbuf_free(uop);
+	if (uop->fds)
+		mm_free(uop->fds);
+	if (uop->pending)
+		mm_free(uop->pending);
+
+	memset(uop, 0, sizeof(struct uringop));
+	mm_free(uop);
+}
+
+void
+event_uring_op_init_(struct event_uring_op *op, struct event_base *base,
+    deferred_cb_fn cb, void *arg)
+{
+	memset(op, 0, sizeof(*op));
+	event_deferred_cb_init_(&op->evcb,
+	    event_base_get_npriorities(base) / 2, cb, arg);
+}
+
+int
+event_base_is_uring_(struct event_base *base)
+{
+	return base && base->evsel == &uringops;
+}
+
+struct io_uring_sqe *
+event_uring_get_sqe_(struct event_base *base, struct event_uring_op *op)
+{
+	struct io_uring_sqe *sqe;
+
+	EVLOCK_ASSERT_LOCKED(base->th_base_lock);
+	if (!event_base_is_uring_(base))
+		return (NULL);
+	if (!(sqe = uring_get_sqe(base->evbase)))
+		return (NULL);
+	sqe->user_data = (ev_uint64_t)(ev_uintptr_t)op;
+	return (sqe);
+}
+
+void
+event_uring_commit_(struct event_base *base)
+{
+	EVLOCK_ASSERT_LOCKED(base->th_base_lock);
+	/* The loop thread submits everything in its next io_uring_enter(),
+	 * but if it is already sleeping in one, it won't see our request
+	 * until something wakes it up.  Submitting it ourselves is cheaper
+	 * than a wakeup. */
+	if (EVBASE_NEED_NOTIFY(base))
+		uring_submit(base->evbase);
+}
+
+int
+event_uring_buffer_group_(struct event_base *base)
+{
+#ifdef EVENT__HAVE_STRUCT_IO_URING_BUF_REG
+	struct uringop *uop;
+	struct io_uring_buf_reg reg;
+	unsigned i;
+
+	EVLOCK_ASSERT_LOCKED(base->th_base_lock);
+	if (!event_base_is_uring_(base))
+		return (-1);
+	uop = base->evbase;
+	if (uop->pbuf_state)
+		return (uop->pbuf_state > 0 ? URING_PBUF_GROUP : -1);
+
+	uop->pbuf_state = -1;
+	uop->pbuf_ring_size =
+	    URING_PBUF_COUNT * sizeof(struct io_uring_buf);
+	uop->pbuf_ring = mmap(NULL, uop->pbuf_ring_size,
+	    PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+	if (uop->pbuf_ring == MAP_FAILED) {
+		uop->pbuf_ring = NULL;
+		return (-1);
+	}
+	if (!(uop->pbuf_mem = mm_malloc(URING_PBUF_COUNT * EVENT_URING_BUFFER_SIZE))) {
+		uring_pbuf_free(uop);
+		return (-1);
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (ev_uint64_t)(ev_uintptr_t)uop->pbuf_ring;
+	reg.ring_entries = URING_PBUF_COUNT;
+	reg.bgid = URING_PBUF_GROUP;
+	if (sys_io_uring_register(uop->ring_fd, IORING_REGISTER_PBUF_RING,
+		&reg, 1) < 0) {
+		event_debug(("%s: no provided-buffer ring: %s", __func__,
+			strerror(errno)));
+		uring_pbuf_free(uop);
+		return (-1);
+	}
+
+	uop->pbuf_tail = 0;
+	for (i = 0; i < URING_PBUF_COUNT; ++i)
+		event_uring_buffer_release_(base, i);
+	uop->pbuf_state = 1;
+
+	return (URING_PBUF_GROUP);
+#else
+	return (-1);
+#endif
+}
+
+void *
+event_uring_buffer_(struct event_base *base, unsigned bid)
+{
+	struct uringop *uop = base->evbase;
+
+	EVUTIL_ASSERT(bid < URING_PBUF_COUNT && uop->pbuf_mem);
+	return uop->pbuf_mem + (size_t)bid * EVENT_URING_BUFFER_SIZE;
+}
+
+void
+event_uring_buffer_release_(struct event_base *base, unsigned bid)
+{
+#ifdef EVENT__HAVE_STRUCT_IO_URING_BUF_REG
+	struct uringop *uop = base->evbase;
+	struct io_uring_buf *buf;
+
+	EVUTIL_ASSERT(bid < URING_PBUF_COUNT && uop->pbuf_ring);
+	buf = &uop->pbuf_ring->bufs[uop->pbuf_tail & (URING_PBUF_COUNT - 1)];
+	buf->addr = (ev_uint64_t)(ev_uintptr_t)event_uring_buffer_(base, bid);
+	buf->len = EVENT_URING_BUFFER_SIZE;
+	buf->bid = (ev_uint16_t)bid;
+	++uop->pbuf_tail;
+	__atomic_store_n(&uop->pbuf_ring->tail, uop->pbuf_tail,
+	    __ATOMIC_RELEASE);
+#endif
+}
+
+#endif /* EVENT__HAVE_IO_URING */